@@ -0,0 +1,950 @@
+/*
+ * Copyright (c) 2014 Thomas Roell.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal with the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimers.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimers in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of Thomas Roell, nor the names of its contributors
+ *     may be used to endorse or promote products derived from this Software
+ *     without specific prior written permission.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * WITH THE SOFTWARE.
+ */
+
+/* clock_gettime() */
+#define _POSIX_C_SOURCE 199309L
+
+#include "rfat_disk.h"
+#include "rfat_port.h"
+
+#include <stdlib.h>
+#include <time.h>
+
+#if (HOST_DISK_MUTEX == 1)
+#include <pthread.h>
+#endif /* (HOST_DISK_MUTEX == 1) */
+
+
+#define HOST_SDCARD_STATE_IDLE            0
+#define HOST_SDCARD_STATE_TRANSFER        1
+#define HOST_SDCARD_STATE_READ_MULTIPLE   2
+#define HOST_SDCARD_STATE_WRITE_SINGLE    3
+#define HOST_SDCARD_STATE_WRITE_MULTIPLE  4
+
+#define HOST_SDCARD_R1_IN_IDLE_STATE      0x01
+#define HOST_SDCARD_R1_ILLEGAL_COMMAND    0x04
+#define HOST_SDCARD_R1_COM_CRC_ERROR      0x08
+#define HOST_SDCARD_R1_PARAMETER_ERROR    0x40
+
+#define HOST_SDCARD_R2_WP_VIOLATION       0x20
+#define HOST_SDCARD_R2_OUT_OF_RANGE       0x80
+
+#define HOST_SDCARD_DATA_ACCEPTED         0x05
+#define HOST_SDCARD_DATA_CRC_ERROR        0x0b
+#define HOST_SDCARD_DATA_WRITE_ERROR      0x0d
+
+#define HOST_SDCARD_ERROR_OUT_OF_RANGE    0x08
+
+typedef struct _host_sdcard_t {
+    uint8_t                 state;
+    uint8_t                 status;
+    bool                    selected;
+    bool                    app;
+    bool                    crc;
+    bool                    receive;
+    uint32_t                polls;
+    uint32_t                address;
+    uint32_t                count;
+    uint32_t                last;
+    uint8_t                 command[6];
+    uint32_t                command_count;
+    uint8_t                 response[8];
+    uint32_t                response_offset;
+    uint32_t                response_count;
+    uint32_t                response_delay;
+    uint8_t                 data[1 + RFAT_BLK_SIZE + 2];
+    uint32_t                data_offset;
+    uint32_t                data_count;
+    uint32_t                data_delay;
+    uint64_t                busy;
+} host_sdcard_t;
+
+static host_sdcard_t host_sdcard;
+
+static uint64_t host_disk_clock;
+static uint64_t host_disk_nanos;
+static uint64_t host_disk_time_stamp;
+static uint32_t host_disk_speed;
+
+uint32_t host_disk_error_rate = 0;
+uint32_t host_disk_error_seed = 1;
+bool     host_disk_write_protect = false;
+bool     host_disk_unit_hidden = false;
+bool     host_disk_removed = false;
+uint32_t host_disk_write_limit = 0xffffffff;
+
+host_disk_statistics_t host_disk_statistics;
+
+uint8_t  *host_disk_image = NULL;
+
+static uint8_t host_disk_exchange(uint8_t data);
+
+
+/*
+ * The card side CRCs are computed bitwise, so that they are independent of
+ * RFAT_CONFIG_DISK_CRC and the table driven code in rfat_disk.c.
+ */
+
+static uint8_t host_disk_crc7(const uint8_t *data, uint32_t count)
+{
+    unsigned int n, i;
+    uint8_t crc7 = 0;
+
+    for (n = 0; n < count; n++)
+    {
+	for (i = 0; i < 8; i++)
+	{
+	    crc7 <<= 1;
+
+	    if (((data[n] << i) ^ crc7) & 0x80)
+	    {
+		crc7 ^= 0x09;
+	    }
+	}
+    }
+
+    return crc7 & 0x7f;
+}
+
+static uint16_t host_disk_crc16(const uint8_t *data, uint32_t count)
+{
+    unsigned int n, i;
+    uint16_t crc16 = 0;
+
+    for (n = 0; n < count; n++)
+    {
+	crc16 ^= (data[n] << 8);
+
+	for (i = 0; i < 8; i++)
+	{
+	    crc16 = (crc16 & 0x8000) ? ((crc16 << 1) ^ 0x1021) : (crc16 << 1);
+	}
+    }
+
+    return crc16;
+}
+
+static uint32_t host_disk_random(void)
+{
+    uint32_t x = host_disk_error_seed;
+
+    if (x == 0)
+    {
+	x = 1;
+    }
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+
+    host_disk_error_seed = x;
+
+    return x;
+}
+
+static uint8_t host_disk_error(uint8_t data)
+{
+    if (host_disk_error_rate && (host_disk_speed == HOST_DISK_SPEED_DATA_TRANSFER))
+    {
+	if ((host_disk_random() % host_disk_error_rate) == 0)
+	{
+	    data ^= (1 << (host_disk_random() & 7));
+
+	    host_disk_statistics.bit_errors++;
+	}
+    }
+
+    return data;
+}
+
+static uint64_t host_disk_cycles(uint32_t time)
+{
+    return ((uint64_t)time * host_disk_speed) / 1000000;
+}
+
+static bool host_sdcard_is_sdhc(void)
+{
+    return (HOST_DISK_BLKCNT >= 4209984);
+}
+
+
+static void host_sdcard_register(host_sdcard_t *card, const uint8_t *data, uint32_t count)
+{
+    uint16_t crc16;
+
+    crc16 = host_disk_crc16(data, count);
+
+    card->data[0] = 0xfe;
+    memcpy(&card->data[1], data, count);
+    card->data[1 + count +0] = crc16 >> 8;
+    card->data[1 + count +1] = crc16;
+
+    card->data_offset = 0;
+    card->data_count = 1 + count + 2;
+    card->data_delay = HOST_DISK_NCR;
+}
+
+static void host_sdcard_read(host_sdcard_t *card)
+{
+    uint16_t crc16;
+
+    if (card->address >= HOST_DISK_BLKCNT)
+    {
+	/* "Data Error Token" */
+	card->data[0] = HOST_SDCARD_ERROR_OUT_OF_RANGE;
+	card->data_count = 1;
+
+	card->state = HOST_SDCARD_STATE_TRANSFER;
+    }
+    else
+    {
+	crc16 = host_disk_crc16(&host_disk_image[(size_t)card->address * RFAT_BLK_SIZE], RFAT_BLK_SIZE);
+
+	card->data[0] = 0xfe;
+	memcpy(&card->data[1], &host_disk_image[(size_t)card->address * RFAT_BLK_SIZE], RFAT_BLK_SIZE);
+	card->data[1 + RFAT_BLK_SIZE +0] = crc16 >> 8;
+	card->data[1 + RFAT_BLK_SIZE +1] = crc16;
+	card->data_count = 1 + RFAT_BLK_SIZE + 2;
+
+	card->address++;
+
+	host_disk_statistics.blocks_read++;
+    }
+
+    card->data_offset = 0;
+    card->data_delay = host_disk_cycles(HOST_DISK_READ_LATENCY) / 8;
+}
+
+static void host_sdcard_write(host_sdcard_t *card)
+{
+    uint16_t crc16;
+    uint8_t response;
+    uint32_t busy;
+
+    card->receive = false;
+
+    crc16 = host_disk_crc16(&card->data[0], RFAT_BLK_SIZE);
+
+    if (card->crc && (crc16 != (((uint16_t)card->data[RFAT_BLK_SIZE +0] << 8) | card->data[RFAT_BLK_SIZE +1])))
+    {
+	host_disk_statistics.data_crc_error++;
+
+	response = HOST_SDCARD_DATA_CRC_ERROR;
+    }
+    else if (card->address >= HOST_DISK_BLKCNT)
+    {
+	card->status |= HOST_SDCARD_R2_OUT_OF_RANGE;
+
+	response = HOST_SDCARD_DATA_WRITE_ERROR;
+    }
+    else if (host_disk_write_protect)
+    {
+	card->status |= HOST_SDCARD_R2_WP_VIOLATION;
+
+	response = HOST_SDCARD_DATA_WRITE_ERROR;
+    }
+    else
+    {
+	if (host_disk_write_limit != 0)
+	{
+	    memcpy(&host_disk_image[(size_t)card->address * RFAT_BLK_SIZE], &card->data[0], RFAT_BLK_SIZE);
+
+	    if (host_disk_write_limit != 0xffffffff)
+	    {
+		host_disk_write_limit--;
+	    }
+	}
+
+	busy = HOST_DISK_WRITE_BUSY;
+
+	if ((card->address / HOST_DISK_PAGE_SIZE) != (card->last / HOST_DISK_PAGE_SIZE))
+	{
+	    busy += HOST_DISK_PAGE_BUSY;
+	}
+
+	if ((card->address / HOST_DISK_UNIT_SIZE) != (card->last / HOST_DISK_UNIT_SIZE))
+	{
+	    busy += HOST_DISK_UNIT_BUSY;
+	}
+
+	card->last = card->address;
+
+	card->address++;
+	card->count++;
+
+	/* The "Data Response Token" goes out with the next byte, the busy
+	 * period starts with the one after that.
+	 */
+	card->busy = host_disk_clock + 16 + host_disk_cycles(busy);
+
+	host_disk_statistics.blocks_written++;
+
+	response = HOST_SDCARD_DATA_ACCEPTED;
+    }
+
+    card->response[0] = response;
+    card->response_offset = 0;
+    card->response_count = 1;
+    card->response_delay = 0;
+
+    if (card->state == HOST_SDCARD_STATE_WRITE_SINGLE)
+    {
+	card->state = HOST_SDCARD_STATE_TRANSFER;
+    }
+}
+
+static void host_sdcard_command(host_sdcard_t *card)
+{
+    unsigned int index, count;
+    uint32_t argument, c_size, c_size_mult, read_bl_len, au_size;
+    uint8_t data[64];
+    bool app;
+
+    index = card->command[0] & 0x3f;
+    argument = (((uint32_t)card->command[1] << 24) |
+		((uint32_t)card->command[2] << 16) |
+		((uint32_t)card->command[3] <<  8) |
+		((uint32_t)card->command[4] <<  0));
+
+    app = card->app;
+    card->app = false;
+
+    count = 0;
+
+    host_disk_statistics.commands++;
+
+    card->response[0] = (card->state == HOST_SDCARD_STATE_IDLE) ? HOST_SDCARD_R1_IN_IDLE_STATE : 0x00;
+
+    /* CMD_GO_IDLE_STATE and CMD_SEND_IF_COND are always checked, the rest
+     * only after CMD_CRC_ON_OFF.
+     */
+    if ((card->crc || (index == 0) || (index == 8)) && (card->command[5] != ((host_disk_crc7(card->command, 5) << 1) | 0x01)))
+    {
+	host_disk_statistics.command_crc_error++;
+
+	card->response[0] |= HOST_SDCARD_R1_COM_CRC_ERROR;
+    }
+    else if ((card->state == HOST_SDCARD_STATE_IDLE) &&
+	     !((index == 0) || (index == 8) || (index == 55) || (index == 58) || (index == 59) || (app && (index == 41))))
+    {
+	card->response[0] |= HOST_SDCARD_R1_ILLEGAL_COMMAND;
+    }
+    else if ((card->state > HOST_SDCARD_STATE_TRANSFER) &&
+	     !((index == 0) || (index == 12) || (index == 13)))
+    {
+	card->response[0] |= HOST_SDCARD_R1_ILLEGAL_COMMAND;
+    }
+    else if (app)
+    {
+	switch (index) {
+	case 13:
+	    /* ACMD_SD_STATUS, AU_SIZE is HOST_DISK_UNIT_SIZE (16kB << (AU_SIZE -1)) */
+	    memset(data, 0, 64);
+
+	    if (!host_disk_unit_hidden)
+	    {
+		for (au_size = 1; (32u << (au_size -1)) < HOST_DISK_UNIT_SIZE; au_size++)
+		{
+		    continue;
+		}
+
+		data[10] = au_size << 4;
+	    }
+
+	    card->response[1] = card->status;
+	    card->status = 0;
+	    count = 1;
+
+	    host_sdcard_register(card, data, 64);
+	    break;
+
+	case 22:
+	    /* ACMD_SEND_NUM_WR_BLOCKS */
+	    data[0] = card->count >> 24;
+	    data[1] = card->count >> 16;
+	    data[2] = card->count >> 8;
+	    data[3] = card->count >> 0;
+
+	    host_sdcard_register(card, data, 4);
+	    break;
+
+	case 41:
+	    /* ACMD_SD_SEND_OP_COND */
+	    if (card->state == HOST_SDCARD_STATE_IDLE)
+	    {
+		card->polls++;
+
+		if (card->polls >= HOST_DISK_INIT_POLLS)
+		{
+		    card->state = HOST_SDCARD_STATE_TRANSFER;
+
+		    card->response[0] &= ~HOST_SDCARD_R1_IN_IDLE_STATE;
+		}
+	    }
+	    break;
+
+	default:
+	    card->response[0] |= HOST_SDCARD_R1_ILLEGAL_COMMAND;
+	    break;
+	}
+    }
+    else
+    {
+	switch (index) {
+	case 0:
+	    /* CMD_GO_IDLE_STATE */
+	    card->state = HOST_SDCARD_STATE_IDLE;
+	    card->status = 0;
+	    card->crc = false;
+	    card->polls = 0;
+	    card->data_count = 0;
+
+	    card->response[0] = HOST_SDCARD_R1_IN_IDLE_STATE;
+	    break;
+
+	case 8:
+	    /* CMD_SEND_IF_COND, R7 */
+	    card->response[1] = 0x00;
+	    card->response[2] = 0x00;
+	    card->response[3] = (argument >> 8) & 0x0f;
+	    card->response[4] = argument & 0xff;
+	    count = 4;
+	    break;
+
+	case 9:
+	    /* CMD_SEND_CSD */
+	    memset(data, 0, 16);
+
+	    if (host_sdcard_is_sdhc())
+	    {
+		c_size = (HOST_DISK_BLKCNT >> 10) -1;
+
+		data[0]  = 0x40;
+		data[5]  = 0x59;
+		data[7]  = (c_size >> 16) & 0x3f;
+		data[8]  = c_size >> 8;
+		data[9]  = c_size >> 0;
+	    }
+	    else
+	    {
+		c_size_mult = 7;
+
+		for (read_bl_len = 9; ((HOST_DISK_BLKCNT >> (read_bl_len - 9)) >> 9) > 4096; read_bl_len++)
+		{
+		}
+
+		c_size = ((HOST_DISK_BLKCNT >> (read_bl_len - 9)) >> 9) -1;
+
+		data[0]  = 0x00;
+		data[5]  = 0x50 | read_bl_len;
+		data[6]  = (c_size >> 10) & 0x03;
+		data[7]  = c_size >> 2;
+		data[8]  = (c_size & 0x03) << 6;
+		data[9]  = (c_size_mult >> 1) & 0x03;
+		data[10] = (c_size_mult & 0x01) << 7;
+	    }
+
+	    data[15] = (host_disk_crc7(data, 15) << 1) | 0x01;
+
+	    host_sdcard_register(card, data, 16);
+	    break;
+
+	case 10:
+	    /* CMD_SEND_CID, PSN is "RFAT" */
+	    memset(data, 0, 16);
+
+	    data[9]  = 'R';
+	    data[10] = 'F';
+	    data[11] = 'A';
+	    data[12] = 'T';
+	    data[15] = (host_disk_crc7(data, 15) << 1) | 0x01;
+
+	    host_sdcard_register(card, data, 16);
+	    break;
+
+	case 12:
+	    /* CMD_STOP_TRANSMISSION, R1b for a write */
+	    if (card->state == HOST_SDCARD_STATE_READ_MULTIPLE)
+	    {
+		card->state = HOST_SDCARD_STATE_TRANSFER;
+		card->data_count = 0;
+	    }
+	    else if (card->state == HOST_SDCARD_STATE_WRITE_MULTIPLE)
+	    {
+		card->state = HOST_SDCARD_STATE_TRANSFER;
+		card->busy = host_disk_clock + (8 * (HOST_DISK_NCR +2));
+	    }
+	    else
+	    {
+		card->response[0] |= HOST_SDCARD_R1_ILLEGAL_COMMAND;
+	    }
+	    break;
+
+	case 13:
+	    /* CMD_SEND_STATUS, R2 */
+	    card->response[1] = card->status;
+	    card->status = 0;
+	    count = 1;
+	    break;
+
+	case 16:
+	    /* CMD_SET_BLOCKLEN */
+	    if (argument != RFAT_BLK_SIZE)
+	    {
+		card->response[0] |= HOST_SDCARD_R1_PARAMETER_ERROR;
+	    }
+	    break;
+
+	case 17:
+	case 18:
+	case 24:
+	case 25:
+	    /* CMD_READ_SINGLE_BLOCK, CMD_READ_MULTIPLE_BLOCK, CMD_WRITE_SINGLE_BLOCK, CMD_WRITE_MULTIPLE_BLOCK */
+	    card->address = host_sdcard_is_sdhc() ? argument : (argument >> RFAT_BLK_SHIFT);
+
+	    if (card->address >= HOST_DISK_BLKCNT)
+	    {
+		card->response[0] |= HOST_SDCARD_R1_PARAMETER_ERROR;
+	    }
+	    else
+	    {
+		if (index == 17)
+		{
+		    host_sdcard_read(card);
+		}
+		else if (index == 18)
+		{
+		    card->state = HOST_SDCARD_STATE_READ_MULTIPLE;
+
+		    host_sdcard_read(card);
+		}
+		else if (index == 24)
+		{
+		    card->state = HOST_SDCARD_STATE_WRITE_SINGLE;
+		}
+		else
+		{
+		    card->state = HOST_SDCARD_STATE_WRITE_MULTIPLE;
+		    card->count = 0;
+		}
+	    }
+	    break;
+
+	case 55:
+	    /* CMD_APP_CMD */
+	    card->app = true;
+	    break;
+
+	case 58:
+	    /* CMD_READ_OCR, R3 */
+	    card->response[1] = ((card->state != HOST_SDCARD_STATE_IDLE) ? 0x80 : 0x00) | (host_sdcard_is_sdhc() ? 0x40 : 0x00);
+	    card->response[2] = 0xff;
+	    card->response[3] = 0x80;
+	    card->response[4] = 0x00;
+	    count = 4;
+	    break;
+
+	case 59:
+	    /* CMD_CRC_ON_OFF */
+	    card->crc = (argument & 1) ? true : false;
+	    break;
+
+	default:
+	    card->response[0] |= HOST_SDCARD_R1_ILLEGAL_COMMAND;
+	    break;
+	}
+    }
+
+    card->response_offset = 0;
+    card->response_count = 1 + count;
+    card->response_delay = HOST_DISK_NCR;
+}
+
+
+/*
+ * host_sdcard_output(host_sdcard_t *card)
+ *
+ * Byte the card puts on DO. A pending response takes precedence over
+ * a busy period, which in turn takes precedence over read data.
+ */
+
+static uint8_t host_sdcard_output(host_sdcard_t *card)
+{
+    uint8_t data = 0xff;
+
+    if (card->response_delay)
+    {
+	card->response_delay--;
+    }
+    else if (card->response_offset < card->response_count)
+    {
+	data = card->response[card->response_offset++];
+    }
+    else if (card->busy > host_disk_clock)
+    {
+	data = 0x00;
+
+	host_disk_statistics.busy++;
+    }
+    else if (card->data_offset < card->data_count)
+    {
+	if (card->data_delay)
+	{
+	    card->data_delay--;
+	}
+	else
+	{
+	    data = card->data[card->data_offset++];
+
+	    if ((card->data_offset == card->data_count) && (card->state == HOST_SDCARD_STATE_READ_MULTIPLE))
+	    {
+		host_sdcard_read(card);
+	    }
+	}
+    }
+
+    return data;
+}
+
+/*
+ * host_sdcard_input(host_sdcard_t *card, uint8_t data)
+ *
+ * Byte the card sees on DI.
+ */
+
+static void host_sdcard_input(host_sdcard_t *card, uint8_t data)
+{
+    if (card->receive)
+    {
+	card->data[card->data_offset++] = data;
+
+	if (card->data_offset == (RFAT_BLK_SIZE + 2))
+	{
+	    host_sdcard_write(card);
+	}
+    }
+    else if (card->command_count || ((data & 0xc0) == 0x40))
+    {
+	card->command[card->command_count++] = data;
+
+	if (card->command_count == 6)
+	{
+	    card->command_count = 0;
+
+	    host_sdcard_command(card);
+	}
+    }
+    else if (card->busy <= host_disk_clock)
+    {
+	if (((card->state == HOST_SDCARD_STATE_WRITE_SINGLE) && (data == 0xfe)) ||
+	    ((card->state == HOST_SDCARD_STATE_WRITE_MULTIPLE) && (data == 0xfc)))
+	{
+	    card->receive = true;
+	    card->data_offset = 0;
+	    card->data_count = 0;
+	}
+	else if ((card->state == HOST_SDCARD_STATE_WRITE_MULTIPLE) && (data == 0xfd))
+	{
+	    /* "Stop Tran Token", one byte later the card signals busy.
+	     */
+	    card->state = HOST_SDCARD_STATE_TRANSFER;
+	    card->busy = host_disk_clock + 16 + host_disk_cycles(HOST_DISK_WRITE_BUSY);
+	    card->response_offset = 0;
+	    card->response_count = 0;
+	    card->response_delay = 1;
+	}
+    }
+}
+
+static uint8_t host_disk_exchange(uint8_t data)
+{
+    host_sdcard_t *card = &host_sdcard;
+    uint8_t response = 0xff;
+
+    host_disk_statistics.bytes++;
+
+    data = host_disk_error(data);
+
+    if (host_disk_removed)
+    {
+	/* No card, no response. Reinserting it powers it up in IDLE.
+	 */
+	memset(card, 0, sizeof(*card));
+    }
+    else if (card->selected)
+    {
+	response = host_sdcard_output(card);
+
+	host_sdcard_input(card, data);
+    }
+
+    host_disk_clock += 8;
+
+    if (host_disk_speed)
+    {
+	host_disk_nanos += (8000000000ull / host_disk_speed);
+    }
+
+    return host_disk_error(response);
+}
+
+
+bool host_disk_init(void)
+{
+    if (host_disk_image == NULL)
+    {
+	host_disk_image = (uint8_t*)malloc((size_t)HOST_DISK_BLKCNT * RFAT_BLK_SIZE);
+
+	if (host_disk_image != NULL)
+	{
+	    /* Simulate a completely erased device */
+	    memset(host_disk_image, 0xff, (size_t)HOST_DISK_BLKCNT * RFAT_BLK_SIZE);
+	}
+    }
+
+    return (host_disk_image != NULL);
+}
+
+
+void host_disk_time_start(void)
+{
+    host_disk_time_stamp = host_disk_clock;
+}
+
+bool host_disk_time_elapsed(uint32_t time)
+{
+    return ((host_disk_clock - host_disk_time_stamp) > (((uint64_t)time * host_disk_speed) / 1000));
+}
+
+/*
+ * host_disk_time_current(void)
+ *
+ * Microseconds of SCLK time clocked over the bus.
+ */
+
+uint32_t host_disk_time_current(void)
+{
+    return (uint32_t)(host_disk_nanos / 1000);
+}
+
+/*
+ * host_core_time_current(void)
+ *
+ * Microseconds of wall clock time. Unlike the disk side, the core lock is
+ * contended by host threads, so SCLK time would not reflect the waiting.
+ */
+
+uint32_t host_core_time_current(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint32_t)(((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000));
+}
+
+
+#if (HOST_DISK_MUTEX == 1)
+
+/*
+ * host_core_lock(void), host_disk_lock(void)
+ *
+ * The core lock reports success as "true", while the disk lock returns a
+ * status code, as rfat_core.c and rfat_disk.c expect.
+ */
+
+static pthread_mutex_t host_core_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t host_disk_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+bool host_core_lock(void)
+{
+    return (pthread_mutex_lock(&host_core_mutex) == 0);
+}
+
+void host_core_unlock(void)
+{
+    pthread_mutex_unlock(&host_core_mutex);
+}
+
+int host_disk_lock(void)
+{
+    return (pthread_mutex_lock(&host_disk_mutex) == 0) ? F_NO_ERROR : F_ERR_OS;
+}
+
+void host_disk_unlock(void)
+{
+    pthread_mutex_unlock(&host_disk_mutex);
+}
+
+#endif /* (HOST_DISK_MUTEX == 1) */
+
+
+bool host_disk_present(void)
+{
+    return !host_disk_removed;
+}
+
+bool host_disk_write_protected(void)
+{
+    return host_disk_write_protect;
+}
+
+
+/*
+ * host_disk_mode(int mode)
+ */
+
+uint32_t host_disk_mode(int mode)
+{
+    unsigned int n;
+
+    if (mode == RFAT_DISK_MODE_NONE)
+    {
+	host_sdcard.selected = false;
+
+	host_disk_speed = 0;
+    }
+    else
+    {
+	if (mode == RFAT_DISK_MODE_IDENTIFY)
+	{
+	    host_sdcard.selected = false;
+
+	    host_disk_speed = 400000;
+
+	    /* 74 clock cycles with CS/MOSI driven H */
+	    for (n = 0; n < 10; n++)
+	    {
+		host_disk_exchange(0xff);
+	    }
+	}
+	else
+	{
+	    host_disk_speed = HOST_DISK_SPEED_DATA_TRANSFER;
+
+	    host_disk_deselect();
+	}
+
+	host_disk_select();
+    }
+
+    return host_disk_speed;
+}
+
+
+void host_disk_select(void)
+{
+    /* Toggling CS resyncs the card to the start of a command.
+     */
+    host_sdcard.selected = true;
+    host_sdcard.command_count = 0;
+    host_sdcard.receive = false;
+}
+
+
+void host_disk_deselect(void)
+{
+    host_sdcard.selected = false;
+    host_sdcard.response_count = 0;
+    host_sdcard.response_delay = 0;
+
+    /* The extra clock cycle for the card to release DO.
+     */
+    host_disk_exchange(0x00);
+}
+
+
+void host_disk_send(uint8_t data)
+{
+    host_disk_exchange(data);
+}
+
+
+uint8_t host_disk_receive(void)
+{
+    return host_disk_exchange(0xff);
+}
+
+
+/*
+ * host_disk_send_block(const uint8_t *data)
+ */
+
+void host_disk_send_block(const uint8_t *data)
+{
+    unsigned int n;
+    uint32_t crc16;
+
+    crc16 = 0;
+
+    for (n = 0; n < RFAT_BLK_SIZE; n++)
+    {
+#if (RFAT_CONFIG_DISK_CRC == 1)
+	RFAT_UPDATE_CRC16(crc16, data[n]);
+#endif /* (RFAT_CONFIG_DISK_CRC == 1) */
+
+	host_disk_exchange(data[n]);
+    }
+
+    host_disk_exchange(crc16 >> 8);
+    host_disk_exchange(crc16);
+}
+
+
+/*
+ * host_disk_receive_block(uint8_t *data)
+ *
+ * Returns 0 on success, and non-zero on a CRC error.
+ */
+
+uint32_t host_disk_receive_block(uint8_t *data)
+{
+    unsigned int n;
+    uint32_t crc16;
+
+    crc16 = 0;
+
+    for (n = 0; n < RFAT_BLK_SIZE; n++)
+    {
+	data[n] = host_disk_exchange(0xff);
+
+#if (RFAT_CONFIG_DISK_CRC == 1)
+	RFAT_UPDATE_CRC16(crc16, data[n]);
+#endif /* (RFAT_CONFIG_DISK_CRC == 1) */
+    }
+
+#if (RFAT_CONFIG_DISK_CRC == 1)
+    crc16 ^= (host_disk_exchange(0xff) << 8);
+    crc16 ^= host_disk_exchange(0xff);
+#else /* (RFAT_CONFIG_DISK_CRC == 1) */
+    host_disk_exchange(0xff);
+    host_disk_exchange(0xff);
+#endif /* (RFAT_CONFIG_DISK_CRC == 1) */
+
+    return crc16;
+}
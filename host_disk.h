@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2014 Thomas Roell.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal with the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimers.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimers in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of Thomas Roell, nor the names of its contributors
+ *     may be used to endorse or promote products derived from this Software
+ *     without specific prior written permission.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * WITH THE SOFTWARE.
+ */
+
+#if !defined(_HOST_DISK_H)
+#define _HOST_DISK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Host side implementation of the DISK SPI interface. Instead of a SSI
+ * peripheral there is a byte level SDCARD state machine behind
+ * RFAT_PORT_DISK_SPI_SEND()/RFAT_PORT_DISK_SPI_RECEIVE(), so that the real
+ * protocol code in rfat_disk.c (RFAT_CONFIG_DISK_SIMULATE == 0) can be run
+ * and profiled on a host.
+ *
+ * Time is derived from the number of SCLK cycles clocked over the emulated
+ * bus, so timeouts and busy periods are deterministic.
+ */
+
+#define HOST_DISK_SPEED_DATA_TRANSFER    25000000
+
+#if !defined(HOST_DISK_BLKCNT)
+#define HOST_DISK_BLKCNT                 (unsigned long)(65536 * 64)
+#endif /* !defined(HOST_DISK_BLKCNT) */
+
+/* NCR, in bytes between the end of a command and the R1 response (1..8) */
+#define HOST_DISK_NCR                    1
+
+/* Number of ACMD_SD_SEND_OP_COND polls before the card leaves IDLE */
+#define HOST_DISK_INIT_POLLS             4
+
+/* NAC, in microseconds between a read command and the "Start Block Token" */
+#define HOST_DISK_READ_LATENCY           100
+
+/* Busy period, in microseconds after a block had been accepted */
+#define HOST_DISK_WRITE_BUSY             500
+
+/* Page and allocation unit (AU) size, in blocks. A block written to another
+ * page (AU) than the block written before extends the busy period by
+ * HOST_DISK_PAGE_BUSY (HOST_DISK_UNIT_BUSY) microseconds.
+ */
+#define HOST_DISK_PAGE_SIZE              16
+#define HOST_DISK_PAGE_BUSY              1000
+#define HOST_DISK_UNIT_SIZE              1024
+#define HOST_DISK_UNIT_BUSY              5000
+
+/* Use RFAT_PORT_DISK_SPI_SEND_BLOCK()/RFAT_PORT_DISK_SPI_RECEIVE_BLOCK() */
+#define HOST_DISK_SPI_BLOCK              1
+
+/* If set, RFAT_PORT_CORE_LOCK() and RFAT_PORT_DISK_LOCK() are backed by two
+ * pthread mutexes, so that several host threads can share the volume.
+ */
+#if !defined(HOST_DISK_MUTEX)
+#define HOST_DISK_MUTEX                  0
+#endif /* !defined(HOST_DISK_MUTEX) */
+
+
+typedef struct _host_disk_statistics_t {
+    uint32_t                bytes;
+    uint32_t                busy;
+    uint32_t                commands;
+    uint32_t                command_crc_error;
+    uint32_t                data_crc_error;
+    uint32_t                blocks_read;
+    uint32_t                blocks_written;
+    uint32_t                bit_errors;
+} host_disk_statistics_t;
+
+/* If non-zero, a random bit is flipped in about one out of "host_disk_error_rate"
+ * bytes on MOSI and MISO each (only in RFAT_DISK_MODE_DATA_TRANSFER).
+ */
+extern uint32_t host_disk_error_rate;
+extern uint32_t host_disk_error_seed;
+extern bool     host_disk_write_protect;
+
+/* If set, SD_STATUS does not report the AU_SIZE, like older SDCARDs.
+ */
+extern bool     host_disk_unit_hidden;
+
+/* If set, the SDCARD does not respond, and RFAT_PORT_DISK_SPI_PRESENT() reports
+ * it as removed. Once cleared again, the SDCARD starts over in IDLE.
+ */
+extern bool     host_disk_removed;
+
+/* Number of blocks that still reach "host_disk_image". Once used up, the
+ * SDCARD keeps accepting blocks, but drops them, as if power had failed
+ * right there. The image then holds what a power cut would leave behind.
+ */
+extern uint32_t host_disk_write_limit;
+
+extern host_disk_statistics_t host_disk_statistics;
+
+extern uint8_t  *host_disk_image;
+
+extern bool host_disk_init(void);
+
+extern void host_disk_time_start(void);
+extern bool host_disk_time_elapsed(uint32_t time);
+extern uint32_t host_disk_time_current(void);
+
+extern uint32_t host_core_time_current(void);
+
+#define RFAT_PORT_CORE_TIME_STAMP()              host_core_time_current()
+
+/* F_QUEUE producer and consumer may run on different host cores. */
+#define RFAT_PORT_CORE_BARRIER()                 __sync_synchronize()
+
+#if (HOST_DISK_MUTEX == 1)
+extern bool     host_core_lock(void);
+extern void     host_core_unlock(void);
+extern int      host_disk_lock(void);
+extern void     host_disk_unlock(void);
+
+#define RFAT_PORT_CORE_LOCK()                    host_core_lock()
+#define RFAT_PORT_CORE_UNLOCK()                  host_core_unlock()
+
+#define RFAT_PORT_DISK_LOCK()                    host_disk_lock()
+#define RFAT_PORT_DISK_UNLOCK()                  host_disk_unlock()
+#endif /* (HOST_DISK_MUTEX == 1) */
+
+#define RFAT_PORT_DISK_INIT()                    host_disk_init()
+
+#define RFAT_PORT_DISK_TIME_START()              host_disk_time_start()
+#define RFAT_PORT_DISK_TIME_ELAPSED(_time)       host_disk_time_elapsed((_time))
+#define RFAT_PORT_DISK_TIME_STAMP()              host_disk_time_current()
+
+#define RFAT_PORT_DISK_SPI_PRESENT()             host_disk_present()
+#define RFAT_PORT_DISK_SPI_WRITE_PROTECTED()     host_disk_write_protected()
+
+extern bool     host_disk_present(void);
+extern bool     host_disk_write_protected(void);
+
+extern uint32_t host_disk_mode(int mode);
+extern void     host_disk_select(void);
+extern void     host_disk_deselect(void);
+extern void     host_disk_send(uint8_t data);
+extern uint8_t  host_disk_receive(void);
+extern void     host_disk_send_block(const uint8_t *data);
+extern uint32_t host_disk_receive_block(uint8_t *data);
+
+#define RFAT_PORT_DISK_SPI_MODE(_mode)           host_disk_mode((_mode))
+#define RFAT_PORT_DISK_SPI_SELECT()              host_disk_select()
+#define RFAT_PORT_DISK_SPI_DESELECT()            host_disk_deselect()
+#define RFAT_PORT_DISK_SPI_SEND(_data)           host_disk_send((_data))
+#define RFAT_PORT_DISK_SPI_RECEIVE()             host_disk_receive()
+
+#if (HOST_DISK_SPI_BLOCK == 1)
+#define RFAT_PORT_DISK_SPI_SEND_BLOCK(_data)     host_disk_send_block((_data))
+#define RFAT_PORT_DISK_SPI_RECEIVE_BLOCK(_data)  host_disk_receive_block((_data))
+#endif /* (HOST_DISK_SPI_BLOCK == 1) */
+
+#endif /* _HOST_DISK_H */
@@ -63,11 +63,18 @@
 #define F_ERR_OS                     29
 #define F_ERR_TOOLONGNAME            30
 #define F_ERR_UNUSABLE               31
+#define F_ERR_INPROGRESS             32
 
 #define F_SEEK_CUR                   0
 #define F_SEEK_END                   1
 #define F_SEEK_SET                   2
 
+#define F_COMMIT_NONE                0
+#define F_COMMIT_BYTES               1
+#define F_COMMIT_CLUSTERS            2
+#define F_COMMIT_SECONDS             3
+#define F_COMMIT_MILLISECONDS        4
+
 #define F_SEPARATORCHAR              '/'
 #define F_SECTOR_SIZE                512
 
@@ -83,6 +90,14 @@
 #endif /* (RFAT_CONFIG_VFAT_SUPPORTED == 1) */
 #endif /* !defined(F_MAXPATH) */
 
+#if !defined(F_MAXPOOLPATH)
+#if (RFAT_CONFIG_VFAT_SUPPORTED == 1)
+#define F_MAXPOOLPATH                (F_MAXLNAME+1)
+#else /* (RFAT_CONFIG_VFAT_SUPPORTED == 1) */
+#define F_MAXPOOLPATH                ((F_MAXNAME+F_MAXEXT+2) * 4) /* 3 directories plus name */
+#endif /* (RFAT_CONFIG_VFAT_SUPPORTED == 1) */
+#endif /* !defined(F_MAXPOOLPATH) */
+
 #define F_ATTR_READONLY              0x01
 #define F_ATTR_HIDDEN                0x02
 #define F_ATTR_SYSTEM                0x04
@@ -149,6 +164,82 @@ typedef struct {
     unsigned long  bad_high;
 } F_SPACE;
 
+typedef struct {
+    unsigned long  filesize;                        /* file length                   */
+    unsigned short createdate;                      /* file creation date            */
+    unsigned short createtime;                      /* file creation time            */
+    unsigned short modifieddate;                    /* file last modification date   */
+    unsigned short modifiedtime;                    /* file last modification time   */
+    unsigned short lastaccessdate;                  /* file last access date         */
+    unsigned char  attr;                            /* file attribute                */
+    unsigned long  cluster;                         /* file start cluster            */
+} F_STAT;
+
+typedef struct {
+    void           *buffer;                         /* data buffer                   */
+    long           size;                            /* data size in bytes            */
+} F_IOVEC;
+
+typedef struct {
+    F_FILE                 *file;           /* file the queue is drained to  */
+    unsigned char          *data;           /* ring buffer                   */
+    unsigned long          size;            /* ring buffer size (power of 2) */
+    volatile unsigned long head;            /* advanced by f_queue_put()     */
+    volatile unsigned long tail;            /* advanced by f_queue_drain()   */
+    volatile unsigned long overrun;         /* records dropped               */
+} F_QUEUE;
+
+#if (RFAT_CONFIG_STATISTICS == 1)
+typedef struct {
+    unsigned long          command;         /* command frames                */
+    unsigned long          response;        /* response polling, responses   */
+    unsigned long          data;            /* data block payload            */
+    unsigned long          crc;             /* data block CRC16              */
+    unsigned long          token;           /* start/stop/response tokens    */
+    unsigned long          busy;            /* busy polling                  */
+    unsigned long          deselect;        /* dummy bytes after deselect    */
+    unsigned long          busy_time;       /* busy polling, in microseconds */
+} F_BUSSTAT;
+#endif /* (RFAT_CONFIG_STATISTICS == 1) */
+
+#if (RFAT_CONFIG_LOCK_STATISTICS_ENTRIES != 0)
+#define F_LOCKSTAT_CORE              0
+#define F_LOCKSTAT_DISK              1
+
+#define F_LOCKSTAT_BUCKETS           7
+
+typedef struct {
+    const char             *function;       /* lock owner, NULL if unused    */
+    unsigned long          count;           /* acquisitions                  */
+    unsigned long          wait_time;       /* waiting, in microseconds      */
+    unsigned long          wait_max;
+    unsigned long          hold_time;       /* holding, in microseconds      */
+    unsigned long          hold_max;
+    unsigned long          hold_histogram[F_LOCKSTAT_BUCKETS]; /* < 10us, < 100us ... < 1s, >= 1s */
+} F_LOCKSTAT;
+#endif /* (RFAT_CONFIG_LOCK_STATISTICS_ENTRIES != 0) */
+
+#if (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1)
+typedef struct {
+    F_FILE                 *file;           /* underlying contiguous file    */
+    unsigned long          blkcnt;          /* number of data blocks         */
+    unsigned long          tail_blkno;      /* write position                */
+    unsigned long          tail_offset;
+    unsigned long          sync_blkno;      /* tail recorded in the header   */
+    unsigned long          head_blkno;      /* read position                 */
+    unsigned long          head_offset;
+} F_RING;
+
+typedef struct {
+    F_FILE                 *file;           /* active file                   */
+    unsigned long          size;            /* preallocated file size        */
+    unsigned long          count;           /* files kept preallocated       */
+    unsigned long          sequence;        /* next file to be activated     */
+    unsigned long          limit;           /* next file to be preallocated  */
+    char                   pattern[F_MAXPOOLPATH]; /* path, '#' for digits */
+} F_POOL;
+#endif /* (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1) */
+
 extern const char * f_getversion(void);
 extern int          f_initvolume(void);
 extern int          f_delvolume(void);
@@ -158,6 +249,16 @@ extern int          f_getfreespace(F_SPACE *pspace);
 extern int          f_getserial(unsigned long *p_serial);
 extern int          f_setlabel(const char *volname);
 extern int          f_getlabel(char *volname, int length);
+extern int          f_idle(void);
+extern int          f_poll(int *pbusy);
+extern int          f_begin(void);
+extern int          f_commit(void);
+#if (RFAT_CONFIG_STATISTICS == 1)
+extern int          f_getbusstat(F_BUSSTAT *pstat, int reset);
+#endif /* (RFAT_CONFIG_STATISTICS == 1) */
+#if (RFAT_CONFIG_LOCK_STATISTICS_ENTRIES != 0)
+extern int          f_getlockstat(int lock, F_LOCKSTAT *plockstat, int reset);
+#endif /* (RFAT_CONFIG_LOCK_STATISTICS_ENTRIES != 0) */
 
 extern int          f_mkdir(const char *dirname);
 extern int          f_rmdir(const char *dirname);
@@ -173,12 +274,37 @@ extern int          f_settimedate(const char *filename, unsigned short ctime, un
 extern int          f_gettimedate(const char *filename, unsigned short *p_ctime, unsigned short *p_cdate);
 extern int          f_setattr(const char *filename, unsigned char attr);
 extern int          f_getattr(const char *filename, unsigned char *p_attr);
+extern int          f_stat(const char *filename, F_STAT *stat);
 
 extern F_FILE *     f_open(const char *filename, const char *type);
+extern F_FILE *     f_open_find(F_FIND *find, const char *type);
 extern int          f_close(F_FILE *file);
 extern int          f_flush(F_FILE *file);
+extern int          f_datasync(F_FILE *file);
+extern int          f_setcommit(F_FILE *file, int policy, unsigned long interval);
+extern int          f_setvbuf(F_FILE *file, void *buffer, long size);
 extern long         f_write(const void *buffer, long size, long count, F_FILE *file);
+extern int          f_write_reserve(F_FILE *file, long size, void **p_data);
+extern long         f_write_commit(F_FILE *file, long size);
 extern long         f_read(void *buffer, long size, long count, F_FILE *file);
+extern long         f_writev(F_FILE *file, const F_IOVEC *iov, int iovcnt);
+extern long         f_readv(F_FILE *file, const F_IOVEC *iov, int iovcnt);
+extern int          f_queue_init(F_QUEUE *queue, F_FILE *file, void *data, unsigned long size);
+extern int          f_queue_put(F_QUEUE *queue, const void *record, unsigned long size);
+extern long         f_queue_drain(F_QUEUE *queue, int flush);
+extern unsigned long f_queue_overrun(F_QUEUE *queue);
+#if (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1)
+extern int          f_ring_open(F_RING *ring, const char *filename, unsigned long size);
+extern int          f_ring_close(F_RING *ring);
+extern int          f_ring_sync(F_RING *ring);
+extern long         f_ring_write(F_RING *ring, const void *buffer, long size);
+extern long         f_ring_read(F_RING *ring, void *buffer, long size);
+extern int          f_ring_rewind(F_RING *ring);
+extern int          f_pool_open(F_POOL *pool, const char *pattern, unsigned long size, int count);
+extern int          f_pool_close(F_POOL *pool);
+extern int          f_pool_fill(F_POOL *pool);
+extern int          f_pool_rotate(F_POOL *pool);
+#endif /* (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1) */
 extern int          f_seek(F_FILE *file, long offset, int whence);
 extern long         f_tell(F_FILE *file);
 extern int          f_eof(F_FILE *file);
@@ -187,6 +313,7 @@ extern int          f_rewind(F_FILE *file);
 extern int          f_putc(int c, F_FILE *file);
 extern int          f_getc(F_FILE *file);
 extern int          f_seteof(F_FILE *file);
+extern int          f_fstat(F_FILE *file, F_STAT *stat);
 extern F_FILE *     f_truncate(const char *filename, long length);
 
 #endif /* _RFAT_H */
@@ -34,31 +34,125 @@
 #define RFAT_VERSION_BUILD                     67
 #define RFAT_VERSION_STRING                    "1.0.67"
 
+/* Each option can be overridden from the compiler command line, e.g.
+ * -DRFAT_CONFIG_MAX_FILES=4.
+ */
+
+#if !defined(RFAT_CONFIG_MAX_FILES)
 #define RFAT_CONFIG_MAX_FILES                  1
+#endif /* !defined(RFAT_CONFIG_MAX_FILES) */
+#if !defined(RFAT_CONFIG_FAT12_SUPPORTED)
 #define RFAT_CONFIG_FAT12_SUPPORTED            0
+#endif /* !defined(RFAT_CONFIG_FAT12_SUPPORTED) */
+#if !defined(RFAT_CONFIG_VFAT_SUPPORTED)
 #define RFAT_CONFIG_VFAT_SUPPORTED             0
+#endif /* !defined(RFAT_CONFIG_VFAT_SUPPORTED) */
+#if !defined(RFAT_CONFIG_UTF8_SUPPORTED)
 #define RFAT_CONFIG_UTF8_SUPPORTED             0
+#endif /* !defined(RFAT_CONFIG_UTF8_SUPPORTED) */
+#if !defined(RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED)
 #define RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED 0
+#endif /* !defined(RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED) */
+#if !defined(RFAT_CONFIG_CONTIGUOUS_SUPPORTED)
 #define RFAT_CONFIG_CONTIGUOUS_SUPPORTED       1
+#endif /* !defined(RFAT_CONFIG_CONTIGUOUS_SUPPORTED) */
+#if !defined(RFAT_CONFIG_SEQUENTIAL_SUPPORTED)
 #define RFAT_CONFIG_SEQUENTIAL_SUPPORTED       1
+#endif /* !defined(RFAT_CONFIG_SEQUENTIAL_SUPPORTED) */
+#if !defined(RFAT_CONFIG_MEDIA_FAILURE_SUPPORTED)
 #define RFAT_CONFIG_MEDIA_FAILURE_SUPPORTED    0
+#endif /* !defined(RFAT_CONFIG_MEDIA_FAILURE_SUPPORTED) */
+#if !defined(RFAT_CONFIG_VOLUME_DIRTY_SUPPORTED)
 #define RFAT_CONFIG_VOLUME_DIRTY_SUPPORTED     0
+#endif /* !defined(RFAT_CONFIG_VOLUME_DIRTY_SUPPORTED) */
+#if !defined(RFAT_CONFIG_FSINFO_SUPPORTED)
 #define RFAT_CONFIG_FSINFO_SUPPORTED           0
+#endif /* !defined(RFAT_CONFIG_FSINFO_SUPPORTED) */
+#if !defined(RFAT_CONFIG_2NDFAT_SUPPORTED)
 #define RFAT_CONFIG_2NDFAT_SUPPORTED           1
+#endif /* !defined(RFAT_CONFIG_2NDFAT_SUPPORTED) */
+#if !defined(RFAT_CONFIG_COMMIT_POLICY_SUPPORTED)
+#define RFAT_CONFIG_COMMIT_POLICY_SUPPORTED    0
+#endif /* !defined(RFAT_CONFIG_COMMIT_POLICY_SUPPORTED) */
+#if !defined(RFAT_CONFIG_STREAM_BUFFER_SUPPORTED)
+#define RFAT_CONFIG_STREAM_BUFFER_SUPPORTED    0
+#endif /* !defined(RFAT_CONFIG_STREAM_BUFFER_SUPPORTED) */
+#if !defined(RFAT_CONFIG_TRANSFER_UNLOCK_SUPPORTED)
+#define RFAT_CONFIG_TRANSFER_UNLOCK_SUPPORTED  0
+#endif /* !defined(RFAT_CONFIG_TRANSFER_UNLOCK_SUPPORTED) */
+#if !defined(RFAT_CONFIG_UNIT_PROBE_SUPPORTED)
+#define RFAT_CONFIG_UNIT_PROBE_SUPPORTED       0
+#endif /* !defined(RFAT_CONFIG_UNIT_PROBE_SUPPORTED) */
+#if !defined(RFAT_CONFIG_WRITE_BUDGET_SUPPORTED)
+#define RFAT_CONFIG_WRITE_BUDGET_SUPPORTED     0
+#endif /* !defined(RFAT_CONFIG_WRITE_BUDGET_SUPPORTED) */
 
 
+#if !defined(RFAT_CONFIG_FAT_CACHE_ENTRIES)
 #define RFAT_CONFIG_FAT_CACHE_ENTRIES          1
+#endif /* !defined(RFAT_CONFIG_FAT_CACHE_ENTRIES) */
+#if !defined(RFAT_CONFIG_DATA_CACHE_ENTRIES)
 #define RFAT_CONFIG_DATA_CACHE_ENTRIES         0
+#endif /* !defined(RFAT_CONFIG_DATA_CACHE_ENTRIES) */
+#if !defined(RFAT_CONFIG_FILE_DATA_CACHE)
 #define RFAT_CONFIG_FILE_DATA_CACHE            0
+#endif /* !defined(RFAT_CONFIG_FILE_DATA_CACHE) */
+#if !defined(RFAT_CONFIG_CLUSTER_CACHE_ENTRIES)
 #define RFAT_CONFIG_CLUSTER_CACHE_ENTRIES      0
+#endif /* !defined(RFAT_CONFIG_CLUSTER_CACHE_ENTRIES) */
+#if !defined(RFAT_CONFIG_DEFERRED_RELEASE_ENTRIES)
+#define RFAT_CONFIG_DEFERRED_RELEASE_ENTRIES   0
+#endif /* !defined(RFAT_CONFIG_DEFERRED_RELEASE_ENTRIES) */
+#if !defined(RFAT_CONFIG_DEFERRED_RELEASE_CLUSTERS)
+#define RFAT_CONFIG_DEFERRED_RELEASE_CLUSTERS  128
+#endif /* !defined(RFAT_CONFIG_DEFERRED_RELEASE_CLUSTERS) */
+#if !defined(RFAT_CONFIG_APPEND_RESERVE_CLUSTERS)
+#define RFAT_CONFIG_APPEND_RESERVE_CLUSTERS    0
+#endif /* !defined(RFAT_CONFIG_APPEND_RESERVE_CLUSTERS) */
+/* With RFAT_CONFIG_WRITE_BUDGET_SUPPORTED an f_write() that crosses into a new
+ * cluster does at most: one FAT block written back and one read to link the
+ * cluster, one FAT2 copy of a FAT block not next to the pending ones, and the
+ * data stream stop/restart around those. The search for the next free AU is
+ * left to f_idle(), unless the allocation window ran out before f_idle() was
+ * called. RFAT_CONFIG_WRITE_BUDGET_BLOCKS is the number of FAT2 copies, and of
+ * AUs inspected, per f_idle() call.
+ */
+#if !defined(RFAT_CONFIG_WRITE_BUDGET_BLOCKS)
+#define RFAT_CONFIG_WRITE_BUDGET_BLOCKS        1
+#endif /* !defined(RFAT_CONFIG_WRITE_BUDGET_BLOCKS) */
+#if !defined(RFAT_CONFIG_WRITE_RESERVE_SIZE)
+#define RFAT_CONFIG_WRITE_RESERVE_SIZE         0
+#endif /* !defined(RFAT_CONFIG_WRITE_RESERVE_SIZE) */
+#if !defined(RFAT_CONFIG_MAP_RESOLVE_ENTRIES)
+#define RFAT_CONFIG_MAP_RESOLVE_ENTRIES        1
+#endif /* !defined(RFAT_CONFIG_MAP_RESOLVE_ENTRIES) */
+#if !defined(RFAT_CONFIG_META_DATA_RETRIES)
 #define RFAT_CONFIG_META_DATA_RETRIES          3
+#endif /* !defined(RFAT_CONFIG_META_DATA_RETRIES) */
+#if !defined(RFAT_CONFIG_DISK_CRC)
 #define RFAT_CONFIG_DISK_CRC                   1
+#endif /* !defined(RFAT_CONFIG_DISK_CRC) */
+#if !defined(RFAT_CONFIG_DISK_COMMAND_RETRIES)
 #define RFAT_CONFIG_DISK_COMMAND_RETRIES       3
+#endif /* !defined(RFAT_CONFIG_DISK_COMMAND_RETRIES) */
+#if !defined(RFAT_CONFIG_DISK_DATA_RETRIES)
 #define RFAT_CONFIG_DISK_DATA_RETRIES          3
+#endif /* !defined(RFAT_CONFIG_DISK_DATA_RETRIES) */
 
+#if !defined(RFAT_CONFIG_STATISTICS)
 #define RFAT_CONFIG_STATISTICS                 0
+#endif /* !defined(RFAT_CONFIG_STATISTICS) */
+#if !defined(RFAT_CONFIG_LOCK_STATISTICS_ENTRIES)
+#define RFAT_CONFIG_LOCK_STATISTICS_ENTRIES    0
+#endif /* !defined(RFAT_CONFIG_LOCK_STATISTICS_ENTRIES) */
+#if !defined(RFAT_CONFIG_DISK_SIMULATE)
 #define RFAT_CONFIG_DISK_SIMULATE              0
+#endif /* !defined(RFAT_CONFIG_DISK_SIMULATE) */
+#if !defined(RFAT_CONFIG_DISK_SIMULATE_BLKCNT)
 #define RFAT_CONFIG_DISK_SIMULATE_BLKCNT       (unsigned long)(65536 * 64)
+#endif /* !defined(RFAT_CONFIG_DISK_SIMULATE_BLKCNT) */
+#if !defined(RFAT_CONFIG_DISK_SIMULATE_TRACE)
 #define RFAT_CONFIG_DISK_SIMULATE_TRACE        1
+#endif /* !defined(RFAT_CONFIG_DISK_SIMULATE_TRACE) */
 
 #endif /* _RFAT_CONFIG_h */
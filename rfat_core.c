@@ -29,11 +29,19 @@
 #include "rfat_core.h"
 #include "rfat_port.h"
 
+#if (RFAT_CONFIG_LOCK_STATISTICS_ENTRIES != 0)
+#if defined(RFAT_PORT_CORE_TIME_STAMP)
+#define RFAT_VOLUME_LOCK_TIME_STAMP()  RFAT_PORT_CORE_TIME_STAMP()
+#else /* RFAT_PORT_CORE_TIME_STAMP */
+#define RFAT_VOLUME_LOCK_TIME_STAMP()  0
+#endif /* RFAT_PORT_CORE_TIME_STAMP */
+#endif /* (RFAT_CONFIG_LOCK_STATISTICS_ENTRIES != 0) */
+
 static rfat_volume_t rfat_volume;
 
 static uint32_t rfat_cache[(1 +
 			    RFAT_CONFIG_FAT_CACHE_ENTRIES +
-			    ((RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1) ? 1 : 0) +
+			    ((RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1) ? ((RFAT_CONFIG_MAP_RESOLVE_ENTRIES != 1) ? (1 + RFAT_CONFIG_MAP_RESOLVE_ENTRIES) : 1) : 0) +
 			    (((RFAT_CONFIG_FILE_DATA_CACHE == 0) ? 1 : RFAT_CONFIG_MAX_FILES) * RFAT_CONFIG_DATA_CACHE_ENTRIES))
 			   * (RFAT_BLK_SIZE / sizeof(uint32_t))];
 
@@ -126,6 +134,11 @@ static int rfat_volume_init(rfat_volume_t *volume)
 #if (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1)
         volume->map_cache.data = cache;
         cache += RFAT_BLK_SIZE;
+
+#if (RFAT_CONFIG_MAP_RESOLVE_ENTRIES != 1)
+        volume->map_data = cache;
+        cache += (RFAT_CONFIG_MAP_RESOLVE_ENTRIES * RFAT_BLK_SIZE);
+#endif /* (RFAT_CONFIG_MAP_RESOLVE_ENTRIES != 1) */
 #endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1) */
 
 #if (RFAT_CONFIG_FAT_CACHE_ENTRIES != 0)
@@ -190,36 +203,19 @@ static int rfat_volume_mount(rfat_volume_t * volume)
     unsigned int index;
 #endif /* (RFAT_CONFIG_CLUSTER_CACHE_ENTRIES != 0) */
 
+    if (volume->state == RFAT_VOLUME_STATE_CARDREMOVED)
+    {
+	status = rfat_volume_remount(volume);
+    }
+    else
+    {
 #if (RFAT_CONFIG_STATISTICS == 1)
-    memset(&volume->statistics, 0, sizeof(volume->statistics));
+	memset(&volume->statistics, 0, sizeof(volume->statistics));
 #endif /* (RFAT_CONFIG_STATISTICS == 1) */
 
-    status = rfat_disk_info(volume->disk, &write_protected, &blkcnt, &blk_unit_size, &product);
+	status = rfat_disk_info(volume->disk, &write_protected, &blkcnt, &blk_unit_size, &product);
 
-    if (status == F_NO_ERROR)
-    {
-	if (volume->state == RFAT_VOLUME_STATE_CARDREMOVED)
-	{
-	    if (volume->product != product)
-	    {
-		volume->state = RFAT_VOLUME_STATE_UNUSABLE;
-		
-		status = F_ERR_UNUSABLE;
-	    }
-#if (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1)
-	    else
-	    {
-		/* Check whether the log needs to be replayed after a SDCARD power failure.
-		 */
-		if ((volume->log_lead_sig == RFAT_HTOFL(RFAT_LOG_LEAD_SIG)) &&
-		    (volume->log_struct_sig == RFAT_HTOFL(RFAT_LOG_STRUCT_SIG)))
-		{
-		    status = rfat_volume_commit(volume);
-		}
-	    }
-#endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1) */
-	}
-	else
+	if (status == F_NO_ERROR)
 	{
 	    volume->flags = 0;
 	
@@ -283,6 +279,23 @@ static int rfat_volume_mount(rfat_volume_t * volume)
 			{
 			    boot_blkno = RFAT_FTOHL(boot->mbr.mbr_par_table[0].mbr_rel_sec);
 
+#if (RFAT_CONFIG_UNIT_PROBE_SUPPORTED == 1)
+			    /* Use the AU size rfat_volume_format() had measured, unless the card
+			     * reports one.
+			     */
+			    if ((blk_unit_size == 0) && (boot->mbr.mbr_unit_sig == RFAT_HTOFL(RFAT_UNIT_SIG)))
+			    {
+				blk_unit_size = RFAT_FTOHL(boot->mbr.mbr_unit_size);
+
+				if ((blk_unit_size <= RFAT_UNIT_PROBE_PAGE_SIZE) ||
+				    (blk_unit_size > RFAT_UNIT_PROBE_UNIT_SIZE) ||
+				    (blk_unit_size & (blk_unit_size -1)))
+				{
+				    blk_unit_size = 0;
+				}
+			    }
+#endif /* (RFAT_CONFIG_UNIT_PROBE_SUPPORTED == 1) */
+
 #if (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1)
 			    if ((boot->mbr.mbr_par_table[1].mbr_sys_id == 0x00) &&
 				(boot->mbr.mbr_par_table[2].mbr_sys_id == 0x00) &&
@@ -567,6 +580,11 @@ static int rfat_volume_mount(rfat_volume_t * volume)
 #endif /* (RFAT_CONFIG_CLUSTER_CACHE_ENTRIES != 0) */
 			    
 				    volume->cwd_clsno = RFAT_CLSNO_NONE;
+
+#if (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1)
+				    volume->group_clsno = RFAT_CLSNO_NONE;
+				    volume->group_dir_index = RFAT_GROUP_INDEX_NONE;
+#endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1) */
 			    
 #if (RFAT_CONFIG_MAX_FILES == 1)
 				    volume->file_table[0].mode = 0;
@@ -591,6 +609,10 @@ static int rfat_volume_mount(rfat_volume_t * volume)
 					if ((boot->bpblog.log_lead_sig == RFAT_HTOFL(RFAT_LOG_LEAD_SIG)) &&
 					    (boot->bpblog.log_struct_sig == RFAT_HTOFL(RFAT_LOG_STRUCT_SIG)))
 					{
+					    volume->group_clsno = RFAT_FTOHL(boot->bpblog.log_group_clsno);
+					    volume->group_dir_clsno = RFAT_FTOHL(boot->bpblog.log_group_dir_clsno);
+					    volume->group_dir_index = RFAT_FTOHL(boot->bpblog.log_group_dir_index);
+
 					    status = rfat_volume_commit(volume);
 					}
 					else
@@ -716,6 +738,11 @@ static int rfat_volume_mount(rfat_volume_t * volume)
 					volume->base_clsno = volume->start_clsno;
 					volume->limit_clsno = volume->start_clsno;
 #endif /* (RFAT_CONFIG_SEQUENTIAL_SUPPORTED == 1) */
+
+#if (RFAT_CONFIG_WRITE_BUDGET_SUPPORTED == 1) && (RFAT_CONFIG_2NDFAT_SUPPORTED == 1) && (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0)
+					volume->mirror_blkno = 0;
+					volume->mirror_blkno_e = 0;
+#endif /* (RFAT_CONFIG_WRITE_BUDGET_SUPPORTED == 1) && (RFAT_CONFIG_2NDFAT_SUPPORTED == 1) && (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0) */
 				    }
 				}
 			    }
@@ -724,10 +751,161 @@ static int rfat_volume_mount(rfat_volume_t * volume)
 		}
 	    }
 	}
-	
+
+#if (RFAT_CONFIG_DEFERRED_RELEASE_ENTRIES != 0)
 	if (status == F_NO_ERROR)
 	{
-	    volume->state = RFAT_VOLUME_STATE_MOUNTED;
+	    volume->release_count = 0;
+	}
+#endif /* (RFAT_CONFIG_DEFERRED_RELEASE_ENTRIES != 0) */
+    }
+
+    if (status == F_NO_ERROR)
+    {
+	volume->state = RFAT_VOLUME_STATE_MOUNTED;
+    }
+
+    return status;
+}
+
+/* rfat_volume_remount() is the fast path of rfat_volume_mount() after F_ERR_CARDREMOVED.
+ * If the reinserted SDCARD has the same CID serial, and the boot sector still describes
+ * the same file system, then everything in memory is still valid: caches, allocation
+ * cursors, deferred releases and open files. Only the CID and the boot sector are read.
+ *
+ * Files open only for reading that failed with F_ERR_CARDREMOVED or F_ERR_ONDRIVE (the
+ * access that ran into the removal) are reattached. Files open for writing keep the
+ * error, as data in flight to the SDCARD may have been lost. f_close() still updates
+ * their directory entries.
+ */
+
+static int rfat_volume_remount(rfat_volume_t *volume)
+{
+    int status = F_NO_ERROR;
+    bool write_protected;
+    uint32_t product, serial, fat_blkcnt;
+    rfat_boot_t *boot;
+    rfat_file_t *file;
+#if (RFAT_CONFIG_MAX_FILES > 1)
+    rfat_file_t *file_e;
+#endif /* (RFAT_CONFIG_MAX_FILES > 1) */
+
+    status = rfat_disk_identify(volume->disk, &write_protected, &product);
+
+    if (status == F_NO_ERROR)
+    {
+	if (volume->product != product)
+	{
+	    volume->state = RFAT_VOLUME_STATE_UNUSABLE;
+
+	    status = F_ERR_UNUSABLE;
+	}
+	else
+	{
+	    if (write_protected)
+	    {
+		volume->flags |= RFAT_VOLUME_FLAG_WRITE_PROTECTED;
+	    }
+	    else
+	    {
+		volume->flags &= ~RFAT_VOLUME_FLAG_WRITE_PROTECTED;
+	    }
+
+	    /* The boot sector is read into the dir cache. Without a FAT cache or a data cache
+	     * the dir cache may hold unwritten data, which cannot be written back before the
+	     * SDCARD is known to be the same. In that case only the CID serial is checked.
+	     */
+#if (RFAT_CONFIG_FAT_CACHE_ENTRIES == 0) || (RFAT_CONFIG_DATA_CACHE_ENTRIES == 0)
+	    if (!(0
+#if (RFAT_CONFIG_FAT_CACHE_ENTRIES == 0)
+		  || (volume->flags & RFAT_VOLUME_FLAG_FAT_DIRTY)
+#endif /* (RFAT_CONFIG_FAT_CACHE_ENTRIES == 0) */
+#if (RFAT_CONFIG_DATA_CACHE_ENTRIES == 0)
+		  || volume->data_file
+#endif /* (RFAT_CONFIG_DATA_CACHE_ENTRIES == 0) */
+		    ))
+#endif /* (RFAT_CONFIG_FAT_CACHE_ENTRIES == 0) || (RFAT_CONFIG_DATA_CACHE_ENTRIES == 0) */
+	    {
+		boot = (rfat_boot_t*)((void*)volume->dir_cache.data);
+
+		volume->dir_cache.blkno = RFAT_BLKNO_INVALID;
+
+		status = rfat_volume_read(volume, volume->boot_blkno, (uint8_t*)boot);
+
+		if (status == F_NO_ERROR)
+		{
+		    serial = 0;
+
+		    if (boot->bpb.bpb_fat_sz_16 != 0)
+		    {
+			fat_blkcnt = RFAT_FTOHS(boot->bpb.bpb_fat_sz_16);
+
+			if (boot->bpb40.bs_boot_sig == 0x29)
+			{
+			    serial = RFAT_FTOHL(boot->bpb40.bs_vol_id);
+			}
+		    }
+		    else
+		    {
+			fat_blkcnt = RFAT_FTOHL(boot->bpb71.bpb_fat_sz_32);
+
+			if (boot->bpb71.bs_boot_sig == 0x29)
+			{
+			    serial = RFAT_FTOHL(boot->bpb71.bs_vol_id);
+			}
+		    }
+
+		    if ((boot->bs.bs_trail_sig != RFAT_HTOFS(0xaa55)) ||
+			((boot->bpb.bpb_sec_per_clus * RFAT_BLK_SIZE) != volume->cls_size) ||
+			((volume->boot_blkno + RFAT_FTOHS(boot->bpb.bpb_rsvd_sec_cnt)) != volume->fat1_blkno) ||
+			(fat_blkcnt != volume->fat_blkcnt) ||
+			(serial != volume->serial))
+		    {
+			volume->state = RFAT_VOLUME_STATE_UNUSABLE;
+
+			status = F_ERR_UNUSABLE;
+		    }
+		}
+	    }
+
+#if (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1)
+	    if (status == F_NO_ERROR)
+	    {
+		/* Check whether the log needs to be replayed after a SDCARD power failure.
+		 */
+		if ((volume->log_lead_sig == RFAT_HTOFL(RFAT_LOG_LEAD_SIG)) &&
+		    (volume->log_struct_sig == RFAT_HTOFL(RFAT_LOG_STRUCT_SIG)))
+		{
+		    status = rfat_volume_commit(volume);
+		}
+	    }
+#endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1) */
+
+	    if (status == F_NO_ERROR)
+	    {
+#if (RFAT_CONFIG_MAX_FILES == 1)
+		file = &volume->file_table[0];
+
+		if (file->mode && !(file->mode & RFAT_FILE_MODE_WRITE) && ((file->status == F_ERR_CARDREMOVED) || (file->status == F_ERR_ONDRIVE)))
+		{
+		    file->status = F_NO_ERROR;
+		}
+#else /* (RFAT_CONFIG_MAX_FILES == 1) */
+		file = &volume->file_table[0];
+		file_e = &volume->file_table[RFAT_CONFIG_MAX_FILES];
+	    
+		do
+		{
+		    if (file->mode && !(file->mode & RFAT_FILE_MODE_WRITE) && ((file->status == F_ERR_CARDREMOVED) || (file->status == F_ERR_ONDRIVE)))
+		    {
+			file->status = F_NO_ERROR;
+		    }
+		
+		    file++;
+		}
+		while (file < file_e);
+#endif /* (RFAT_CONFIG_MAX_FILES == 1) */
+	    }
 	}
     }
 
@@ -743,6 +921,13 @@ static int rfat_volume_unmount(rfat_volume_t * volume)
     rfat_file_t *file_e;
 #endif /* (RFAT_CONFIG_MAX_FILES > 1) */
 
+#if (RFAT_CONFIG_TRANSFER_UNLOCK_SUPPORTED == 1)
+    if (volume->transfer_count != 0)
+    {
+	status = F_ERR_LOCKED;
+    }
+    else
+#endif /* (RFAT_CONFIG_TRANSFER_UNLOCK_SUPPORTED == 1) */
     if (volume->state >= RFAT_VOLUME_STATE_MOUNTED)
     {
 #if (RFAT_CONFIG_MAX_FILES == 1)
@@ -768,6 +953,31 @@ static int rfat_volume_unmount(rfat_volume_t * volume)
 	while ((status == F_NO_ERROR) && (file < file_e));
 #endif /* (RFAT_CONFIG_MAX_FILES == 1) */
 
+#if (RFAT_CONFIG_DEFERRED_RELEASE_ENTRIES != 0)
+	if (status == F_NO_ERROR)
+	{
+	    if (volume->state == RFAT_VOLUME_STATE_MOUNTED)
+	    {
+		status = rfat_volume_release(volume, 0xffffffff);
+	    }
+	}
+#endif /* (RFAT_CONFIG_DEFERRED_RELEASE_ENTRIES != 0) */
+
+#if (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1)
+	if (status == F_NO_ERROR)
+	{
+	    if ((volume->state == RFAT_VOLUME_STATE_MOUNTED) && (volume->flags & RFAT_VOLUME_FLAG_TRANSACTION))
+	    {
+		volume->flags &= ~RFAT_VOLUME_FLAG_TRANSACTION;
+
+		volume->group_clsno = RFAT_CLSNO_NONE;
+		volume->group_dir_index = RFAT_GROUP_INDEX_NONE;
+
+		status = rfat_volume_record(volume);
+	    }
+	}
+#endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1) */
+
 	if (status == F_NO_ERROR)
 	{
 	    /* Revert the state to be RFAT_VOLUME_STATE_INITIALIZED, so that can be remounted.
@@ -779,9 +989,12 @@ static int rfat_volume_unmount(rfat_volume_t * volume)
     return status;
 }
 
-static int rfat_volume_lock(rfat_volume_t *volume)
+static int rfat_volume_lock_function(rfat_volume_t *volume, const char *function)
 {
     int status = F_NO_ERROR;
+#if (RFAT_CONFIG_LOCK_STATISTICS_ENTRIES != 0)
+    uint32_t stamp = RFAT_VOLUME_LOCK_TIME_STAMP();
+#endif /* (RFAT_CONFIG_LOCK_STATISTICS_ENTRIES != 0) */
 
     if (volume->state == RFAT_VOLUME_STATE_NONE)
     {
@@ -797,6 +1010,8 @@ static int rfat_volume_lock(rfat_volume_t *volume)
 	else
 #endif /* RFAT_PORT_CORE_LOCK */
 	{
+	    RFAT_VOLUME_LOCK_STATISTICS_ACQUIRE(function, stamp);
+
 	    if (volume->state == RFAT_VOLUME_STATE_UNUSABLE)
 	    {
 		status = F_ERR_UNUSABLE;
@@ -821,21 +1036,26 @@ static int rfat_volume_lock(rfat_volume_t *volume)
 		}
 	    }
 
-#if defined(RFAT_PORT_CORE_UNLOCK)
 	    if (status != F_NO_ERROR)
 	    {
+		RFAT_VOLUME_LOCK_STATISTICS_RELEASE();
+
+#if defined(RFAT_PORT_CORE_UNLOCK)
 		RFAT_PORT_CORE_UNLOCK();
-	    }
 #endif /* RFAT_PORT_CORE_UNLOCK */
+	    }
 	}
     }
 
     return status;
 }
 
-static int rfat_volume_lock_noinit(rfat_volume_t *volume)
+static int rfat_volume_lock_noinit_function(rfat_volume_t *volume, const char *function)
 {
     int status = F_NO_ERROR;
+#if (RFAT_CONFIG_LOCK_STATISTICS_ENTRIES != 0)
+    uint32_t stamp = RFAT_VOLUME_LOCK_TIME_STAMP();
+#endif /* (RFAT_CONFIG_LOCK_STATISTICS_ENTRIES != 0) */
 
     if (volume->state == RFAT_VOLUME_STATE_NONE)
     {
@@ -858,15 +1078,22 @@ static int rfat_volume_lock_noinit(rfat_volume_t *volume)
 	{
 	    status = F_ERR_BUSY;
 	}
+	else
 #endif /* RFAT_PORT_CORE_LOCK */
+	{
+	    RFAT_VOLUME_LOCK_STATISTICS_ACQUIRE(function, stamp);
+	}
     }
 
     return status;
 }
 
-static int  rfat_volume_lock_nomount(rfat_volume_t *volume)
+static int  rfat_volume_lock_nomount_function(rfat_volume_t *volume, const char *function)
 {
     int status = F_NO_ERROR;
+#if (RFAT_CONFIG_LOCK_STATISTICS_ENTRIES != 0)
+    uint32_t stamp = RFAT_VOLUME_LOCK_TIME_STAMP();
+#endif /* (RFAT_CONFIG_LOCK_STATISTICS_ENTRIES != 0) */
 
     if (volume->state == RFAT_VOLUME_STATE_NONE)
     {
@@ -882,14 +1109,21 @@ static int  rfat_volume_lock_nomount(rfat_volume_t *volume)
 	else
 #endif /* RFAT_PORT_CORE_LOCK */
 	{
+	    RFAT_VOLUME_LOCK_STATISTICS_ACQUIRE(function, stamp);
+
 	    if (volume->disk == NULL)
 	    {
 		status = F_ERR_INITFUNC;
 	    }
 
+	    if (status != F_NO_ERROR)
+	    {
+		RFAT_VOLUME_LOCK_STATISTICS_RELEASE();
+
 #if defined(RFAT_PORT_CORE_UNLOCK)
-	    RFAT_PORT_CORE_UNLOCK();
+		RFAT_PORT_CORE_UNLOCK();
 #endif /* RFAT_PORT_CORE_UNLOCK */
+	    }
 	}
     }
 
@@ -920,13 +1154,76 @@ static int rfat_volume_unlock(rfat_volume_t *volume, int status)
 	}
     }
 
+    RFAT_VOLUME_LOCK_STATISTICS_RELEASE();
+
+#if defined(RFAT_PORT_CORE_UNLOCK)
+    RFAT_PORT_CORE_UNLOCK();
+#endif /* RFAT_PORT_CORE_UNLOCK */
+
+    return status;
+}
+
+#if (RFAT_CONFIG_TRANSFER_UNLOCK_SUPPORTED == 1)
+
+/* rfat_volume_transfer_begin() and rfat_volume_transfer_end() bracket a multi
+ * block transfer between the disk and the caller's buffer. The core lock is
+ * dropped in between, so that other tasks can work off the caches while the
+ * transfer only holds the disk lock. A non-zero "volume->transfer_count"
+ * keeps rfat_volume_unmount() from pulling the volume out from underneath.
+ */
+
+static void rfat_volume_transfer_begin(rfat_volume_t *volume)
+{
+    volume->transfer_count++;
+
+    RFAT_VOLUME_LOCK_STATISTICS_RELEASE();
+
 #if defined(RFAT_PORT_CORE_UNLOCK)
     RFAT_PORT_CORE_UNLOCK();
 #endif /* RFAT_PORT_CORE_UNLOCK */
+}
+
+static int rfat_volume_transfer_end(rfat_volume_t *volume, int status)
+{
+#if (RFAT_CONFIG_LOCK_STATISTICS_ENTRIES != 0)
+    uint32_t stamp = RFAT_VOLUME_LOCK_TIME_STAMP();
+#endif /* (RFAT_CONFIG_LOCK_STATISTICS_ENTRIES != 0) */
+
+#if defined(RFAT_PORT_CORE_LOCK)
+    /* The caller is in the middle of an operation, and has to
+     * return with the core lock held. Hence there is no timeout.
+     */
+    while (!RFAT_PORT_CORE_LOCK())
+    {
+	continue;
+    }
+#endif /* RFAT_PORT_CORE_LOCK */
+
+    /* "volume->lock_entry" may have been changed by another task while
+     * the core lock was dropped, hence the relock is accounted on its own.
+     */
+    RFAT_VOLUME_LOCK_STATISTICS_ACQUIRE(__func__, stamp);
+
+    volume->transfer_count--;
+
+    if (status == F_NO_ERROR)
+    {
+	if (volume->state == RFAT_VOLUME_STATE_CARDREMOVED)
+	{
+	    status = F_ERR_CARDREMOVED;
+	}
+
+	if (volume->state == RFAT_VOLUME_STATE_UNUSABLE)
+	{
+	    status = F_ERR_UNUSABLE;
+	}
+    }
 
     return status;
 }
 
+#endif /* (RFAT_CONFIG_TRANSFER_UNLOCK_SUPPORTED == 1) */
+
 static int rfat_volume_read(rfat_volume_t *volume, uint32_t address, uint8_t *data)
 {
     int status = F_NO_ERROR;
@@ -1181,6 +1478,15 @@ static int rfat_volume_clean(rfat_volume_t *volume, int status_o)
 
     if (volume->state == RFAT_VOLUME_STATE_MOUNTED)
     {
+#if (RFAT_CONFIG_WRITE_BUDGET_SUPPORTED == 1) && (RFAT_CONFIG_2NDFAT_SUPPORTED == 1)
+	/* FAT2 is brought up to date before the volume is declared clean.
+	 */
+	if (status_o == F_NO_ERROR)
+	{
+	    status_o = rfat_volume_mirror(volume, 0xffffffff);
+	}
+#endif /* (RFAT_CONFIG_WRITE_BUDGET_SUPPORTED == 1) && (RFAT_CONFIG_2NDFAT_SUPPORTED == 1) */
+
 #if (RFAT_CONFIG_VOLUME_DIRTY_SUPPORTED == 1)
 #if (RFAT_CONFIG_FSINFO_SUPPORTED == 1)
 	if ((volume->fsinfo_blkofs != 0) &&
@@ -1283,78 +1589,150 @@ static int rfat_volume_clean(rfat_volume_t *volume, int status_o)
 
 #else /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0) */
 
-static int rfat_volume_record(rfat_volume_t *volume)
+/* Write the log, i.e. the boot block with the map, the pending directory updates and
+ * the group state.
+ */
+
+static int rfat_volume_log(rfat_volume_t *volume)
 {
     int status = F_NO_ERROR;
-#if (RFAT_CONFIG_VFAT_SUPPORTED == 1) && (RFAT_CONFIG_UTF8_SUPPORTED == 1)
-    uint16_t bs_trail_sig;
-#endif /* (RFAT_CONFIG_VFAT_SUPPORTED == 1) && (RFAT_CONFIG_UTF8_SUPPORTED == 1) */
+    uint8_t bs_data[24];
     rfat_boot_t *boot;
 
-    status = rfat_map_cache_flush(volume);
-
-    if (status == F_NO_ERROR)
-    {
-	if (volume->map_flags
-	    || ((volume->dir_flags & (RFAT_DIR_FLAG_DESTROY_ENTRY | RFAT_DIR_FLAG_CREATE_ENTRY)) == (RFAT_DIR_FLAG_DESTROY_ENTRY | RFAT_DIR_FLAG_CREATE_ENTRY))
-#if (RFAT_CONFIG_VFAT_SUPPORTED == 1)
-	    || ((volume->dir_flags & RFAT_DIR_FLAG_DESTROY_ENTRY) && volume->del_entries)
-	    || ((volume->dir_flags & RFAT_DIR_FLAG_CREATE_ENTRY) && volume->dir_entries)
-#endif /* (RFAT_CONFIG_VFAT_SUPPORTED == 1) */
-	    )
-	{
-	    boot = (rfat_boot_t*)((void*)&volume->bs_data[0]);
+    boot = (rfat_boot_t*)((void*)&volume->bs_data[0]);
 
-	    /* Make sure the file system is marked unusable other
-	     * than for TRANSACTION_SAFE recovery.
-	     */
-	    boot->bpb.bpb_byts_per_sec |= 0x8000;
+    /* Make sure the file system is marked unusable other
+     * than for TRANSACTION_SAFE recovery.
+     */
+    boot->bpb.bpb_byts_per_sec |= 0x8000;
 
-	    /* Fill in the heads to signal an uncomitted rfat_volume_record().
-	     */
-	    boot->bpblog.log_lead_sig = RFAT_HTOFL(RFAT_LOG_LEAD_SIG);
-	    boot->bpblog.log_struct_sig = RFAT_HTOFL(RFAT_LOG_STRUCT_SIG);
+    /* Fill in the heads to signal an uncomitted rfat_volume_record().
+     */
+    boot->bpblog.log_lead_sig = RFAT_HTOFL(RFAT_LOG_LEAD_SIG);
+    boot->bpblog.log_struct_sig = RFAT_HTOFL(RFAT_LOG_STRUCT_SIG);
 
 #if (RFAT_CONFIG_MEDIA_FAILURE_SUPPORTED == 1)
-	    if (volume->flags & RFAT_VOLUME_FLAG_MEDIA_FAILURE)
-	    {
-		if (volume->type == RFAT_VOLUME_TYPE_FAT32)
-		{
-		    boot->bpb71.bs_nt_reserved |= 0x02;
-		}
-		else
-		{
-		    boot->bpb40.bs_nt_reserved |= 0x02;
-		}
-	    }
+    if (volume->flags & RFAT_VOLUME_FLAG_MEDIA_FAILURE)
+    {
+	if (volume->type == RFAT_VOLUME_TYPE_FAT32)
+	{
+	    boot->bpb71.bs_nt_reserved |= 0x02;
+	}
+	else
+	{
+	    boot->bpb40.bs_nt_reserved |= 0x02;
+	}
+    }
 #endif /* (RFAT_CONFIG_MEDIA_FAILURE_SUPPORTED == 1) */
 	    
 #if (RFAT_CONFIG_VFAT_SUPPORTED == 1) && (RFAT_CONFIG_UTF8_SUPPORTED == 1)
-	    /* If VFAT and UTF8 are enabled, VFAT uses uint16_t per lfn_name character. That will
-	     * overflow the boot sector with the maximum length of 255. Hence detect the overflow
-	     * case, and write the lfn_name to a separate block, patch in the bs_trail_sig, 
-	     * write the boot block, and then undo the patching of the bs_trail_sig.
+    /* If VFAT and UTF8 are enabled, VFAT uses uint16_t per lfn_name character. That will
+     * overflow the boot sector with the maximum length of 255. Hence detect the overflow
+     * case, and write the lfn_name to a separate block.
+     */
+    if ((volume->dir_flags & RFAT_DIR_FLAG_CREATE_ENTRY) &&
+	(volume->dir_entries != 0) &&
+	(volume->lfn_count > 128))
+    {
+	status = rfat_volume_write(volume, volume->lfn_blkno, (uint8_t*)volume->lfn_name);
+    }
+	    
+    if (status == F_NO_ERROR)
+#endif /* (RFAT_CONFIG_VFAT_SUPPORTED == 1) && (RFAT_CONFIG_UTF8_SUPPORTED == 1) */
+    {
+	/* The tail of the boot block, i.e. the group state and the bs_trail_sig, is
+	 * patched in for the write, and then restored, as for VFAT and UTF8 lfn_name[]
+	 * overlaps it.
+	 */
+	memcpy(bs_data, &boot->bpblog.log_group_clsno, sizeof(bs_data));
+
+	boot->bpblog.log_group_clsno = RFAT_HTOFL(volume->group_clsno);
+	boot->bpblog.log_group_dir_clsno = RFAT_HTOFL(volume->group_dir_clsno);
+	boot->bpblog.log_group_dir_index = RFAT_HTOFL(volume->group_dir_index);
+	boot->bpblog.bs_trail_sig = RFAT_HTOFS(0xaa55);
+		
+	status = rfat_volume_write(volume, volume->boot_blkno, (uint8_t*)boot);
+
+	memcpy(&boot->bpblog.log_group_clsno, bs_data, sizeof(bs_data));
+    }
+
+    return status;
+}
+
+static int rfat_volume_record(rfat_volume_t *volume)
+{
+    int status = F_NO_ERROR;
+    int record, logged;
+    uint8_t dir_flags;
+    rfat_boot_t *boot;
+
+    boot = (rfat_boot_t*)((void*)&volume->bs_data[0]);
+
+    status = rfat_map_cache_flush(volume);
+
+    if (status == F_NO_ERROR)
+    {
+	dir_flags = volume->dir_flags;
+	logged = FALSE;
+
+	record = (((volume->dir_flags & (RFAT_DIR_FLAG_DESTROY_ENTRY | RFAT_DIR_FLAG_CREATE_ENTRY)) == (RFAT_DIR_FLAG_DESTROY_ENTRY | RFAT_DIR_FLAG_CREATE_ENTRY))
+#if (RFAT_CONFIG_VFAT_SUPPORTED == 1)
+		  || ((volume->dir_flags & RFAT_DIR_FLAG_DESTROY_ENTRY) && volume->del_entries)
+		  || ((volume->dir_flags & RFAT_DIR_FLAG_CREATE_ENTRY) && volume->dir_entries)
+#endif /* (RFAT_CONFIG_VFAT_SUPPORTED == 1) */
+		  );
+
+	if (volume->flags & RFAT_VOLUME_FLAG_TRANSACTION)
+	{
+	    /* Within a f_begin()/f_commit() group a directory update that fits into a single
+	     * block is written directly, once a log is in place. The log then only needs to
+	     * cover the FAT blocks touched so far, and gets rewritten when the map grows.
+	     * The first log (after f_begin() or rfat_volume_settle()) may cover released
+	     * clusters, so it has to carry the directory update. So has a directory update
+	     * that spans multiple blocks. In both cases the log has to be rewritten before
+	     * the next directory update, so that a replay does not apply an outdated one.
 	     */
-	    if ((volume->dir_flags & RFAT_DIR_FLAG_CREATE_ENTRY) &&
-		(volume->dir_entries != 0) &&
-		(volume->lfn_count > 128))
+	    if (boot->bpblog.log_lead_sig != RFAT_HTOFL(RFAT_LOG_LEAD_SIG))
 	    {
-		status = rfat_volume_write(volume, volume->lfn_blkno, (uint8_t*)volume->lfn_name);
+		record = (record || volume->map_flags);
 	    }
-	    
-	    if (status == F_NO_ERROR)
+
+	    if (record)
 	    {
-		bs_trail_sig = boot->bpb.bs_trail_sig;
-		
-		boot->bpb.bs_trail_sig = RFAT_HTOFS(0xaa55);
-		
-		status = rfat_volume_write(volume, volume->boot_blkno, (uint8_t*)boot);
-		
-		boot->bpb.bs_trail_sig = bs_trail_sig;
+		volume->flags &= ~RFAT_VOLUME_FLAG_TRANSACTION_LOGGED;
+	    }
+	    else
+	    {
+		if (!(volume->flags & RFAT_VOLUME_FLAG_TRANSACTION_LOGGED))
+		{
+		    volume->dir_flags = 0;
+
+		    record = TRUE;
+		    logged = TRUE;
+		}
+	    }
+	}
+	else
+	{
+	    if (volume->map_flags && !(volume->flags & RFAT_VOLUME_FLAG_TRANSACTION_LOGGED))
+	    {
+		record = TRUE;
+	    }
+	}
+
+	if (record)
+	{
+	    status = rfat_volume_log(volume);
+
+	    if (logged)
+	    {
+		volume->dir_flags = dir_flags;
+
+		if (status == F_NO_ERROR)
+		{
+		    volume->flags |= RFAT_VOLUME_FLAG_TRANSACTION_LOGGED;
+		}
 	    }
-#else /* (RFAT_CONFIG_VFAT_SUPPORTED == 1) && (RFAT_CONFIG_UTF8_SUPPORTED == 1) */
-	    status = rfat_volume_write(volume, volume->boot_blkno, (uint8_t*)boot);
-#endif /* (RFAT_CONFIG_VFAT_SUPPORTED == 1) && (RFAT_CONFIG_UTF8_SUPPORTED == 1) */
 	}
 
 	if (status == F_NO_ERROR)
@@ -1366,6 +1744,131 @@ static int rfat_volume_record(rfat_volume_t *volume)
     return status;
 }
 
+/* On a replay within a f_begin()/f_commit() group, the FAT blocks written after the
+ * log may hold clusters the directory does not refer to yet. The log names the file
+ * that allocated clusters last, and the head of a new cluster chain, if any. A link
+ * of the file's cluster chain pointing to a free cluster becomes the end of the chain,
+ * and a new cluster chain the directory entry does not lead to gets released.
+ */
+
+static int rfat_volume_reclaim(rfat_volume_t *volume)
+{
+    int status = F_NO_ERROR;
+    int reached;
+    uint32_t clsno, clsdata, clscnt, blkno;
+    rfat_dir_t *dir;
+    rfat_cache_entry_t *entry;
+
+    clsno = RFAT_CLSNO_NONE;
+    clscnt = 0;
+
+    reached = ((volume->group_clsno < 2) || (volume->group_clsno > volume->last_clsno));
+
+    if (volume->group_dir_clsno == RFAT_CLSNO_NONE)
+    {
+	blkno = volume->root_blkno + RFAT_INDEX_TO_BLKCNT_ROOT(volume->group_dir_index);
+    }
+    else
+    {
+	blkno = RFAT_CLSNO_TO_BLKNO(volume->group_dir_clsno) + RFAT_INDEX_TO_BLKCNT(volume->group_dir_index);
+    }
+
+    status = rfat_dir_cache_read(volume, blkno, &entry);
+
+    if (status == F_NO_ERROR)
+    {
+	dir = (rfat_dir_t*)((void*)(entry->data + RFAT_INDEX_TO_BLKOFS(volume->group_dir_index)));
+
+	if ((dir->dir_name[0] != 0x00) && (dir->dir_name[0] != 0xe5))
+	{
+	    clsno = (uint32_t)RFAT_FTOHS(dir->dir_clsno_lo);
+
+	    if (volume->type == RFAT_VOLUME_TYPE_FAT32)
+	    {
+		clsno |= ((uint32_t)RFAT_FTOHS(dir->dir_clsno_hi) << 16);
+	    }
+	}
+    }
+
+    while ((status == F_NO_ERROR) && (clsno >= 2) && (clsno <= volume->last_clsno) && (clscnt < volume->last_clsno))
+    {
+	if (clsno == volume->group_clsno)
+	{
+	    reached = TRUE;
+	}
+
+	status = rfat_cluster_read(volume, clsno, &clsdata);
+
+	if (status == F_NO_ERROR)
+	{
+	    if (clsdata == RFAT_CLSNO_FREE)
+	    {
+		status = rfat_cluster_write(volume, clsno, RFAT_CLSNO_END_OF_CHAIN, FALSE);
+
+		clsdata = RFAT_CLSNO_END_OF_CHAIN;
+	    }
+
+	    clsno = clsdata;
+	    clscnt++;
+	}
+    }
+
+    clsno = volume->group_clsno;
+    clscnt = 0;
+
+    while ((status == F_NO_ERROR) && !reached && (clsno >= 2) && (clsno <= volume->last_clsno) && (clscnt < volume->last_clsno))
+    {
+	status = rfat_cluster_read(volume, clsno, &clsdata);
+
+	if (status == F_NO_ERROR)
+	{
+	    if (clsdata == RFAT_CLSNO_FREE)
+	    {
+		break;
+	    }
+
+	    status = rfat_cluster_write(volume, clsno, RFAT_CLSNO_FREE, FALSE);
+
+	    clsno = clsdata;
+	    clscnt++;
+	}
+    }
+
+    volume->group_clsno = RFAT_CLSNO_NONE;
+    volume->group_dir_index = RFAT_GROUP_INDEX_NONE;
+
+    if (status == F_NO_ERROR)
+    {
+	status = rfat_map_cache_flush(volume);
+
+	if (status == F_NO_ERROR)
+	{
+	    if (volume->map_flags & RFAT_MAP_FLAG_MAP_CHANGED)
+	    {
+		status = rfat_map_cache_resolve(volume);
+	    }
+	}
+    }
+
+#if (RFAT_CONFIG_FSINFO_SUPPORTED == 1)
+    if ((status == F_NO_ERROR) && (clscnt != 0) && (volume->fsinfo_blkofs != 0))
+    {
+	if (volume->flags & RFAT_VOLUME_FLAG_FSINFO_VALID)
+	{
+	    volume->free_clscnt += clscnt;
+
+	    status = rfat_volume_fsinfo(volume, volume->free_clscnt, volume->next_clsno);
+	}
+	else
+	{
+	    status = rfat_volume_fsinfo(volume, 0xffffffff, 0xffffffff);
+	}
+    }
+#endif /* (RFAT_CONFIG_FSINFO_SUPPORTED == 1) */
+
+    return status;
+}
+
 static int rfat_volume_commit(rfat_volume_t *volume)
 {
     int status = F_NO_ERROR;
@@ -1400,9 +1903,14 @@ static int rfat_volume_commit(rfat_volume_t *volume)
 #endif /* (RFAT_CONFIG_VFAT_SUPPORTED == 1) && (RFAT_CONFIG_UTF8_SUPPORTED == 1) */
     }
 
+    /* Within a f_begin()/f_commit() group FAT1 is left alone, so that the map
+     * accumulates the FAT changes of all operations. The log is left in place
+     * as well, since its map is required to replay the directory updates applied
+     * so far. f_commit() finally resolves the map and clears the log.
+     */
     if (status == F_NO_ERROR)
     {
-	if (volume->map_flags & RFAT_MAP_FLAG_MAP_CHANGED)
+	if ((volume->map_flags & RFAT_MAP_FLAG_MAP_CHANGED) && !(volume->flags & RFAT_VOLUME_FLAG_TRANSACTION))
 	{
 	    status = rfat_map_cache_resolve(volume);
 	}
@@ -1419,7 +1927,8 @@ static int rfat_volume_commit(rfat_volume_t *volume)
     {
 	if ((volume->fsinfo_blkofs != 0) &&
 	    (volume->flags & RFAT_VOLUME_FLAG_FSINFO_VALID) &&
-	    (volume->flags & RFAT_VOLUME_FLAG_FSINFO_DIRTY))
+	    (volume->flags & RFAT_VOLUME_FLAG_FSINFO_DIRTY) &&
+	    !(volume->flags & RFAT_VOLUME_FLAG_TRANSACTION))
 	{
 	    status = rfat_volume_fsinfo(volume, volume->free_clscnt, volume->next_clsno);
 
@@ -1694,13 +2203,23 @@ static int rfat_volume_commit(rfat_volume_t *volume)
 
     if (status == F_NO_ERROR)
     {
-	if (boot->bpblog.log_lead_sig == RFAT_HTOFL(RFAT_LOG_LEAD_SIG))
+	if ((volume->group_dir_index != RFAT_GROUP_INDEX_NONE) && !(volume->flags & RFAT_VOLUME_FLAG_TRANSACTION))
+	{
+	    status = rfat_volume_reclaim(volume);
+	}
+    }
+
+    if (status == F_NO_ERROR)
+    {
+	if ((boot->bpblog.log_lead_sig == RFAT_HTOFL(RFAT_LOG_LEAD_SIG)) && !(volume->flags & RFAT_VOLUME_FLAG_TRANSACTION))
 	{
 	    boot->bpb.bpb_byts_per_sec &= ~0x8000;
 
 	    boot->bpblog.log_lead_sig = RFAT_HTOFL(0x00000000);
 	    boot->bpblog.log_struct_sig = RFAT_HTOFL(0x00000000);
 
+	    volume->flags &= ~RFAT_VOLUME_FLAG_TRANSACTION_LOGGED;
+
 #if (RFAT_CONFIG_MEDIA_FAILURE_SUPPORTED == 1)
 	    if (volume->flags & RFAT_VOLUME_FLAG_MEDIA_FAILURE)
 	    {
@@ -1739,69 +2258,358 @@ static int rfat_volume_commit(rfat_volume_t *volume)
     return status;
 }
 
-#endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0) */
-
+/* Within a f_begin()/f_commit() group the log of the last rfat_volume_record()
+ * stays on the media, and a replay copies all FAT2 blocks of its map into FAT1.
+ * Freeing clusters in FAT2 while a directory entry still refers to them would
+ * hence be unsafe. So before any cluster gets released, FAT1 is brought up to
+ * date and the log is cleared. Pending directory updates are left untouched.
+ */
 
-static int  rfat_volume_format(rfat_volume_t *volume)
+static int rfat_volume_settle(rfat_volume_t *volume)
 {
     int status = F_NO_ERROR;
-    bool write_protected;
-    unsigned int fattype, sys_id;
-    uint32_t blkcnt, blk_unit_size, cls_blk_shift, clscnt, clscnt_e, tot_sec;
-    uint32_t boot_blkno, fat1_blkno, fat2_blkno, root_blkno, clus_blkno, fat_blkcnt, root_blkcnt;
-    uint32_t bkboot_blkofs, fsinfo_blkofs;
-    uint32_t hpc, spt, start_h, start_s, start_c, end_h, end_s, end_c;
-    uint32_t product;
+    uint8_t dir_flags;
     rfat_boot_t *boot;
-    rfat_fsinfo_t *fsinfo;
 
-    status = rfat_disk_info(volume->disk, &write_protected, &blkcnt, &blk_unit_size, &product);
+    boot = (rfat_boot_t*)((void*)&volume->bs_data[0]);
 
-    if (status == F_NO_ERROR)
+    if ((volume->flags & RFAT_VOLUME_FLAG_TRANSACTION) &&
+	(boot->bpblog.log_lead_sig == RFAT_HTOFL(RFAT_LOG_LEAD_SIG)))
     {
-	if (write_protected)
+	dir_flags = volume->dir_flags;
+
+	volume->dir_flags = 0;
+	volume->flags &= ~RFAT_VOLUME_FLAG_TRANSACTION;
+
+	volume->group_clsno = RFAT_CLSNO_NONE;
+	volume->group_dir_index = RFAT_GROUP_INDEX_NONE;
+
+	status = rfat_map_cache_flush(volume);
+
+	if (status == F_NO_ERROR)
 	{
-	    status = F_ERR_WRITEPROTECT;
+	    status = rfat_volume_commit(volume);
 	}
-	else
+
+	volume->flags |= RFAT_VOLUME_FLAG_TRANSACTION;
+	volume->dir_flags = dir_flags;
+    }
+
+    return status;
+}
+
+/* Note that "file" is about to allocate clusters within a f_begin()/f_commit() group,
+ * and whether it starts a new cluster chain ("clsno" == RFAT_CLSNO_NONE), so that the
+ * next log names it for rfat_volume_reclaim().
+ */
+
+static void rfat_volume_claim(rfat_volume_t *volume, rfat_file_t *file, uint32_t clsno)
+{
+    if (volume->flags & RFAT_VOLUME_FLAG_TRANSACTION)
+    {
+	if ((volume->group_dir_clsno != file->dir_clsno) || (volume->group_dir_index != file->dir_index))
 	{
-#if (RFAT_CONFIG_FAT12_SUPPORTED == 0)
-	    /* SDSC with 64MB or less end up being FAT12. So let's reject them
-	     * early.
-	     */
-	    if (blkcnt <= 131072)
-	    {
-		status = F_ERR_MEDIATOOSMALL;
-	    }
-	    else
-#endif /* (RFAT_CONFIG_FAT12_SUPPORTED == 0) */
+	    volume->group_clsno = RFAT_CLSNO_NONE;
+	    volume->group_dir_clsno = file->dir_clsno;
+	    volume->group_dir_index = file->dir_index;
+
+	    volume->flags &= ~RFAT_VOLUME_FLAG_TRANSACTION_LOGGED;
+	}
+
+	if (clsno == RFAT_CLSNO_NONE)
+	{
+	    volume->group_clsno = RFAT_CLSNO_END_OF_CHAIN;
+	}
+    }
+}
+
+#endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0) */
+
+#if (RFAT_CONFIG_DEFERRED_RELEASE_ENTRIES != 0)
+
+/* Release up to "clscnt" clusters of the queued cluster chains as a self contained
+ * metadata update. The directory entries owning those chains are already gone,
+ * so a power loss in between leaves at worst lost chains behind.
+ */
+
+static int rfat_volume_release(rfat_volume_t *volume, uint32_t clscnt)
+{
+    int status = F_NO_ERROR;
+
+    if (volume->release_count != 0)
+    {
+#if (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0)
+	status = rfat_volume_dirty(volume);
+	
+	if (status == F_NO_ERROR)
+	{
+	    status = rfat_cluster_chain_release(volume, clscnt);
+
+	    if (status == F_NO_ERROR)
 	    {
-		/* SDSC/SDHC are limited to 32GB. Above it's a SDXC,
-		 * which would exFAT ... but a 64GB SDXC still works
-		 * fine with FAT32.
-		 */
-		if (blkcnt > 134217728)
-		{
-		    status = F_ERR_MEDIATOOLARGE;
-		}
+		status = rfat_fat_cache_flush(volume);
 	    }
+
+	    status = rfat_volume_clean(volume, status);
 	}
+#else /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0) */
+	status = rfat_cluster_chain_release(volume, clscnt);
 
 	if (status == F_NO_ERROR)
 	{
-	    /*
-	     * There is a upper limit of 4153344 blocks for SDSC cards, and
-	     * a lower limit of 4211712 for SDHC cards as per SD spec (CSD description).
-	     *
-	     * Hower the real lower limit for SHDC is:
-	     *
-	     *    16384 + (65525 * 64) = 4209984
-	     *    4211712 = 8192 + 8192 + (65552 * 64)
-	     *
-	     *    (16384 is the required padding upfront for SDHC at this size)
-	     *
-	     * The upper legal limit for SDSC is also slightly different from the
-	     * spec if one thinks about it:
+	    status = rfat_volume_record(volume);
+	}
+#endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0) */
+    }
+
+    return status;
+}
+
+#endif /* (RFAT_CONFIG_DEFERRED_RELEASE_ENTRIES != 0) */
+
+#if (RFAT_CONFIG_WRITE_BUDGET_SUPPORTED == 1)
+
+#if (RFAT_CONFIG_2NDFAT_SUPPORTED == 1) && (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0)
+
+/* Copy up to "blkcnt" of the FAT1 blocks rfat_fat_cache_mirror() left pending to FAT2.
+ */
+
+static int rfat_volume_mirror(rfat_volume_t *volume, uint32_t blkcnt)
+{
+    int status = F_NO_ERROR;
+    uint32_t blkno;
+    rfat_cache_entry_t *entry;
+
+    if (volume->mirror_blkno != volume->mirror_blkno_e)
+    {
+	/* Write back the FAT cache first, so that filling it below cannot add to the
+	 * pending blocks while they are being copied.
+	 */
+	status = rfat_fat_cache_flush(volume);
+
+	while ((status == F_NO_ERROR) && (blkcnt != 0) && (volume->mirror_blkno != volume->mirror_blkno_e))
+	{
+	    blkno = volume->mirror_blkno;
+
+	    status = rfat_fat_cache_read(volume, blkno, &entry);
+
+	    if (status == F_NO_ERROR)
+	    {
+		status = rfat_volume_write(volume, blkno + volume->fat_blkcnt, entry->data);
+
+		if (status == F_NO_ERROR)
+		{
+		    volume->mirror_blkno = blkno +1;
+
+		    blkcnt--;
+		}
+	    }
+	}
+    }
+
+    return status;
+}
+
+#endif /* (RFAT_CONFIG_2NDFAT_SUPPORTED == 1) && (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0) */
+
+/* Do a bounded piece of the metadata work f_write() does not do itself with
+ * RFAT_CONFIG_WRITE_BUDGET_SUPPORTED. Dirty FAT blocks are written back, so that
+ * f_write() finds the FAT cache clean, up to RFAT_CONFIG_WRITE_BUDGET_BLOCKS pending
+ * FAT2 blocks are copied, and a file that used up its allocation window gets up to
+ * as many AUs inspected for it, so that the search is mostly done by the time
+ * f_write() needs a new cluster.
+ */
+
+static int rfat_volume_idle(rfat_volume_t *volume)
+{
+    int status = F_NO_ERROR;
+#if (RFAT_CONFIG_SEQUENTIAL_SUPPORTED == 1)
+    uint32_t clsno_b, clsno_t, clsno_n;
+    rfat_file_t *file;
+#if (RFAT_CONFIG_MAX_FILES > 1)
+    rfat_file_t *file_e;
+#endif /* (RFAT_CONFIG_MAX_FILES > 1) */
+#endif /* (RFAT_CONFIG_SEQUENTIAL_SUPPORTED == 1) */
+
+    if (volume->state == RFAT_VOLUME_STATE_MOUNTED)
+    {
+#if (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0)
+	status = rfat_fat_cache_flush(volume);
+
+#if (RFAT_CONFIG_2NDFAT_SUPPORTED == 1)
+	if (status == F_NO_ERROR)
+	{
+	    status = rfat_volume_mirror(volume, RFAT_CONFIG_WRITE_BUDGET_BLOCKS);
+	}
+#endif /* (RFAT_CONFIG_2NDFAT_SUPPORTED == 1) */
+#endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0) */
+
+#if (RFAT_CONFIG_SEQUENTIAL_SUPPORTED == 1)
+	if (status == F_NO_ERROR)
+	{
+#if (RFAT_CONFIG_MAX_FILES == 1)
+	    file = &volume->file_table[0];
+
+	    if ((file->mode & RFAT_FILE_MODE_WRITE) &&
+#if (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1)
+		!(file->flags & RFAT_FILE_FLAG_CONTIGUOUS) &&
+#endif /* (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1) */
+		(volume->free_clsno == volume->limit_clsno))
+	    {
+		clsno_b = volume->base_clsno;
+
+		status = rfat_cluster_chain_window(volume, file, RFAT_CONFIG_WRITE_BUDGET_BLOCKS, &clsno_b, &clsno_t, &clsno_n);
+
+		if (status == F_NO_ERROR)
+		{
+		    volume->base_clsno = clsno_b;
+		    volume->limit_clsno = clsno_t;
+		    volume->free_clsno = clsno_n;
+		}
+	    }
+#else /* (RFAT_CONFIG_MAX_FILES == 1) */
+	    file_e = &volume->file_table[RFAT_CONFIG_MAX_FILES];
+
+	    for (file = &volume->file_table[0]; file < file_e; file++)
+	    {
+		/* A file that has a chain but no window yet gets its window seeded from the
+		 * end of the chain by its next allocation, rather than claiming a new AU here.
+		 */
+		if ((file->mode & RFAT_FILE_MODE_WRITE) &&
+#if (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1)
+		    !(file->flags & RFAT_FILE_FLAG_CONTIGUOUS) &&
+#endif /* (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1) */
+		    (file->free_clsno == file->limit_clsno) &&
+		    ((file->limit_clsno != volume->start_clsno) || (file->first_clsno == RFAT_CLSNO_NONE)))
+		{
+		    clsno_b = volume->base_clsno;
+		    clsno_t = volume->base_clsno;
+		    clsno_n = volume->base_clsno;
+
+		    /* A new file fills up the AU claimed last before a new AU gets claimed.
+		     */
+		    if ((file->limit_clsno == volume->start_clsno) && (clsno_b != volume->start_clsno))
+		    {
+			status = rfat_cluster_chain_seed(volume, file, clsno_b, clsno_b, &clsno_b, &clsno_t, &clsno_n);
+		    }
+
+		    if ((status == F_NO_ERROR) && (clsno_n == clsno_t))
+		    {
+			clsno_b = volume->base_clsno;
+
+			status = rfat_cluster_chain_window(volume, file, RFAT_CONFIG_WRITE_BUDGET_BLOCKS, &clsno_b, &clsno_t, &clsno_n);
+
+			if (status == F_NO_ERROR)
+			{
+			    volume->base_clsno = clsno_b;
+			}
+		    }
+
+		    if ((status == F_NO_ERROR) && (clsno_n != clsno_t))
+		    {
+			file->base_clsno = clsno_b;
+			file->limit_clsno = clsno_t;
+			file->free_clsno = clsno_n;
+		    }
+
+		    break;
+		}
+	    }
+#endif /* (RFAT_CONFIG_MAX_FILES == 1) */
+
+	    /* Running out of AUs is left to f_write() to deal with.
+	     */
+	    if (status == F_ERR_NOMOREENTRY)
+	    {
+		status = F_NO_ERROR;
+	    }
+	}
+#endif /* (RFAT_CONFIG_SEQUENTIAL_SUPPORTED == 1) */
+    }
+
+    return status;
+}
+
+#endif /* (RFAT_CONFIG_WRITE_BUDGET_SUPPORTED == 1) */
+
+
+static int  rfat_volume_format(rfat_volume_t *volume)
+{
+    int status = F_NO_ERROR;
+    bool write_protected;
+    unsigned int fattype, sys_id;
+    uint32_t blkcnt, blk_unit_size, cls_blk_shift, clscnt, clscnt_e, tot_sec;
+    uint32_t boot_blkno, fat1_blkno, fat2_blkno, root_blkno, clus_blkno, fat_blkcnt, root_blkcnt;
+    uint32_t bkboot_blkofs, fsinfo_blkofs;
+    uint32_t hpc, spt, start_h, start_s, start_c, end_h, end_s, end_c;
+    uint32_t product;
+#if (RFAT_CONFIG_UNIT_PROBE_SUPPORTED == 1)
+    uint32_t unit_size, page_size;
+#endif /* (RFAT_CONFIG_UNIT_PROBE_SUPPORTED == 1) */
+    rfat_boot_t *boot;
+    rfat_fsinfo_t *fsinfo;
+
+    status = rfat_disk_info(volume->disk, &write_protected, &blkcnt, &blk_unit_size, &product);
+
+    if (status == F_NO_ERROR)
+    {
+	if (write_protected)
+	{
+	    status = F_ERR_WRITEPROTECT;
+	}
+	else
+	{
+#if (RFAT_CONFIG_FAT12_SUPPORTED == 0)
+	    /* SDSC with 64MB or less end up being FAT12. So let's reject them
+	     * early.
+	     */
+	    if (blkcnt <= 131072)
+	    {
+		status = F_ERR_MEDIATOOSMALL;
+	    }
+	    else
+#endif /* (RFAT_CONFIG_FAT12_SUPPORTED == 0) */
+	    {
+		/* SDSC/SDHC are limited to 32GB. Above it's a SDXC,
+		 * which would exFAT ... but a 64GB SDXC still works
+		 * fine with FAT32.
+		 */
+		if (blkcnt > 134217728)
+		{
+		    status = F_ERR_MEDIATOOLARGE;
+		}
+	    }
+	}
+
+#if (RFAT_CONFIG_UNIT_PROBE_SUPPORTED == 1)
+	unit_size = 0;
+	page_size = 0;
+
+	if ((status == F_NO_ERROR) && (blk_unit_size == 0))
+	{
+	    /* Without an AU_SIZE in SD_STATUS rfat_volume_mount() would have to
+	     * guess the AU size from the card capacity. Measure it instead, and
+	     * record it in the MBR, where rfat_volume_mount() picks it up.
+	     */
+	    status = rfat_volume_probe(volume, blkcnt, &unit_size, &page_size);
+	}
+#endif /* (RFAT_CONFIG_UNIT_PROBE_SUPPORTED == 1) */
+
+	if (status == F_NO_ERROR)
+	{
+	    /*
+	     * There is a upper limit of 4153344 blocks for SDSC cards, and
+	     * a lower limit of 4211712 for SDHC cards as per SD spec (CSD description).
+	     *
+	     * Hower the real lower limit for SHDC is:
+	     *
+	     *    16384 + (65525 * 64) = 4209984
+	     *    4211712 = 8192 + 8192 + (65552 * 64)
+	     *
+	     *    (16384 is the required padding upfront for SDHC at this size)
+	     *
+	     * The upper legal limit for SDSC is also slightly different from the
+	     * spec if one thinks about it:
 	     *
 	     *    768 + (65524 * 64) = 4194304
 	     *    4153344 = 768 + (64884 * 64)
@@ -2172,6 +2980,15 @@ static int  rfat_volume_format(rfat_volume_t *volume)
 		boot->mbr.mbr_par_table[0].mbr_tot_sec      = RFAT_HTOFL(tot_sec);
 		boot->bs.bs_trail_sig                       = RFAT_HTOFS(0xaa55);
 
+#if (RFAT_CONFIG_UNIT_PROBE_SUPPORTED == 1)
+		if (unit_size != 0)
+		{
+		    boot->mbr.mbr_unit_sig  = RFAT_HTOFL(RFAT_UNIT_SIG);
+		    boot->mbr.mbr_unit_size = RFAT_HTOFL(unit_size);
+		    boot->mbr.mbr_page_size = RFAT_HTOFL(page_size);
+		}
+#endif /* (RFAT_CONFIG_UNIT_PROBE_SUPPORTED == 1) */
+
 		status = rfat_volume_write(volume, 0, (uint8_t*)boot);
 
 		if (status == F_NO_ERROR)
@@ -2301,6 +3118,92 @@ static int  rfat_volume_format(rfat_volume_t *volume)
     return status;
 }
 
+#if (RFAT_CONFIG_UNIT_PROBE_SUPPORTED == 1)
+
+/* A SDCARD pays extra when a write crosses a page or an allocation unit (AU)
+ * boundary. To find those sizes, 2 blocks are written with one multi block
+ * write, where the second block starts at an odd multiple of a candidate size.
+ * Below the page size, this stays within a page. At the page size it straddles
+ * a page boundary, and at the AU size an AU boundary. The first candidate that
+ * takes 50% longer than the level before is picked. The block in front is
+ * written separately beforehand, so that the first block does not switch
+ * to a new page or AU on its own. Each candidate is timed at 3 locations,
+ * and the minimum is used to filter out the card's background activities.
+ *
+ * The scratch area is in the middle of the card, aligned to twice the largest
+ * AU probed. This is only used by rfat_volume_format(), where all of the card
+ * is scratch area. Without RFAT_PORT_DISK_TIME_STAMP() nothing is found.
+ */
+
+static int rfat_volume_probe(rfat_volume_t *volume, uint32_t blkcnt, uint32_t *p_unit_size, uint32_t *p_page_size)
+{
+    int status = F_NO_ERROR;
+    uint32_t blk_size, blkno, base, index, time, time_min, time_level;
+    uint8_t *data;
+
+    *p_unit_size = 0;
+    *p_page_size = 0;
+
+    data = volume->dir_cache.data;
+    volume->dir_cache.blkno = RFAT_BLKNO_INVALID;
+
+    memset(data, 0, RFAT_BLK_SIZE);
+
+    base = (blkcnt >> 1) & ~((2 * RFAT_UNIT_PROBE_UNIT_SIZE) -1);
+
+    time_level = 0;
+
+    for (blk_size = 1; (status == F_NO_ERROR) && !*p_unit_size && (blk_size <= RFAT_UNIT_PROBE_UNIT_SIZE) && ((base + 7 * blk_size) < blkcnt); blk_size <<= 1)
+    {
+	time_min = 0xffffffff;
+
+	for (index = 3; (status == F_NO_ERROR) && (index <= 7); index += 2)
+	{
+	    blkno = base + index * blk_size;
+
+	    status = rfat_disk_write_timed(volume->disk, (blkno -2), 1, data, &time);
+
+	    if (status == F_NO_ERROR)
+	    {
+		status = rfat_disk_write_timed(volume->disk, (blkno -1), 2, data, &time);
+
+		if (time_min > time)
+		{
+		    time_min = time;
+		}
+	    }
+	}
+
+	if (status == F_NO_ERROR)
+	{
+	    if (blk_size == 1)
+	    {
+		time_level = time_min;
+	    }
+	    else if ((2 * time_min) > (3 * time_level))
+	    {
+		if (blk_size <= RFAT_UNIT_PROBE_PAGE_SIZE)
+		{
+		    if (*p_page_size == 0)
+		    {
+			*p_page_size = blk_size;
+
+			time_level = time_min;
+		    }
+		}
+		else
+		{
+		    *p_unit_size = blk_size;
+		}
+	    }
+	}
+    }
+
+    return status;
+}
+
+#endif /* (RFAT_CONFIG_UNIT_PROBE_SUPPORTED == 1) */
+
 static int rfat_volume_erase(rfat_volume_t *volume)
 {
     int status = F_NO_ERROR;
@@ -2496,7 +3399,7 @@ static int rfat_dir_cache_write(rfat_volume_t *volume)
 #if (RFAT_CONFIG_2NDFAT_SUPPORTED == 1)
 		if (volume->fat2_blkno)
 		{
-		    status = rfat_volume_write(volume, volume->dir_cache.blkno + volume->fat_blkcnt, volume->dir_cache.data);
+		    status = rfat_fat_cache_mirror(volume, volume->dir_cache.blkno, volume->dir_cache.data);
 		}
 		
 		if (status == F_NO_ERROR)
@@ -2673,7 +3576,9 @@ static int rfat_map_cache_write(rfat_volume_t *volume, uint32_t blkno, const uin
 {
     int status = F_NO_ERROR;
     uint32_t page, index, mask, offset;
+    uint8_t dir_flags;
     uint32_t *map;
+    uint16_t *map_table, *map_table_e;
 
     page   = (blkno - volume->fat1_blkno) >> (RFAT_BLK_SHIFT + 8);
     index  = ((blkno - volume->fat1_blkno) >> 5) & RFAT_BLK_MASK;
@@ -2689,36 +3594,104 @@ static int rfat_map_cache_write(rfat_volume_t *volume, uint32_t blkno, const uin
     {
 	map = (uint32_t*)((void*)volume->map_cache.data);
 	
-	if (!(map[index] & mask))
+	if (map[index] & mask)
 	{
-	    map[index] |= mask;
-	    
-	    volume->map_flags |= (RFAT_MAP_FLAG_MAP_DIRTY | (RFAT_MAP_FLAG_MAP_0_CHANGED << page));
-	    
-	    if (volume->map_entries >= RFAT_MAP_TABLE_ENTRIES)
-	    {
-		volume->map_entries = RFAT_MAP_TABLE_OVERFLOW;
-	    }
-	    else
+	    /* Within a f_begin()/f_commit() group a replay copies this block into FAT1.
+	     * So the log has to cover all FAT blocks written so far, and name the
+	     * current volume->group_clsno, before the block gets overwritten. Then a
+	     * replay always sees the FAT writes up to some point, in order.
+	     */
+	    if (((volume->flags & (RFAT_VOLUME_FLAG_TRANSACTION | RFAT_VOLUME_FLAG_TRANSACTION_LOGGED)) == RFAT_VOLUME_FLAG_TRANSACTION) &&
+		(((rfat_boot_t*)((void*)&volume->bs_data[0]))->bpblog.log_lead_sig == RFAT_HTOFL(RFAT_LOG_LEAD_SIG)))
 	    {
-		volume->map_table[volume->map_entries++] = (blkno - volume->fat1_blkno);
-	    }
-	}
+		status = rfat_map_cache_store(volume);
 
-	status = rfat_volume_write(volume, (blkno + offset), data);
-    }
+		if (status == F_NO_ERROR)
+		{
+		    dir_flags = volume->dir_flags;
 
-    return status;
-}
+		    volume->dir_flags = 0;
 
-static int rfat_map_cache_read(rfat_volume_t *volume, uint32_t blkno, uint8_t *data)
-{
-    int status = F_NO_ERROR;
-    uint32_t page, index, mask, offset;
-    uint32_t *map;
+		    status = rfat_volume_log(volume);
 
-    page   = (blkno - volume->fat1_blkno) >> (RFAT_BLK_SHIFT + 8);
-    index  = ((blkno - volume->fat1_blkno) >> 5) & RFAT_BLK_MASK;
+		    volume->dir_flags = dir_flags;
+
+		    if (status == F_NO_ERROR)
+		    {
+			volume->flags |= RFAT_VOLUME_FLAG_TRANSACTION_LOGGED;
+		    }
+		}
+	    }
+	}
+	else
+	{
+	    map[index] |= mask;
+	    
+	    volume->map_flags |= (RFAT_MAP_FLAG_MAP_DIRTY | (RFAT_MAP_FLAG_MAP_0_CHANGED << page));
+	    volume->flags &= ~RFAT_VOLUME_FLAG_TRANSACTION_LOGGED;
+	    
+	    if (volume->map_entries != RFAT_MAP_TABLE_OVERFLOW)
+	    {
+		/* FAT blocks tend to be modified front to back, so check whether the new
+		 * block extends an existing run, before starting a new one.
+		 */
+		index = blkno - volume->fat1_blkno;
+
+		map_table = &volume->map_table[0];
+		map_table_e = &volume->map_table[2 * volume->map_entries];
+
+		while (map_table < map_table_e)
+		{
+		    if (index == (uint32_t)(map_table[0] + map_table[1]))
+		    {
+			map_table[1]++;
+			break;
+		    }
+
+		    if ((index +1) == map_table[0])
+		    {
+			map_table[0]--;
+			map_table[1]++;
+			break;
+		    }
+
+		    map_table += 2;
+		}
+
+		if (map_table == map_table_e)
+		{
+		    if (volume->map_entries == RFAT_MAP_TABLE_EXTENTS)
+		    {
+			volume->map_entries = RFAT_MAP_TABLE_OVERFLOW;
+		    }
+		    else
+		    {
+			map_table[0] = index;
+			map_table[1] = 1;
+
+			volume->map_entries++;
+		    }
+		}
+	    }
+	}
+
+	if (status == F_NO_ERROR)
+	{
+	    status = rfat_volume_write(volume, (blkno + offset), data);
+	}
+    }
+
+    return status;
+}
+
+static int rfat_map_cache_read(rfat_volume_t *volume, uint32_t blkno, uint8_t *data)
+{
+    int status = F_NO_ERROR;
+    uint32_t page, index, mask, offset;
+    uint32_t *map;
+
+    page   = (blkno - volume->fat1_blkno) >> (RFAT_BLK_SHIFT + 8);
+    index  = ((blkno - volume->fat1_blkno) >> 5) & RFAT_BLK_MASK;
     mask   = 1ul << ((blkno - volume->fat1_blkno) & 31);
     offset = 0;
 
@@ -2742,38 +3715,54 @@ static int rfat_map_cache_read(rfat_volume_t *volume, uint32_t blkno, uint8_t *d
     return status;
 }
 
-static int rfat_map_cache_flush(rfat_volume_t *volume)
+/* Put the map where the log refers to, i.e. into volume->map_table[] for FAT12/FAT16,
+ * or into the map blocks for FAT32.
+ */
+
+static int rfat_map_cache_store(rfat_volume_t *volume)
 {
     int status = F_NO_ERROR;
 
-    status = rfat_fat_cache_flush(volume);
-
-    if (status == F_NO_ERROR)
+    if (volume->map_entries == RFAT_MAP_TABLE_OVERFLOW)
     {
-	if (volume->map_entries == RFAT_MAP_TABLE_OVERFLOW)
+	if (volume->map_flags & RFAT_MAP_FLAG_MAP_DIRTY)
 	{
-	    if (volume->map_flags & RFAT_MAP_FLAG_MAP_DIRTY)
+	    if (volume->type != RFAT_VOLUME_TYPE_FAT32)
 	    {
-		if (volume->type != RFAT_VOLUME_TYPE_FAT32)
-		{
-		    /* For FAT12/FAT16 the map is stored in volume->map_table[]. There
-		     * can be at most 256 FAT blocks for FAT32, which means 256 bits,
-		     * which is 64 bytes. Hence it fits into volume->map_table[].
-		     */
-		    memcpy(volume->map_table, volume->map_cache.data, 64);
-		}
-		else
-		{
-		    status = rfat_volume_write(volume, volume->map_cache.blkno, volume->map_cache.data);
-		}
+		/* For FAT12/FAT16 the map is stored in volume->map_table[]. There
+		 * can be at most 256 FAT blocks for FAT32, which means 256 bits,
+		 * which is 64 bytes. Hence it fits into volume->map_table[].
+		 */
+		memcpy(volume->map_table, volume->map_cache.data, 64);
+	    }
+	    else
+	    {
+		status = rfat_volume_write(volume, volume->map_cache.blkno, volume->map_cache.data);
 	    }
 	}
+    }
 
-	if (status == F_NO_ERROR)
-	{
-	    volume->map_flags &= ~RFAT_MAP_FLAG_MAP_DIRTY;
+    if (status == F_NO_ERROR)
+    {
+	volume->map_flags &= ~RFAT_MAP_FLAG_MAP_DIRTY;
+    }
+
+    return status;
+}
+
+static int rfat_map_cache_flush(rfat_volume_t *volume)
+{
+    int status = F_NO_ERROR;
+
+    status = rfat_fat_cache_flush(volume);
+
+    if (status == F_NO_ERROR)
+    {
+	status = rfat_map_cache_store(volume);
 
 #if (RFAT_CONFIG_FSINFO_SUPPORTED == 1)
+	if (status == F_NO_ERROR)
+	{
 	    if ((volume->map_flags & RFAT_MAP_FLAG_MAP_CHANGED) &&
 		(volume->fsinfo_blkofs != 0) &&
 		(volume->flags & RFAT_VOLUME_FLAG_FSINFO_VALID) &&
@@ -2781,21 +3770,140 @@ static int rfat_map_cache_flush(rfat_volume_t *volume)
 	    {
 		volume->map_flags |= RFAT_MAP_FLAG_MAP_FSINFO;
 	    }
+	}
 #endif /* (RFAT_CONFIG_FSINFO_SUPPORTED == 1) */
+    }
+
+    return status;
+}
+
+#if (RFAT_CONFIG_MAP_RESOLVE_ENTRIES == 1)
+
+static int rfat_map_cache_copy(rfat_volume_t *volume, uint32_t blkno, uint32_t blkcnt)
+{
+    int status = F_NO_ERROR;
+    uint8_t *data;
+    rfat_cache_entry_t *entry;
+
+    do
+    {
+#if (RFAT_CONFIG_FAT_CACHE_ENTRIES == 0)
+	if (blkno == volume->dir_cache.blkno)
+	{
+	    data = volume->dir_cache.data;
+	}
+#else /* (RFAT_CONFIG_FAT_CACHE_ENTRIES == 0) */
+#if (RFAT_CONFIG_FAT_CACHE_ENTRIES == 1)
+	if (blkno == volume->fat_cache.blkno)
+	{
+	    data = volume->fat_cache.data;
+	}
+#else /* (RFAT_CONFIG_FAT_CACHE_ENTRIES == 1) */
+	if (blkno == volume->fat_cache[0].blkno)
+	{
+	    data = volume->fat_cache[0].data;
+	}
+	else if (blkno == volume->fat_cache[1].blkno)
+	{
+	    data = volume->fat_cache[1].data;
+	}
+#endif /* (RFAT_CONFIG_FAT_CACHE_ENTRIES == 1) */
+#endif /* (RFAT_CONFIG_FAT_CACHE_ENTRIES == 0) */
+	else
+	{
+	    status = rfat_dir_cache_read(volume, blkno + volume->fat_blkcnt, &entry);
+
+	    if (status == F_NO_ERROR)
+	    {
+		entry->blkno = blkno;
+
+		data = entry->data;
+	    }
+	}
+
+	if (status == F_NO_ERROR)
+	{
+	    status = rfat_volume_write(volume, blkno, data);
+	}
+
+	blkno++;
+	blkcnt--;
+    }
+    while ((status == F_NO_ERROR) && blkcnt);
+
+    return status;
+}
+
+#else /* (RFAT_CONFIG_MAP_RESOLVE_ENTRIES == 1) */
+
+/* Copy a run of FAT blocks from FAT2 to FAT1, RFAT_CONFIG_MAP_RESOLVE_ENTRIES blocks
+ * at a time via multi block reads and writes. The FAT cache had been flushed before
+ * (rfat_map_cache_flush()), so FAT2 on the disk is current.
+ */
+
+static int rfat_map_cache_copy(rfat_volume_t *volume, uint32_t blkno, uint32_t blkcnt)
+{
+    int status = F_NO_ERROR;
+    uint32_t count;
+
+    do
+    {
+	count = blkcnt;
+
+	if (count > RFAT_CONFIG_MAP_RESOLVE_ENTRIES)
+	{
+	    count = RFAT_CONFIG_MAP_RESOLVE_ENTRIES;
+	}
+
+	status = rfat_disk_read_sequential(volume->disk, blkno + volume->fat_blkcnt, count, volume->map_data);
+
+	if (status == F_NO_ERROR)
+	{
+	    status = rfat_disk_write_sequential(volume->disk, blkno, count, volume->map_data, NULL);
+	}
+
+	blkno += count;
+	blkcnt -= count;
+    }
+    while ((status == F_NO_ERROR) && blkcnt);
+
+    if (status == F_NO_ERROR)
+    {
+	status = rfat_disk_sync(volume->disk, NULL);
+    }
+
+#if (RFAT_CONFIG_MEDIA_FAILURE_SUPPORTED == 1)
+    if (status == F_ERR_INVALIDSECTOR)
+    {
+	volume->flags |= RFAT_VOLUME_FLAG_MEDIA_FAILURE;
+    }
+#endif /* (RFAT_CONFIG_MEDIA_FAILURE_SUPPORTED == 1) */
+
+    if (status != F_NO_ERROR)
+    {
+	if (status != F_ERR_CARDREMOVED)
+	{
+	    status = F_ERR_UNUSABLE;
 	}
     }
 
     return status;
 }
 
+#endif /* (RFAT_CONFIG_MAP_RESOLVE_ENTRIES == 1) */
+
+/* The map_table[] holds up to RFAT_MAP_TABLE_EXTENTS runs of FAT blocks, as pairs
+ * of the offset of the first block relative to volume->fat1_blkno and the number
+ * of blocks. Beyond that the bitmap is used, from which runs are gathered. Either
+ * way each run is copied in one go by rfat_map_cache_copy().
+ */
+
 static int rfat_map_cache_resolve(rfat_volume_t *volume)
 {
     int status = F_NO_ERROR;
     uint16_t *map_table, *map_table_e;
-    uint32_t blkno, blkno_n, mask, page;
+    uint32_t blkno, blkno_n, blkno_s, blkcnt, mask, page;
     uint32_t *map, *map_e;
-    uint8_t *data;
-    rfat_cache_entry_t *entry;
 
     status = rfat_dir_cache_flush(volume);
 
@@ -2804,50 +3912,13 @@ static int rfat_map_cache_resolve(rfat_volume_t *volume)
 	if (volume->map_entries != RFAT_MAP_TABLE_OVERFLOW)
 	{
 	    map_table = &volume->map_table[0];
-	    map_table_e = &volume->map_table[volume->map_entries];
+	    map_table_e = &volume->map_table[2 * volume->map_entries];
 
 	    do
 	    {
-		blkno = volume->fat1_blkno + *map_table++;
-
-#if (RFAT_CONFIG_FAT_CACHE_ENTRIES == 0)
-		if (blkno == volume->dir_cache.blkno)
-		{
-		    data = volume->dir_cache.data;
-		}
-#else /* (RFAT_CONFIG_FAT_CACHE_ENTRIES == 0) */
-#if (RFAT_CONFIG_FAT_CACHE_ENTRIES == 1)
-		if (blkno == volume->fat_cache.blkno)
-		{
-		    data = volume->fat_cache.data;
-		}
-#else /* (RFAT_CONFIG_FAT_CACHE_ENTRIES == 1) */
-		if (blkno == volume->fat_cache[0].blkno)
-		{
-		    data = volume->fat_cache[0].data;
-		}
-		else if (blkno == volume->fat_cache[1].blkno)
-		{
-		    data = volume->fat_cache[1].data;
-		}
-#endif /* (RFAT_CONFIG_FAT_CACHE_ENTRIES == 1) */
-#endif /* (RFAT_CONFIG_FAT_CACHE_ENTRIES == 0) */
-		else
-		{
-		    status = rfat_dir_cache_read(volume, blkno + volume->fat_blkcnt, &entry);
-
-		    if (status == F_NO_ERROR)
-		    {
-			entry->blkno = blkno;
-
-			data = entry->data;
-		    }
-		}
+		status = rfat_map_cache_copy(volume, (volume->fat1_blkno + map_table[0]), map_table[1]);
 
-		if (status == F_NO_ERROR)
-		{
-		    status = rfat_volume_write(volume, blkno, data);
-		}
+		map_table += 2;
 	    }
 	    while ((status == F_NO_ERROR) && (map_table < map_table_e));
 	}
@@ -2900,53 +3971,33 @@ static int rfat_map_cache_resolve(rfat_volume_t *volume)
 		    map_e = (uint32_t*)((void*)(volume->map_cache.data + RFAT_BLK_SIZE));
 		}
 
+		blkno_s = blkno;
+		blkcnt = 0;
+
 		while ((status == F_NO_ERROR) && (map < map_e))
 		{
 		    mask = *map++;
 
 		    blkno_n  = blkno + 32;
 		    
-		    while (mask)
+		    while ((status == F_NO_ERROR) && (mask || blkcnt) && (blkno < blkno_n))
 		    {
 			if (mask & 1)
 			{
-#if (RFAT_CONFIG_FAT_CACHE_ENTRIES == 0)
-			    if (blkno == volume->dir_cache.blkno)
-			    {
-				data = volume->dir_cache.data;
-			    }
-#else /* (RFAT_CONFIG_FAT_CACHE_ENTRIES == 0) */
-#if (RFAT_CONFIG_FAT_CACHE_ENTRIES == 1)
-			    if (blkno == volume->fat_cache.blkno)
-			    {
-				data = volume->fat_cache.data;
-			    }
-#else /* (RFAT_CONFIG_FAT_CACHE_ENTRIES == 1) */
-			    if (blkno == volume->fat_cache[0].blkno)
-			    {
-				data = volume->fat_cache[0].data;
-			    }
-			    else if (blkno == volume->fat_cache[1].blkno)
+			    if (blkcnt == 0)
 			    {
-				data = volume->fat_cache[1].data;
+				blkno_s = blkno;
 			    }
-#endif /* (RFAT_CONFIG_FAT_CACHE_ENTRIES == 1) */
-#endif /* (RFAT_CONFIG_FAT_CACHE_ENTRIES == 0) */
-			    else
-			    {
-				status = rfat_dir_cache_read(volume, blkno + volume->fat_blkcnt, &entry);
-
-				if (status == F_NO_ERROR)
-				{
-				    entry->blkno = blkno;
 
-				    data = entry->data;
-				}
-			    }
-			    
-			    if (status == F_NO_ERROR)
+			    blkcnt++;
+			}
+			else
+			{
+			    if (blkcnt)
 			    {
-				status = rfat_volume_write(volume, blkno, data);
+				status = rfat_map_cache_copy(volume, blkno_s, blkcnt);
+
+				blkcnt = 0;
 			    }
 			}
 
@@ -2957,6 +4008,11 @@ static int rfat_map_cache_resolve(rfat_volume_t *volume)
 		    blkno = blkno_n;
 		}
 
+		if ((status == F_NO_ERROR) && blkcnt)
+		{
+		    status = rfat_map_cache_copy(volume, blkno_s, blkcnt);
+		}
+
 		if (status == F_NO_ERROR)
 		{
 		    volume->map_flags &= ~(RFAT_MAP_FLAG_MAP_0_CHANGED << page);
@@ -2998,25 +4054,61 @@ static int rfat_map_cache_resolve(rfat_volume_t *volume)
 
 /***********************************************************************************************************************/
 
-#if (RFAT_CONFIG_FAT_CACHE_ENTRIES != 0)
-#if (RFAT_CONFIG_FAT_CACHE_ENTRIES == 1)
+#if (RFAT_CONFIG_2NDFAT_SUPPORTED == 1) && (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0)
 
-static int rfat_fat_cache_write(rfat_volume_t *volume, rfat_cache_entry_t *entry)
+/* Update the FAT2 copy of the FAT1 block "blkno". With RFAT_CONFIG_WRITE_BUDGET_SUPPORTED
+ * the copy is only noted, as long as "blkno" is next to the blocks already pending,
+ * and left to rfat_volume_mirror().
+ */
+
+static int rfat_fat_cache_mirror(rfat_volume_t *volume, uint32_t blkno, const uint8_t *data)
 {
     int status = F_NO_ERROR;
 
-#if (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1)
-    status = rfat_map_cache_write(volume, volume->fat_cache.blkno, volume->fat_cache.data);
-#else /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1) */
-    status = rfat_volume_write(volume, volume->fat_cache.blkno, volume->fat_cache.data);
-#endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1) */
-                
-    if (status == F_NO_ERROR)
+#if (RFAT_CONFIG_WRITE_BUDGET_SUPPORTED == 1)
+    if (volume->mirror_blkno == volume->mirror_blkno_e)
     {
-#if (RFAT_CONFIG_2NDFAT_SUPPORTED == 1) && (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0) 
-	if (volume->fat2_blkno)
+	volume->mirror_blkno = blkno;
+	volume->mirror_blkno_e = blkno +1;
+    }
+    else if ((blkno +1) == volume->mirror_blkno)
+    {
+	volume->mirror_blkno = blkno;
+    }
+    else if (blkno == volume->mirror_blkno_e)
+    {
+	volume->mirror_blkno_e = blkno +1;
+    }
+    else if ((blkno < volume->mirror_blkno) || (blkno > volume->mirror_blkno_e))
+#endif /* (RFAT_CONFIG_WRITE_BUDGET_SUPPORTED == 1) */
+    {
+	status = rfat_volume_write(volume, blkno + volume->fat_blkcnt, data);
+    }
+
+    return status;
+}
+
+#endif /* (RFAT_CONFIG_2NDFAT_SUPPORTED == 1) && (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0) */
+
+#if (RFAT_CONFIG_FAT_CACHE_ENTRIES != 0)
+#if (RFAT_CONFIG_FAT_CACHE_ENTRIES == 1)
+
+static int rfat_fat_cache_write(rfat_volume_t *volume, rfat_cache_entry_t *entry)
+{
+    int status = F_NO_ERROR;
+
+#if (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1)
+    status = rfat_map_cache_write(volume, volume->fat_cache.blkno, volume->fat_cache.data);
+#else /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1) */
+    status = rfat_volume_write(volume, volume->fat_cache.blkno, volume->fat_cache.data);
+#endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1) */
+                
+    if (status == F_NO_ERROR)
+    {
+#if (RFAT_CONFIG_2NDFAT_SUPPORTED == 1) && (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0) 
+	if (volume->fat2_blkno)
 	{
-	    status = rfat_volume_write(volume, volume->fat_cache.blkno + volume->fat_blkcnt, volume->fat_cache.data);
+	    status = rfat_fat_cache_mirror(volume, volume->fat_cache.blkno, volume->fat_cache.data);
 	}
 
 	if (status == F_NO_ERROR)
@@ -3119,7 +4211,7 @@ static int rfat_fat_cache_write(rfat_volume_t *volume, rfat_cache_entry_t *entry
 #if (RFAT_CONFIG_2NDFAT_SUPPORTED == 1) && (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0)
 	if (volume->fat2_blkno)
 	{
-	    status = rfat_volume_write(volume, entry->blkno + volume->fat_blkcnt, entry->data);
+	    status = rfat_fat_cache_mirror(volume, entry->blkno, entry->data);
 	}
 
 	if (status == F_NO_ERROR)
@@ -3161,7 +4253,18 @@ static int rfat_fat_cache_fill(rfat_volume_t *volume, uint32_t blkno, rfat_cache
 #if (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1)
 	    if (volume->flags & (RFAT_VOLUME_FLAG_FAT_0_DIRTY << index))
 	    {
-		status = rfat_fat_cache_write(volume, &volume->fat_cache[index]);
+		/* Write back in the order the entries got dirty (see rfat_cluster_chain_append()).
+		 */
+		if ((volume->flags & (RFAT_VOLUME_FLAG_FAT_0_DIRTY << (index ^ 1))) &&
+		    (!(volume->flags & RFAT_VOLUME_FLAG_FAT_1_FIRST) == (index == 1)))
+		{
+		    status = rfat_fat_cache_write(volume, &volume->fat_cache[index ^ 1]);
+		}
+
+		if (status == F_NO_ERROR)
+		{
+		    status = rfat_fat_cache_write(volume, &volume->fat_cache[index]);
+		}
 	    }
 #endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1) */
 
@@ -3217,6 +4320,37 @@ static int rfat_fat_cache_read(rfat_volume_t *volume, uint32_t blkno, rfat_cache
 
 static inline void rfat_fat_cache_modify(rfat_volume_t *volume, rfat_cache_entry_t *entry)
 {
+#if (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1)
+    if (entry == &volume->fat_cache[0])
+    {
+	if (!(volume->flags & RFAT_VOLUME_FLAG_FAT_0_DIRTY))
+	{
+	    if (volume->flags & RFAT_VOLUME_FLAG_FAT_1_DIRTY)
+	    {
+		volume->flags |= RFAT_VOLUME_FLAG_FAT_1_FIRST;
+	    }
+	    else
+	    {
+		volume->flags &= ~RFAT_VOLUME_FLAG_FAT_1_FIRST;
+	    }
+	}
+    }
+    else
+    {
+	if (!(volume->flags & RFAT_VOLUME_FLAG_FAT_1_DIRTY))
+	{
+	    if (volume->flags & RFAT_VOLUME_FLAG_FAT_0_DIRTY)
+	    {
+		volume->flags &= ~RFAT_VOLUME_FLAG_FAT_1_FIRST;
+	    }
+	    else
+	    {
+		volume->flags |= RFAT_VOLUME_FLAG_FAT_1_FIRST;
+	    }
+	}
+    }
+#endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1) */
+
     volume->flags |= ((entry == &volume->fat_cache[0]) ? RFAT_VOLUME_FLAG_FAT_0_DIRTY : RFAT_VOLUME_FLAG_FAT_1_DIRTY);
 }
 
@@ -3224,7 +4358,18 @@ static int rfat_fat_cache_flush(rfat_volume_t *volume)
 {
     int status = F_NO_ERROR;
 
+#if (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1)
+    if ((volume->flags & (RFAT_VOLUME_FLAG_FAT_1_DIRTY | RFAT_VOLUME_FLAG_FAT_1_FIRST)) == (RFAT_VOLUME_FLAG_FAT_1_DIRTY | RFAT_VOLUME_FLAG_FAT_1_FIRST))
+    {
+	RFAT_VOLUME_STATISTICS_COUNT(fat_cache_flush);
+
+	status = rfat_fat_cache_write(volume, &volume->fat_cache[1]);
+    }
+
+    if ((status == F_NO_ERROR) && (volume->flags & RFAT_VOLUME_FLAG_FAT_0_DIRTY))
+#else /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1) */
     if (volume->flags & RFAT_VOLUME_FLAG_FAT_0_DIRTY)
+#endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1) */
     {
 	RFAT_VOLUME_STATISTICS_COUNT(fat_cache_flush);
 
@@ -3373,6 +4518,88 @@ static int rfat_fat_cache_flush(rfat_volume_t *volume)
 
 #endif /* (RFAT_CONFIG_FAT_CACHE_ENTRIES != 0) */
 
+/* Zero out "blkcnt" FAT blocks starting at "blkno" in one go. The FAT cache is flushed
+ * first, so that all preceeding FAT updates end up on the disk before. Any cached copy
+ * of the zeroed FAT blocks is discarded.
+ */
+
+static int rfat_fat_cache_zero(rfat_volume_t *volume, uint32_t blkno, uint32_t blkcnt)
+{
+    int status = F_NO_ERROR;
+#if (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1)
+    uint8_t *data;
+#endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1) */
+
+    status = rfat_fat_cache_flush(volume);
+
+    if (status == F_NO_ERROR)
+    {
+#if (RFAT_CONFIG_FAT_CACHE_ENTRIES != 0)
+#if (RFAT_CONFIG_FAT_CACHE_ENTRIES == 1)
+	if ((volume->fat_cache.blkno - blkno) < blkcnt)
+	{
+	    volume->fat_cache.blkno = RFAT_BLKNO_INVALID;
+	}
+#else /* (RFAT_CONFIG_FAT_CACHE_ENTRIES == 1) */
+	if ((volume->fat_cache[0].blkno - blkno) < blkcnt)
+	{
+	    volume->fat_cache[0].blkno = RFAT_BLKNO_INVALID;
+	}
+
+	if ((volume->fat_cache[1].blkno - blkno) < blkcnt)
+	{
+	    volume->fat_cache[1].blkno = RFAT_BLKNO_INVALID;
+	}
+#endif /* (RFAT_CONFIG_FAT_CACHE_ENTRIES == 1) */
+#else /* (RFAT_CONFIG_FAT_CACHE_ENTRIES != 0) */
+	if ((volume->dir_cache.blkno - blkno) < blkcnt)
+	{
+	    volume->dir_cache.blkno = RFAT_BLKNO_INVALID;
+	}
+#endif /* (RFAT_CONFIG_FAT_CACHE_ENTRIES != 0) */
+
+#if (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1)
+	status = rfat_dir_cache_flush(volume);
+
+	if (status == F_NO_ERROR)
+	{
+	    data = volume->dir_cache.data;
+	    volume->dir_cache.blkno = RFAT_BLKNO_INVALID;
+	    
+	    memset(data, 0, RFAT_BLK_SIZE);
+
+	    do
+	    {
+		status = rfat_map_cache_write(volume, blkno, data);
+
+		if (status == F_NO_ERROR)
+		{
+		    RFAT_VOLUME_STATISTICS_COUNT(fat_cache_write);
+		}
+
+		blkno++;
+		blkcnt--;
+	    }
+	    while ((status == F_NO_ERROR) && blkcnt);
+	}
+#else /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1) */
+	status = rfat_volume_zero(volume, blkno, blkcnt, NULL);
+
+#if (RFAT_CONFIG_2NDFAT_SUPPORTED == 1)
+	if (status == F_NO_ERROR)
+	{
+	    if (volume->fat2_blkno)
+	    {
+		status = rfat_volume_zero(volume, blkno + volume->fat_blkcnt, blkcnt, NULL);
+	    }
+	}
+#endif /* (RFAT_CONFIG_2NDFAT_SUPPORTED == 1) */
+#endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1) */
+    }
+
+    return status;
+}
+
 /***********************************************************************************************************************/
 
 #if (RFAT_CONFIG_DATA_CACHE_ENTRIES != 0)
@@ -3536,6 +4763,42 @@ static int rfat_data_cache_invalidate(rfat_volume_t *volume, rfat_file_t *file,
     return status;
 }
 
+/* Return the data cache entry "file" goes throu, and whether it has to be written back
+ * before it can hold another block.
+ */
+static rfat_cache_entry_t *rfat_data_cache_entry(rfat_volume_t *volume, rfat_file_t *file, int *p_dirty)
+{
+    *p_dirty = (file->flags & RFAT_FILE_FLAG_DATA_DIRTY) ? TRUE : FALSE;
+
+    return &file->data_cache;
+}
+
+#if (RFAT_FILE_GATHER_SUPPORTED == 1)
+
+/* Hand out the data cache entry as a block sized buffer. Whatever block it holds is
+ * written back and dropped from the cache.
+ */
+static int rfat_data_cache_bounce(rfat_volume_t *volume, rfat_file_t *file, rfat_cache_entry_t ** p_entry)
+{
+    int status = F_NO_ERROR;
+
+    if (file->flags & RFAT_FILE_FLAG_DATA_DIRTY)
+    {
+	status = rfat_data_cache_write(volume, file);
+    }
+
+    if (status == F_NO_ERROR)
+    {
+	file->data_cache.blkno = RFAT_BLKNO_INVALID;
+
+	*p_entry = &file->data_cache;
+    }
+
+    return status;
+}
+
+#endif /* (RFAT_FILE_GATHER_SUPPORTED == 1) */
+
 #else /* (RFAT_CONFIG_FILE_DATA_CACHE == 1) */
 
 static int rfat_data_cache_write(rfat_volume_t *volume, rfat_file_t *file)
@@ -3695,6 +4958,36 @@ static int rfat_data_cache_invalidate(rfat_volume_t *volume, rfat_file_t *file,
     return status;
 }
 
+static rfat_cache_entry_t *rfat_data_cache_entry(rfat_volume_t *volume, rfat_file_t *file, int *p_dirty)
+{
+    *p_dirty = (volume->data_file != NULL) ? TRUE : FALSE;
+
+    return &volume->data_cache;
+}
+
+#if (RFAT_FILE_GATHER_SUPPORTED == 1)
+
+static int rfat_data_cache_bounce(rfat_volume_t *volume, rfat_file_t *file, rfat_cache_entry_t ** p_entry)
+{
+    int status = F_NO_ERROR;
+
+    if (volume->data_file)
+    {
+	status = rfat_data_cache_write(volume, file);
+    }
+
+    if (status == F_NO_ERROR)
+    {
+	volume->data_cache.blkno = RFAT_BLKNO_INVALID;
+
+	*p_entry = &volume->data_cache;
+    }
+
+    return status;
+}
+
+#endif /* (RFAT_FILE_GATHER_SUPPORTED == 1) */
+
 #endif /* (RFAT_CONFIG_FILE_DATA_CACHE == 1) */
 
 #else /* (RFAT_CONFIG_DATA_CACHE_ENTRIES != 0) */
@@ -3840,6 +5133,17 @@ static int rfat_data_cache_invalidate(rfat_volume_t *volume, rfat_file_t *file,
     return status;
 }
 
+static rfat_cache_entry_t *rfat_data_cache_entry(rfat_volume_t *volume, rfat_file_t *file, int *p_dirty)
+{
+    *p_dirty = ((volume->data_file != NULL)
+#if (RFAT_CONFIG_FAT_CACHE_ENTRIES == 0)
+		|| (volume->flags & RFAT_VOLUME_FLAG_FAT_DIRTY)
+#endif /* (RFAT_CONFIG_FAT_CACHE_ENTRIES == 0) */
+		) ? TRUE : FALSE;
+
+    return &volume->dir_cache;
+}
+
 #endif /* (RFAT_CONFIG_DATA_CACHE_ENTRIES != 0) */
 
 /***********************************************************************************************************************/
@@ -4127,12 +5431,49 @@ static int rfat_cluster_chain_seek(rfat_volume_t *volume, uint32_t clsno, uint32
     return status;
 }
 
+#if (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1)
+
+/* With TRANSACTION_SAFE a replay may bring FAT blocks written after the last log
+ * into FAT1. So the link to "clsno_n" gets written before its END_OF_CHAIN, which
+ * means a FAT block never holds a cluster that the FAT blocks written before it
+ * do not lead to. At worst the last link points to a free cluster, which
+ * rfat_volume_commit() repairs. A new cluster chain ("clsno" == RFAT_CLSNO_NONE)
+ * has no such link, so its head is noted in volume->group_clsno instead.
+ */
+
+static int rfat_cluster_chain_append(rfat_volume_t *volume, uint32_t clsno, uint32_t clsno_n)
+{
+    int status = F_NO_ERROR;
+
+    if (clsno != RFAT_CLSNO_NONE)
+    {
+	status = rfat_cluster_write(volume, clsno, clsno_n, TRUE);
+    }
+    else
+    {
+	if (volume->group_clsno == RFAT_CLSNO_END_OF_CHAIN)
+	{
+	    volume->group_clsno = clsno_n;
+	    volume->flags &= ~RFAT_VOLUME_FLAG_TRANSACTION_LOGGED;
+	}
+    }
+
+    if (status == F_NO_ERROR)
+    {
+	status = rfat_cluster_write(volume, clsno_n, RFAT_CLSNO_END_OF_CHAIN, TRUE);
+    }
+
+    return status;
+}
+
+#endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1) */
 
 /* In order to guarantee file system fault tolerance the chain allocation is done iteratively.
  * free entry is found, it's marked as END_OF_CHAIN, and then the previous entry in the chain
  * is linked to it. This ensures that there is not broken chain anywhere. The is only the
  * possibility that there is a lost END_OF_CHAIN somewhere. Given that the fat cache writes
  * in sequence, the link process happens AFTER the END_OF_CHAIN has been written. 
+ * With TRANSACTION_SAFE the order is reversed (see rfat_cluster_chain_append()).
  * 
  * If the allocation fails, then the chain is first split at the original create point,
  * and then freed. Hence again no inconsistent state is possible.
@@ -4160,6 +5501,20 @@ static int rfat_cluster_chain_create(rfat_volume_t *volume, uint32_t clsno, uint
 	{
 	    if (clsdata == RFAT_CLSNO_FREE)
 	    {
+#if (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1)
+		status = rfat_cluster_chain_append(volume, ((clsno_l != RFAT_CLSNO_NONE) ? clsno_l : clsno), clsno_n);
+
+		if (status == F_NO_ERROR)
+		{
+		    if (clsno_a == RFAT_CLSNO_NONE)
+		    {
+			clsno_a = clsno_n;
+		    }
+
+		    clsno_l = clsno_n;
+		    clscnt_a++;
+		}
+#else /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1) */
 		status = rfat_cluster_write(volume, clsno_n, RFAT_CLSNO_END_OF_CHAIN, TRUE);
 		
 		if (status == F_NO_ERROR)
@@ -4177,6 +5532,7 @@ static int rfat_cluster_chain_create(rfat_volume_t *volume, uint32_t clsno, uint
 		    clsno_l = clsno_n;
 		    clscnt_a++;
 		}
+#endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1) */
 	    }
 	    
 	    clsno_n++;
@@ -4196,12 +5552,14 @@ static int rfat_cluster_chain_create(rfat_volume_t *volume, uint32_t clsno, uint
 
     if (status == F_NO_ERROR)
     {
+#if (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0)
 	if (clsno != RFAT_CLSNO_NONE)
 	{
 	    status = rfat_cluster_write(volume, clsno, clsno_a, TRUE);
 	}
 	
 	if (status == F_NO_ERROR)
+#endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0) */
 	{
 #if (RFAT_CONFIG_FSINFO_SUPPORTED == 1)
 	    volume->flags |= RFAT_VOLUME_FLAG_FSINFO_DIRTY;
@@ -4225,12 +5583,43 @@ static int rfat_cluster_chain_create(rfat_volume_t *volume, uint32_t clsno, uint
 	{
 	    if (clsno_a != RFAT_CLSNO_NONE)
 	    {
-		status = rfat_cluster_chain_destroy(volume, clsno_a, RFAT_CLSNO_FREE);
+#if (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1)
+		if (clsno != RFAT_CLSNO_NONE)
+		{
+		    status = rfat_cluster_write(volume, clsno, RFAT_CLSNO_END_OF_CHAIN, TRUE);
+		}
+
+		if (volume->group_clsno == clsno_a)
+		{
+		    volume->group_clsno = RFAT_CLSNO_END_OF_CHAIN;
+		}
+
+		if ((status == F_NO_ERROR) || (status == F_ERR_NOMOREENTRY))
+#endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1) */
+		{
+		    status = rfat_cluster_chain_destroy(volume, clsno_a, RFAT_CLSNO_FREE);
+		}
 	    }
 	    
-	    if (status == F_NO_ERROR)
+	    if ((status == F_NO_ERROR) || (status == F_ERR_NOMOREENTRY))
 	    {
-		status = F_ERR_NOMOREENTRY;
+#if (RFAT_CONFIG_DEFERRED_RELEASE_ENTRIES != 0)
+		/* Out of free clusters. Release all queued cluster chains, and retry.
+		 */
+		if (volume->release_count != 0)
+		{
+		    status = rfat_cluster_chain_release(volume, 0xffffffff);
+
+		    if (status == F_NO_ERROR)
+		    {
+			status = rfat_cluster_chain_create(volume, clsno, clscnt, p_clsno_a, p_clsno_l);
+		    }
+		}
+		else
+#endif /* (RFAT_CONFIG_DEFERRED_RELEASE_ENTRIES != 0) */
+		{
+		    status = F_ERR_NOMOREENTRY;
+		}
 	    }
 	}
 #if (RFAT_CONFIG_FSINFO_SUPPORTED == 1)
@@ -4246,67 +5635,238 @@ static int rfat_cluster_chain_create(rfat_volume_t *volume, uint32_t clsno, uint
 
 #if (RFAT_CONFIG_SEQUENTIAL_SUPPORTED == 1)
 
-static int rfat_cluster_chain_create_sequential(rfat_volume_t *volume, uint32_t clsno, uint32_t clscnt, uint32_t *p_clsno_a, uint32_t *p_clsno_l)
+/* Walk down from the AU at "*p_clsno_b" (wrapping around at volume->start_clsno) inspecting
+ * up to "aucnt" AUs for one that ends in a run of free clusters, and that is not the allocation
+ * window of another open file. On return "*p_clsno_b", "*p_clsno_t" and "*p_clsno_n" describe
+ * the last AU inspected, with "*p_clsno_n" == "*p_clsno_t" if there was no free cluster at its
+ * end. F_ERR_NOMOREENTRY is returned if the walk got back to volume->base_clsno.
+ */
+
+static int rfat_cluster_chain_window(rfat_volume_t *volume, rfat_file_t *file, uint32_t aucnt, uint32_t *p_clsno_b, uint32_t *p_clsno_t, uint32_t *p_clsno_n)
 {
     int status = F_NO_ERROR;
-    uint32_t clsno_a, clsno_b, clsno_t, clsno_n, clsno_l, clsno_s, clscnt_a, clsdata;
+    uint32_t clsno_b, clsno_t, clsno_n, clsno_s, clsdata;
+#if (RFAT_CONFIG_MAX_FILES > 1)
+    rfat_file_t *file_s, *file_e;
 
-    clsno_b = volume->base_clsno;
-    clsno_t = volume->limit_clsno;
-    clsno_n = volume->free_clsno;
+    file_e = &volume->file_table[RFAT_CONFIG_MAX_FILES];
+#endif /* (RFAT_CONFIG_MAX_FILES > 1) */
 
-    clsno_a = RFAT_CLSNO_NONE;
-    clsno_l = RFAT_CLSNO_NONE;
-
-    clscnt_a = 0;
+    clsno_b = *p_clsno_b;
+    clsno_t = clsno_b;
+    clsno_n = clsno_b;
 
     do
     {
-	if (clsno_n == clsno_t)
+	if (clsno_b == volume->start_clsno)
 	{
-	    do
+	    clsno_t = volume->end_clsno;
+	    clsno_b = clsno_t - (volume->blk_unit_size >> volume->cls_blk_shift);
+	}
+	else
+	{
+	    clsno_t = clsno_b;
+	    clsno_b = clsno_t - (volume->blk_unit_size >> volume->cls_blk_shift);
+	}
+
+	if (clsno_b == volume->base_clsno)
+	{
+	    status = F_ERR_NOMOREENTRY;
+	}
+	else
+	{
+	    clsno_n = clsno_t;
+
+#if (RFAT_CONFIG_MAX_FILES > 1)
+	    /* Skip an AU that is the allocation window of another open file.
+	     */
+	    for (file_s = &volume->file_table[0]; file_s < file_e; file_s++)
 	    {
-		if (clsno_b == volume->start_clsno)
+		if ((file_s != file) && file_s->mode && (file_s->base_clsno == clsno_b) && (file_s->free_clsno != file_s->limit_clsno))
 		{
-		    clsno_t = volume->end_clsno;
-		    clsno_b = clsno_t - (volume->blk_unit_size >> volume->cls_blk_shift);
+		    break;
 		}
-		else
+	    }
+
+	    if (file_s == file_e)
+#endif /* (RFAT_CONFIG_MAX_FILES > 1) */
+	    {
+		do 
 		{
-		    clsno_t = clsno_b;
-		    clsno_b = clsno_t - (volume->blk_unit_size >> volume->cls_blk_shift);
+		    clsno_s = clsno_n -1;
+
+		    status = rfat_cluster_read_uncached(volume, clsno_s, &clsdata);
+
+		    if (status == F_NO_ERROR)
+		    {
+			if (clsdata == RFAT_CLSNO_FREE)
+			{
+			    clsno_n = clsno_s;
+			}
+		    }
 		}
+		while ((status == F_NO_ERROR) && (clsdata == RFAT_CLSNO_FREE) && (clsno_n != clsno_b));
+	    }
+
+	    aucnt--;
+	}
+    }
+    while ((status == F_NO_ERROR) && (clsno_n == clsno_t) && (aucnt != 0));
+
+    if (status == F_NO_ERROR)
+    {
+	*p_clsno_b = clsno_b;
+	*p_clsno_t = clsno_t;
+	*p_clsno_n = clsno_n;
+    }
+
+    return status;
+}
+
+#if (RFAT_CONFIG_MAX_FILES > 1)
+
+/* Set up "*p_clsno_b", "*p_clsno_t" and "*p_clsno_n" for the AU that starts at "clsno_b", using the
+ * run of free clusters at the end of that AU down to "clsno_s". This way a file reopened for writing
+ * continues in the AU where its chain ends, and a new file fills up the AU that was claimed last,
+ * rather than each file starting a new AU. "*p_clsno_n" == "*p_clsno_t" is returned if there is no
+ * such run of free clusters, or if the AU is the allocation window of another open file.
+ */
+
+static int rfat_cluster_chain_seed(rfat_volume_t *volume, rfat_file_t *file, uint32_t clsno_b, uint32_t clsno_s, uint32_t *p_clsno_b, uint32_t *p_clsno_t, uint32_t *p_clsno_n)
+{
+    int status = F_NO_ERROR;
+    uint32_t clsno_t, clsno_n, clsdata;
+    rfat_file_t *file_s, *file_e;
+
+    file_e = &volume->file_table[RFAT_CONFIG_MAX_FILES];
+
+    clsno_t = clsno_b + (volume->blk_unit_size >> volume->cls_blk_shift);
+    clsno_n = clsno_t;
+
+    for (file_s = &volume->file_table[0]; file_s < file_e; file_s++)
+    {
+	if ((file_s != file) && file_s->mode && (file_s->base_clsno == clsno_b) && (file_s->free_clsno != file_s->limit_clsno))
+	{
+	    break;
+	}
+    }
+
+    if (file_s == file_e)
+    {
+	while ((status == F_NO_ERROR) && (clsno_n != clsno_s))
+	{
+	    status = rfat_cluster_read_uncached(volume, (clsno_n -1), &clsdata);
 
-		if (clsno_b == volume->base_clsno)
+	    if (status == F_NO_ERROR)
+	    {
+		if (clsdata != RFAT_CLSNO_FREE)
 		{
-		    status = F_ERR_NOMOREENTRY;
+		    break;
 		}
-		else
-		{
-		    clsno_n = clsno_t;
 
-		    do 
-		    {
-			clsno_s = clsno_n -1;
+		clsno_n--;
+	    }
+	}
+    }
 
-			status = rfat_cluster_read_uncached(volume, clsno_s, &clsdata);
+    if (status == F_NO_ERROR)
+    {
+	*p_clsno_b = clsno_b;
+	*p_clsno_t = clsno_t;
+	*p_clsno_n = clsno_n;
+    }
 
-			if (status == F_NO_ERROR)
-			{
-			    if (clsdata == RFAT_CLSNO_FREE)
-			    {
-				clsno_n = clsno_s;
-			    }
-			}
+    return status;
+}
+
+#endif /* (RFAT_CONFIG_MAX_FILES > 1) */
+
+static int rfat_cluster_chain_create_sequential(rfat_volume_t *volume, rfat_file_t *file, uint32_t clsno, uint32_t clscnt, uint32_t *p_clsno_a, uint32_t *p_clsno_l)
+{
+    int status = F_NO_ERROR;
+    uint32_t clsno_a, clsno_b, clsno_t, clsno_n, clsno_l, clscnt_a;
+#if (RFAT_CONFIG_MAX_FILES > 1)
+    uint32_t clsno_c, clscnt_u;
+
+    /* With more than one file, each file has its own allocation window. The 
+     * volume->base_clsno is used as the cursor for claiming the next AU, so that
+     * concurrent writers do not interleave their clusters within the same AU.
+     */
+    clsno_b = file->base_clsno;
+    clsno_t = file->limit_clsno;
+    clsno_n = file->free_clsno;
+    clsno_c = volume->base_clsno;
+#else /* (RFAT_CONFIG_MAX_FILES > 1) */
+    clsno_b = volume->base_clsno;
+    clsno_t = volume->limit_clsno;
+    clsno_n = volume->free_clsno;
+#endif /* (RFAT_CONFIG_MAX_FILES > 1) */
+
+    clsno_a = RFAT_CLSNO_NONE;
+    clsno_l = RFAT_CLSNO_NONE;
+
+    clscnt_a = 0;
+
+    do
+    {
+	if (clsno_n == clsno_t)
+	{
+#if (RFAT_CONFIG_MAX_FILES > 1)
+	    /* The first allocation after the file got opened continues in the AU that
+	     * holds the end of the chain, or for a new file in the AU claimed last, as
+	     * long as there are free clusters left in it.
+	     */
+	    if (clsno_t == volume->start_clsno)
+	    {
+		if (clsno != RFAT_CLSNO_NONE)
+		{
+		    if ((clsno >= volume->start_clsno) && (clsno < volume->end_clsno))
+		    {
+			clscnt_u = (volume->blk_unit_size >> volume->cls_blk_shift);
+
+			status = rfat_cluster_chain_seed(volume, file, (volume->start_clsno + (((clsno - volume->start_clsno) / clscnt_u) * clscnt_u)), (clsno +1), &clsno_b, &clsno_t, &clsno_n);
+		    }
+		}
+		else
+		{
+		    if (clsno_c != volume->start_clsno)
+		    {
+			status = rfat_cluster_chain_seed(volume, file, clsno_c, clsno_c, &clsno_b, &clsno_t, &clsno_n);
 		    }
-		    while ((status == F_NO_ERROR) && (clsdata == RFAT_CLSNO_FREE) && (clsno_n != clsno_b));
 		}
 	    }
-	    while ((status == F_NO_ERROR) && (clsno_n == clsno_t));
+
+	    if ((status == F_NO_ERROR) && (clsno_n == clsno_t))
+	    {
+		clsno_b = clsno_c;
+
+		status = rfat_cluster_chain_window(volume, file, 0xffffffff, &clsno_b, &clsno_t, &clsno_n);
+
+		clsno_c = clsno_b;
+	    }
+#else /* (RFAT_CONFIG_MAX_FILES > 1) */
+	    status = rfat_cluster_chain_window(volume, file, 0xffffffff, &clsno_b, &clsno_t, &clsno_n);
+#endif /* (RFAT_CONFIG_MAX_FILES > 1) */
 	}
 
 	if (status == F_NO_ERROR)
 	{
+#if (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1)
+	    status = rfat_cluster_chain_append(volume, ((clsno_l != RFAT_CLSNO_NONE) ? clsno_l : clsno), clsno_n);
+
+	    if (status == F_NO_ERROR)
+	    {
+		if (clsno_a == RFAT_CLSNO_NONE)
+		{
+		    clsno_a = clsno_n;
+		}
+
+		clsno_l = clsno_n;
+		clscnt_a++;
+
+		clsno_n++;
+	    }
+#else /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1) */
 	    status = rfat_cluster_write(volume, clsno_n, RFAT_CLSNO_END_OF_CHAIN, TRUE);
 		
 	    if (status == F_NO_ERROR)
@@ -4326,18 +5886,21 @@ static int rfat_cluster_chain_create_sequential(rfat_volume_t *volume, uint32_t
 
 		clsno_n++;
 	    }
+#endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1) */
 	}
     }
     while ((status == F_NO_ERROR) && (clscnt != clscnt_a));
 
     if (status == F_NO_ERROR)
     {
+#if (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0)
 	if (clsno != RFAT_CLSNO_NONE)
 	{
 	    status = rfat_cluster_write(volume, clsno, clsno_a, TRUE);
 	}
 	
 	if (status == F_NO_ERROR)
+#endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0) */
 	{
 #if (RFAT_CONFIG_FSINFO_SUPPORTED == 1)
 	    volume->flags |= RFAT_VOLUME_FLAG_FSINFO_DIRTY;
@@ -4345,9 +5908,17 @@ static int rfat_cluster_chain_create_sequential(rfat_volume_t *volume, uint32_t
 	    volume->free_clscnt -= clscnt_a;
 #endif /* (RFAT_CONFIG_FSINFO_SUPPORTED == 1) */
 	    
+#if (RFAT_CONFIG_MAX_FILES > 1)
+	    file->base_clsno = clsno_b;
+	    file->limit_clsno = clsno_t;
+	    file->free_clsno = clsno_n;
+
+	    volume->base_clsno = clsno_c;
+#else /* (RFAT_CONFIG_MAX_FILES > 1) */
 	    volume->base_clsno = clsno_b;
 	    volume->limit_clsno = clsno_t;
 	    volume->free_clsno = clsno_n;
+#endif /* (RFAT_CONFIG_MAX_FILES > 1) */
 
 	    *p_clsno_a = clsno_a;
 	    
@@ -4363,7 +5934,22 @@ static int rfat_cluster_chain_create_sequential(rfat_volume_t *volume, uint32_t
 	{
 	    if (clsno_a != RFAT_CLSNO_NONE)
 	    {
-		status = rfat_cluster_chain_destroy(volume, clsno_a, RFAT_CLSNO_FREE);
+#if (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1)
+		if (clsno != RFAT_CLSNO_NONE)
+		{
+		    status = rfat_cluster_write(volume, clsno, RFAT_CLSNO_END_OF_CHAIN, TRUE);
+		}
+
+		if (volume->group_clsno == clsno_a)
+		{
+		    volume->group_clsno = RFAT_CLSNO_END_OF_CHAIN;
+		}
+
+		if ((status == F_NO_ERROR) || (status == F_ERR_NOMOREENTRY))
+#endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1) */
+		{
+		    status = rfat_cluster_chain_destroy(volume, clsno_a, RFAT_CLSNO_FREE);
+		}
 	    }
 
 	    if ((status == F_NO_ERROR) || (status == F_ERR_NOMOREENTRY))
@@ -4394,7 +5980,7 @@ static int rfat_cluster_chain_create_sequential(rfat_volume_t *volume, uint32_t
 static int rfat_cluster_chain_create_contiguous(rfat_volume_t *volume, uint32_t clscnt, uint32_t *p_clsno_a)
 {
     int status = F_NO_ERROR;
-    uint32_t clsno_a, clsno_n, clscnt_a, clsdata;
+    uint32_t blkno, clsno_a, clsno_n, clscnt_a, clsdata;
 
     clsno_a = volume->end_clsno;
     clscnt_a = 0;
@@ -4415,7 +6001,21 @@ static int rfat_cluster_chain_create_contiguous(rfat_volume_t *volume, uint32_t
 	    }
 	    else
 	    {
-		clsno_a = (((((clsno_a << volume->cls_blk_shift) + volume->cls_blk_offset) / volume->blk_unit_size) * volume->blk_unit_size) - volume->cls_blk_offset) >> volume->cls_blk_shift;
+		/* The run of free clusters above is too short. Start over below
+		 * the AU that contains the used cluster.
+		 */
+		blkno = (((clsno_a << volume->cls_blk_shift) + volume->cls_blk_offset) / volume->blk_unit_size) * volume->blk_unit_size;
+
+		if (blkno > ((volume->start_clsno << volume->cls_blk_shift) + volume->cls_blk_offset))
+		{
+		    clsno_a = (blkno - volume->cls_blk_offset) >> volume->cls_blk_shift;
+		}
+		else
+		{
+		    clsno_a = volume->start_clsno;
+		}
+
+		clscnt_a = 0;
 	    }
 	}
     }
@@ -4453,7 +6053,23 @@ static int rfat_cluster_chain_create_contiguous(rfat_volume_t *volume, uint32_t
 	}
 	else
 	{
-	    status = F_ERR_NOMOREENTRY;
+#if (RFAT_CONFIG_DEFERRED_RELEASE_ENTRIES != 0)
+	    /* Out of free clusters. Release all queued cluster chains, and retry.
+	     */
+	    if (volume->release_count != 0)
+	    {
+		status = rfat_cluster_chain_release(volume, 0xffffffff);
+
+		if (status == F_NO_ERROR)
+		{
+		    status = rfat_cluster_chain_create_contiguous(volume, clscnt, &clsno_a);
+		}
+	    }
+	    else
+#endif /* (RFAT_CONFIG_DEFERRED_RELEASE_ENTRIES != 0) */
+	    {
+		status = F_ERR_NOMOREENTRY;
+	    }
 	}
     }
 
@@ -4467,84 +6083,408 @@ static int rfat_cluster_chain_create_contiguous(rfat_volume_t *volume, uint32_t
 
 /* The chain destroy process walks along the chain and frees each entry front to back.
  * Hence it's possible to have a lost chain, but no file system corruption.
+ *
+ * For FAT16/FAT32 the chain is processed in runs of consecutive clusters (i.e. each
+ * entry links to the next one) within a FAT block. A run is cleared directly in the
+ * FAT cache. FAT blocks that are completely covered by a run are not touched at all,
+ * but collected and zeroed out in one go via rfat_fat_cache_zero(). As this happens
+ * before any later FAT entry gets modified, the front to back order is retained.
+ *
+ * At most "*p_clscnt" clusters are freed, and "*p_clscnt" is reduced by the number of
+ * freed clusters. "*p_clsno" returns the cluster where a subsequent call has to continue,
+ * or RFAT_CLSNO_NONE if the end of the chain was reached.
  */
 
-static int rfat_cluster_chain_destroy(rfat_volume_t *volume, uint32_t clsno, uint32_t clsdata)
+static int rfat_cluster_chain_free(rfat_volume_t *volume, uint32_t clsno, uint32_t clsdata, uint32_t *p_clscnt, uint32_t *p_clsno)
 {
     int status = F_NO_ERROR;
-    uint32_t clsno_n;
+    uint32_t clsno_n, clscnt, clscnt_r, offset, blkno, blkno_z, blkcnt_z, index, index_n, index_e;
+    rfat_cache_entry_t *entry;
+
+    clscnt_r = *p_clscnt;
+    blkno_z = RFAT_BLKNO_INVALID;
+    blkcnt_z = 0;
 
     do
     {
-	/* Bypass cluster cache on read while destroying.
-	 */
-	status = rfat_cluster_read_uncached(volume, clsno, &clsno_n);
-
-	if (status == F_NO_ERROR)
+	if ((clsdata == RFAT_CLSNO_FREE) && (volume->type != RFAT_VOLUME_TYPE_FAT12))
 	{
-	    status = rfat_cluster_write(volume, clsno, clsdata, FALSE);
+	    offset = clsno << volume->type;
+	    blkno = volume->fat1_blkno + (offset >> RFAT_BLK_SHIFT);
+	    index = (offset & RFAT_BLK_MASK) >> volume->type;
+	    index_e = (RFAT_BLK_SIZE >> volume->type);
+
+	    if (((clsno - index) + (index_e -1)) > volume->last_clsno)
+	    {
+		index_e = (volume->last_clsno - (clsno - index)) +1;
+	    }
+
+	    status = rfat_fat_cache_read(volume, blkno, &entry);
 
 	    if (status == F_NO_ERROR)
 	    {
-		if (clsdata == RFAT_CLSNO_FREE)
+		if (volume->type == RFAT_VOLUME_TYPE_FAT16)
 		{
-#if (RFAT_CONFIG_FSINFO_SUPPORTED == 1)
-		    volume->free_clscnt++;
-#endif /* (RFAT_CONFIG_FSINFO_SUPPORTED == 1) */
-		}
+		    uint16_t *fat_data;
 
-		if ((clsno_n >= 2) && (clsno_n <= volume->last_clsno))
-		{
-		    clsno = clsno_n;
-		    clsdata = RFAT_CLSNO_FREE;
+		    fat_data = (uint16_t*)((void*)entry->data);
+
+		    for (index_n = index; index_n < (index_e -1); index_n++)
+		    {
+			if (RFAT_FTOHS(fat_data[index_n]) != ((clsno - index) + index_n +1))
+			{
+			    break;
+			}
+		    }
+
+		    if ((index_n - index) >= clscnt_r)
+		    {
+			index_n = index + clscnt_r -1;
+		    }
+
+		    clsno_n = RFAT_FTOHS(fat_data[index_n]);
+		    
+		    if (clsno_n >= RFAT_CLSNO_RESERVED16)
+		    {
+			clsno_n += (RFAT_CLSNO_RESERVED32 - RFAT_CLSNO_RESERVED16);
+		    }
+
+		    clscnt = (index_n - index) +1;
 		}
 		else
 		{
-		    if (clsno_n < RFAT_CLSNO_LAST)
+		    uint32_t *fat_data;
+
+		    fat_data = (uint32_t*)((void*)entry->data);
+
+		    for (index_n = index; index_n < (index_e -1); index_n++)
 		    {
-			status = F_ERR_EOF;
+			if (RFAT_FTOHL(fat_data[index_n]) != ((clsno - index) + index_n +1))
+			{
+			    break;
+			}
 		    }
-		}
-	    }
-	}
-    }
-    while ((status == F_NO_ERROR) && (clsno_n < RFAT_CLSNO_LAST));
 
-#if (RFAT_CONFIG_FSINFO_SUPPORTED == 1)
-    if (status == F_NO_ERROR)
-    {
-	volume->flags |= RFAT_VOLUME_FLAG_FSINFO_DIRTY;
-    }
-    else
-    {
-	volume->flags &= ~RFAT_VOLUME_FLAG_FSINFO_VALID;
-    }
-#endif /* (RFAT_CONFIG_FSINFO_SUPPORTED == 1) */
+		    if ((index_n - index) >= clscnt_r)
+		    {
+			index_n = index + clscnt_r -1;
+		    }
 
-    return status;
-}
+		    clsno_n = RFAT_FTOHL(fat_data[index_n]);
 
-/***********************************************************************************************************************/
+		    /* The reserved upper 4 bits need to be 0, if the block gets zeroed out.
+		     */
+		    if (clsno_n & 0xf0000000)
+		    {
+			index_e = 0;
+		    }
 
-static inline unsigned int rfat_name_ascii_upcase(unsigned int cc)
-{
-    unsigned int uc;
+		    clsno_n &= 0x0fffffff;
 
-    if ((cc <= 0x1f) || (cc > 0x7f))
-    {
-	uc = 0x0000;
-    }
-    else
-    {
-	if ((cc >= 'a') && (cc <= 'z'))
-	{
-	    uc = cc - ('a' - 'A');
-	}
-	else
-	{
-	    uc = cc;
-	}
-    }
+		    clscnt = (index_n - index) +1;
+		}
+
+		if ((index == 0) && (clscnt == (uint32_t)(RFAT_BLK_SIZE >> volume->type)) && (index_e == clscnt))
+		{
+		    if ((blkcnt_z != 0) && ((blkno_z + blkcnt_z) != blkno))
+		    {
+			status = rfat_fat_cache_zero(volume, blkno_z, blkcnt_z);
+
+			blkcnt_z = 0;
+		    }
+
+		    if (blkcnt_z == 0)
+		    {
+			blkno_z = blkno;
+		    }
+		    
+		    blkcnt_z++;
+		}
+		else
+		{
+		    if (blkcnt_z != 0)
+		    {
+			/* rfat_fat_cache_zero() might reuse the FAT cache entry, so reread it.
+			 */
+			status = rfat_fat_cache_zero(volume, blkno_z, blkcnt_z);
+
+			blkcnt_z = 0;
+
+			if (status == F_NO_ERROR)
+			{
+			    status = rfat_fat_cache_read(volume, blkno, &entry);
+			}
+		    }
+
+		    if (status == F_NO_ERROR)
+		    {
+			if (volume->type == RFAT_VOLUME_TYPE_FAT16)
+			{
+			    memset((uint16_t*)((void*)entry->data) + index, 0, (clscnt * sizeof(uint16_t)));
+			}
+			else
+			{
+			    uint32_t *fat_data;
+
+			    fat_data = (uint32_t*)((void*)entry->data);
+
+			    for (index_n = index; index_n < (index + clscnt); index_n++)
+			    {
+				fat_data[index_n] &= RFAT_HTOFL(0xf0000000);
+			    }
+			}
+
+			rfat_fat_cache_modify(volume, entry);
+		    }
+		}
+
+		if (status == F_NO_ERROR)
+		{
+		    clscnt_r -= clscnt;
+
+#if (RFAT_CONFIG_FSINFO_SUPPORTED == 1)
+		    volume->free_clscnt += clscnt;
+#endif /* (RFAT_CONFIG_FSINFO_SUPPORTED == 1) */
+
+#if (RFAT_CONFIG_CLUSTER_CACHE_ENTRIES != 0)
+		    for (index = 0; index < RFAT_CONFIG_CLUSTER_CACHE_ENTRIES; index++)
+		    {
+			if ((volume->cluster_cache[index].clsno - clsno) < clscnt)
+			{
+			    volume->cluster_cache[index].clsdata = RFAT_CLSNO_FREE;
+			}
+		    }
+#endif /* (RFAT_CONFIG_CLUSTER_CACHE_ENTRIES != 0) */
+		}
+	    }
+	}
+	else
+	{
+	    if (blkcnt_z != 0)
+	    {
+		status = rfat_fat_cache_zero(volume, blkno_z, blkcnt_z);
+
+		blkcnt_z = 0;
+	    }
+
+	    if (status == F_NO_ERROR)
+	    {
+		/* Bypass cluster cache on read while destroying.
+		 */
+		status = rfat_cluster_read_uncached(volume, clsno, &clsno_n);
+
+		if (status == F_NO_ERROR)
+		{
+		    status = rfat_cluster_write(volume, clsno, clsdata, FALSE);
+
+		    if (status == F_NO_ERROR)
+		    {
+			if (clsdata == RFAT_CLSNO_FREE)
+			{
+			    clscnt_r--;
+
+#if (RFAT_CONFIG_FSINFO_SUPPORTED == 1)
+			    volume->free_clscnt++;
+#endif /* (RFAT_CONFIG_FSINFO_SUPPORTED == 1) */
+			}
+		    }
+		}
+	    }
+	}
+
+	if (status == F_NO_ERROR)
+	{
+	    if ((clsno_n >= 2) && (clsno_n <= volume->last_clsno))
+	    {
+		clsno = clsno_n;
+		clsdata = RFAT_CLSNO_FREE;
+	    }
+	    else
+	    {
+		if (clsno_n < RFAT_CLSNO_LAST)
+		{
+		    status = F_ERR_EOF;
+		}
+
+		clsno = RFAT_CLSNO_NONE;
+	    }
+	}
+    }
+    while ((status == F_NO_ERROR) && (clsno != RFAT_CLSNO_NONE) && (clscnt_r != 0));
+
+    if ((status == F_NO_ERROR) && (blkcnt_z != 0))
+    {
+	status = rfat_fat_cache_zero(volume, blkno_z, blkcnt_z);
+    }
+
+    *p_clscnt = clscnt_r;
+    *p_clsno = clsno;
+
+#if (RFAT_CONFIG_FSINFO_SUPPORTED == 1)
+    if (status == F_NO_ERROR)
+    {
+	volume->flags |= RFAT_VOLUME_FLAG_FSINFO_DIRTY;
+    }
+    else
+    {
+	volume->flags &= ~RFAT_VOLUME_FLAG_FSINFO_VALID;
+    }
+#endif /* (RFAT_CONFIG_FSINFO_SUPPORTED == 1) */
+
+    return status;
+}
+
+static int rfat_cluster_chain_destroy(rfat_volume_t *volume, uint32_t clsno, uint32_t clsdata)
+{
+    uint32_t clscnt;
+
+    clscnt = 0xffffffff;
+
+    return rfat_cluster_chain_free(volume, clsno, clsdata, &clscnt, &clsno);
+}
+
+/* Discard a cluster chain that is not referenced anymore. With deferred release the
+ * chain is queued for rfat_volume_release(), otherwise it is destroyed right away.
+ */
+
+static int rfat_cluster_chain_discard(rfat_volume_t *volume, uint32_t clsno, uint32_t clsdata)
+{
+#if (RFAT_CONFIG_DEFERRED_RELEASE_ENTRIES != 0)
+    return rfat_cluster_chain_defer(volume, clsno, clsdata);
+#else /* (RFAT_CONFIG_DEFERRED_RELEASE_ENTRIES != 0) */
+    return rfat_cluster_chain_destroy(volume, clsno, clsdata);
+#endif /* (RFAT_CONFIG_DEFERRED_RELEASE_ENTRIES != 0) */
+}
+
+#if (RFAT_CONFIG_DEFERRED_RELEASE_ENTRIES != 0)
+
+/* Deferred destruction of a cluster chain. If "clsdata" is RFAT_CLSNO_FREE, the whole
+ * chain starting at "clsno" is queued. Otherwise "clsno" is rewritten to "clsdata" first,
+ * and the remainder of the chain is queued. If the queue is full, the chain is destroyed
+ * synchronously.
+ *
+ * The caller has to make sure that the chain is not referenced anymore, i.e. that the
+ * directory entry has been updated (or for TRANSACTION_SAFE is going to be recorded).
+ * Hence a power loss results at worst in a lost chain.
+ */
+
+static int rfat_cluster_chain_defer(rfat_volume_t *volume, uint32_t clsno, uint32_t clsdata)
+{
+    int status = F_NO_ERROR;
+    uint32_t clsno_n;
+
+    if (clsdata != RFAT_CLSNO_FREE)
+    {
+	/* Bypass cluster cache on read while destroying.
+	 */
+	status = rfat_cluster_read_uncached(volume, clsno, &clsno_n);
+
+	if (status == F_NO_ERROR)
+	{
+	    if (clsno_n != clsdata)
+	    {
+		status = rfat_cluster_write(volume, clsno, clsdata, FALSE);
+	    }
+
+	    if (status == F_NO_ERROR)
+	    {
+		if ((clsno_n >= 2) && (clsno_n <= volume->last_clsno))
+		{
+		    clsno = clsno_n;
+		}
+		else
+		{
+		    if (clsno_n < RFAT_CLSNO_LAST)
+		    {
+			status = F_ERR_EOF;
+		    }
+		    
+		    clsno = RFAT_CLSNO_NONE;
+		}
+	    }
+	}
+    }
+
+    if (status == F_NO_ERROR)
+    {
+	if (clsno != RFAT_CLSNO_NONE)
+	{
+	    if (volume->release_count != RFAT_CONFIG_DEFERRED_RELEASE_ENTRIES)
+	    {
+		volume->release_table[volume->release_count] = clsno;
+		volume->release_count++;
+	    }
+	    else
+	    {
+		status = rfat_cluster_chain_destroy(volume, clsno, RFAT_CLSNO_FREE);
+	    }
+	}
+    }
+
+    return status;
+}
+
+/* Free up to "clscnt" clusters out of the queued cluster chains. The last queued chain is
+ * freed front to back, and its head is advanced in the queue, so that a subsequent call
+ * can continue where the previous one left off. A damaged chain is simply dropped, which
+ * results in a lost chain.
+ */
+
+static int rfat_cluster_chain_release(rfat_volume_t *volume, uint32_t clscnt)
+{
+    int status = F_NO_ERROR;
+    uint32_t clsno;
+
+    while ((status == F_NO_ERROR) && (clscnt != 0) && (volume->release_count != 0))
+    {
+	status = rfat_cluster_chain_free(volume, volume->release_table[volume->release_count -1], RFAT_CLSNO_FREE, &clscnt, &clsno);
+
+	if (status == F_ERR_EOF)
+	{
+	    status = F_NO_ERROR;
+
+	    clsno = RFAT_CLSNO_NONE;
+	}
+
+	if (status == F_NO_ERROR)
+	{
+	    if (clsno == RFAT_CLSNO_NONE)
+	    {
+		volume->release_count--;
+	    }
+	    else
+	    {
+		volume->release_table[volume->release_count -1] = clsno;
+	    }
+	}
+    }
+
+    return status;
+}
+
+#endif /* (RFAT_CONFIG_DEFERRED_RELEASE_ENTRIES != 0) */
+
+/***********************************************************************************************************************/
+
+static inline unsigned int rfat_name_ascii_upcase(unsigned int cc)
+{
+    unsigned int uc;
+
+    if ((cc <= 0x1f) || (cc > 0x7f))
+    {
+	uc = 0x0000;
+    }
+    else
+    {
+	if ((cc >= 'a') && (cc <= 'z'))
+	{
+	    uc = cc - ('a' - 'A');
+	}
+	else
+	{
+	    uc = cc;
+	}
+    }
 
     return uc;
 }
@@ -6994,10 +8934,18 @@ static int rfat_path_create_entry(rfat_volume_t *volume, uint32_t clsno_d, uint3
 		 * Also the fat cache has to be flushed as it's the final operation of a sequence (see f_mkdir).
 		 * The issue at hand is that if a new cluster is linked in that is not zeroed out, the
 		 * directory is invalid. One the other hand, we cannot write a directory entry to a directory
-		 * that has uncommited clusters in the fat cache.
+		 * that has uncommited clusters in the fat cache. Within a f_begin()/f_commit() group
+		 * the log gets cleared first, as no file owns the new cluster (see rfat_volume_reclaim()).
 		 */
-		
-		status = rfat_cluster_chain_create(volume, RFAT_CLSNO_NONE, 1, &clsno_s, NULL);
+
+#if (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1)
+		status = rfat_volume_settle(volume);
+
+		if (status == F_NO_ERROR)
+#endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1) */
+		{
+		    status = rfat_cluster_chain_create(volume, RFAT_CLSNO_NONE, 1, &clsno_s, NULL);
+		}
 		
 		if (status == F_NO_ERROR)
 		{
@@ -7291,7 +9239,7 @@ static int rfat_path_destroy_entry(rfat_volume_t *volume, uint32_t clsno, uint32
 	    {
 		if (first_clsno != RFAT_CLSNO_NONE)
 		{
-		    status = rfat_cluster_chain_destroy(volume, first_clsno, RFAT_CLSNO_FREE);
+		    status = rfat_cluster_chain_discard(volume, first_clsno, RFAT_CLSNO_FREE);
 		}
 	    }
 	}
@@ -7308,9 +9256,27 @@ static int rfat_path_destroy_entry(rfat_volume_t *volume, uint32_t clsno, uint32
 
 #else /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0) */
 
+    /* Within a f_begin()/f_commit() group the cluster chain is released only after
+     * rfat_volume_settle(), as a replay could otherwise bring back a FAT2 block that
+     * still has the chain. The entry may be the one named by the log, so that name is
+     * dropped, and the log gets rewritten before the next covered FAT block.
+     */
+    if (volume->flags & RFAT_VOLUME_FLAG_TRANSACTION)
+    {
+	volume->group_clsno = RFAT_CLSNO_NONE;
+	volume->group_dir_index = RFAT_GROUP_INDEX_NONE;
+
+	volume->flags &= ~RFAT_VOLUME_FLAG_TRANSACTION_LOGGED;
+    }
+
     if (first_clsno != RFAT_CLSNO_NONE)
     {
-	status = rfat_cluster_chain_destroy(volume, first_clsno, RFAT_CLSNO_FREE);
+	status = rfat_volume_settle(volume);
+
+	if (status == F_NO_ERROR)
+	{
+	    status = rfat_cluster_chain_discard(volume, first_clsno, RFAT_CLSNO_FREE);
+	}
     }
 
     if (status == F_NO_ERROR)
@@ -7355,12 +9321,12 @@ static rfat_file_t * rfat_file_enumerate(rfat_volume_t *volume, rfat_file_t *fil
 
     rfat_file_t *file_s, *file_e;
 
-    file_s = (file == NULL) ? &volume->file_table[0] : NULL;
+    file_s = (file == NULL) ? &volume->file_table[0] : (file +1);
     file_e = &volume->file_table[RFAT_CONFIG_MAX_FILES];
 
     file = NULL;
 
-    do
+    while (file_s < file_e)
     {
 	if (file_s->mode && (file_s->dir_clsno == clsno) && (file_s->dir_index == index))
 	{
@@ -7370,7 +9336,6 @@ static rfat_file_t * rfat_file_enumerate(rfat_volume_t *volume, rfat_file_t *fil
 
 	file_s++;
     }
-    while (file_s < file_e);
 #endif /* (RFAT_CONFIG_MAX_FILES == 1) */
 
     return file;
@@ -7414,6 +9379,8 @@ static int rfat_file_sync(rfat_volume_t *volume, rfat_file_t *file, int access,
 		volume->dir.dir_acc_date = RFAT_HTOFS(cdate);
 		    
 		volume->dir_flags |= RFAT_DIR_FLAG_ACCESS_ENTRY;
+
+		file->acc_date = cdate;
 	    }
 	}
 
@@ -7423,6 +9390,10 @@ static int rfat_file_sync(rfat_volume_t *volume, rfat_file_t *file, int access,
 	    volume->dir.dir_wrt_date = RFAT_HTOFS(cdate);
 
 	    volume->dir_flags |= RFAT_DIR_FLAG_MODIFY_ENTRY;
+
+	    file->attr |= RFAT_DIR_ATTR_ARCHIVE;
+	    file->wrt_time = ctime;
+	    file->wrt_date = cdate;
 	}
     }
 	
@@ -7480,6 +9451,8 @@ static int rfat_file_sync(rfat_volume_t *volume, rfat_file_t *file, int access,
 		    if (volume->type == RFAT_VOLUME_TYPE_FAT32)
 		    {
 			dir->dir_acc_date = RFAT_HTOFS(cdate);
+
+			file->acc_date = cdate;
 		    }
 		}
 
@@ -7488,6 +9461,10 @@ static int rfat_file_sync(rfat_volume_t *volume, rfat_file_t *file, int access,
 		    dir->dir_attr |= RFAT_DIR_ATTR_ARCHIVE;
 		    dir->dir_wrt_time = RFAT_HTOFS(ctime);
 		    dir->dir_wrt_date = RFAT_HTOFS(cdate);
+
+		    file->attr |= RFAT_DIR_ATTR_ARCHIVE;
+		    file->wrt_time = ctime;
+		    file->wrt_date = cdate;
 		}
 	    }
 
@@ -7517,27 +9494,115 @@ static int rfat_file_flush(rfat_volume_t *volume, rfat_file_t *file, int close)
 	 * outstanding errors.
 	 */
 
-	status = rfat_data_cache_flush(volume, file);
-
-	if (status == F_NO_ERROR)
+#if (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1)
+	if ((file->stream_count == 0) && (file->stream_index != 0))
 	{
-	    status = rfat_disk_sync(volume->disk, &file->status);
+	    status = rfat_file_stream_flush(volume, file);
 	}
 
-	if (file->status == F_NO_ERROR)
+	if (status == F_NO_ERROR)
+#endif /* (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1) */
 	{
-	    file->status = status;
+	    status = rfat_data_cache_flush(volume, file);
 	}
 
-	if (close || (file->flags & (RFAT_FILE_FLAG_DIR_MODIFIED | RFAT_FILE_FLAG_DATA_MODIFIED)))
+	if (status == F_NO_ERROR)
 	{
-	    status = rfat_file_sync(volume, file, close, (file->flags & (RFAT_FILE_FLAG_DIR_MODIFIED | RFAT_FILE_FLAG_DATA_MODIFIED)), file->first_clsno, file->length);
+	    status = rfat_disk_sync(volume->disk, &file->status);
 	}
-    }
+
+#if (RFAT_CONFIG_APPEND_RESERVE_CLUSTERS != 0)
+	/* Hand back the clusters rfat_file_extend() reserved past "file->length" on close.
+	 * A plain flush keeps them, as a log that gets flushed after every record would
+	 * otherwise reserve and trim the same clusters over and over again.
+	 */
+	if ((status == F_NO_ERROR) && close && (file->flags & RFAT_FILE_FLAG_RESERVED))
+	{
+	    if (file->position != file->length)
+	    {
+		status = rfat_file_seek(volume, file, file->length);
+	    }
+
+	    if (status == F_NO_ERROR)
+	    {
+		status = rfat_file_shrink(volume, file);
+	    }
+	}
+#endif /* (RFAT_CONFIG_APPEND_RESERVE_CLUSTERS != 0) */
+
+	if (file->status == F_NO_ERROR)
+	{
+	    file->status = status;
+	}
+
+	if (close || (file->flags & (RFAT_FILE_FLAG_DIR_MODIFIED | RFAT_FILE_FLAG_DATA_MODIFIED)))
+	{
+	    status = rfat_file_sync(volume, file, close, (file->flags & (RFAT_FILE_FLAG_DIR_MODIFIED | RFAT_FILE_FLAG_DATA_MODIFIED)), file->first_clsno, file->length);
+	}
+    }
 
     if (status == F_NO_ERROR)
     {
-	file->flags &= ~(RFAT_FILE_FLAG_DATA_MODIFIED | RFAT_FILE_FLAG_DIR_MODIFIED);
+	file->flags &= ~(RFAT_FILE_FLAG_DATA_MODIFIED | RFAT_FILE_FLAG_DIR_MODIFIED | RFAT_FILE_FLAG_CHAIN_MODIFIED);
+
+#if (RFAT_CONFIG_COMMIT_POLICY_SUPPORTED == 1)
+	if (file->commit_policy != F_COMMIT_NONE)
+	{
+	    file->commit_mark = rfat_file_commit_mark(volume, file);
+	}
+#endif /* (RFAT_CONFIG_COMMIT_POLICY_SUPPORTED == 1) */
+    }
+
+    if (file->status != F_NO_ERROR)
+    {
+	status = file->status;
+    }
+
+    return status;
+}
+
+/* rfat_file_datasync() only makes the file data durable. The directory entry
+ * is left alone unless the cluster chain changed, as otherwise the data would
+ * not be reachable after a power failure. A pure change of "file->length" and
+ * the modification time are deferred to the next rfat_file_flush().
+ */
+static int rfat_file_datasync(rfat_volume_t *volume, rfat_file_t *file)
+{
+    int status = F_NO_ERROR;
+
+    if (volume->state == RFAT_VOLUME_STATE_MOUNTED)
+    {
+#if (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1)
+	if ((file->stream_count == 0) && (file->stream_index != 0))
+	{
+	    status = rfat_file_stream_flush(volume, file);
+	}
+
+	if (status == F_NO_ERROR)
+#endif /* (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1) */
+	{
+	    status = rfat_data_cache_flush(volume, file);
+	}
+
+	if (status == F_NO_ERROR)
+	{
+	    status = rfat_disk_sync(volume->disk, &file->status);
+	}
+
+	if (file->status == F_NO_ERROR)
+	{
+	    file->status = status;
+	}
+
+	if ((status == F_NO_ERROR) && (file->flags & RFAT_FILE_FLAG_CHAIN_MODIFIED))
+	{
+	    status = rfat_file_sync(volume, file, FALSE, (file->flags & (RFAT_FILE_FLAG_DIR_MODIFIED | RFAT_FILE_FLAG_DATA_MODIFIED)), file->first_clsno, file->length);
+
+	    if (status == F_NO_ERROR)
+	    {
+		file->flags &= ~(RFAT_FILE_FLAG_DATA_MODIFIED | RFAT_FILE_FLAG_DIR_MODIFIED | RFAT_FILE_FLAG_CHAIN_MODIFIED);
+	    }
+	}
     }
 
     if (file->status != F_NO_ERROR)
@@ -7548,12 +9613,250 @@ static int rfat_file_flush(rfat_volume_t *volume, rfat_file_t *file, int close)
     return status;
 }
 
+#if (RFAT_CONFIG_COMMIT_POLICY_SUPPORTED == 1)
+
+static uint32_t rfat_file_commit_mark(rfat_volume_t *volume, rfat_file_t *file)
+{
+    uint32_t mark;
+#if defined(RFAT_PORT_CORE_TIMEDATE)
+    uint16_t ctime, cdate;
+#endif /* RFAT_PORT_CORE_TIMEDATE */
+
+    if (file->commit_policy == F_COMMIT_BYTES)
+    {
+	mark = file->length;
+    }
+    else if (file->commit_policy == F_COMMIT_CLUSTERS)
+    {
+	mark = RFAT_SIZE_TO_CLSCNT(file->length);
+    }
+#if defined(RFAT_PORT_CORE_TIME_STAMP)
+    else if (file->commit_policy == F_COMMIT_MILLISECONDS)
+    {
+	/* A free running microsecond time stamp, the difference to the previous
+	 * mark is correct across a wrap around.
+	 */
+	mark = RFAT_PORT_CORE_TIME_STAMP();
+    }
+#endif /* RFAT_PORT_CORE_TIME_STAMP */
+    else
+    {
+#if defined(RFAT_PORT_CORE_TIMEDATE)
+	RFAT_PORT_CORE_TIMEDATE(&ctime, &cdate);
+
+	/* The day count is not contiguous at the end of a month, which means
+	 * that at worst a commit happens too early. 
+	 */
+	mark = ((((((cdate & F_CDATE_YEAR_MASK) >> F_CDATE_YEAR_SHIFT) * 16 +
+		   ((cdate & F_CDATE_MONTH_MASK) >> F_CDATE_MONTH_SHIFT)) * 32 +
+		  ((cdate & F_CDATE_DAY_MASK) >> F_CDATE_DAY_SHIFT)) * 24 +
+		 ((ctime & F_CTIME_HOUR_MASK) >> F_CTIME_HOUR_SHIFT)) * 60 +
+		((ctime & F_CTIME_MIN_MASK) >> F_CTIME_MIN_SHIFT)) * 60 +
+	       ((ctime & F_CTIME_SEC_MASK) >> F_CTIME_SEC_SHIFT) * 2;
+#else /* RFAT_PORT_CORE_TIMEDATE */
+	mark = 0;
+#endif /* RFAT_PORT_CORE_TIMEDATE */
+    }
+
+    return mark;
+}
+
+/* rfat_file_commit() is called at the end of a rfat_file_write(), and performs
+ * a rfat_file_flush() if the configured interval since the last flush had
+ * been exceeded. Hence the directory entry on the disk lags behind the file
+ * by at most one interval.
+ */
+static int rfat_file_commit(rfat_volume_t *volume, rfat_file_t *file)
+{
+    int status = F_NO_ERROR;
+
+    if ((rfat_file_commit_mark(volume, file) - file->commit_mark) >= file->commit_interval)
+    {
+	status = rfat_file_flush(volume, file, FALSE);
+    }
+
+    return status;
+}
+
+#endif /* (RFAT_CONFIG_COMMIT_POLICY_SUPPORTED == 1) */
+
+/* rfat_file_settle() is what follows a write with RFAT_FILE_MODE_COMMIT or a commit
+ * policy. It waits for the SDCARD to finish the write in "c" mode, and performs
+ * the rfat_file_flush() the commit policy calls for. It is called by rfat_file_write()
+ * as well as by the fast paths of f_putc() and f_write_commit(), which do not go
+ * through rfat_file_write().
+ */
+static int rfat_file_settle(rfat_volume_t *volume, rfat_file_t *file)
+{
+    int status = F_NO_ERROR;
+
+    if (file->mode & RFAT_FILE_MODE_COMMIT)
+    {
+	status = rfat_disk_sync(volume->disk, &file->status);
+    }
+
+#if (RFAT_CONFIG_COMMIT_POLICY_SUPPORTED == 1)
+    if ((status == F_NO_ERROR) && (file->commit_policy != F_COMMIT_NONE))
+    {
+	status = rfat_file_commit(volume, file);
+    }
+#endif /* (RFAT_CONFIG_COMMIT_POLICY_SUPPORTED == 1) */
+
+    return status;
+}
+
+#if (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1)
+
+/* rfat_file_stream_flush() empties the stream buffer. Pending write data is
+ * passed to rfat_file_write(), while for unconsumed read data the file position
+ * is moved back. The buffer is reset upfront, so that the rfat_file_write() and
+ * rfat_file_seek() calls do not recurse.
+ */
+static int rfat_file_stream_flush(rfat_volume_t *volume, rfat_file_t *file)
+{
+    int status = F_NO_ERROR;
+    uint32_t count, total;
+
+    if (file->stream_count != 0)
+    {
+	count = file->stream_count - file->stream_index;
+
+	file->stream_count = 0;
+	file->stream_index = 0;
+
+	if (count != 0)
+	{
+	    status = rfat_file_seek(volume, file, (file->position - count));
+	}
+    }
+    else
+    {
+	count = file->stream_index;
+
+	file->stream_index = 0;
+
+	if (count != 0)
+	{
+	    status = rfat_file_write(volume, file, file->stream_data, count, &total);
+
+	    if ((status == F_NO_ERROR) && (total != count))
+	    {
+		status = F_ERR_EOF;
+	    }
+	}
+    }
+
+    return status;
+}
+
+/* rfat_file_stream_read() copies "count" bytes (less than "file->stream_size")
+ * out of the stream buffer, refilling it with one multi block rfat_file_read()
+ * if needed.
+ */
+static int rfat_file_stream_read(rfat_volume_t *volume, rfat_file_t *file, uint8_t *data, uint32_t count, uint32_t *p_count)
+{
+    int status = F_NO_ERROR;
+    uint32_t size, total;
+
+    /* While writing "file->stream_index" is beyond "file->stream_count".
+     */
+    size = (file->stream_index < file->stream_count) ? (file->stream_count - file->stream_index) : 0;
+
+    if (size > count)
+    {
+	size = count;
+    }
+
+    memcpy(data, file->stream_data + file->stream_index, size);
+
+    file->stream_index += size;
+
+    total = size;
+
+    if (total != count)
+    {
+	status = rfat_file_stream_flush(volume, file);
+
+	if (status == F_NO_ERROR)
+	{
+	    status = rfat_file_read(volume, file, file->stream_data, file->stream_size, &size);
+
+	    file->stream_count = size;
+
+	    if (size > (count - total))
+	    {
+		size = (count - total);
+	    }
+
+	    memcpy(data + total, file->stream_data, size);
+
+	    file->stream_index = size;
+
+	    total += size;
+	}
+    }
+
+    *p_count = total;
+
+    return status;
+}
+
+/* rfat_file_stream_write() empties the stream buffer, and then starts it over
+ * with "count" bytes (less than "file->stream_size"), or as many as the file
+ * can still take.
+ */
+static int rfat_file_stream_write(rfat_volume_t *volume, rfat_file_t *file, const uint8_t *data, uint32_t count, uint32_t *p_count)
+{
+    int status = F_NO_ERROR;
+
+    *p_count = 0;
+
+    status = rfat_file_stream_flush(volume, file);
+
+    if ((status == F_NO_ERROR) && (file->mode & RFAT_FILE_MODE_APPEND) && (file->position != file->length))
+    {
+	status = rfat_file_seek(volume, file, file->length);
+    }
+
+    if (status == F_NO_ERROR)
+    {
+	if (count > RFAT_FILE_STREAM_LIMIT(file))
+	{
+	    count = RFAT_FILE_STREAM_LIMIT(file);
+	}
+
+	memcpy(file->stream_data, data, count);
+
+	file->stream_index = count;
+
+	*p_count = count;
+    }
+
+    return status;
+}
+
+#endif /* (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1) */
+
 static int rfat_file_seek(rfat_volume_t *volume, rfat_file_t *file, uint32_t position)
 {
     int status = F_NO_ERROR;
     uint32_t clsno, clscnt, offset;
 
-    if ((file->mode & RFAT_FILE_MODE_WRITE) && ((file->position & ~RFAT_BLK_MASK) != (position & ~RFAT_BLK_MASK)))
+#if (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1)
+    if (file->stream_count != 0)
+    {
+	/* Unconsumed read data is simply dropped.
+	 */
+	file->stream_count = 0;
+	file->stream_index = 0;
+    }
+    else if (file->stream_index != 0)
+    {
+	status = rfat_file_stream_flush(volume, file);
+    }
+#endif /* (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1) */
+
+    if ((status == F_NO_ERROR) && (file->mode & RFAT_FILE_MODE_WRITE) && ((file->position & ~RFAT_BLK_MASK) != (position & ~RFAT_BLK_MASK)))
     {
 	status = rfat_data_cache_flush(volume, file);
     }
@@ -7683,7 +9986,12 @@ static int rfat_file_shrink(rfat_volume_t *volume, rfat_file_t *file)
 	     * available again.
 	     */
 		   
-	    status = rfat_cluster_chain_destroy(volume, file->first_clsno, RFAT_CLSNO_FREE);
+	    status = rfat_volume_settle(volume);
+
+	    if (status == F_NO_ERROR)
+	    {
+		status = rfat_cluster_chain_discard(volume, file->first_clsno, RFAT_CLSNO_FREE);
+	    }
 
 	    if (status == F_NO_ERROR)
 	    {
@@ -7705,7 +10013,7 @@ static int rfat_file_shrink(rfat_volume_t *volume, rfat_file_t *file)
 
 		if (status == F_NO_ERROR)
 		{
-		    status = rfat_cluster_chain_destroy(volume, file->first_clsno, RFAT_CLSNO_FREE);
+		    status = rfat_cluster_chain_discard(volume, file->first_clsno, RFAT_CLSNO_FREE);
 		}
 	    }
 #endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1) */
@@ -7730,11 +10038,13 @@ static int rfat_file_shrink(rfat_volume_t *volume, rfat_file_t *file)
 	{
 #if (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0)
 	    status = rfat_volume_dirty(volume);
+#else /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0) */
+	    status = rfat_volume_settle(volume);
+#endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0) */
 
 	    if (status == F_NO_ERROR)
-#endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0) */
 	    {
-		status = rfat_cluster_chain_destroy(volume, file->clsno, RFAT_CLSNO_END_OF_CHAIN);
+		status = rfat_cluster_chain_discard(volume, file->clsno, RFAT_CLSNO_END_OF_CHAIN);
 		
 		if (status == F_NO_ERROR)
 		{
@@ -7752,12 +10062,16 @@ static int rfat_file_shrink(rfat_volume_t *volume, rfat_file_t *file)
     {
 	if (file->length != file->position)
 	{
-	    file->flags |= RFAT_FILE_FLAG_DIR_MODIFIED;
+	    file->flags |= (RFAT_FILE_FLAG_DIR_MODIFIED | RFAT_FILE_FLAG_CHAIN_MODIFIED);
 	    file->length = file->position;
 	}
 
 	file->flags |= RFAT_FILE_FLAG_END_OF_CHAIN;
 
+#if (RFAT_CONFIG_APPEND_RESERVE_CLUSTERS != 0)
+	file->flags &= ~RFAT_FILE_FLAG_RESERVED;
+#endif /* (RFAT_CONFIG_APPEND_RESERVE_CLUSTERS != 0) */
+
 #if (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1)
 	if (file->flags & RFAT_FILE_FLAG_CONTIGUOUS)
 	{
@@ -7785,6 +10099,9 @@ static int rfat_file_extend(rfat_volume_t *volume, rfat_file_t *file, uint32_t l
 {
     int status = F_NO_ERROR;
     uint32_t clsno, clscnt, clsno_a, clsno_l, clsno_n, clsdata, blkno, blkno_e, blkcnt, count, size, position, offset, length_o;
+#if (RFAT_CONFIG_APPEND_RESERVE_CLUSTERS != 0)
+    uint32_t clscnt_n;
+#endif /* (RFAT_CONFIG_APPEND_RESERVE_CLUSTERS != 0) */
     rfat_cache_entry_t *entry;
 
     /* Compute below:
@@ -7928,10 +10245,28 @@ static int rfat_file_extend(rfat_volume_t *volume, rfat_file_t *file, uint32_t l
 			if (status == F_NO_ERROR)
 #endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0) */
 			{
+#if (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1)
+			    rfat_volume_claim(volume, file, clsno_l);
+
+#endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1) */
+#if (RFAT_CONFIG_APPEND_RESERVE_CLUSTERS != 0)
+			    /* A file opened for append gets at least RFAT_CONFIG_APPEND_RESERVE_CLUSTERS
+			     * clusters linked in one go, so that a FAT block is not rewritten for every
+			     * cluster appended. The clusters past "length" are picked up by the walk
+			     * above in later calls, and handed back by rfat_file_flush().
+			     */
+			    clscnt_n = clscnt;
+
+			    if ((file->mode & RFAT_FILE_MODE_APPEND) && (clscnt < RFAT_CONFIG_APPEND_RESERVE_CLUSTERS))
+			    {
+				clscnt = RFAT_CONFIG_APPEND_RESERVE_CLUSTERS;
+			    }
+#endif /* (RFAT_CONFIG_APPEND_RESERVE_CLUSTERS != 0) */
+
 #if (RFAT_CONFIG_SEQUENTIAL_SUPPORTED == 1)
 			  if (1 || (file->mode & RFAT_FILE_MODE_SEQUENTIAL))
 			    {
-				status = rfat_cluster_chain_create_sequential(volume, clsno_l, clscnt, &clsno_a, &clsno_l);
+				status = rfat_cluster_chain_create_sequential(volume, file, clsno_l, clscnt, &clsno_a, &clsno_l);
 			    }
 			    else
 #endif /* (RFAT_CONFIG_SEQUENTIAL_SUPPORTED == 1) */
@@ -7939,6 +10274,27 @@ static int rfat_file_extend(rfat_volume_t *volume, rfat_file_t *file, uint32_t l
 				status = rfat_cluster_chain_create(volume, clsno_l, clscnt, &clsno_a, &clsno_l);
 			    }
 
+			    if (status == F_NO_ERROR)
+			    {
+				file->flags |= RFAT_FILE_FLAG_CHAIN_MODIFIED;
+
+#if (RFAT_CONFIG_APPEND_RESERVE_CLUSTERS != 0)
+				if (clscnt != clscnt_n)
+				{
+				    /* "clsno_l" has to be the cluster at "length", not the end of the chain.
+				     */
+				    file->flags = (file->flags & ~RFAT_FILE_FLAG_END_OF_CHAIN) | RFAT_FILE_FLAG_RESERVED;
+
+				    clsno_l = clsno_a;
+
+				    if (clscnt_n > 1)
+				    {
+					status = rfat_cluster_chain_seek(volume, clsno_a, (clscnt_n -1), &clsno_l);
+				    }
+				}
+#endif /* (RFAT_CONFIG_APPEND_RESERVE_CLUSTERS != 0) */
+			    }
+
 			    if (clsno_n == RFAT_CLSNO_NONE)
 			    {
 				clsno_n = clsno_a;
@@ -8178,9 +10534,15 @@ static int rfat_file_reserve(rfat_volume_t *volume, rfat_file_t *file, uint32_t
 
 #if (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0)
     status = rfat_volume_dirty(volume);
+#else /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0) */
+    /* The contiguous chain gets hooked up back to front, so its head is only known at
+     * the end. Within a f_begin()/f_commit() group the log gets cleared first instead
+     * (see rfat_volume_reclaim()).
+     */
+    status = rfat_volume_settle(volume);
+#endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0) */
 
     if (status == F_NO_ERROR)
-#endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0) */
     {
 	status = rfat_cluster_chain_create_contiguous(volume, clscnt, &clsno_a);
 
@@ -8207,31 +10569,25 @@ static int rfat_file_reserve(rfat_volume_t *volume, rfat_file_t *file, uint32_t
 
 #endif /* (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1) */
 
-static int rfat_file_open(rfat_volume_t *volume, const char *filename, uint32_t mode, uint32_t size, rfat_file_t **p_file)
+static rfat_file_t * rfat_file_allocate(rfat_volume_t *volume)
 {
-    int status = F_NO_ERROR;
-    uint32_t clsno, clsno_d, index, count;
-    uint16_t ctime, cdate;
-#if (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1)
-    uint32_t clscnt, clsdata;
-#endif /* (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1) */
 #if (RFAT_CONFIG_MAX_FILES == 1)
+
     rfat_file_t *file;
-#else /* (RFAT_CONFIG_MAX_FILES == 1) */
-    rfat_file_t *file, *file_s, *file_e, *file_o;
-#endif /* (RFAT_CONFIG_MAX_FILES == 1) */
-    rfat_dir_t *dir;
 
     file = NULL;
 
-#if (RFAT_CONFIG_MAX_FILES == 1)
-
     if (!volume->file_table[0].mode)
     {
 	file = &volume->file_table[0];
     }
+
 #else /* (RFAT_CONFIG_MAX_FILES == 1) */
 
+    rfat_file_t *file, *file_s, *file_e;
+
+    file = NULL;
+
     file_s = &volume->file_table[0];
     file_e = &volume->file_table[RFAT_CONFIG_MAX_FILES];
 
@@ -8243,7 +10599,7 @@ static int rfat_file_open(rfat_volume_t *volume, const char *filename, uint32_t
             break;
         }
 
-	file++;
+	file_s++;
     }
     while (file_s < file_e);
 
@@ -8252,15 +10608,234 @@ static int rfat_file_open(rfat_volume_t *volume, const char *filename, uint32_t
     if (file)
     {
 	file->flags = 0;
+	file->option = 0;
 
-	if ((mode & RFAT_FILE_MODE_WRITE) && (volume->flags & RFAT_VOLUME_FLAG_WRITE_PROTECTED))
-	{
-	    status = F_ERR_WRITEPROTECT;
-	}
-	else
-	{
-	    status = rfat_path_find_directory(volume, filename, &filename, &clsno_d);
-	
+#if (RFAT_CONFIG_SEQUENTIAL_SUPPORTED == 1) && (RFAT_CONFIG_MAX_FILES > 1)
+	file->base_clsno = volume->start_clsno;
+	file->limit_clsno = volume->start_clsno;
+	file->free_clsno = volume->start_clsno;
+#endif /* (RFAT_CONFIG_SEQUENTIAL_SUPPORTED == 1) && (RFAT_CONFIG_MAX_FILES > 1) */
+    }
+
+    return file;
+}
+
+static void rfat_file_attach(rfat_volume_t *volume, rfat_file_t *file, uint32_t clsno, uint32_t index, rfat_dir_t *dir)
+{
+    file->dir_clsno = clsno;
+    file->dir_index = index;
+    file->length = RFAT_FTOHL(dir->dir_file_size);
+    file->attr = dir->dir_attr;
+    file->crt_time = RFAT_FTOHS(dir->dir_crt_time);
+    file->crt_date = RFAT_FTOHS(dir->dir_crt_date);
+    file->wrt_time = RFAT_FTOHS(dir->dir_wrt_time);
+    file->wrt_date = RFAT_FTOHS(dir->dir_wrt_date);
+    file->acc_date = RFAT_FTOHS(dir->dir_acc_date);
+			    
+    if (volume->type == RFAT_VOLUME_TYPE_FAT32)
+    {
+	file->first_clsno = ((uint32_t)RFAT_FTOHS(dir->dir_clsno_hi) << 16) | (uint32_t)RFAT_FTOHS(dir->dir_clsno_lo);
+    }
+    else
+    {
+	file->first_clsno = (uint32_t)RFAT_FTOHS(dir->dir_clsno_lo);
+    }
+}
+
+/* rfat_file_setup() is called once file->dir_clsno/file->dir_index/file->length/file->first_clsno
+ * are known. It checks for conflicting open instances and then performs the truncation/reservation/append
+ * processing common to rfat_file_open() and rfat_file_open_find().
+ */
+
+static int rfat_file_setup(rfat_volume_t *volume, rfat_file_t *file, uint32_t mode, uint32_t size)
+{
+    int status = F_NO_ERROR;
+#if (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1)
+    uint32_t clsno, clscnt, clsdata;
+#endif /* (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1) */
+#if (RFAT_CONFIG_MAX_FILES != 1)
+    rfat_file_t *file_o;
+
+    file_o = NULL;
+
+    do
+    {
+	file_o = rfat_file_enumerate(volume, file_o, file->dir_clsno, file->dir_index);
+
+	if (file_o != NULL)
+	{
+	    if (mode & RFAT_FILE_MODE_WRITE)
+	    {
+		status = F_ERR_LOCKED;
+	    }
+	    else
+	    {
+		if (file_o->mode & RFAT_FILE_MODE_WRITE)
+		{
+		    status = F_ERR_LOCKED;
+		}
+	    }
+	}
+    }
+    while ((status == F_NO_ERROR) && (file_o != NULL));
+#endif /* (RFAT_CONFIG_MAX_FILES != 1) */
+
+    if (status == F_NO_ERROR)
+    {
+	file->status = F_NO_ERROR;
+	file->position = 0;
+	file->last_clsno = RFAT_CLSNO_NONE;
+
+	if (file->first_clsno == RFAT_CLSNO_NONE)
+	{
+	    file->flags |= RFAT_FILE_FLAG_END_OF_CHAIN;
+	    file->clsno = RFAT_CLSNO_NONE;
+	    file->blkno = RFAT_BLKNO_INVALID;
+	    file->blkno_e = RFAT_BLKNO_INVALID;
+	}
+	else
+	{
+	    file->clsno = file->first_clsno;
+	    file->blkno = RFAT_CLSNO_TO_BLKNO(file->clsno);
+	    file->blkno_e = file->blkno + volume->cls_blk_size;
+	}
+
+	if (mode & RFAT_FILE_MODE_TRUNCATE)
+	{
+	    file->length = 0;
+
+	    status = rfat_file_shrink(volume, file);
+	}
+
+#if (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1)
+	if (size)
+	{
+	    if (file->first_clsno == RFAT_CLSNO_NONE)
+	    {
+		status = rfat_file_reserve(volume, file, size);
+	    }
+	    else
+	    {
+		clsno = file->first_clsno;
+		clscnt = 1;
+
+		do
+		{
+		    status = rfat_cluster_read(volume, clsno, &clsdata);
+					    
+		    if (status == F_NO_ERROR)
+		    {
+			if ((clsdata >= 2) && (clsdata <= volume->last_clsno))
+			{
+			    if ((clsno +1) == clsdata)
+			    {
+				clsno++;
+				clscnt++;
+			    }
+			    else
+			    {
+				status = F_ERR_EOF;
+			    }
+
+			}
+			else
+			{
+			    if (clsdata < RFAT_CLSNO_LAST)
+			    {
+				status = F_ERR_EOF;
+			    }
+			}
+		    }
+		}
+		while ((status == F_NO_ERROR) && (clsdata < RFAT_CLSNO_LAST));
+
+		if (status == F_NO_ERROR)
+		{
+		    if (clscnt >= RFAT_SIZE_TO_CLSCNT(size))
+		    {
+			file->flags |= (RFAT_FILE_FLAG_CONTIGUOUS | RFAT_FILE_FLAG_END_OF_CHAIN);
+			file->last_clsno = file->first_clsno + clscnt -1;
+
+			if (size >= (RFAT_FILE_SIZE_MAX & ~volume->cls_mask))
+			{
+			    file->size = RFAT_FILE_SIZE_MAX;
+			}
+			else
+			{
+			    file->size = (size + volume->cls_mask) & ~volume->cls_mask;
+			}
+		    }
+		    else
+		    {
+			status = F_ERR_EOF;
+		    }
+		}
+	    }
+	}
+#endif /* (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1) */
+			    
+	if (status == F_NO_ERROR)
+	{
+	    if (mode & RFAT_FILE_MODE_APPEND)
+	    {
+		status = rfat_file_seek(volume, file, file->length);
+	    }
+				
+	    if (status == F_NO_ERROR)
+	    {
+#if (RFAT_CONFIG_FILE_DATA_CACHE == 1)
+		file->data_cache.blkno = RFAT_BLKNO_INVALID;
+#endif /* (RFAT_CONFIG_FILE_DATA_CACHE == 1) */
+
+		if (mode & RFAT_FILE_MODE_DIRECT)
+		{
+		    file->flags |= RFAT_FILE_FLAG_DIRECT;
+		}
+
+		if (mode & RFAT_FILE_MODE_NONBLOCK)
+		{
+		    file->option |= RFAT_FILE_OPTION_NONBLOCK;
+		}
+
+#if (RFAT_CONFIG_COMMIT_POLICY_SUPPORTED == 1)
+		file->commit_policy = F_COMMIT_NONE;
+#endif /* (RFAT_CONFIG_COMMIT_POLICY_SUPPORTED == 1) */
+
+#if (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1)
+		file->stream_data = NULL;
+		file->stream_size = 0;
+		file->stream_index = 0;
+		file->stream_count = 0;
+#endif /* (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1) */
+
+		file->mode = mode;
+	    }
+	}
+    }
+
+    return status;
+}
+
+static int rfat_file_open(rfat_volume_t *volume, const char *filename, uint32_t mode, uint32_t size, rfat_file_t **p_file)
+{
+    int status = F_NO_ERROR;
+    uint32_t clsno, clsno_d, index, count;
+    uint16_t ctime, cdate;
+    rfat_file_t *file;
+    rfat_dir_t *dir;
+
+    file = rfat_file_allocate(volume);
+
+    if (file)
+    {
+	if ((mode & RFAT_FILE_MODE_WRITE) && (volume->flags & RFAT_VOLUME_FLAG_WRITE_PROTECTED))
+	{
+	    status = F_ERR_WRITEPROTECT;
+	}
+	else
+	{
+	    status = rfat_path_find_directory(volume, filename, &filename, &clsno_d);
+	
 	    if (status == F_NO_ERROR)
 	    {
 		status = rfat_path_convert_filename(volume, filename, NULL);
@@ -8309,18 +10884,7 @@ static int rfat_file_open(rfat_volume_t *volume, const char *filename, uint32_t
 				}
 #endif /* (RFAT_CONFIG_VFAT_SUPPORTED == 1) */
 
-				file->dir_clsno = clsno;
-				file->dir_index = index;
-				file->length = RFAT_FTOHL(dir->dir_file_size);
-			    
-				if (volume->type == RFAT_VOLUME_TYPE_FAT32)
-				{
-				    file->first_clsno = ((uint32_t)RFAT_FTOHS(dir->dir_clsno_hi) << 16) | (uint32_t)RFAT_FTOHS(dir->dir_clsno_lo);
-				}
-				else
-				{
-				    file->first_clsno = (uint32_t)RFAT_FTOHS(dir->dir_clsno_lo);
-				}
+				rfat_file_attach(volume, file, clsno, index, dir);
 			    }
 			}
 			else
@@ -8349,6 +10913,12 @@ static int rfat_file_open(rfat_volume_t *volume, const char *filename, uint32_t
 				    file->dir_index = index;
 				    file->length = 0;
 				    file->first_clsno = RFAT_CLSNO_NONE;
+				    file->attr = 0;
+				    file->crt_time = (volume->type == RFAT_VOLUME_TYPE_FAT32) ? ctime : 0;
+				    file->crt_date = (volume->type == RFAT_VOLUME_TYPE_FAT32) ? cdate : 0;
+				    file->wrt_time = ctime;
+				    file->wrt_date = cdate;
+				    file->acc_date = 0;
 				}
 			    }
 			    else
@@ -8359,143 +10929,7 @@ static int rfat_file_open(rfat_volume_t *volume, const char *filename, uint32_t
 
 			if (status == F_NO_ERROR)
 			{
-
-#if (RFAT_CONFIG_MAX_FILES != 1)
-			    file_o = NULL;
-
-			    do
-			    {
-				file_o = rfat_file_enumerate(volume, file_o, clsno, index);
-
-				if (file_o != NULL)
-				{
-				    if (mode & RFAT_FILE_MODE_WRITE)
-				    {
-					status = F_ERR_LOCKED;
-				    }
-				    else
-				    {
-					if (file_o->mode & RFAT_FILE_MODE_WRITE)
-					{
-					    status = F_ERR_LOCKED;
-					}
-				    }
-				}
-			    }
-			    while ((status == F_NO_ERROR) && (file_o != NULL));
-#endif /* (RFAT_CONFIG_MAX_FILES != 1) */
-
-			    if (status == F_NO_ERROR)
-			    {
-				file->status = F_NO_ERROR;
-				file->position = 0;
-				file->last_clsno = RFAT_CLSNO_NONE;
-
-				if (file->first_clsno == RFAT_CLSNO_NONE)
-				{
-				    file->flags |= RFAT_FILE_FLAG_END_OF_CHAIN;
-				    file->clsno = RFAT_CLSNO_NONE;
-				    file->blkno = RFAT_BLKNO_INVALID;
-				    file->blkno_e = RFAT_BLKNO_INVALID;
-				}
-				else
-				{
-				    file->clsno = file->first_clsno;
-				    file->blkno = RFAT_CLSNO_TO_BLKNO(file->clsno);
-				    file->blkno_e = file->blkno + volume->cls_blk_size;
-				}
-
-				if (mode & RFAT_FILE_MODE_TRUNCATE)
-				{
-				    file->length = 0;
-
-				    status = rfat_file_shrink(volume, file);
-				}
-
-#if (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1)
-				if (size)
-				{
-				    if (file->first_clsno == RFAT_CLSNO_NONE)
-				    {
-					status = rfat_file_reserve(volume, file, size);
-				    }
-				    else
-				    {
-					clsno = file->first_clsno;
-					clscnt = 0;
-
-					do
-					{
-					    status = rfat_cluster_read(volume, clsno, &clsdata);
-					    
-					    if (status == F_NO_ERROR)
-					    {
-						if ((clsdata >= 2) && (clsdata <= volume->last_clsno))
-						{
-						    if ((clsno +1) == clsdata)
-						    {
-							clsno++;
-							clscnt++;
-						    }
-						    else
-						    {
-							status = F_ERR_EOF;
-						    }
-
-						}
-						else
-						{
-						    if (clsdata < RFAT_CLSNO_LAST)
-						    {
-							status = F_ERR_EOF;
-						    }
-						}
-					    }
-					}
-					while ((status == F_NO_ERROR) && (clsdata < RFAT_CLSNO_LAST));
-
-					if (status == F_NO_ERROR)
-					{
-					    if (clscnt == RFAT_SIZE_TO_CLSCNT(size))
-					    {
-						file->flags |= (RFAT_FILE_FLAG_CONTIGUOUS | RFAT_FILE_FLAG_END_OF_CHAIN);
-						file->last_clsno = file->first_clsno + clscnt -1;
-
-						if (size >= (RFAT_FILE_SIZE_MAX & ~volume->cls_mask))
-						{
-						    file->size = RFAT_FILE_SIZE_MAX;
-						}
-						else
-						{
-						    file->size = (size + volume->cls_mask) & ~volume->cls_mask;
-						}
-					    }
-					    else
-					    {
-						status = F_ERR_EOF;
-					    }
-					}
-				    }
-				}
-#endif /* (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1) */
-			    
-				if (status == F_NO_ERROR)
-				{
-				    if (mode & RFAT_FILE_MODE_APPEND)
-				    {
-					status = rfat_file_seek(volume, file, file->length);
-				    }
-				
-				    if (status == F_NO_ERROR)
-				    {
-#if (RFAT_CONFIG_FILE_DATA_CACHE == 1)
-					file->data_cache.blkno = RFAT_BLKNO_INVALID;
-#endif /* (RFAT_CONFIG_FILE_DATA_CACHE == 1) */
-
-					file->mode = mode;
-				    }
-				}
-			    }
+			    status = rfat_file_setup(volume, file, mode, size);
 			}
 		    }
 		}
@@ -8512,2160 +10946,4708 @@ static int rfat_file_open(rfat_volume_t *volume, const char *filename, uint32_t
     return status;
 }
 
-static int rfat_file_close(rfat_volume_t *volume, rfat_file_t *file)
+/* rfat_file_open_find() opens the file reported back by the last f_findfirst()/f_findnext().
+ * The primary dir entry is located directly via find->find_clsno/find->find_index, and
+ * validated against the recorded find->name/find->ext. There is no path resolution and
+ * no directory scan involved.
+ */
+
+static int rfat_file_open_find(rfat_volume_t *volume, F_FIND *find, uint32_t mode, uint32_t size, rfat_file_t **p_file)
 {
     int status = F_NO_ERROR;
+    uint32_t clsno, index, blkno;
+    rfat_cache_entry_t *entry;
+    rfat_file_t *file;
+    rfat_dir_t *dir;
 
-    if (file->mode & RFAT_FILE_MODE_WRITE)
-    {
-	status = rfat_file_flush(volume, file, TRUE);
-    }
-
-    file->mode = 0;
-    file->dir_clsno = RFAT_CLSNO_NONE;
-    file->dir_index = 0;
-
-    return status;
-}
-
-static int rfat_file_read(rfat_volume_t *volume, rfat_file_t *file, uint8_t *data, uint32_t count, uint32_t *p_count)
-{
-    int status = F_NO_ERROR;
-    uint32_t blkno, blkno_e, blkcnt, clsno, position, total, size;
-    rfat_cache_entry_t *entry;
-
-    *p_count = 0;
-
-    if (file->position >= file->length)
-    {
-	count = 0;
-    }
-    else
-    {
-	if (count > (file->length - file->position))
-	{
-	    count = (file->length - file->position);
-	}
-    }
+    file = rfat_file_allocate(volume);
 
-    if (count != 0)
+    if (file)
     {
-	total = count;
-
-        position = file->position;
-        clsno = file->clsno;
-        blkno = file->blkno;
-        blkno_e = file->blkno_e;
-
-	/* Take care of the case where there is an empty cluster chain,
-	 * but file->length is not 0.
-	 */
-	if (clsno == RFAT_CLSNO_NONE)
+	if ((mode & RFAT_FILE_MODE_WRITE) && (volume->flags & RFAT_VOLUME_FLAG_WRITE_PROTECTED))
 	{
-	    status = F_ERR_EOF;
+	    status = F_ERR_WRITEPROTECT;
 	}
-        else
+	else
 	{
-	    if (blkno == blkno_e)
+	    if ((find->find_clsno == RFAT_CLSNO_END_OF_CHAIN) || (find->find_index == 0))
 	    {
-#if (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1)
-		if (file->flags & RFAT_FILE_FLAG_CONTIGUOUS)
+		status = F_ERR_NOTFOUND;
+	    }
+	    else
+	    {
+		/* rfat_path_find_next() leaves find->find_index pointing to the entry
+		 * past the primary dir entry.
+		 */
+		clsno = find->find_clsno;
+		index = find->find_index -1;
+
+		if (clsno == RFAT_CLSNO_NONE)
 		{
-		    clsno++;
-		    blkno_e += volume->cls_blk_size;
+		    blkno = volume->root_blkno + RFAT_INDEX_TO_BLKCNT_ROOT(index);
 		}
 		else
-#endif /* (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1) */
 		{
-		    status = rfat_cluster_chain_seek(volume, clsno, 1, &clsno);
-
-		    if (status == F_NO_ERROR)
-		    {
-			blkno = RFAT_CLSNO_TO_BLKNO(clsno);
-			blkno_e = blkno + volume->cls_blk_size;
-		    }
+		    blkno = RFAT_CLSNO_TO_BLKNO(clsno) + RFAT_INDEX_TO_BLKCNT(index);
 		}
-	    }
-	}
-
-        if (status == F_NO_ERROR)
-        {
-            if (((position & RFAT_BLK_MASK) + count) < RFAT_BLK_SIZE)
-            {
-                status = rfat_data_cache_read(volume, file, blkno, &entry);
-	    
-                if (status == F_NO_ERROR)
-                {
-                    memcpy(data, entry->data + (position & RFAT_BLK_MASK), count);
-
-                    position += count;
-                    count = 0;
-
-                    if (!(position & RFAT_BLK_MASK))
-                    {
-                        blkno++;
-                    }
-                }
-            }
-            else
-            {
-                if (position & RFAT_BLK_MASK)
-                {
-                    status = rfat_data_cache_read(volume, file, blkno, &entry);
-	    
-                    if (status == F_NO_ERROR)
-                    {
-                        size = (RFAT_BLK_SIZE - (position & RFAT_BLK_MASK));
-
-                        memcpy(data, entry->data + (RFAT_BLK_SIZE - size), size);
 
-                        position += size;
-                        data += size;
-                        count -= size;
+		status = rfat_dir_cache_read(volume, blkno, &entry);
 
-                        blkno++;
-                    }
-                }
+		if (status == F_NO_ERROR)
+		{
+		    dir = (rfat_dir_t*)((void*)(entry->data + RFAT_INDEX_TO_BLKOFS(index)));
 
-                while ((status == F_NO_ERROR) && (count != 0))
-                {
-                    if (blkno == blkno_e)
-                    {
-#if (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1)
-			if (file->flags & RFAT_FILE_FLAG_CONTIGUOUS)
-			{
-			    clsno++;
-			    blkno_e += volume->cls_blk_size;
-			}
-			else
-#endif /* (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1) */
-			{
-			    status = rfat_cluster_chain_seek(volume, clsno, 1, &clsno);
-			    
-			    if (status == F_NO_ERROR)
-			    {
-				blkno = RFAT_CLSNO_TO_BLKNO(clsno);
-				blkno_e = blkno + volume->cls_blk_size;
-			    }
-			}
+		    if ((dir->dir_name[0] == 0x00) ||
+			(dir->dir_name[0] == 0xe5) ||
+			((dir->dir_attr & RFAT_DIR_ATTR_LONG_NAME_MASK) == RFAT_DIR_ATTR_LONG_NAME) ||
+			(dir->dir_attr & RFAT_DIR_ATTR_VOLUME_ID) ||
+			memcmp(&dir->dir_name[0], &find->name[0], (F_MAXNAME+F_MAXEXT)))
+		    {
+			/* The directory got modified since the f_findfirst()/f_findnext().
+			 */
+			status = F_ERR_NOTFOUND;
 		    }
-                
-                    if (status == F_NO_ERROR)
-                    {
-                        if (count < RFAT_BLK_SIZE)
-                        {
-                            status = rfat_data_cache_read(volume, file, blkno, &entry);
-                    
-                            if (status == F_NO_ERROR)
-                            {
-                                memcpy(data, entry->data, count);
-
-                                position += count;
-                                data += count;
-                                count = 0;
-                            }
-                        }
-                        else
-                        {
-			    size = volume->cls_size - (position & volume->cls_mask);
-                            
-                            if (size > count)
-                            {
-                                size = count & ~RFAT_BLK_MASK;
-                            }
-
-                            blkcnt = size >> RFAT_BLK_SHIFT;
-
-                            status = rfat_data_cache_flush(volume, file);
-
-                            if (status == F_NO_ERROR)
-                            {
-                                status = rfat_disk_read_sequential(volume->disk, blkno, blkcnt, data);
-
-#if (RFAT_CONFIG_MEDIA_FAILURE_SUPPORTED == 1)
-				if (status == F_ERR_INVALIDSECTOR)
-				{
-				    volume->flags |= RFAT_VOLUME_FLAG_MEDIA_FAILURE;
-				}
-#endif /* (RFAT_CONFIG_MEDIA_FAILURE_SUPPORTED == 1) */
-
-                                if (status == F_NO_ERROR)
-                                {
-                                    position += size;
-                                    data += size;
-                                    count -= size;
-
-                                    blkno += blkcnt;
-                                }
-
-				/* After any data related disk operation, "file->status" needs
-				 * to be checked asynchronously for a previous error.
-				 */
-				if (file->status != F_NO_ERROR)
-				{
-				    status = file->status;
-				}
-                            }
-                        }
-                    }
-                }
-            }
-        
-            if (status == F_NO_ERROR)
-            {
-                file->position = position;
-                file->clsno = clsno;
-                file->blkno = blkno;
-                file->blkno_e = blkno_e;
-            }
-        }
+		    else if (dir->dir_attr & RFAT_DIR_ATTR_DIRECTORY)
+		    {
+			status = F_ERR_INVALIDDIR;
+		    }
+		    else if ((mode & RFAT_FILE_MODE_WRITE) && (dir->dir_attr & RFAT_DIR_ATTR_READ_ONLY))
+		    {
+			status = F_ERR_ACCESSDENIED;
+		    }
+		    else
+		    {
+			rfat_file_attach(volume, file, clsno, index, dir);
 
-	*p_count = total - count;
+			status = rfat_file_setup(volume, file, mode, size);
+		    }
+		}
+	    }
+	}
     }
-
-    if (file->status == F_NO_ERROR)
+    else
     {
-	file->status = status;
+	status = F_ERR_NOMOREENTRY;
     }
 
+    *p_file = file;
+
     return status;
 }
 
-static int rfat_file_write(rfat_volume_t *volume, rfat_file_t *file, const uint8_t *data, uint32_t count, uint32_t *p_count)
+static int rfat_file_mode(const char *type, uint32_t *p_mode, uint32_t *p_size)
 {
     int status = F_NO_ERROR;
-    uint32_t blkno, blkno_e, blkcnt, clsno, offset, position, length, total, size;
-    rfat_cache_entry_t *entry;
-
-    *p_count = 0;
+    int c;
+    uint32_t mode, size;
 
-    if ((file->mode & RFAT_FILE_MODE_APPEND) && (file->position != file->length))
-    {
-	status = rfat_file_seek(volume, file, file->length);
-    }
+    mode = 0;
+    size = 0;
 
-    if (status == F_NO_ERROR)
+    while ((status == F_NO_ERROR) && (c = *type++))
     {
-#if (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1)
-	if (file->flags & RFAT_FILE_FLAG_CONTIGUOUS)
+	if ((c == 'r') || (c == 'w') || (c == 'a'))
 	{
-	    if (file->size < file->position)
+	    if (!(mode & (RFAT_FILE_MODE_READ | RFAT_FILE_MODE_WRITE)))
 	    {
-		status = F_ERR_EOF;
+		if (c == 'r')
+		{
+		    mode = RFAT_FILE_MODE_READ;
+		}
+		else if (c == 'w')
+		{
+		    mode = RFAT_FILE_MODE_WRITE | RFAT_FILE_MODE_CREATE | RFAT_FILE_MODE_TRUNCATE;
+		}
+		else
+		{
+		    mode = RFAT_FILE_MODE_WRITE | RFAT_FILE_MODE_CREATE | RFAT_FILE_MODE_APPEND;
+		}
+		
+		if (*type == '+')
+		{
+		    mode |= (RFAT_FILE_MODE_READ | RFAT_FILE_MODE_WRITE);
+		    type++;
+		}
 	    }
 	    else
 	    {
-		if (count > (file->size - file->position))
-		{
-		    count = (file->size - file->position);
-		}
+		status = F_ERR_NOTUSEABLE;
 	    }
 	}
-	else
-#endif /* (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1) */
+	else if (c == 'c')
 	{
-	    if (count > (RFAT_FILE_SIZE_MAX - file->position))
-	    {
-		count = (RFAT_FILE_SIZE_MAX - file->position);
-	    }
+	    mode |= RFAT_FILE_MODE_COMMIT;
 	}
-
-	if (status == F_NO_ERROR)
+	else if (c == 'S')
 	{
-	    if (count != 0)
+	    mode &= ~RFAT_FILE_MODE_RANDOM;
+	    mode |= RFAT_FILE_MODE_SEQUENTIAL;
+	}
+	else if (c == 'R')
+	{
+	    mode &= ~RFAT_FILE_MODE_SEQUENTIAL;
+	    mode |= RFAT_FILE_MODE_RANDOM;
+	}
+	else if (c == 'D')
+	{
+	    mode |= RFAT_FILE_MODE_DIRECT;
+	}
+	else if (c == 'N')
+	{
+	    mode |= RFAT_FILE_MODE_NONBLOCK;
+	}
+#if (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1)
+	else if ((c == ',') && (*type != '\0'))
+	{
+	    /* ",<size>". Make sure that <size> does not overflow
+	     * RFAT_FILE_SIZE_MAX.
+	     */
+	    while ((status == F_NO_ERROR) && (*type != '\0'))
 	    {
-		file->flags |= RFAT_FILE_FLAG_DATA_MODIFIED;
+		c = *type++;
 
-		total  = count;
-		offset = (file->length + RFAT_BLK_MASK) & ~RFAT_BLK_MASK;
-		length = file->position + count;
+		if ((c >= '0') && (c <= '9'))
+		{
+		    if (size >= (RFAT_FILE_SIZE_MAX / 10u))
+		    {
+			size = RFAT_FILE_SIZE_MAX;
+		    }
+		    else
+		    {
+			size = size * 10u;
 
-		if (length > file->length)
+			if (size >= (RFAT_FILE_SIZE_MAX - (c - '0')))
+			{
+			    size = RFAT_FILE_SIZE_MAX;
+			}
+			else
+			{
+			    size += (c - '0');
+			}
+		    }
+		}
+		else if ((c == 'K') && (*type == '\0'))
 		{
-		    if ((file->length == 0) || (file->length != file->position) || (((file->length -1) & ~volume->cls_mask) != ((length -1) & ~volume->cls_mask)))
+		    if (size >= (RFAT_FILE_SIZE_MAX / 1024u))
 		    {
-			status = rfat_file_extend(volume, file, length);
+			size = RFAT_FILE_SIZE_MAX;
 		    }
 		    else
 		    {
-			file->length = length;
-			file->flags |= RFAT_FILE_FLAG_DIR_MODIFIED;
+			size = size * 1024u;
 		    }
 		}
-
-		if (status == F_NO_ERROR)
+		else if ((c == 'M') && (*type == '\0'))
 		{
-		    position = file->position;
-		    clsno = file->clsno;
-		    blkno = file->blkno;
-		    blkno_e = file->blkno_e;
-
-		    /* Take care of the case where the cluster chain of a file was truncted,
-		     * but the length was not adjusted on disk.
-		     */
-		    if (clsno == RFAT_CLSNO_NONE)
+		    if (size >= (RFAT_FILE_SIZE_MAX / 1048576u))
 		    {
-			status = F_ERR_EOF;
+			size = RFAT_FILE_SIZE_MAX;
 		    }
 		    else
 		    {
-			if (blkno == blkno_e)
-			{
-			    status = rfat_data_cache_flush(volume, file);
-
-			    if (status == F_NO_ERROR)
-			    {
-#if (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1)
-				if (file->flags & RFAT_FILE_FLAG_CONTIGUOUS)
-				{
-				    clsno++;
-				    blkno_e += volume->cls_blk_size;
-				}
-				else
-#endif /* (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1) */
-				{
-				    status = rfat_cluster_chain_seek(volume, clsno, 1, &clsno);
-			
-				    if (status == F_NO_ERROR)
-				    {
-					blkno = RFAT_CLSNO_TO_BLKNO(clsno);
-					blkno_e = blkno + volume->cls_blk_size;
-				    }
-				}
-			    }
-			}
+			size = size * 1048576u;
 		    }
-
-		    if (status == F_NO_ERROR)
+		}
+		else if ((c == 'G') && (*type == '\0'))
+		{
+		    if (size >= (RFAT_FILE_SIZE_MAX / 1073741824u))
 		    {
-			if (((position & RFAT_BLK_MASK) + count) < RFAT_BLK_SIZE)
-			{
-			    /* All data is within one block, simply go throu the cache.
-			     * If the block is beyond the old file->length, is has to 
-			     * be all zeros. Otherwise got throu the normal cache.
-			     */
+			size = RFAT_FILE_SIZE_MAX;
+		    }
+		    else
+		    {
+			size = size * 1073741824u;
+		    }
+		}
+		else
+		{
+		    status = F_ERR_NOTUSEABLE;
+		}
+	    }
+	}
+#endif /* (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1) */
+	else
+	{
+	    status = F_ERR_NOTUSEABLE;
+	}
+    }
 
-			    if (position >= offset)
-			    {
-				status = rfat_data_cache_zero(volume, file, blkno, &entry);
-			    }
-			    else
-			    {
-				status = rfat_data_cache_read(volume, file, blkno, &entry);
-			    }
-	    
-			    if (status == F_NO_ERROR)
-			    {
-				memcpy(entry->data + (position & RFAT_BLK_MASK), data, count);
+    if ((status == F_NO_ERROR) && !(mode & (RFAT_FILE_MODE_READ | RFAT_FILE_MODE_WRITE)))
+    {
+        status = F_ERR_NOTUSEABLE;
+    }
 
-				rfat_data_cache_modify(volume, file);
+    *p_mode = mode;
+    *p_size = size;
 
-				position += count;
-				count = 0;
+    return status;
+}
 
-				if (!(position & RFAT_BLK_MASK))
-				{
-				    blkno++;
-				}
-			    }
-			}
-			else
-			{
-			    if (position & RFAT_BLK_MASK)
-			    {
-				size = (RFAT_BLK_SIZE - (position & RFAT_BLK_MASK));
+static int rfat_file_close(rfat_volume_t *volume, rfat_file_t *file)
+{
+    int status = F_NO_ERROR;
 
-				if (position >= offset)
-				{
-				    status = rfat_data_cache_zero(volume, file, blkno, &entry);
-				}
-				else
-				{ 
-				    status = rfat_data_cache_read(volume, file, blkno, &entry);
-				}
+    if (file->mode & RFAT_FILE_MODE_WRITE)
+    {
+	status = rfat_file_flush(volume, file, TRUE);
+    }
 
-				if (status == F_NO_ERROR)
-				{
-				    memcpy(entry->data + (RFAT_BLK_SIZE - size), data, size);
-				
-				    rfat_data_cache_modify(volume, file);
+#if (RFAT_CONFIG_WRITE_RESERVE_SIZE != 0)
+    if (volume->reserve_file == file)
+    {
+	volume->reserve_file = NULL;
+    }
+#endif /* (RFAT_CONFIG_WRITE_RESERVE_SIZE != 0) */
 
-				    if (size < count)
-				    {
-					status = rfat_data_cache_write(volume, file);
-				    }
+#if (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1)
+    file->stream_data = NULL;
+    file->stream_size = 0;
+    file->stream_index = 0;
+    file->stream_count = 0;
+#endif /* (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1) */
 
-				    if (status == F_NO_ERROR)
-				    {
-					position += size;
-					data += size;
-					count -= size;
-                                    
-					blkno++;
-				    }
-				}
-			    }
+    file->mode = 0;
+    file->dir_clsno = RFAT_CLSNO_NONE;
+    file->dir_index = 0;
 
-			    while ((status == F_NO_ERROR) && (count != 0))
-			    {
-				if (blkno == blkno_e)
-				{
-				    status = rfat_data_cache_flush(volume, file);
+    return status;
+}
 
-				    if (status == F_NO_ERROR)
-				    {
-#if (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1)
-					if (file->flags & RFAT_FILE_FLAG_CONTIGUOUS)
-					{
-					    clsno++;
-					    blkno_e += volume->cls_blk_size;
-					}
-					else
-#endif /* (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1) */
-					{
-					    status = rfat_cluster_chain_seek(volume, clsno, 1, &clsno);
-					
-					    if (status == F_NO_ERROR)
-					    {
-						blkno = RFAT_CLSNO_TO_BLKNO(clsno);
-						blkno_e = blkno + volume->cls_blk_size;
-					    }
-					}
-				    }
-				}
+/* A direct transfer has to start at a block boundary and cover whole blocks in the caller's
+ * buffer. A direct write must not leave a gap past the end of the file either, which would be
+ * zeroed throu the data cache. A file opened for append is written at the end of the file.
+ */
 
-				if (status == F_NO_ERROR)
-				{
-				    if (count < RFAT_BLK_SIZE)
-				    {
-					if (position >= offset)
-					{
-					    status = rfat_data_cache_zero(volume, file, blkno, &entry);
-					}
-					else
-					{
-					    status = rfat_data_cache_read(volume, file, blkno, &entry);
-					}
+static int rfat_file_direct_check(rfat_file_t *file, uint32_t count, int write)
+{
+    int status = F_NO_ERROR;
+    uint32_t position;
 
-					if (status == F_NO_ERROR)
-					{
-					    memcpy(entry->data, data, count);
-
-					    rfat_data_cache_modify(volume, file);
-
-					    if (status == F_NO_ERROR)
-					    {
-						position += count;
-						data += count;
-						count = 0;
-					    }
-					}
-				    }
-				    else
-				    {
-					size = volume->cls_size - (position & volume->cls_mask);
-			    
-					if (size > count)
-					{
-					    size = count & ~RFAT_BLK_MASK;
-					}
-
-					blkcnt = size >> RFAT_BLK_SHIFT;
-
-					status = rfat_data_cache_invalidate(volume, file, blkno, blkcnt);
-
-					if (status == F_NO_ERROR)
-					{
-					    status = rfat_disk_write_sequential(volume->disk, blkno, blkcnt, data, &file->status);
-
-#if (RFAT_CONFIG_MEDIA_FAILURE_SUPPORTED == 1)
-					    if (status == F_ERR_INVALIDSECTOR)
-					    {
-						volume->flags |= RFAT_VOLUME_FLAG_MEDIA_FAILURE;
-					    }
-#endif /* (RFAT_CONFIG_MEDIA_FAILURE_SUPPORTED == 1) */
-
-					    if (status == F_NO_ERROR)
-					    {
-						position += size;
-						data += size;
-						count -= size;
-                                            
-						blkno += blkcnt;
-					    }
-
-					    /* After any data related disk operation, "file->status" needs
-					     * to be checked asynchronously for a previous error.
-					     */
-					    if (file->status != F_NO_ERROR)
-					    {
-						status = file->status;
-					    }
-					}
-				    }
-				}
-			    }
-			}
-		    }
-
-		    if (status == F_NO_ERROR)
-		    {
-			if (file->mode & RFAT_FILE_MODE_COMMIT)
-			{
-			    status = rfat_disk_sync(volume->disk, &file->status);
-			}
-
-			if (status == F_NO_ERROR)
-			{
-			    file->position = position;
-			    file->clsno = clsno;
-			    file->blkno = blkno;
-			    file->blkno_e = blkno_e;
-			}
-		    }
-		}
+    if (file->flags & RFAT_FILE_FLAG_DIRECT)
+    {
+	position = file->position;
 
-		*p_count = total - count;
-	    }
+	if (write && (file->mode & RFAT_FILE_MODE_APPEND))
+	{
+	    position = file->length;
 	}
-    }
 
-    if (file->status == F_NO_ERROR)
-    {
-	file->status = status;
+	if (((position | count) & RFAT_BLK_MASK) || (write && (position > file->length)))
+	{
+	    status = F_ERR_NOTUSEABLE;
+	}
     }
 
     return status;
 }
 
+/* A read that ran into a removal of the SDCARD leaves "file->status" set. Only the
+ * remount in rfat_volume_lock() can reattach the file, so the lock is taken once
+ * more before the sticky error gets reported.
+ */
 
-/***********************************************************************************************************************/
-
-const char * f_getversion(void)
-{
-    return RFAT_VERSION_STRING;
-}
-
-int f_initvolume(void)
+static int rfat_file_reattach(rfat_file_t *file)
 {
     int status = F_NO_ERROR;
     rfat_volume_t *volume;
 
-    volume = RFAT_DEFAULT_VOLUME();
+    status = file->status;
 
-    status = rfat_volume_lock_noinit(volume);
-    
-    if (status == F_NO_ERROR)
+    if ((status == F_ERR_CARDREMOVED) || (status == F_ERR_ONDRIVE))
     {
-        status = rfat_volume_init(volume);
-        
-	status = rfat_volume_unlock(volume, status);
-    }
-
-    return status;
-}
-
-int f_delvolume(void)
-{
-    int status = F_NO_ERROR;
-    rfat_volume_t *volume;
-
-    volume = RFAT_DEFAULT_VOLUME();
+	volume = RFAT_FILE_VOLUME(file);
 
-    status = rfat_volume_lock_nomount(volume);
-    
-    if (status == F_NO_ERROR)
-    {
-	status = rfat_volume_unmount(volume);
+	status = rfat_volume_lock(volume);
 
 	if (status == F_NO_ERROR)
 	{
-	    status = rfat_disk_release(volume->disk);
+	    status = rfat_volume_unlock(volume, status);
 
 	    if (status == F_NO_ERROR)
 	    {
-		volume->state = RFAT_VOLUME_STATE_INITIALIZED;
-		volume->disk = NULL;
+		status = file->status;
 	    }
 	}
-        
-	status = rfat_volume_unlock(volume, status);
     }
 
     return status;
 }
 
-int f_format(int fattype)
+static int rfat_file_read(rfat_volume_t *volume, rfat_file_t *file, uint8_t *data, uint32_t count, uint32_t *p_count)
 {
     int status = F_NO_ERROR;
-    rfat_volume_t *volume;
+    uint32_t blkno, blkno_e, blkcnt, clsno, position, total, size;
+    rfat_cache_entry_t *entry;
 
-    volume = RFAT_DEFAULT_VOLUME();
+    *p_count = 0;
 
-    status = rfat_volume_lock(volume);
-    
-    if (status == F_NO_ERROR)
+#if (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1)
+    if (file->stream_count | file->stream_index)
     {
-	if (volume->flags & RFAT_VOLUME_FLAG_WRITE_PROTECTED)
-	{
-	    status = F_ERR_WRITEPROTECT;
-	}
-	else
-	{
-	    status = rfat_volume_unmount(volume);
-
-	    if (status == F_NO_ERROR)
-	    {
-		status = rfat_volume_erase(volume);
-	    }
-	}
-
-	status = rfat_volume_unlock(volume, status);
+	status = rfat_file_stream_flush(volume, file);
     }
 
-    return status;
-}
-
-
-#if !defined(RFAT_CONFIG_ULTRA_LIGHT_BUILD)
-
-int f_hardformat(int fattype)
-{
-    int status = F_NO_ERROR;
-    rfat_volume_t *volume;
-
-    volume = RFAT_DEFAULT_VOLUME();
+    if (status != F_NO_ERROR)
+    {
+	count = 0;
+    }
+    else
+#endif /* (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1) */
 
-    status = rfat_volume_lock_nomount(volume);
-    
-    if (status == F_NO_ERROR)
+    /* A direct transfer has to cover whole blocks in the caller's buffer, so
+     * that a trailing partial block at the end of the file can be read without
+     * the data cache.
+     */
+    if (rfat_file_direct_check(file, count, FALSE) != F_NO_ERROR)
     {
-	status = rfat_volume_unmount(volume);
+	status = F_ERR_NOTUSEABLE;
 
-	if (status == F_NO_ERROR)
+	count = 0;
+    }
+    else if (file->position >= file->length)
+    {
+	count = 0;
+    }
+    else
+    {
+	if (count > (file->length - file->position))
 	{
-	    status = rfat_volume_format(volume);
-        }
-        
-	status = rfat_volume_unlock(volume, status);
+	    count = (file->length - file->position);
+	}
     }
 
-    return status;
-}
-
-#endif /* !defined(RFAT_CONFIG_ULTRA_LIGHT_BUILD) */
-
-
-int f_getfreespace(F_SPACE *pspace)
-{
-    int status = F_NO_ERROR;
-    uint32_t clsno, clsno_e, clscnt_total, clscnt_free, clsdata;
-    rfat_volume_t *volume;
+    if (count != 0)
+    {
+	total = count;
 
-    volume = RFAT_DEFAULT_VOLUME();
+        position = file->position;
+        clsno = file->clsno;
+        blkno = file->blkno;
+        blkno_e = file->blkno_e;
 
-    status = rfat_volume_lock(volume);
-    
-    if (status == F_NO_ERROR)
-    {
-#if (RFAT_CONFIG_FSINFO_SUPPORTED == 1)
-	if (volume->flags & RFAT_VOLUME_FLAG_FSINFO_VALID)
+	/* Take care of the case where there is an empty cluster chain,
+	 * but file->length is not 0.
+	 */
+	if (clsno == RFAT_CLSNO_NONE)
 	{
-	    clscnt_total = volume->last_clsno - 1;
-	    clscnt_free = volume->free_clscnt;
+	    status = F_ERR_EOF;
 	}
-	else
-#endif /* (RFAT_CONFIG_FSINFO_SUPPORTED == 1) */
+        else
 	{
-	    clscnt_total = volume->last_clsno - 1;
-	    clscnt_free = 0;
-
-	    for (clsno = 2, clsno_e = volume->last_clsno; ((status == F_NO_ERROR) && (clsno <= clsno_e)); clsno++)
+	    if (blkno == blkno_e)
 	    {
-		/* Bypass cluster cache on read while scanning.
-		 */
-		status = rfat_cluster_read_uncached(volume, clsno, &clsdata);
-		
-		if (status == F_NO_ERROR)
+#if (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1)
+		if (file->flags & RFAT_FILE_FLAG_CONTIGUOUS)
 		{
-		    if (clsdata == RFAT_CLSNO_FREE)
+		    clsno++;
+		    blkno_e += volume->cls_blk_size;
+		}
+		else
+#endif /* (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1) */
+		{
+		    status = rfat_cluster_chain_seek(volume, clsno, 1, &clsno);
+
+		    if (status == F_NO_ERROR)
 		    {
-			clscnt_free++;
+			blkno = RFAT_CLSNO_TO_BLKNO(clsno);
+			blkno_e = blkno + volume->cls_blk_size;
 		    }
 		}
 	    }
+	}
 
-#if (RFAT_CONFIG_FSINFO_SUPPORTED == 1)
-	    if (status == F_NO_ERROR)
-	    {
-		volume->flags |= (RFAT_VOLUME_FLAG_FSINFO_VALID | RFAT_VOLUME_FLAG_FSINFO_DIRTY);
-		volume->free_clscnt = clscnt_free;
+        if (status == F_NO_ERROR)
+        {
+            if (!(file->flags & RFAT_FILE_FLAG_DIRECT) && (((position & RFAT_BLK_MASK) + count) < RFAT_BLK_SIZE))
+            {
+                status = rfat_data_cache_read(volume, file, blkno, &entry);
+	    
+                if (status == F_NO_ERROR)
+                {
+                    memcpy(data, entry->data + (position & RFAT_BLK_MASK), count);
 
-		if ((volume->state == RFAT_VOLUME_STATE_MOUNTED) &&
-		    (volume->fsinfo_blkofs != 0))
-		{
-#if (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1)
-		    /* If a map/fat entry has changed, this triggers a record/commit sequence.
-		     * Otherwise the RFAT_VOLUME_FLAG_FSINFO_DIRTY setting will simply update
-		     * the FSINFO on disk.
-		     */
-		    status = rfat_volume_record(volume);
+                    position += count;
+                    count = 0;
 
-#else /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1) */
+                    if (!(position & RFAT_BLK_MASK))
+                    {
+                        blkno++;
+                    }
+                }
+            }
+            else
+            {
+                if (position & RFAT_BLK_MASK)
+                {
+                    status = rfat_data_cache_read(volume, file, blkno, &entry);
+	    
+                    if (status == F_NO_ERROR)
+                    {
+                        size = (RFAT_BLK_SIZE - (position & RFAT_BLK_MASK));
 
-#if (RFAT_CONFIG_VOLUME_DIRTY_SUPPORTED == 1)
-		    /* volume->free_clscnt is only maintained in FSINFO if RFAT_VOLUME_FLAG_MOUNTED_DIRTY
-		     * is not set. If RFAT_VOLUME_FLAG_VOLUME_DIRTY is set, then the volume is in a dirty
-		     * state, where volume->free_clscnt cannot be updated. In this case wait for the update
-		     * till the next rfat_volume_clean() gets called.
-		     */
-		    if (!(volume->flags & (RFAT_VOLUME_FLAG_VOLUME_DIRTY | RFAT_VOLUME_FLAG_MOUNTED_DIRTY)))
-		    {
-			status = rfat_fat_cache_flush(volume);
-		    
-			if (status == F_NO_ERROR)
+                        memcpy(data, entry->data + (RFAT_BLK_SIZE - size), size);
+
+                        position += size;
+                        data += size;
+                        count -= size;
+
+                        blkno++;
+                    }
+                }
+
+                while ((status == F_NO_ERROR) && (count != 0))
+                {
+                    if (blkno == blkno_e)
+                    {
+#if (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1)
+			if (file->flags & RFAT_FILE_FLAG_CONTIGUOUS)
 			{
-			    status = rfat_volume_fsinfo(volume, volume->free_clscnt, volume->next_clsno);
+			    clsno++;
+			    blkno_e += volume->cls_blk_size;
+			}
+			else
+#endif /* (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1) */
+			{
+			    status = rfat_cluster_chain_seek(volume, clsno, 1, &clsno);
 			    
 			    if (status == F_NO_ERROR)
 			    {
-				volume->flags &= ~RFAT_VOLUME_FLAG_FSINFO_DIRTY;
+				blkno = RFAT_CLSNO_TO_BLKNO(clsno);
+				blkno_e = blkno + volume->cls_blk_size;
 			    }
 			}
 		    }
-#endif /* (RFAT_CONFIG_VOLUME_DIRTY_SUPPORTED == 1) */
-#endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1) */
-		}
-	    }
-#endif /* (RFAT_CONFIG_FSINFO_SUPPORTED == 1) */
-	}
+                
+                    if (status == F_NO_ERROR)
+                    {
+                        if (count < RFAT_BLK_SIZE)
+                        {
+			    if (file->flags & RFAT_FILE_FLAG_DIRECT)
+			    {
+				status = rfat_disk_read_sequential(volume->disk, blkno, 1, data);
 
-        if (status == F_NO_ERROR)
-        {
-            pspace->total      = clscnt_total << volume->cls_shift;
-            pspace->free       = clscnt_free  << volume->cls_shift;
-            pspace->used       = (clscnt_total - clscnt_free) << volume->cls_shift;
-            pspace->bad        = 0;
-            pspace->total_high = clscnt_total >> (32 - volume->cls_shift);
-            pspace->free_high  = clscnt_free  >> (32 - volume->cls_shift);
-            pspace->used_high  = (clscnt_total - clscnt_free) >> (32 - volume->cls_shift);
-            pspace->bad_high   = 0;
+#if (RFAT_CONFIG_MEDIA_FAILURE_SUPPORTED == 1)
+				if (status == F_ERR_INVALIDSECTOR)
+				{
+				    volume->flags |= RFAT_VOLUME_FLAG_MEDIA_FAILURE;
+				}
+#endif /* (RFAT_CONFIG_MEDIA_FAILURE_SUPPORTED == 1) */
+
+				if (status == F_NO_ERROR)
+				{
+				    position += count;
+				    data += count;
+				    count = 0;
+				}
+
+				if (file->status != F_NO_ERROR)
+				{
+				    status = file->status;
+				}
+			    }
+			    else
+			    {
+				status = rfat_data_cache_read(volume, file, blkno, &entry);
+                    
+				if (status == F_NO_ERROR)
+				{
+				    memcpy(data, entry->data, count);
+
+				    position += count;
+				    data += count;
+				    count = 0;
+				}
+			    }
+                        }
+                        else
+                        {
+			    size = volume->cls_size - (position & volume->cls_mask);
+                            
+                            if (size > count)
+                            {
+                                size = count & ~RFAT_BLK_MASK;
+                            }
+
+                            blkcnt = size >> RFAT_BLK_SHIFT;
+
+                            status = rfat_data_cache_flush(volume, file);
+
+                            if (status == F_NO_ERROR)
+                            {
+#if (RFAT_CONFIG_TRANSFER_UNLOCK_SUPPORTED == 1)
+				rfat_volume_transfer_begin(volume);
+#endif /* (RFAT_CONFIG_TRANSFER_UNLOCK_SUPPORTED == 1) */
+
+                                status = rfat_disk_read_sequential(volume->disk, blkno, blkcnt, data);
+
+#if (RFAT_CONFIG_TRANSFER_UNLOCK_SUPPORTED == 1)
+				status = rfat_volume_transfer_end(volume, status);
+#endif /* (RFAT_CONFIG_TRANSFER_UNLOCK_SUPPORTED == 1) */
+
+#if (RFAT_CONFIG_MEDIA_FAILURE_SUPPORTED == 1)
+				if (status == F_ERR_INVALIDSECTOR)
+				{
+				    volume->flags |= RFAT_VOLUME_FLAG_MEDIA_FAILURE;
+				}
+#endif /* (RFAT_CONFIG_MEDIA_FAILURE_SUPPORTED == 1) */
+
+                                if (status == F_NO_ERROR)
+                                {
+                                    position += size;
+                                    data += size;
+                                    count -= size;
+
+                                    blkno += blkcnt;
+                                }
+
+				/* After any data related disk operation, "file->status" needs
+				 * to be checked asynchronously for a previous error.
+				 */
+				if (file->status != F_NO_ERROR)
+				{
+				    status = file->status;
+				}
+                            }
+                        }
+                    }
+                }
+            }
+        
+            if (status == F_NO_ERROR)
+            {
+                file->position = position;
+                file->clsno = clsno;
+                file->blkno = blkno;
+                file->blkno_e = blkno_e;
+            }
         }
 
-	status = rfat_volume_unlock(volume, status);
+	*p_count = total - count;
+    }
+
+    /* A rejected direct transfer did not touch the file, hence the error does
+     * not stick to "file->status".
+     */
+    if ((file->status == F_NO_ERROR) && (status != F_ERR_NOTUSEABLE))
+    {
+	file->status = status;
     }
 
     return status;
 }
 
-int f_getserial(unsigned long *p_serial)
+static int rfat_file_write(rfat_volume_t *volume, rfat_file_t *file, const uint8_t *data, uint32_t count, uint32_t *p_count)
 {
     int status = F_NO_ERROR;
-    rfat_volume_t *volume;
+    uint32_t blkno, blkno_e, blkcnt, clsno, offset, position, length, total, size;
+    rfat_cache_entry_t *entry;
 
-    volume = RFAT_DEFAULT_VOLUME();
-    
-    status = rfat_volume_lock(volume);
-    
-    if (status == F_NO_ERROR)
-    {
-	*p_serial = volume->serial;
+    *p_count = 0;
 
-	status = rfat_volume_unlock(volume, status);
+#if (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1)
+    if (file->stream_count | file->stream_index)
+    {
+	status = rfat_file_stream_flush(volume, file);
     }
+#endif /* (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1) */
 
-    return status;
-}
-
-
-#if !defined(RFAT_CONFIG_ULTRA_LIGHT_BUILD)
+    if ((status == F_NO_ERROR) && (file->mode & RFAT_FILE_MODE_APPEND) && (file->position != file->length))
+    {
+	status = rfat_file_seek(volume, file, file->length);
+    }
 
-int f_setlabel(const char *volname)
-{
-    int status = F_NO_ERROR;
-    uint32_t clsno, index;
-    uint16_t ctime, cdate;
-    rfat_dir_t *dir;
-    rfat_volume_t *volume;
+    if (status == F_NO_ERROR)
+    {
+	status = rfat_file_direct_check(file, count, TRUE);
+    }
 
-    volume = RFAT_DEFAULT_VOLUME();
-    
-    status = rfat_volume_lock(volume);
-    
     if (status == F_NO_ERROR)
     {
-	if (volume->flags & RFAT_VOLUME_FLAG_WRITE_PROTECTED)
+#if (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1)
+	if (file->flags & RFAT_FILE_FLAG_CONTIGUOUS)
 	{
-	    status = F_ERR_WRITEPROTECT;
+	    if (file->size < file->position)
+	    {
+		status = F_ERR_EOF;
+	    }
+	    else
+	    {
+		if (count > (file->size - file->position))
+		{
+		    count = (file->size - file->position);
+		}
+	    }
 	}
 	else
+#endif /* (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1) */
 	{
-	    volname = rfat_name_cstring_to_label(volname, volume->dir.dir_name);
+	    if (count > (RFAT_FILE_SIZE_MAX - file->position))
+	    {
+		count = (RFAT_FILE_SIZE_MAX - file->position);
+	    }
+	}
 
-	    if (volname != NULL)
+	if (status == F_NO_ERROR)
+	{
+	    if (count != 0)
 	    {
-#if (RFAT_CONFIG_VFAT_SUPPORTED == 1)
-		volume->dir.dir_nt_reserved = 0x00;
-#endif /* (RFAT_CONFIG_VFAT_SUPPORTED == 1) */
+		file->flags |= RFAT_FILE_FLAG_DATA_MODIFIED;
 
-		status = rfat_path_find_entry(volume, RFAT_CLSNO_NONE, 0, 1, rfat_path_find_callback_volume, NULL, &clsno, &index, &dir);
+		total  = count;
+		offset = (file->length + RFAT_BLK_MASK) & ~RFAT_BLK_MASK;
+		length = file->position + count;
 
-		if (status == F_NO_ERROR)
+		if (length > file->length)
 		{
-#if defined(RFAT_PORT_CORE_TIMEDATE)
-		    RFAT_PORT_CORE_TIMEDATE(&ctime, &cdate);
-#else /* RFAT_PORT_CORE_TIMEDATE */
-		    ctime = 0;
-		    cdate = 0;
-#endif /* RFAT_PORT_CORE_TIMEDATE */
-
-		    if (dir == NULL)
+		    if ((file->length == 0) || (file->length != file->position) || (((file->length -1) & ~volume->cls_mask) != ((length -1) & ~volume->cls_mask)))
 		    {
-#if (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0)
-			status = rfat_volume_dirty(volume);
-
-			if (status == F_NO_ERROR)
-#endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0) */
-			{
-			    status = rfat_path_create_entry(volume, RFAT_CLSNO_NONE, clsno, index, (const char*)volume->dir.dir_name, RFAT_DIR_ATTR_VOLUME_ID, RFAT_CLSNO_NONE, ctime, cdate);
-			
-#if (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0)
-			    status = rfat_volume_clean(volume, status);
-#endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0) */
-			}
+			status = rfat_file_extend(volume, file, length);
 		    }
 		    else
 		    {
-			memcpy(dir->dir_name, volume->dir.dir_name, sizeof(dir->dir_name));
-
-			dir->dir_wrt_time = RFAT_HTOFS(ctime);
-			dir->dir_wrt_date = RFAT_HTOFS(cdate);
-
-			status = rfat_dir_cache_write(volume);
+			file->length = length;
+			file->flags |= RFAT_FILE_FLAG_DIR_MODIFIED;
 		    }
 		}
-	    }
-	    else
-	    {
-		status = F_ERR_INVALIDNAME;
-	    }
-	}
-
-	status = rfat_volume_unlock(volume, status);
-    }
-
-    return status;
-}
-
-int f_getlabel(char *volname, int length)
-{
-    int status = F_NO_ERROR;
-    const uint8_t *dosname;
-    char *volname_e;
-    rfat_dir_t *dir;
-    rfat_boot_t *boot;
-    rfat_volume_t *volume;
-
-    volume = RFAT_DEFAULT_VOLUME();
-    
-    status = rfat_volume_lock(volume);
-    
-    if (status == F_NO_ERROR)
-    {
-	dosname = NULL;
-
-	status = rfat_path_find_entry(volume, RFAT_CLSNO_NONE, 0, 0, rfat_path_find_callback_volume, NULL, NULL, NULL, &dir);
-
-	if (status == F_NO_ERROR)
-	{
-	    volname_e = volname + length;
-
-	    if (dir == NULL)
-	    {
-#if (RFAT_CONFIG_VOLUME_DIRTY_SUPPORTED == 1) || (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1)
-		boot = (rfat_boot_t*)((void*)&volume->bs_data[0]);
-#else /* (RFAT_CONFIG_VOLUME_DIRTY_SUPPORTED == 1) || (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1) */
-
-		boot = (rfat_boot_t*)((void*)volume->dir_cache.data);
 
-		status = rfat_dir_cache_flush(volume);
-		
 		if (status == F_NO_ERROR)
 		{
-		    status = rfat_volume_read(volume, volume->boot_blkno, (uint8_t*)boot);
-		}
+		    position = file->position;
+		    clsno = file->clsno;
+		    blkno = file->blkno;
+		    blkno_e = file->blkno_e;
 
-		if (status == F_NO_ERROR)
-#endif /* (RFAT_CONFIG_VOLUME_DIRTY_SUPPORTED == 1) || (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1) */
-		{
-		    if (volume->type != RFAT_VOLUME_TYPE_FAT32)
+		    /* Take care of the case where the cluster chain of a file was truncted,
+		     * but the length was not adjusted on disk.
+		     */
+		    if (clsno == RFAT_CLSNO_NONE)
 		    {
-			if (boot->bpb40.bs_boot_sig == 0x29)
-			{
-			    dosname = (const uint8_t*)boot->bpb40.bs_vol_lab;
-			}
+			status = F_ERR_EOF;
 		    }
 		    else
 		    {
-			if (boot->bpb71.bs_boot_sig == 0x29)
+			if (blkno == blkno_e)
 			{
-			    dosname = (const uint8_t*)boot->bpb71.bs_vol_lab;
+			    status = rfat_data_cache_flush(volume, file);
+
+			    if (status == F_NO_ERROR)
+			    {
+#if (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1)
+				if (file->flags & RFAT_FILE_FLAG_CONTIGUOUS)
+				{
+				    clsno++;
+				    blkno_e += volume->cls_blk_size;
+				}
+				else
+#endif /* (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1) */
+				{
+				    status = rfat_cluster_chain_seek(volume, clsno, 1, &clsno);
+			
+				    if (status == F_NO_ERROR)
+				    {
+					blkno = RFAT_CLSNO_TO_BLKNO(clsno);
+					blkno_e = blkno + volume->cls_blk_size;
+				    }
+				}
+			    }
 			}
 		    }
-		}
-	    }
-	    else
-	    {
-		dosname = (const uint8_t*)dir->dir_name;
-	    }
-	}
-
-	if (status == F_NO_ERROR)
-	{
-	    if (dosname != NULL)
-	    {
-		volname = rfat_name_label_to_cstring(dosname, volname, volname_e);
-
-		if (volname == NULL)
-		{
-		    status = F_ERR_TOOLONGNAME;
-		}
-	    }
-	    else
-	    {
-		status = F_ERR_NOTFOUND;
-	    }
-	}
-
-	status = rfat_volume_unlock(volume, status);
-    }
-
-    return status;
-}
-
-#endif /* !defined(RFAT_CONFIG_ULTRA_LIGHT_BUILD) */
-
-int f_mkdir(const char *dirname)
-{
-    int status = F_NO_ERROR;
-    uint16_t ctime, cdate;
-    uint32_t clsno, clsno_d, clsno_s, blkno_s, index, count;
-    rfat_dir_t *dir;
-    rfat_cache_entry_t *entry;
-    rfat_volume_t *volume;
-
-    volume = RFAT_PATH_VOLUME(dirname);
-    
-    status = rfat_volume_lock(volume);
-    
-    if (status == F_NO_ERROR)
-    {
-	if (volume->flags & RFAT_VOLUME_FLAG_WRITE_PROTECTED)
-	{
-	    status = F_ERR_WRITEPROTECT;
-	}
-	else
-	{
-	    if (((dirname[0] == '/') || (dirname[0] == '\\')) && (dirname[1] == '\0'))
-	    {
-		status = F_ERR_INVALIDDIR;
-	    }
-	    else
-	    {
-		status = rfat_path_find_directory(volume, dirname, &dirname, &clsno_d);
-            
-		if (status == F_NO_ERROR)
-		{
-		    status = rfat_path_convert_filename(volume, dirname, NULL);
 
 		    if (status == F_NO_ERROR)
 		    {
-			if (volume->dir.dir_name[0] == '.')
-			{
-			    status = F_ERR_NOTFOUND;
-			}
-			else
+			if (((position & RFAT_BLK_MASK) + count) < RFAT_BLK_SIZE)
 			{
-#if (RFAT_CONFIG_VFAT_SUPPORTED == 1)
-			    if ((volume->dir.dir_name[0] == '\0') || (volume->dir.dir_nt_reserved & RFAT_DIR_TYPE_LOSSY))
+			    /* All data is within one block, simply go throu the cache.
+			     * If the block is beyond the old file->length, is has to 
+			     * be all zeros. Otherwise got throu the normal cache.
+			     */
+
+			    if (position >= offset)
 			    {
-				count = 1 + volume->dir_entries;
+				status = rfat_data_cache_zero(volume, file, blkno, &entry);
 			    }
 			    else
-#endif /* (RFAT_CONFIG_VFAT_SUPPORTED == 1) */
 			    {
-				count = 1;
+				status = rfat_data_cache_read(volume, file, blkno, &entry);
 			    }
-
-			    status = rfat_path_find_entry(volume, clsno_d, 0, count, rfat_path_find_callback_name, NULL, &clsno, &index, &dir);
-			
+	    
 			    if (status == F_NO_ERROR)
 			    {
-				if (dir == NULL)
+				memcpy(entry->data + (position & RFAT_BLK_MASK), data, count);
+
+				rfat_data_cache_modify(volume, file);
+
+				position += count;
+				count = 0;
+
+				if (!(position & RFAT_BLK_MASK))
 				{
-				    /* No conflicting entry found, hence start out creating the subdirectory.
-				     *
-				     * The strategy is to first allocate the cluster for the subdirectory, populate it
-				     * and then create the new directory entry in the parent. This way there is no
-				     * inconsistent file system state along the way.
-				     */
+				    blkno++;
+				}
+			    }
+			}
+			else
+			{
+			    if (position & RFAT_BLK_MASK)
+			    {
+				size = (RFAT_BLK_SIZE - (position & RFAT_BLK_MASK));
 
-#if (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0)
-				    status = rfat_volume_dirty(volume);
+				if (position >= offset)
+				{
+				    status = rfat_data_cache_zero(volume, file, blkno, &entry);
+				}
+				else
+				{ 
+				    status = rfat_data_cache_read(volume, file, blkno, &entry);
+				}
 
-				    if (status == F_NO_ERROR)
-#endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0) */
-				    {
-					status = rfat_cluster_chain_create(volume, RFAT_CLSNO_NONE, 1, &clsno_s, NULL);
+				if (status == F_NO_ERROR)
+				{
+				    memcpy(entry->data + (RFAT_BLK_SIZE - size), data, size);
 				
-					if (status == F_NO_ERROR)
-					{
-					    blkno_s = RFAT_CLSNO_TO_BLKNO(clsno_s);
-				    
-					    status = rfat_volume_zero(volume, blkno_s, volume->cls_blk_size, NULL);
-
-					    if (status == F_NO_ERROR)
-					    {
-						status = rfat_dir_cache_zero(volume, blkno_s, &entry);
+				    rfat_data_cache_modify(volume, file);
 
-						if (status == F_NO_ERROR)
-						{
-#if defined(RFAT_PORT_CORE_TIMEDATE)
-						    RFAT_PORT_CORE_TIMEDATE(&ctime, &cdate);
-#else /* RFAT_PORT_CORE_TIMEDATE */
-						    ctime = 0;
-						    cdate = 0;
-#endif /* RFAT_PORT_CORE_TIMEDATE */
-						
-						    rfat_path_setup_entry(volume, rfat_dirname_dot, RFAT_DIR_ATTR_DIRECTORY, clsno_s, ctime, cdate, ((rfat_dir_t*)((void*)entry->data)));
-						    rfat_path_setup_entry(volume, rfat_dirname_dotdot, RFAT_DIR_ATTR_DIRECTORY, clsno_d, ctime, cdate, ((rfat_dir_t*)((void*)(entry->data + sizeof(rfat_dir_t)))));
-						
-						    status = rfat_dir_cache_write(volume);
-						
-						    if (status == F_NO_ERROR)
-						    {
-							/* Subdirectory has been created, so back to hooking up the directory entry.
-							 */
-						    
-							status = rfat_path_create_entry(volume, clsno_d, clsno, index, NULL, RFAT_DIR_ATTR_DIRECTORY, clsno_s, ctime, cdate);
-
-							if (status == F_ERR_NOMOREENTRY)
-							{
-							    rfat_cluster_chain_destroy(volume, clsno_s, RFAT_CLSNO_FREE);
-							}
-						    }
-						}
-					    }
-					}
+				    /* A non-blocking file writes out the completed block
+				     * right away. It is the one block the call programs,
+				     * see rfat_file_write_poll().
+				     */
+				    if ((size < count) || (file->option & RFAT_FILE_OPTION_NONBLOCK))
+				    {
+					status = rfat_data_cache_write(volume, file);
+				    }
 
-#if (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0)
-					status = rfat_volume_clean(volume, status);
-#endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0) */
+				    if (status == F_NO_ERROR)
+				    {
+					position += size;
+					data += size;
+					count -= size;
+                                    
+					blkno++;
 				    }
 				}
-				else
-				{
-				    status = F_ERR_DUPLICATED;
-				}
 			    }
-			}
-		    }
-		}
-	    }
-	}
-
-	status = rfat_volume_unlock(volume, status);
-    }
-
-    return status;
-}
-
-int f_rmdir(const char *dirname)
-{
-    int status = F_NO_ERROR;
-    uint32_t clsno, clsno_d, index, first_clsno;
-#if (RFAT_CONFIG_VFAT_SUPPORTED == 1)
-    unsigned int entries;
-#endif /* (RFAT_CONFIG_VFAT_SUPPORTED == 1) */
-    rfat_dir_t *dir;
-    rfat_volume_t *volume;
-
-    volume = RFAT_PATH_VOLUME(dirname);
-    
-    status = rfat_volume_lock(volume);
-    
-    if (status == F_NO_ERROR)
-    {
-	if (volume->flags & RFAT_VOLUME_FLAG_WRITE_PROTECTED)
-	{
-	    status = F_ERR_WRITEPROTECT;
-	}
-	else
-	{
-	    if (((dirname[0] == '/') || (dirname[0] == '\\')) && (dirname[1] == '\0'))
-	    {
-		status = F_ERR_INVALIDDIR;
-	    }
-	    else
-	    {
-		status = rfat_path_find_directory(volume, dirname, &dirname, &clsno_d);
-            
-		if (status == F_NO_ERROR)
-		{
-		    status = rfat_path_convert_filename(volume, dirname, NULL);
 
-		    if (status == F_NO_ERROR)
-		    {
-			if (volume->dir.dir_name[0] == '.')
-			{
-			    status = F_ERR_NOTFOUND;
-			}
-			else
-			{
-			    // ### FIXME ... filter out "/"
-			    status = rfat_path_find_entry(volume, clsno_d, 0, 0, rfat_path_find_callback_name, NULL, &clsno, &index, &dir);
-			
-			    if (status == F_NO_ERROR)
+			    while ((status == F_NO_ERROR) && (count != 0))
 			    {
-				if (dir != NULL)
+				if (blkno == blkno_e)
 				{
-				    if (dir->dir_attr & RFAT_DIR_ATTR_DIRECTORY)
-				    {
-#if (RFAT_CONFIG_VFAT_SUPPORTED == 1)
-					/* rfat_path_find_callback_name() fills in the proper volume->dir_entries on a match.
-					 */
-					entries = volume->dir_entries;
-#endif /* (RFAT_CONFIG_VFAT_SUPPORTED == 1) */
+				    status = rfat_data_cache_flush(volume, file);
 
-					if (volume->type == RFAT_VOLUME_TYPE_FAT32)
+				    if (status == F_NO_ERROR)
+				    {
+#if (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1)
+					if (file->flags & RFAT_FILE_FLAG_CONTIGUOUS)
 					{
-					    first_clsno = ((uint32_t)RFAT_FTOHS(dir->dir_clsno_hi) << 16) | (uint32_t)RFAT_FTOHS(dir->dir_clsno_lo);
+					    clsno++;
+					    blkno_e += volume->cls_blk_size;
 					}
 					else
-					{ 
-					    first_clsno = (uint32_t)RFAT_FTOHS(dir->dir_clsno_lo);
+#endif /* (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1) */
+					{
+					    status = rfat_cluster_chain_seek(volume, clsno, 1, &clsno);
+					
+					    if (status == F_NO_ERROR)
+					    {
+						blkno = RFAT_CLSNO_TO_BLKNO(clsno);
+						blkno_e = blkno + volume->cls_blk_size;
+					    }
 					}
+				    }
+				}
 
-					/* Skip "." and ".."
-					 */
-					status = rfat_path_find_entry(volume, first_clsno, 2, 0, rfat_path_find_callback_empty, NULL, NULL, NULL, &dir);
+				if (status == F_NO_ERROR)
+				{
+				    if (count < RFAT_BLK_SIZE)
+				    {
+					if (position >= offset)
+					{
+					    status = rfat_data_cache_zero(volume, file, blkno, &entry);
+					}
+					else
+					{
+					    status = rfat_data_cache_read(volume, file, blkno, &entry);
+					}
 
 					if (status == F_NO_ERROR)
 					{
-					    if (dir == NULL)
-					    {
-#if (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0)
-						status = rfat_volume_dirty(volume);
+					    memcpy(entry->data, data, count);
 
-						if (status == F_NO_ERROR)
-#endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0) */
-						{
-#if (RFAT_CONFIG_VFAT_SUPPORTED == 1)
-						    status = rfat_path_destroy_entry(volume, clsno, index, entries, first_clsno);
-#else /* (RFAT_CONFIG_VFAT_SUPPORTED == 1) */
-						    status = rfat_path_destroy_entry(volume, clsno, index, first_clsno);
-#endif /* (RFAT_CONFIG_VFAT_SUPPORTED == 1) */
-					    
-						    if (status == F_NO_ERROR)
-						    {
-							if (volume->cwd_clsno == first_clsno)
-							{
-							    volume->cwd_clsno = RFAT_CLSNO_END_OF_CHAIN;
-							}
-						    }
+					    rfat_data_cache_modify(volume, file);
 
-					    
-#if (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0)
-						    status = rfat_volume_clean(volume, status);
-#endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0) */
-						}
-					    }
-					    else
+					    if (status == F_NO_ERROR)
 					    {
-						status = F_ERR_NOTEMPTY;
+						position += count;
+						data += count;
+						count = 0;
 					    }
 					}
 				    }
 				    else
 				    {
-					status = F_ERR_INVALIDDIR;
+					size = volume->cls_size - (position & volume->cls_mask);
+			    
+					if (size > count)
+					{
+					    size = count & ~RFAT_BLK_MASK;
+					}
+
+					blkcnt = size >> RFAT_BLK_SHIFT;
+
+					status = rfat_data_cache_invalidate(volume, file, blkno, blkcnt);
+
+					if (status == F_NO_ERROR)
+					{
+#if (RFAT_CONFIG_TRANSFER_UNLOCK_SUPPORTED == 1)
+					    rfat_volume_transfer_begin(volume);
+#endif /* (RFAT_CONFIG_TRANSFER_UNLOCK_SUPPORTED == 1) */
+
+					    status = rfat_disk_write_sequential(volume->disk, blkno, blkcnt, data, &file->status);
+
+#if (RFAT_CONFIG_TRANSFER_UNLOCK_SUPPORTED == 1)
+					    status = rfat_volume_transfer_end(volume, status);
+
+					    /* Some other task might have read one of the blocks
+					     * into the data cache while the transfer was running.
+					     */
+					    if (status == F_NO_ERROR)
+					    {
+						status = rfat_data_cache_invalidate(volume, file, blkno, blkcnt);
+					    }
+#endif /* (RFAT_CONFIG_TRANSFER_UNLOCK_SUPPORTED == 1) */
+
+#if (RFAT_CONFIG_MEDIA_FAILURE_SUPPORTED == 1)
+					    if (status == F_ERR_INVALIDSECTOR)
+					    {
+						volume->flags |= RFAT_VOLUME_FLAG_MEDIA_FAILURE;
+					    }
+#endif /* (RFAT_CONFIG_MEDIA_FAILURE_SUPPORTED == 1) */
+
+					    if (status == F_NO_ERROR)
+					    {
+						position += size;
+						data += size;
+						count -= size;
+                                            
+						blkno += blkcnt;
+					    }
+
+					    /* After any data related disk operation, "file->status" needs
+					     * to be checked asynchronously for a previous error.
+					     */
+					    if (file->status != F_NO_ERROR)
+					    {
+						status = file->status;
+					    }
+					}
 				    }
 				}
-				else
-				{
-				    status = F_ERR_NOTFOUND;
-				}
 			    }
 			}
 		    }
+
+		    if (status == F_NO_ERROR)
+		    {
+			file->position = position;
+			file->clsno = clsno;
+			file->blkno = blkno;
+			file->blkno_e = blkno_e;
+
+			if (RFAT_FILE_SETTLE(file))
+			{
+			    status = rfat_file_settle(volume, file);
+			}
+		    }
 		}
+
+		*p_count = total - count;
 	    }
 	}
+    }
 
-	status = rfat_volume_unlock(volume, status);
+    /* A rejected direct transfer did not touch the file, hence the error does
+     * not stick to "file->status".
+     */
+    if ((file->status == F_NO_ERROR) && (status != F_ERR_NOTUSEABLE))
+    {
+	file->status = status;
     }
 
     return status;
 }
 
-int f_chdir(const char *dirname)
+/* rfat_file_write_poll() is called by f_write() for a file opened with "N" ahead of rfat_file_write().
+ * "*p_count" is trimmed to the end of the current block, so that the call programs at most one block,
+ * and that block write is the last disk operation of the call. Appending within the cached block does
+ * not need the SDCARD at all. A write that completes the block only needs the SDCARD to be ready, as
+ * the block continues the outstanding multi block write. Anything else (a new cluster, a block that
+ * has to be read first, rfat_file_settle() afterwards) ends the multi block write first, and proceeds
+ * only once the SDCARD is RFAT_DISK_STATE_READY. "*p_count" is set to 0 while the SDCARD is busy. A
+ * dirty block left behind by another call is written out here, which leaves the SDCARD busy, so
+ * "*p_count" is set to 0 as well.
+ */
+
+static int rfat_file_write_poll(rfat_volume_t *volume, rfat_file_t *file, uint32_t *p_count)
 {
     int status = F_NO_ERROR;
-    uint32_t clsno_d, blkno_d;
+    int dirty;
+    bool busy;
+    uint32_t count;
     rfat_cache_entry_t *entry;
-    rfat_dir_t *dir;
-    rfat_volume_t *volume;
 
-    volume = RFAT_PATH_VOLUME(dirname);
+    count = *p_count;
+
+    if (count > (RFAT_BLK_SIZE - (file->position & RFAT_BLK_MASK)))
+    {
+	count = (RFAT_BLK_SIZE - (file->position & RFAT_BLK_MASK));
+    }
+
+    entry = rfat_data_cache_entry(volume, file, &dirty);
+
+    if (dirty && (entry->blkno != file->blkno))
+    {
+	status = rfat_disk_poll(volume->disk, entry->blkno, &busy);
+
+	if ((status == F_NO_ERROR) && !busy)
+	{
+	    status = rfat_data_cache_write(volume, file);
+	}
+
+	count = 0;
+    }
+    else
+    {
+	if ((file->position != file->length) ||
+	    !(file->length & volume->cls_mask) ||
+	    ((file->position & RFAT_BLK_MASK) && (entry->blkno != file->blkno)) ||
+	    RFAT_FILE_SETTLE(file))
+	{
+	    status = rfat_disk_poll(volume->disk, RFAT_DISK_ADDRESS_NONE, &busy);
+	}
+	else
+	{
+	    if (((file->position & RFAT_BLK_MASK) + count) == RFAT_BLK_SIZE)
+	    {
+		status = rfat_disk_poll(volume->disk, file->blkno, &busy);
+	    }
+	    else
+	    {
+		busy = false;
+	    }
+	}
+
+	if ((status == F_NO_ERROR) && busy)
+	{
+	    count = 0;
+	}
+    }
+
+    if (file->status == F_NO_ERROR)
+    {
+	file->status = status;
+    }
+
+    *p_count = count;
+
+    return status;
+}
+
+/* rfat_file_sync_poll() is called by f_flush(), f_datasync() and f_close() for a file opened with "N".
+ * It returns F_ERR_INPROGRESS as long as the outstanding multi block write is being ended, or while
+ * the dirty data cache entry is being programmed. Once the SDCARD is RFAT_DISK_STATE_READY, the
+ * caller updates the FAT and the directory entry, which waits for those single block writes.
+ */
+
+static int rfat_file_sync_poll(rfat_volume_t *volume, rfat_file_t *file)
+{
+    int status = F_NO_ERROR;
+    int dirty;
+    bool busy;
+
+    status = rfat_disk_poll(volume->disk, RFAT_DISK_ADDRESS_NONE, &busy);
 
-    status = rfat_volume_lock(volume);
-    
     if (status == F_NO_ERROR)
     {
-        if (((dirname[0] == '/') || (dirname[0] == '\\')) && (dirname[1] == '\0'))
-        {
-            /* rfat_path_find_directory cannot return a vaild "dir" for the "/",
-             * so special code this here.
-             */
-            volume->cwd_clsno = RFAT_CLSNO_NONE;
-        }
-        else
-        {
-            status = rfat_path_find_directory(volume, dirname, &dirname, &clsno_d);
-            
-            if (status == F_NO_ERROR)
-            {
-		status = rfat_path_convert_filename(volume, dirname, NULL);
-		
+	if (busy)
+	{
+	    status = F_ERR_INPROGRESS;
+	}
+	else
+	{
+	    rfat_data_cache_entry(volume, file, &dirty);
+
+	    if (dirty)
+	    {
+		status = rfat_data_cache_write(volume, file);
+
 		if (status == F_NO_ERROR)
 		{
-		    if (volume->dir.dir_name[0] == '.')
+		    status = F_ERR_INPROGRESS;
+		}
+	    }
+	}
+    }
+
+    return status;
+}
+
+/* rfat_file_writev() walks a f_writev() vector with rfat_file_write(). A block that is made up
+ * from several entries of "iov" is gathered in the data cache entry first, which is then passed
+ * to rfat_file_write() like a full block of a single entry. Hence it goes out via
+ * rfat_disk_write_sequential() without being read or zeroed first. An entry that ends within
+ * a block the next entries complete is only written up to that block boundary, so that its
+ * tail starts the next gathered block.
+ */
+
+static int rfat_file_writev(rfat_volume_t *volume, rfat_file_t *file, const F_IOVEC *iov, int iovcnt, uint32_t *p_count)
+{
+    int status = F_NO_ERROR;
+    int index;
+    uint32_t offset, count, total, size;
+    const uint8_t *data;
+#if (RFAT_FILE_GATHER_SUPPORTED == 1)
+    int index_g;
+    uint32_t offset_g, position, remaining, tail;
+    rfat_cache_entry_t *entry;
+#endif /* (RFAT_FILE_GATHER_SUPPORTED == 1) */
+
+    *p_count = 0;
+
+#if (RFAT_FILE_GATHER_SUPPORTED == 1)
+    for (index = 0, remaining = 0; index < iovcnt; index++)
+    {
+	if (iov[index].size > 0)
+	{
+	    remaining += (unsigned long)iov[index].size;
+	}
+    }
+#endif /* (RFAT_FILE_GATHER_SUPPORTED == 1) */
+
+    index = 0;
+    offset = 0;
+
+    while ((status == F_NO_ERROR) && (index < iovcnt))
+    {
+	if ((iov[index].size <= 0) || (offset == (unsigned long)iov[index].size))
+	{
+	    index++;
+	    offset = 0;
+	}
+	else
+	{
+	    data = (const uint8_t*)iov[index].buffer + offset;
+	    count = (unsigned long)iov[index].size - offset;
+
+#if (RFAT_FILE_GATHER_SUPPORTED == 1)
+	    position = (file->mode & RFAT_FILE_MODE_APPEND) ? file->length : file->position;
+	    tail = (position + count) & RFAT_BLK_MASK;
+
+	    if ((tail != 0) && (count >= tail) && ((remaining - count) >= (RFAT_BLK_SIZE - tail)) &&
+#if (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1)
+		!(file->stream_count | file->stream_index) &&
+#endif /* (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1) */
+#if (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1)
+		(!(file->flags & RFAT_FILE_FLAG_CONTIGUOUS) || ((file->size >= position) && ((file->size - position) >= ((count - tail) + RFAT_BLK_SIZE)))) &&
+#endif /* (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1) */
+		((RFAT_FILE_SIZE_MAX - position) >= ((count - tail) + RFAT_BLK_SIZE)))
+	    {
+		if (count != tail)
+		{
+		    count -= tail;
+		}
+		else
+		{
+		    status = rfat_data_cache_bounce(volume, file, &entry);
+
+		    if (status == F_NO_ERROR)
 		    {
-			if (volume->dir.dir_name[1] == ' ')
-			{
-			    /* "." */
-			    volume->cwd_clsno = clsno_d;
-			}
-			else
+			for (index_g = index, offset_g = offset, size = 0; size != RFAT_BLK_SIZE; )
 			{
-			    /* ".." */
-
-			    if (clsno_d != RFAT_CLSNO_NONE)
+			    if ((iov[index_g].size <= 0) || (offset_g == (unsigned long)iov[index_g].size))
 			    {
-				blkno_d = RFAT_CLSNO_TO_BLKNO(clsno_d);
-
-				status = rfat_dir_cache_read(volume, blkno_d, &entry);
-                                                
-				if (status == F_NO_ERROR)
-				{
-				    dir = (rfat_dir_t*)((void*)(entry->data + sizeof(rfat_dir_t)));
-                                
-				    if (volume->type == RFAT_VOLUME_TYPE_FAT32)
-				    {
-					volume->cwd_clsno = ((uint32_t)RFAT_FTOHS(dir->dir_clsno_hi) << 16) | (uint32_t)RFAT_FTOHS(dir->dir_clsno_lo);
-				    }
-				    else
-				    {
-					volume->cwd_clsno = (uint32_t)RFAT_FTOHS(dir->dir_clsno_lo);
-				    }
-				}
+				index_g++;
+				offset_g = 0;
 			    }
 			    else
 			    {
-				status = F_ERR_NOTFOUND;
+				count = (unsigned long)iov[index_g].size - offset_g;
+
+				if (count > (RFAT_BLK_SIZE - size))
+				{
+				    count = (RFAT_BLK_SIZE - size);
+				}
+
+				memcpy(entry->data + size, (const uint8_t*)iov[index_g].buffer + offset_g, count);
+
+				offset_g += count;
+				size += count;
 			    }
 			}
+
+			data = entry->data;
+			count = RFAT_BLK_SIZE;
+		    }
+		}
+	    }
+#endif /* (RFAT_FILE_GATHER_SUPPORTED == 1) */
+
+	    if (status == F_NO_ERROR)
+	    {
+		status = rfat_file_write(volume, file, data, count, &total);
+
+		*p_count += total;
+
+#if (RFAT_FILE_GATHER_SUPPORTED == 1)
+		remaining -= total;
+#endif /* (RFAT_FILE_GATHER_SUPPORTED == 1) */
+
+		/* Advance "index"/"offset" over the bytes that made it to the file,
+		 * which for a gathered block spans multiple entries.
+		 */
+		for (size = total; size != 0; )
+		{
+		    if ((iov[index].size <= 0) || (offset == (unsigned long)iov[index].size))
+		    {
+			index++;
+			offset = 0;
 		    }
 		    else
 		    {
-			status = rfat_path_find_entry(volume, clsno_d, 0, 0, rfat_path_find_callback_name, NULL, NULL, NULL, &dir);
-
-			if (status == F_NO_ERROR)
+			if (((unsigned long)iov[index].size - offset) < size)
 			{
-			    if (dir != NULL)
-			    {
-				if (dir->dir_attr & RFAT_DIR_ATTR_DIRECTORY)
-				{
-				    if (volume->type == RFAT_VOLUME_TYPE_FAT32)
-				    {
-					volume->cwd_clsno = ((uint32_t)RFAT_FTOHS(dir->dir_clsno_hi) << 16) | (uint32_t)RFAT_FTOHS(dir->dir_clsno_lo);
-				    }
-				    else
-				    {
-					volume->cwd_clsno = (uint32_t)RFAT_FTOHS(dir->dir_clsno_lo);
-				    }
-				}
-				else
-				{
-				    status = F_ERR_INVALIDDIR;
-				}
-			    }
-			    else
-			    {
-				status = F_ERR_NOTFOUND;
-			    }
+			    size -= ((unsigned long)iov[index].size - offset);
+			    offset = (unsigned long)iov[index].size;
+			}
+			else
+			{
+			    offset += size;
+			    size = 0;
 			}
 		    }
 		}
-	    }
-        }
 
-	status = rfat_volume_unlock(volume, status);
+		if ((status == F_NO_ERROR) && (total != count))
+		{
+		    break;
+		}
+	    }
+	}
     }
 
     return status;
 }
 
-int f_getcwd(char *dirname, int length)
+/* Make the block at the current file position the cached data block, so that f_write_reserve()
+ * can hand out a pointer into it. The block is read in, or zeroed if it lies past the end of the
+ * file, the same way rfat_file_write() deals with a partial block. F_ERR_NOMOREENTRY is returned
+ * if "count" bytes do not fit into the block, if the position is past the end of the file, or if
+ * the end of the file is on a cluster boundary, where rfat_file_extend() has to be used first.
+ */
+
+static int rfat_file_prepare(rfat_volume_t *volume, rfat_file_t *file, uint32_t count, rfat_cache_entry_t **p_entry)
 {
     int status = F_NO_ERROR;
-    uint32_t clsno_s, clsno_p, clsno_g, blkno, index;
-    char *dirname_e;
-    rfat_cache_entry_t *entry;
-    rfat_dir_t *dir;
-    rfat_volume_t *volume;
-    
-    volume = RFAT_DEFAULT_VOLUME();
+    uint32_t clsno, clsdata, blkno, blkno_e, offset;
+
+    if ((file->mode & RFAT_FILE_MODE_APPEND) && (file->position != file->length))
+    {
+	status = rfat_file_seek(volume, file, file->length);
+    }
 
-    status = rfat_volume_lock(volume);
-    
     if (status == F_NO_ERROR)
     {
-	if (length == 1)
+	if ((((file->position & RFAT_BLK_MASK) + count) > RFAT_BLK_SIZE) ||
+	    (file->position > file->length) ||
+	    (file->clsno == RFAT_CLSNO_NONE))
 	{
-            status = F_ERR_TOOLONGNAME;
+	    status = F_ERR_NOMOREENTRY;
 	}
 	else
 	{
-	    clsno_s = volume->cwd_clsno;
-	
-	    index = length -1;
-	    
-	    if (clsno_s != RFAT_CLSNO_NONE)
-	    {
-		blkno = volume->cls_blk_offset + (clsno_s << volume->cls_blk_shift);
-		    
-		status = rfat_dir_cache_read(volume, blkno, &entry);
+	    clsno = file->clsno;
+	    blkno = file->blkno;
+	    blkno_e = file->blkno_e;
 
-		if (status == F_NO_ERROR)
+	    if (blkno == blkno_e)
+	    {
+		/* f_write_commit() may grow "file->length" within the cluster that holds
+		 * "file->length", but not into the next one, which is left to rfat_file_extend().
+		 */
+		if (file->position == file->length)
 		{
-		    dir = (rfat_dir_t*)((void*)(entry->data + sizeof(rfat_dir_t)));
-		    
-		    if (volume->type == RFAT_VOLUME_TYPE_FAT32)
-		    {
-			clsno_p = ((uint32_t)RFAT_FTOHS(dir->dir_clsno_hi) << 16) | (uint32_t)RFAT_FTOHS(dir->dir_clsno_lo);
-		    }
-		    else
-		    {
-			clsno_p = (uint32_t)RFAT_FTOHS(dir->dir_clsno_lo);
-		    }
-		    
-		    do
+		    status = F_ERR_NOMOREENTRY;
+		}
+#if (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1)
+		else if (file->flags & RFAT_FILE_FLAG_CONTIGUOUS)
+		{
+		    clsno++;
+		    blkno_e += volume->cls_blk_size;
+		}
+#endif /* (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1) */
+		else
+		{
+		    status = rfat_cluster_read(volume, clsno, &clsdata);
+
+		    if (status == F_NO_ERROR)
 		    {
-			if (clsno_p != RFAT_CLSNO_NONE)
+			if ((clsdata >= 2) && (clsdata <= volume->last_clsno))
 			{
-			    blkno = volume->cls_blk_offset + (clsno_p << volume->cls_blk_shift);
-			    
-			    status = rfat_dir_cache_read(volume, blkno, &entry);
-			    
-			    if (status == F_NO_ERROR)
-			    {
-				dir = (rfat_dir_t*)((void*)(entry->data + sizeof(rfat_dir_t)));
-				
-				if (volume->type == RFAT_VOLUME_TYPE_FAT32)
-				{
-				    clsno_g = ((uint32_t)RFAT_FTOHS(dir->dir_clsno_hi) << 16) | (uint32_t)RFAT_FTOHS(dir->dir_clsno_lo);
-				}
-				else
-				{
-				    clsno_g = (uint32_t)RFAT_FTOHS(dir->dir_clsno_lo);
-				}
-			    }
+			    clsno = clsdata;
+			    blkno = RFAT_CLSNO_TO_BLKNO(clsno);
+			    blkno_e = blkno + volume->cls_blk_size;
 			}
 			else
 			{
-			    clsno_g = RFAT_CLSNO_NONE;
-			}
-
-			if (status == F_NO_ERROR)
-			{
-			    status = rfat_path_find_entry(volume, clsno_p, 0, 0, rfat_path_find_callback_directory, (void*)clsno_s, NULL, NULL, &dir);
-
-			    if (status == F_NO_ERROR)
-			    {
-				if (dir != NULL)
-				{
-				    if (clsno_s != volume->cwd_clsno)
-				    {
-					if (index != 0)
-					{
-					    dirname[index--] = F_SEPARATORCHAR;
-					}
-					else
-					{
-					    status = F_ERR_TOOLONGNAME;
-					}
-				    }
-				    
-				    if (status == F_NO_ERROR)
-				    {
-#if (RFAT_CONFIG_VFAT_SUPPORTED == 1)
-					/* It's possible to have a sfn_name only ("." and ".." for example).
-					 */
-					if (volume->lfn_count)
-					{
-					    dirname_e = rfat_name_uniname_to_cstring(volume->lfn_name, volume->lfn_count, dirname, dirname + index);
-					}
-					else
-#endif /* (RFAT_CONFIG_VFAT_SUPPORTED == 1) */
-					{
-					    dirname_e = rfat_name_dosname_to_cstring(dir->dir_name, dir->dir_nt_reserved, dirname, dirname + index);
-					}
-					
-					if (dirname_e != NULL)
-					{
-					    index -= (dirname_e - dirname -1);
-					    
-					    memcpy(&dirname[index+1], &dirname[0], (dirname_e - dirname -1));
-					    
-					    clsno_s = clsno_p;
-					    clsno_p = clsno_g;
-					}
-					else
-					{
-					    status = F_ERR_TOOLONGNAME;
-					}
-				    }
-				}
-				else
-				{
-				    status = F_ERR_NOTFOUND;
-				}
-			    }
+			    status = F_ERR_NOMOREENTRY;
 			}
 		    }
-		    while ((status == F_NO_ERROR) && (clsno_s != RFAT_CLSNO_NONE));
 		}
 	    }
-		
+
 	    if (status == F_NO_ERROR)
 	    {
-		if (index >= 2)
+		offset = (file->length + RFAT_BLK_MASK) & ~RFAT_BLK_MASK;
+
+		if (file->position >= offset)
 		{
-		    dirname[index] = F_SEPARATORCHAR;
-		    
-		    memcpy(&dirname[0], &dirname[index], (length - index));
-		    
-		    dirname[length - index] = '\0';
+		    status = rfat_data_cache_zero(volume, file, blkno, p_entry);
 		}
 		else
 		{
-		    status = F_ERR_TOOLONGNAME;
+		    status = rfat_data_cache_read(volume, file, blkno, p_entry);
+		}
+
+		if (status == F_NO_ERROR)
+		{
+		    file->clsno = clsno;
+		    file->blkno = blkno;
+		    file->blkno_e = blkno_e;
 		}
 	    }
 	}
-
-	status = rfat_volume_unlock(volume, status);
     }
-	
+
     return status;
 }
 
+#if (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1)
 
-#if !defined(RFAT_CONFIG_ULTRA_LIGHT_BUILD)
-
-int f_rename(const char *filename, const char *newname)
+static int rfat_ring_sync(rfat_volume_t *volume, F_RING *ring)
 {
     int status = F_NO_ERROR;
-    uint32_t blkno, clsno_d, clsno_o, index_o;
-#if (RFAT_CONFIG_VFAT_SUPPORTED == 1)
-    uint32_t clsno, index, entries_o, count;
-    uint8_t nt_reserved_o;
-#endif /* (RFAT_CONFIG_VFAT_SUPPORTED == 1) */
-    rfat_dir_t *dir;
-    rfat_cache_entry_t *entry;
-    rfat_volume_t *volume;
+    uint32_t total;
+    rfat_ring_header_t header;
 
-    volume = RFAT_PATH_VOLUME(filename);
+    header.ring_lead_sig = RFAT_HTOFL(RFAT_RING_LEAD_SIG);
+    header.ring_blkcnt = RFAT_HTOFL(ring->blkcnt);
+    header.ring_tail_blkno = RFAT_HTOFL(ring->tail_blkno);
+    header.ring_tail_offset = RFAT_HTOFL(ring->tail_offset);
+
+    /* Seeking to the header block flushes the cached data block first, so
+     * that the header never points past data that is on the disk.
+     */
+    status = rfat_file_seek(volume, ring->file, 0);
 
-    status = rfat_volume_lock(volume);
-    
     if (status == F_NO_ERROR)
     {
-	if (volume->flags & RFAT_VOLUME_FLAG_WRITE_PROTECTED)
+	status = rfat_file_write(volume, ring->file, (const uint8_t*)&header, sizeof(header), &total);
+
+	if (status == F_NO_ERROR)
 	{
-	    status = F_ERR_WRITEPROTECT;
+	    status = rfat_file_datasync(volume, ring->file);
+
+	    if (status == F_NO_ERROR)
+	    {
+		ring->sync_blkno = ring->tail_blkno;
+	    }
 	}
-	else
+    }
+
+    return status;
+}
+
+static int rfat_ring_recover(rfat_volume_t *volume, F_RING *ring)
+{
+    int status = F_NO_ERROR;
+    uint32_t total, blkno, offset, index;
+    rfat_ring_header_t header;
+    rfat_ring_stamp_t stamp;
+
+    status = rfat_file_seek(volume, ring->file, 0);
+
+    if (status == F_NO_ERROR)
+    {
+	status = rfat_file_read(volume, ring->file, (uint8_t*)&header, sizeof(header), &total);
+
+	if (status == F_NO_ERROR)
 	{
-	    status = rfat_path_find_directory(volume, filename, &filename, &clsno_d);
-            
-	    if (status == F_NO_ERROR)
+	    if ((total != sizeof(header)) ||
+		(RFAT_FTOHL(header.ring_lead_sig) != RFAT_RING_LEAD_SIG) ||
+		(RFAT_FTOHL(header.ring_blkcnt) != ring->blkcnt) ||
+		(RFAT_FTOHL(header.ring_tail_offset) >= RFAT_RING_DATA_SIZE) ||
+		(ring->file->length != ((ring->blkcnt +1) << RFAT_BLK_SHIFT)))
 	    {
-		status = rfat_path_convert_filename(volume, filename, NULL);
-	    
-		if (status == F_NO_ERROR)
+		status = F_ERR_NOTUSEABLE;
+	    }
+	    else
+	    {
+		blkno = RFAT_FTOHL(header.ring_tail_blkno);
+		offset = RFAT_FTOHL(header.ring_tail_offset);
+
+		ring->sync_blkno = blkno;
+
+		/* Walk forward from the recorded tail throu all blocks that carry
+		 * a matching stamp. At most one full lap is scanned.
+		 */
+		for (index = 0; index < ring->blkcnt; index++)
 		{
-		    status = rfat_path_find_entry(volume, clsno_d, 0, 0, rfat_path_find_callback_name, NULL, &clsno_o, &index_o, &dir);
+		    status = rfat_file_seek(volume, ring->file, ((1 + (blkno % ring->blkcnt)) << RFAT_BLK_SHIFT));
 
 		    if (status == F_NO_ERROR)
 		    {
-			if (dir != NULL)
-			{
-			    if (dir->dir_attr & RFAT_DIR_ATTR_READ_ONLY)
-			    {
-				status = F_ERR_ACCESSDENIED;
-			    }
-			    else
-			    {
-				if (rfat_file_enumerate(volume, NULL, clsno_o, index_o))
-				{
-				    status = F_ERR_LOCKED;
-				}
-				else
-				{
-#if (RFAT_CONFIG_VFAT_SUPPORTED == 1)
-				    memcpy(&volume->dir, dir, sizeof(rfat_dir_t));
+			status = rfat_file_read(volume, ring->file, (uint8_t*)&stamp, sizeof(stamp), &total);
+		    }
 
-				    nt_reserved_o = dir->dir_nt_reserved;
+		    if ((status != F_NO_ERROR) ||
+			(RFAT_FTOHL(stamp.stamp_blkno) != (blkno +1)) ||
+			(RFAT_FTOHL(stamp.stamp_count) < offset) ||
+			(RFAT_FTOHL(stamp.stamp_count) > RFAT_RING_DATA_SIZE))
+		    {
+			break;
+		    }
 
-				    /* rfat_path_find_callback_name() fills in the proper volume->dir_entries on a match.
-				     */
-				    entries_o = volume->dir_entries;
-#endif /* (RFAT_CONFIG_VFAT_SUPPORTED == 1) */
+		    offset = RFAT_FTOHL(stamp.stamp_count);
 
-				    status = rfat_path_convert_filename(volume, newname, NULL);
-				
-				    if (status == F_NO_ERROR)
-				    {
-#if (RFAT_CONFIG_VFAT_SUPPORTED == 1)
-					if ((volume->dir.dir_name[0] == '\0') || (volume->dir.dir_nt_reserved & RFAT_DIR_TYPE_LOSSY))
-					{
-					    count = 1 + volume->dir_entries;
-					}
-					else
-					{
-					    count = 1;
-					}
+		    if (offset != RFAT_RING_DATA_SIZE)
+		    {
+			break;
+		    }
 
-					status = rfat_path_find_entry(volume, clsno_d, 0, count, rfat_path_find_callback_name, NULL, &clsno, &index, &dir);
-#else /* (RFAT_CONFIG_VFAT_SUPPORTED == 1) */
-					status = rfat_path_find_entry(volume, clsno_d, 0, 0, rfat_path_find_callback_name, NULL, NULL, NULL, &dir);
-#endif /* (RFAT_CONFIG_VFAT_SUPPORTED == 1) */
-				    
-					if (status == F_NO_ERROR)
-					{
-					    if (dir != NULL)
-					    {
-						status = F_ERR_DUPLICATED;
-					    }
-					    else
-					    {
-#if (RFAT_CONFIG_VFAT_SUPPORTED == 1)
-						if ((entries_o != 0) || (count != 1))
-						{
-#if (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1)
-						    /* For TRANSACTION_SAFE, the RFAT_DIR_FLAG_DESTROY_ENTRY operation is recorded first, and
-						     * the rfat_path_create_entry() gets called to add the RFAT_DIR_FLAG_CREATE_ENTRY part.
-						     * If that fails somehow, then the pending operations are canceled.
-						     */
-						    volume->dir_flags |= RFAT_DIR_FLAG_DESTROY_ENTRY;
-						    volume->del_clsno = clsno_o;
-						    volume->del_index = index_o;
-#if (RFAT_CONFIG_VFAT_SUPPORTED == 1)
-						    volume->del_entries = entries_o;
-#endif /* (RFAT_CONFIG_VFAT_SUPPORTED == 1) */
+		    blkno++;
+		    offset = 0;
+		}
 
-						    /* The call to rfat_path_create_entry() is special. The RFAT_CLUSTER_END_OF_CHAIN tells it
-						     * use the existing volume->dir as a template, and to overlay "attr" onto dir_nt_reserved.
-						     */
-						    status = rfat_path_create_entry(volume, clsno_d, clsno, index, NULL, nt_reserved_o, RFAT_CLSNO_END_OF_CHAIN, 0, 0);
-						
-						    if (status != F_NO_ERROR)
-						    {
-							volume->dir_flags &= ~(RFAT_DIR_FLAG_DESTROY_ENTRY | RFAT_DIR_FLAG_CREATE_ENTRY);
-						    }
+		if (status == F_NO_ERROR)
+		{
+		    ring->tail_blkno = blkno;
+		    ring->tail_offset = offset;
+		}
+	    }
+	}
+    }
 
-#else /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1) */
-						    status = rfat_volume_dirty(volume);
+    return status;
+}
 
-						    if (status == F_NO_ERROR)
-						    {
-							/* The call to rfat_path_create_entry() is special. The RFAT_CLUSTER_END_OF_CHAIN tells it
-							 * use the existing volume->dir as a template, and to overlay "attr" onto dir_nt_reserved.
-							 */
+static int rfat_ring_write(rfat_volume_t *volume, F_RING *ring, const uint8_t *data, uint32_t count, uint32_t *p_count)
+{
+    int status = F_NO_ERROR;
+    uint32_t position, size, total;
+    rfat_ring_stamp_t stamp;
 
-							status = rfat_path_create_entry(volume, clsno_d, clsno, index, NULL, nt_reserved_o, RFAT_CLSNO_END_OF_CHAIN, 0, 0);
-						    
-							if (status == F_NO_ERROR)
-							{
-#if (RFAT_CONFIG_VFAT_SUPPORTED == 1)
-							    status = rfat_path_destroy_entry(volume, clsno_o, index_o, entries_o, RFAT_CLSNO_NONE);
-#else /* (RFAT_CONFIG_VFAT_SUPPORTED == 1) */
-							    status = rfat_path_destroy_entry(volume, clsno_o, index_o, RFAT_CLUSTER_NONE);
-#endif /* (RFAT_CONFIG_VFAT_SUPPORTED == 1) */
-							}
+    *p_count = 0;
 
-							status = rfat_volume_clean(volume, status);
-						    }
-#endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1) */
-						}
-						else
-#endif /* (RFAT_CONFIG_VFAT_SUPPORTED == 1) */
+    while ((status == F_NO_ERROR) && (count != 0))
+    {
+	/* The recovery walks forward from the tail in the header, which only
+	 * works as long as the block the header points to has not been
+	 * overwritten. Hence the header is rewritten once per lap, before the
+	 * first block of the next lap gets written.
+	 */
+	if ((ring->tail_blkno - ring->sync_blkno) >= ring->blkcnt)
+	{
+	    status = rfat_ring_sync(volume, ring);
+
+	    if (status != F_NO_ERROR)
+	    {
+		break;
+	    }
+	}
+
+	size = RFAT_RING_DATA_SIZE - ring->tail_offset;
+
+	if (size > count)
+	{
+	    size = count;
+	}
+
+	position = (1 + (ring->tail_blkno % ring->blkcnt)) << RFAT_BLK_SHIFT;
+
+	stamp.stamp_blkno = RFAT_HTOFL(ring->tail_blkno +1);
+	stamp.stamp_count = RFAT_HTOFL(ring->tail_offset + size);
+
+	/* Data and stamp are within the same block, so both modifications end
+	 * up in the data cache, and get written out together.
+	 */
+	status = rfat_file_seek(volume, ring->file, position + sizeof(stamp) + ring->tail_offset);
+
+	if (status == F_NO_ERROR)
+	{
+	    status = rfat_file_write(volume, ring->file, data, size, &total);
+
+	    if (status == F_NO_ERROR)
+	    {
+		status = rfat_file_seek(volume, ring->file, position);
+
+		if (status == F_NO_ERROR)
+		{
+		    status = rfat_file_write(volume, ring->file, (const uint8_t*)&stamp, sizeof(stamp), &total);
+
+		    if (status == F_NO_ERROR)
+		    {
+			data += size;
+			count -= size;
+
+			*p_count += size;
+
+			ring->tail_offset += size;
+
+			if (ring->tail_offset == RFAT_RING_DATA_SIZE)
+			{
+			    ring->tail_blkno++;
+			    ring->tail_offset = 0;
+			}
+		    }
+		}
+	    }
+	}
+    }
+
+    return status;
+}
+
+static int rfat_ring_read(rfat_volume_t *volume, F_RING *ring, uint8_t *data, uint32_t count, uint32_t *p_count)
+{
+    int status = F_NO_ERROR;
+    uint32_t size, total;
+
+    *p_count = 0;
+
+    /* If the writer had overtaken the reader, continue with the oldest block
+     * that is still intact.
+     */
+    if ((ring->tail_blkno >= ring->blkcnt) && (ring->head_blkno < (ring->tail_blkno - ring->blkcnt +1)))
+    {
+	ring->head_blkno = ring->tail_blkno - ring->blkcnt +1;
+	ring->head_offset = 0;
+    }
+
+    while ((status == F_NO_ERROR) && (count != 0))
+    {
+	if (ring->head_blkno == ring->tail_blkno)
+	{
+	    size = ring->tail_offset - ring->head_offset;
+	}
+	else
+	{
+	    size = RFAT_RING_DATA_SIZE - ring->head_offset;
+	}
+
+	if (size == 0)
+	{
+	    break;
+	}
+
+	if (size > count)
+	{
+	    size = count;
+	}
+
+	status = rfat_file_seek(volume, ring->file, ((1 + (ring->head_blkno % ring->blkcnt)) << RFAT_BLK_SHIFT) + sizeof(rfat_ring_stamp_t) + ring->head_offset);
+
+	if (status == F_NO_ERROR)
+	{
+	    status = rfat_file_read(volume, ring->file, data, size, &total);
+
+	    if (status == F_NO_ERROR)
+	    {
+		data += size;
+		count -= size;
+
+		*p_count += size;
+
+		ring->head_offset += size;
+
+		if (ring->head_offset == RFAT_RING_DATA_SIZE)
+		{
+		    ring->head_blkno++;
+		    ring->head_offset = 0;
+		}
+	    }
+	}
+    }
+
+    return status;
+}
+
+/* rfat_pool_name() substitutes the '#' characters in "pool->pattern" by the
+ * decimal digits of "sequence", with the last '#' being the least significant
+ * digit.
+ */
+
+static int rfat_pool_name(F_POOL *pool, uint32_t sequence, char *filename)
+{
+    int status = F_NO_ERROR;
+    unsigned int n;
+
+    for (n = 0; pool->pattern[n] != '\0'; n++)
+    {
+	filename[n] = pool->pattern[n];
+    }
+
+    filename[n] = '\0';
+
+    while (n != 0)
+    {
+	n--;
+
+	if (filename[n] == '#')
+	{
+	    filename[n] = '0' + (sequence % 10);
+
+	    sequence = sequence / 10;
+	}
+    }
+
+    if (sequence != 0)
+    {
+	status = F_ERR_NOMOREENTRY;
+    }
+
+    return status;
+}
+
+#endif /* (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1) */
+
+
+/***********************************************************************************************************************/
+
+const char * f_getversion(void)
+{
+    return RFAT_VERSION_STRING;
+}
+
+int f_initvolume(void)
+{
+    int status = F_NO_ERROR;
+    rfat_volume_t *volume;
+
+    volume = RFAT_DEFAULT_VOLUME();
+
+    status = rfat_volume_lock_noinit(volume);
+    
+    if (status == F_NO_ERROR)
+    {
+        status = rfat_volume_init(volume);
+        
+	status = rfat_volume_unlock(volume, status);
+    }
+
+    return status;
+}
+
+int f_delvolume(void)
+{
+    int status = F_NO_ERROR;
+    rfat_volume_t *volume;
+
+    volume = RFAT_DEFAULT_VOLUME();
+
+    status = rfat_volume_lock_nomount(volume);
+    
+    if (status == F_NO_ERROR)
+    {
+	status = rfat_volume_unmount(volume);
+
+	if (status == F_NO_ERROR)
+	{
+	    status = rfat_disk_release(volume->disk);
+
+	    if (status == F_NO_ERROR)
+	    {
+		volume->state = RFAT_VOLUME_STATE_INITIALIZED;
+		volume->disk = NULL;
+	    }
+	}
+        
+	status = rfat_volume_unlock(volume, status);
+    }
+
+    return status;
+}
+
+int f_format(int fattype)
+{
+    int status = F_NO_ERROR;
+    rfat_volume_t *volume;
+
+    volume = RFAT_DEFAULT_VOLUME();
+
+    status = rfat_volume_lock(volume);
+    
+    if (status == F_NO_ERROR)
+    {
+	if (volume->flags & RFAT_VOLUME_FLAG_WRITE_PROTECTED)
+	{
+	    status = F_ERR_WRITEPROTECT;
+	}
+	else
+	{
+	    status = rfat_volume_unmount(volume);
+
+	    if (status == F_NO_ERROR)
+	    {
+		status = rfat_volume_erase(volume);
+	    }
+	}
+
+	status = rfat_volume_unlock(volume, status);
+    }
+
+    return status;
+}
+
+
+#if !defined(RFAT_CONFIG_ULTRA_LIGHT_BUILD)
+
+int f_hardformat(int fattype)
+{
+    int status = F_NO_ERROR;
+    rfat_volume_t *volume;
+
+    volume = RFAT_DEFAULT_VOLUME();
+
+    status = rfat_volume_lock_nomount(volume);
+    
+    if (status == F_NO_ERROR)
+    {
+	status = rfat_volume_unmount(volume);
+
+	if (status == F_NO_ERROR)
+	{
+	    status = rfat_volume_format(volume);
+        }
+        
+	status = rfat_volume_unlock(volume, status);
+    }
+
+    return status;
+}
+
+#endif /* !defined(RFAT_CONFIG_ULTRA_LIGHT_BUILD) */
+
+
+int f_getfreespace(F_SPACE *pspace)
+{
+    int status = F_NO_ERROR;
+    uint32_t clsno, clsno_e, clscnt_total, clscnt_free, clsdata;
+    rfat_volume_t *volume;
+
+    volume = RFAT_DEFAULT_VOLUME();
+
+    status = rfat_volume_lock(volume);
+    
+    if (status == F_NO_ERROR)
+    {
+#if (RFAT_CONFIG_FSINFO_SUPPORTED == 1)
+	if (volume->flags & RFAT_VOLUME_FLAG_FSINFO_VALID)
+	{
+	    clscnt_total = volume->last_clsno - 1;
+	    clscnt_free = volume->free_clscnt;
+	}
+	else
+#endif /* (RFAT_CONFIG_FSINFO_SUPPORTED == 1) */
+	{
+	    clscnt_total = volume->last_clsno - 1;
+	    clscnt_free = 0;
+
+	    for (clsno = 2, clsno_e = volume->last_clsno; ((status == F_NO_ERROR) && (clsno <= clsno_e)); clsno++)
+	    {
+		/* Bypass cluster cache on read while scanning.
+		 */
+		status = rfat_cluster_read_uncached(volume, clsno, &clsdata);
+		
+		if (status == F_NO_ERROR)
+		{
+		    if (clsdata == RFAT_CLSNO_FREE)
+		    {
+			clscnt_free++;
+		    }
+		}
+	    }
+
+#if (RFAT_CONFIG_FSINFO_SUPPORTED == 1)
+	    if (status == F_NO_ERROR)
+	    {
+		volume->flags |= (RFAT_VOLUME_FLAG_FSINFO_VALID | RFAT_VOLUME_FLAG_FSINFO_DIRTY);
+		volume->free_clscnt = clscnt_free;
+
+		if ((volume->state == RFAT_VOLUME_STATE_MOUNTED) &&
+		    (volume->fsinfo_blkofs != 0))
+		{
+#if (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1)
+		    /* If a map/fat entry has changed, this triggers a record/commit sequence.
+		     * Otherwise the RFAT_VOLUME_FLAG_FSINFO_DIRTY setting will simply update
+		     * the FSINFO on disk.
+		     */
+		    status = rfat_volume_record(volume);
+
+#else /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1) */
+
+#if (RFAT_CONFIG_VOLUME_DIRTY_SUPPORTED == 1)
+		    /* volume->free_clscnt is only maintained in FSINFO if RFAT_VOLUME_FLAG_MOUNTED_DIRTY
+		     * is not set. If RFAT_VOLUME_FLAG_VOLUME_DIRTY is set, then the volume is in a dirty
+		     * state, where volume->free_clscnt cannot be updated. In this case wait for the update
+		     * till the next rfat_volume_clean() gets called.
+		     */
+		    if (!(volume->flags & (RFAT_VOLUME_FLAG_VOLUME_DIRTY | RFAT_VOLUME_FLAG_MOUNTED_DIRTY)))
+		    {
+			status = rfat_fat_cache_flush(volume);
+		    
+			if (status == F_NO_ERROR)
+			{
+			    status = rfat_volume_fsinfo(volume, volume->free_clscnt, volume->next_clsno);
+			    
+			    if (status == F_NO_ERROR)
+			    {
+				volume->flags &= ~RFAT_VOLUME_FLAG_FSINFO_DIRTY;
+			    }
+			}
+		    }
+#endif /* (RFAT_CONFIG_VOLUME_DIRTY_SUPPORTED == 1) */
+#endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1) */
+		}
+	    }
+#endif /* (RFAT_CONFIG_FSINFO_SUPPORTED == 1) */
+	}
+
+        if (status == F_NO_ERROR)
+        {
+            pspace->total      = clscnt_total << volume->cls_shift;
+            pspace->free       = clscnt_free  << volume->cls_shift;
+            pspace->used       = (clscnt_total - clscnt_free) << volume->cls_shift;
+            pspace->bad        = 0;
+            pspace->total_high = clscnt_total >> (32 - volume->cls_shift);
+            pspace->free_high  = clscnt_free  >> (32 - volume->cls_shift);
+            pspace->used_high  = (clscnt_total - clscnt_free) >> (32 - volume->cls_shift);
+            pspace->bad_high   = 0;
+        }
+
+	status = rfat_volume_unlock(volume, status);
+    }
+
+    return status;
+}
+
+int f_getserial(unsigned long *p_serial)
+{
+    int status = F_NO_ERROR;
+    rfat_volume_t *volume;
+
+    volume = RFAT_DEFAULT_VOLUME();
+    
+    status = rfat_volume_lock(volume);
+    
+    if (status == F_NO_ERROR)
+    {
+	*p_serial = volume->serial;
+
+	status = rfat_volume_unlock(volume, status);
+    }
+
+    return status;
+}
+
+
+#if !defined(RFAT_CONFIG_ULTRA_LIGHT_BUILD)
+
+int f_setlabel(const char *volname)
+{
+    int status = F_NO_ERROR;
+    uint32_t clsno, index;
+    uint16_t ctime, cdate;
+    rfat_dir_t *dir;
+    rfat_volume_t *volume;
+
+    volume = RFAT_DEFAULT_VOLUME();
+    
+    status = rfat_volume_lock(volume);
+    
+    if (status == F_NO_ERROR)
+    {
+	if (volume->flags & RFAT_VOLUME_FLAG_WRITE_PROTECTED)
+	{
+	    status = F_ERR_WRITEPROTECT;
+	}
+	else
+	{
+	    volname = rfat_name_cstring_to_label(volname, volume->dir.dir_name);
+
+	    if (volname != NULL)
+	    {
+#if (RFAT_CONFIG_VFAT_SUPPORTED == 1)
+		volume->dir.dir_nt_reserved = 0x00;
+#endif /* (RFAT_CONFIG_VFAT_SUPPORTED == 1) */
+
+		status = rfat_path_find_entry(volume, RFAT_CLSNO_NONE, 0, 1, rfat_path_find_callback_volume, NULL, &clsno, &index, &dir);
+
+		if (status == F_NO_ERROR)
+		{
+#if defined(RFAT_PORT_CORE_TIMEDATE)
+		    RFAT_PORT_CORE_TIMEDATE(&ctime, &cdate);
+#else /* RFAT_PORT_CORE_TIMEDATE */
+		    ctime = 0;
+		    cdate = 0;
+#endif /* RFAT_PORT_CORE_TIMEDATE */
+
+		    if (dir == NULL)
+		    {
+#if (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0)
+			status = rfat_volume_dirty(volume);
+
+			if (status == F_NO_ERROR)
+#endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0) */
+			{
+			    status = rfat_path_create_entry(volume, RFAT_CLSNO_NONE, clsno, index, (const char*)volume->dir.dir_name, RFAT_DIR_ATTR_VOLUME_ID, RFAT_CLSNO_NONE, ctime, cdate);
+			
+#if (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0)
+			    status = rfat_volume_clean(volume, status);
+#endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0) */
+			}
+		    }
+		    else
+		    {
+			memcpy(dir->dir_name, volume->dir.dir_name, sizeof(dir->dir_name));
+
+			dir->dir_wrt_time = RFAT_HTOFS(ctime);
+			dir->dir_wrt_date = RFAT_HTOFS(cdate);
+
+			status = rfat_dir_cache_write(volume);
+		    }
+		}
+	    }
+	    else
+	    {
+		status = F_ERR_INVALIDNAME;
+	    }
+	}
+
+	status = rfat_volume_unlock(volume, status);
+    }
+
+    return status;
+}
+
+int f_getlabel(char *volname, int length)
+{
+    int status = F_NO_ERROR;
+    const uint8_t *dosname;
+    char *volname_e;
+    rfat_dir_t *dir;
+    rfat_boot_t *boot;
+    rfat_volume_t *volume;
+
+    volume = RFAT_DEFAULT_VOLUME();
+    
+    status = rfat_volume_lock(volume);
+    
+    if (status == F_NO_ERROR)
+    {
+	dosname = NULL;
+
+	status = rfat_path_find_entry(volume, RFAT_CLSNO_NONE, 0, 0, rfat_path_find_callback_volume, NULL, NULL, NULL, &dir);
+
+	if (status == F_NO_ERROR)
+	{
+	    volname_e = volname + length;
+
+	    if (dir == NULL)
+	    {
+#if (RFAT_CONFIG_VOLUME_DIRTY_SUPPORTED == 1) || (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1)
+		boot = (rfat_boot_t*)((void*)&volume->bs_data[0]);
+#else /* (RFAT_CONFIG_VOLUME_DIRTY_SUPPORTED == 1) || (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1) */
+
+		boot = (rfat_boot_t*)((void*)volume->dir_cache.data);
+
+		status = rfat_dir_cache_flush(volume);
+		
+		if (status == F_NO_ERROR)
+		{
+		    status = rfat_volume_read(volume, volume->boot_blkno, (uint8_t*)boot);
+		}
+
+		if (status == F_NO_ERROR)
+#endif /* (RFAT_CONFIG_VOLUME_DIRTY_SUPPORTED == 1) || (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1) */
+		{
+		    if (volume->type != RFAT_VOLUME_TYPE_FAT32)
+		    {
+			if (boot->bpb40.bs_boot_sig == 0x29)
+			{
+			    dosname = (const uint8_t*)boot->bpb40.bs_vol_lab;
+			}
+		    }
+		    else
+		    {
+			if (boot->bpb71.bs_boot_sig == 0x29)
+			{
+			    dosname = (const uint8_t*)boot->bpb71.bs_vol_lab;
+			}
+		    }
+		}
+	    }
+	    else
+	    {
+		dosname = (const uint8_t*)dir->dir_name;
+	    }
+	}
+
+	if (status == F_NO_ERROR)
+	{
+	    if (dosname != NULL)
+	    {
+		volname = rfat_name_label_to_cstring(dosname, volname, volname_e);
+
+		if (volname == NULL)
+		{
+		    status = F_ERR_TOOLONGNAME;
+		}
+	    }
+	    else
+	    {
+		status = F_ERR_NOTFOUND;
+	    }
+	}
+
+	status = rfat_volume_unlock(volume, status);
+    }
+
+    return status;
+}
+
+#endif /* !defined(RFAT_CONFIG_ULTRA_LIGHT_BUILD) */
+
+int f_idle(void)
+{
+    int status = F_NO_ERROR;
+    rfat_volume_t *volume;
+
+    volume = RFAT_DEFAULT_VOLUME();
+
+    status = rfat_volume_lock(volume);
+    
+    if (status == F_NO_ERROR)
+    {
+#if (RFAT_CONFIG_DEFERRED_RELEASE_ENTRIES != 0)
+	status = rfat_volume_release(volume, RFAT_CONFIG_DEFERRED_RELEASE_CLUSTERS);
+#endif /* (RFAT_CONFIG_DEFERRED_RELEASE_ENTRIES != 0) */
+
+#if (RFAT_CONFIG_WRITE_BUDGET_SUPPORTED == 1)
+	if (status == F_NO_ERROR)
+	{
+	    status = rfat_volume_idle(volume);
+	}
+#endif /* (RFAT_CONFIG_WRITE_BUDGET_SUPPORTED == 1) */
+
+	status = rfat_volume_unlock(volume, status);
+    }
+
+    return status;
+}
+
+int f_poll(int *pbusy)
+{
+    int status = F_NO_ERROR;
+    rfat_volume_t *volume;
+    bool busy = false;
+
+    volume = RFAT_DEFAULT_VOLUME();
+
+    status = rfat_volume_lock(volume);
+    
+    if (status == F_NO_ERROR)
+    {
+	/* Let the card program the outstanding multi block write in the
+	 * background. An error reported by the card afterwards ends up in
+	 * the status of the file that issued the write, and is returned
+	 * by its next f_flush() or f_close().
+	 */
+	status = rfat_disk_poll(volume->disk, RFAT_DISK_ADDRESS_NONE, &busy);
+
+	status = rfat_volume_unlock(volume, status);
+    }
+
+    *pbusy = busy;
+
+    return status;
+}
+
+int f_begin(void)
+{
+    int status = F_NO_ERROR;
+    rfat_volume_t *volume;
+
+    volume = RFAT_DEFAULT_VOLUME();
+
+    status = rfat_volume_lock(volume);
+    
+    if (status == F_NO_ERROR)
+    {
+#if (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1)
+	if (volume->flags & RFAT_VOLUME_FLAG_TRANSACTION)
+	{
+	    status = F_ERR_NOTUSEABLE;
+	}
+	else
+	{
+	    volume->flags |= RFAT_VOLUME_FLAG_TRANSACTION;
+	}
+#endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1) */
+
+	status = rfat_volume_unlock(volume, status);
+    }
+
+    return status;
+}
+
+int f_commit(void)
+{
+    int status = F_NO_ERROR;
+    rfat_volume_t *volume;
+
+    volume = RFAT_DEFAULT_VOLUME();
+
+    status = rfat_volume_lock(volume);
+    
+    if (status == F_NO_ERROR)
+    {
+#if (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1)
+	if (volume->flags & RFAT_VOLUME_FLAG_TRANSACTION)
+	{
+	    volume->flags &= ~RFAT_VOLUME_FLAG_TRANSACTION;
+
+	    volume->group_clsno = RFAT_CLSNO_NONE;
+	    volume->group_dir_index = RFAT_GROUP_INDEX_NONE;
+
+	    /* Record the accumulated map (which also covers the last directory update),
+	     * copy FAT2 to FAT1 and clear the log, all in one go.
+	     */
+	    status = rfat_volume_record(volume);
+	}
+	else
+	{
+	    status = F_ERR_NOTUSEABLE;
+	}
+#endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1) */
+
+	status = rfat_volume_unlock(volume, status);
+    }
+
+    return status;
+}
+
+#if (RFAT_CONFIG_STATISTICS == 1)
+
+int f_getbusstat(F_BUSSTAT *pstat, int reset)
+{
+    int status = F_NO_ERROR;
+    rfat_volume_t *volume;
+
+    volume = RFAT_DEFAULT_VOLUME();
+
+    status = rfat_volume_lock_nomount(volume);
+    
+    if (status == F_NO_ERROR)
+    {
+	rfat_disk_bus_statistics(volume->disk, pstat, (reset != 0));
+
+	status = rfat_volume_unlock(volume, status);
+    }
+
+    return status;
+}
+
+#endif /* (RFAT_CONFIG_STATISTICS == 1) */
+
+#if (RFAT_CONFIG_LOCK_STATISTICS_ENTRIES != 0)
+
+int f_getlockstat(int lock, F_LOCKSTAT *plockstat, int reset)
+{
+    int status = F_NO_ERROR;
+    rfat_volume_t *volume;
+
+    volume = RFAT_DEFAULT_VOLUME();
+
+    status = rfat_volume_lock_nomount(volume);
+    
+    if (status == F_NO_ERROR)
+    {
+	if (lock == F_LOCKSTAT_CORE)
+	{
+	    memcpy(plockstat, &volume->lock_statistics[0], sizeof(volume->lock_statistics));
+
+	    if (reset)
+	    {
+		memset(&volume->lock_statistics[0], 0, sizeof(volume->lock_statistics));
+
+		/* The pending rfat_volume_unlock() needs a valid entry to account against.
+		 */
+		volume->lock_entry = rfat_lock_statistics_acquire(&volume->lock_statistics[0], __func__, 0);
+	    }
+	}
+	else if (lock == F_LOCKSTAT_DISK)
+	{
+	    status = rfat_disk_lock_statistics(volume->disk, plockstat, (reset != 0));
+	}
+	else
+	{
+	    status = F_ERR_NOTUSEABLE;
+	}
+
+	status = rfat_volume_unlock(volume, status);
+    }
+
+    return status;
+}
+
+#endif /* (RFAT_CONFIG_LOCK_STATISTICS_ENTRIES != 0) */
+
+int f_mkdir(const char *dirname)
+{
+    int status = F_NO_ERROR;
+    uint16_t ctime, cdate;
+    uint32_t clsno, clsno_d, clsno_s, blkno_s, index, count;
+    rfat_dir_t *dir;
+    rfat_cache_entry_t *entry;
+    rfat_volume_t *volume;
+
+    volume = RFAT_PATH_VOLUME(dirname);
+    
+    status = rfat_volume_lock(volume);
+    
+    if (status == F_NO_ERROR)
+    {
+	if (volume->flags & RFAT_VOLUME_FLAG_WRITE_PROTECTED)
+	{
+	    status = F_ERR_WRITEPROTECT;
+	}
+	else
+	{
+	    if (((dirname[0] == '/') || (dirname[0] == '\\')) && (dirname[1] == '\0'))
+	    {
+		status = F_ERR_INVALIDDIR;
+	    }
+	    else
+	    {
+		status = rfat_path_find_directory(volume, dirname, &dirname, &clsno_d);
+            
+		if (status == F_NO_ERROR)
+		{
+		    status = rfat_path_convert_filename(volume, dirname, NULL);
+
+		    if (status == F_NO_ERROR)
+		    {
+			if (volume->dir.dir_name[0] == '.')
+			{
+			    status = F_ERR_NOTFOUND;
+			}
+			else
+			{
+#if (RFAT_CONFIG_VFAT_SUPPORTED == 1)
+			    if ((volume->dir.dir_name[0] == '\0') || (volume->dir.dir_nt_reserved & RFAT_DIR_TYPE_LOSSY))
+			    {
+				count = 1 + volume->dir_entries;
+			    }
+			    else
+#endif /* (RFAT_CONFIG_VFAT_SUPPORTED == 1) */
+			    {
+				count = 1;
+			    }
+
+			    status = rfat_path_find_entry(volume, clsno_d, 0, count, rfat_path_find_callback_name, NULL, &clsno, &index, &dir);
+			
+			    if (status == F_NO_ERROR)
+			    {
+				if (dir == NULL)
+				{
+				    /* No conflicting entry found, hence start out creating the subdirectory.
+				     *
+				     * The strategy is to first allocate the cluster for the subdirectory, populate it
+				     * and then create the new directory entry in the parent. This way there is no
+				     * inconsistent file system state along the way.
+				     */
+
+#if (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0)
+				    status = rfat_volume_dirty(volume);
+#else /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0) */
+				    /* Within a f_begin()/f_commit() group the log gets cleared first, as
+				     * no file owns the new cluster (see rfat_volume_reclaim()).
+				     */
+				    status = rfat_volume_settle(volume);
+#endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0) */
+
+				    if (status == F_NO_ERROR)
+				    {
+					status = rfat_cluster_chain_create(volume, RFAT_CLSNO_NONE, 1, &clsno_s, NULL);
+				
+					if (status == F_NO_ERROR)
+					{
+					    blkno_s = RFAT_CLSNO_TO_BLKNO(clsno_s);
+				    
+					    status = rfat_volume_zero(volume, blkno_s, volume->cls_blk_size, NULL);
+
+					    if (status == F_NO_ERROR)
+					    {
+						status = rfat_dir_cache_zero(volume, blkno_s, &entry);
+
+						if (status == F_NO_ERROR)
+						{
+#if defined(RFAT_PORT_CORE_TIMEDATE)
+						    RFAT_PORT_CORE_TIMEDATE(&ctime, &cdate);
+#else /* RFAT_PORT_CORE_TIMEDATE */
+						    ctime = 0;
+						    cdate = 0;
+#endif /* RFAT_PORT_CORE_TIMEDATE */
+						
+						    rfat_path_setup_entry(volume, rfat_dirname_dot, RFAT_DIR_ATTR_DIRECTORY, clsno_s, ctime, cdate, ((rfat_dir_t*)((void*)entry->data)));
+						    rfat_path_setup_entry(volume, rfat_dirname_dotdot, RFAT_DIR_ATTR_DIRECTORY, clsno_d, ctime, cdate, ((rfat_dir_t*)((void*)(entry->data + sizeof(rfat_dir_t)))));
+						
+						    status = rfat_dir_cache_write(volume);
+						
+						    if (status == F_NO_ERROR)
+						    {
+							/* Subdirectory has been created, so back to hooking up the directory entry.
+							 */
+						    
+							status = rfat_path_create_entry(volume, clsno_d, clsno, index, NULL, RFAT_DIR_ATTR_DIRECTORY, clsno_s, ctime, cdate);
+
+							if (status == F_ERR_NOMOREENTRY)
+							{
+							    rfat_cluster_chain_destroy(volume, clsno_s, RFAT_CLSNO_FREE);
+							}
+						    }
+						}
+					    }
+					}
+
+#if (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0)
+					status = rfat_volume_clean(volume, status);
+#endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0) */
+				    }
+				}
+				else
+				{
+				    status = F_ERR_DUPLICATED;
+				}
+			    }
+			}
+		    }
+		}
+	    }
+	}
+
+	status = rfat_volume_unlock(volume, status);
+    }
+
+    return status;
+}
+
+int f_rmdir(const char *dirname)
+{
+    int status = F_NO_ERROR;
+    uint32_t clsno, clsno_d, index, first_clsno;
+#if (RFAT_CONFIG_VFAT_SUPPORTED == 1)
+    unsigned int entries;
+#endif /* (RFAT_CONFIG_VFAT_SUPPORTED == 1) */
+    rfat_dir_t *dir;
+    rfat_volume_t *volume;
+
+    volume = RFAT_PATH_VOLUME(dirname);
+    
+    status = rfat_volume_lock(volume);
+    
+    if (status == F_NO_ERROR)
+    {
+	if (volume->flags & RFAT_VOLUME_FLAG_WRITE_PROTECTED)
+	{
+	    status = F_ERR_WRITEPROTECT;
+	}
+	else
+	{
+	    if (((dirname[0] == '/') || (dirname[0] == '\\')) && (dirname[1] == '\0'))
+	    {
+		status = F_ERR_INVALIDDIR;
+	    }
+	    else
+	    {
+		status = rfat_path_find_directory(volume, dirname, &dirname, &clsno_d);
+            
+		if (status == F_NO_ERROR)
+		{
+		    status = rfat_path_convert_filename(volume, dirname, NULL);
+
+		    if (status == F_NO_ERROR)
+		    {
+			if (volume->dir.dir_name[0] == '.')
+			{
+			    status = F_ERR_NOTFOUND;
+			}
+			else
+			{
+			    // ### FIXME ... filter out "/"
+			    status = rfat_path_find_entry(volume, clsno_d, 0, 0, rfat_path_find_callback_name, NULL, &clsno, &index, &dir);
+			
+			    if (status == F_NO_ERROR)
+			    {
+				if (dir != NULL)
+				{
+				    if (dir->dir_attr & RFAT_DIR_ATTR_DIRECTORY)
+				    {
+#if (RFAT_CONFIG_VFAT_SUPPORTED == 1)
+					/* rfat_path_find_callback_name() fills in the proper volume->dir_entries on a match.
+					 */
+					entries = volume->dir_entries;
+#endif /* (RFAT_CONFIG_VFAT_SUPPORTED == 1) */
+
+					if (volume->type == RFAT_VOLUME_TYPE_FAT32)
+					{
+					    first_clsno = ((uint32_t)RFAT_FTOHS(dir->dir_clsno_hi) << 16) | (uint32_t)RFAT_FTOHS(dir->dir_clsno_lo);
+					}
+					else
+					{ 
+					    first_clsno = (uint32_t)RFAT_FTOHS(dir->dir_clsno_lo);
+					}
+
+					/* Skip "." and ".."
+					 */
+					status = rfat_path_find_entry(volume, first_clsno, 2, 0, rfat_path_find_callback_empty, NULL, NULL, NULL, &dir);
+
+					if (status == F_NO_ERROR)
+					{
+					    if (dir == NULL)
+					    {
+#if (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0)
+						status = rfat_volume_dirty(volume);
+
+						if (status == F_NO_ERROR)
+#endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0) */
+						{
+#if (RFAT_CONFIG_VFAT_SUPPORTED == 1)
+						    status = rfat_path_destroy_entry(volume, clsno, index, entries, first_clsno);
+#else /* (RFAT_CONFIG_VFAT_SUPPORTED == 1) */
+						    status = rfat_path_destroy_entry(volume, clsno, index, first_clsno);
+#endif /* (RFAT_CONFIG_VFAT_SUPPORTED == 1) */
+					    
+						    if (status == F_NO_ERROR)
+						    {
+							if (volume->cwd_clsno == first_clsno)
+							{
+							    volume->cwd_clsno = RFAT_CLSNO_END_OF_CHAIN;
+							}
+						    }
+
+					    
+#if (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0)
+						    status = rfat_volume_clean(volume, status);
+#endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0) */
+						}
+					    }
+					    else
+					    {
+						status = F_ERR_NOTEMPTY;
+					    }
+					}
+				    }
+				    else
+				    {
+					status = F_ERR_INVALIDDIR;
+				    }
+				}
+				else
+				{
+				    status = F_ERR_NOTFOUND;
+				}
+			    }
+			}
+		    }
+		}
+	    }
+	}
+
+	status = rfat_volume_unlock(volume, status);
+    }
+
+    return status;
+}
+
+int f_chdir(const char *dirname)
+{
+    int status = F_NO_ERROR;
+    uint32_t clsno_d, blkno_d;
+    rfat_cache_entry_t *entry;
+    rfat_dir_t *dir;
+    rfat_volume_t *volume;
+
+    volume = RFAT_PATH_VOLUME(dirname);
+
+    status = rfat_volume_lock(volume);
+    
+    if (status == F_NO_ERROR)
+    {
+        if (((dirname[0] == '/') || (dirname[0] == '\\')) && (dirname[1] == '\0'))
+        {
+            /* rfat_path_find_directory cannot return a vaild "dir" for the "/",
+             * so special code this here.
+             */
+            volume->cwd_clsno = RFAT_CLSNO_NONE;
+        }
+        else
+        {
+            status = rfat_path_find_directory(volume, dirname, &dirname, &clsno_d);
+            
+            if (status == F_NO_ERROR)
+            {
+		status = rfat_path_convert_filename(volume, dirname, NULL);
+		
+		if (status == F_NO_ERROR)
+		{
+		    if (volume->dir.dir_name[0] == '.')
+		    {
+			if (volume->dir.dir_name[1] == ' ')
+			{
+			    /* "." */
+			    volume->cwd_clsno = clsno_d;
+			}
+			else
+			{
+			    /* ".." */
+
+			    if (clsno_d != RFAT_CLSNO_NONE)
+			    {
+				blkno_d = RFAT_CLSNO_TO_BLKNO(clsno_d);
+
+				status = rfat_dir_cache_read(volume, blkno_d, &entry);
+                                                
+				if (status == F_NO_ERROR)
+				{
+				    dir = (rfat_dir_t*)((void*)(entry->data + sizeof(rfat_dir_t)));
+                                
+				    if (volume->type == RFAT_VOLUME_TYPE_FAT32)
+				    {
+					volume->cwd_clsno = ((uint32_t)RFAT_FTOHS(dir->dir_clsno_hi) << 16) | (uint32_t)RFAT_FTOHS(dir->dir_clsno_lo);
+				    }
+				    else
+				    {
+					volume->cwd_clsno = (uint32_t)RFAT_FTOHS(dir->dir_clsno_lo);
+				    }
+				}
+			    }
+			    else
+			    {
+				status = F_ERR_NOTFOUND;
+			    }
+			}
+		    }
+		    else
+		    {
+			status = rfat_path_find_entry(volume, clsno_d, 0, 0, rfat_path_find_callback_name, NULL, NULL, NULL, &dir);
+
+			if (status == F_NO_ERROR)
+			{
+			    if (dir != NULL)
+			    {
+				if (dir->dir_attr & RFAT_DIR_ATTR_DIRECTORY)
+				{
+				    if (volume->type == RFAT_VOLUME_TYPE_FAT32)
+				    {
+					volume->cwd_clsno = ((uint32_t)RFAT_FTOHS(dir->dir_clsno_hi) << 16) | (uint32_t)RFAT_FTOHS(dir->dir_clsno_lo);
+				    }
+				    else
+				    {
+					volume->cwd_clsno = (uint32_t)RFAT_FTOHS(dir->dir_clsno_lo);
+				    }
+				}
+				else
+				{
+				    status = F_ERR_INVALIDDIR;
+				}
+			    }
+			    else
+			    {
+				status = F_ERR_NOTFOUND;
+			    }
+			}
+		    }
+		}
+	    }
+        }
+
+	status = rfat_volume_unlock(volume, status);
+    }
+
+    return status;
+}
+
+int f_getcwd(char *dirname, int length)
+{
+    int status = F_NO_ERROR;
+    uint32_t clsno_s, clsno_p, clsno_g, blkno, index;
+    char *dirname_e;
+    rfat_cache_entry_t *entry;
+    rfat_dir_t *dir;
+    rfat_volume_t *volume;
+    
+    volume = RFAT_DEFAULT_VOLUME();
+
+    status = rfat_volume_lock(volume);
+    
+    if (status == F_NO_ERROR)
+    {
+	if (length == 1)
+	{
+            status = F_ERR_TOOLONGNAME;
+	}
+	else
+	{
+	    clsno_s = volume->cwd_clsno;
+	
+	    index = length -1;
+	    
+	    if (clsno_s != RFAT_CLSNO_NONE)
+	    {
+		blkno = volume->cls_blk_offset + (clsno_s << volume->cls_blk_shift);
+		    
+		status = rfat_dir_cache_read(volume, blkno, &entry);
+
+		if (status == F_NO_ERROR)
+		{
+		    dir = (rfat_dir_t*)((void*)(entry->data + sizeof(rfat_dir_t)));
+		    
+		    if (volume->type == RFAT_VOLUME_TYPE_FAT32)
+		    {
+			clsno_p = ((uint32_t)RFAT_FTOHS(dir->dir_clsno_hi) << 16) | (uint32_t)RFAT_FTOHS(dir->dir_clsno_lo);
+		    }
+		    else
+		    {
+			clsno_p = (uint32_t)RFAT_FTOHS(dir->dir_clsno_lo);
+		    }
+		    
+		    do
+		    {
+			if (clsno_p != RFAT_CLSNO_NONE)
+			{
+			    blkno = volume->cls_blk_offset + (clsno_p << volume->cls_blk_shift);
+			    
+			    status = rfat_dir_cache_read(volume, blkno, &entry);
+			    
+			    if (status == F_NO_ERROR)
+			    {
+				dir = (rfat_dir_t*)((void*)(entry->data + sizeof(rfat_dir_t)));
+				
+				if (volume->type == RFAT_VOLUME_TYPE_FAT32)
+				{
+				    clsno_g = ((uint32_t)RFAT_FTOHS(dir->dir_clsno_hi) << 16) | (uint32_t)RFAT_FTOHS(dir->dir_clsno_lo);
+				}
+				else
+				{
+				    clsno_g = (uint32_t)RFAT_FTOHS(dir->dir_clsno_lo);
+				}
+			    }
+			}
+			else
+			{
+			    clsno_g = RFAT_CLSNO_NONE;
+			}
+
+			if (status == F_NO_ERROR)
+			{
+			    status = rfat_path_find_entry(volume, clsno_p, 0, 0, rfat_path_find_callback_directory, (void*)clsno_s, NULL, NULL, &dir);
+
+			    if (status == F_NO_ERROR)
+			    {
+				if (dir != NULL)
+				{
+				    if (clsno_s != volume->cwd_clsno)
+				    {
+					if (index != 0)
+					{
+					    dirname[index--] = F_SEPARATORCHAR;
+					}
+					else
+					{
+					    status = F_ERR_TOOLONGNAME;
+					}
+				    }
+				    
+				    if (status == F_NO_ERROR)
+				    {
+#if (RFAT_CONFIG_VFAT_SUPPORTED == 1)
+					/* It's possible to have a sfn_name only ("." and ".." for example).
+					 */
+					if (volume->lfn_count)
+					{
+					    dirname_e = rfat_name_uniname_to_cstring(volume->lfn_name, volume->lfn_count, dirname, dirname + index);
+					}
+					else
+#endif /* (RFAT_CONFIG_VFAT_SUPPORTED == 1) */
+					{
+					    dirname_e = rfat_name_dosname_to_cstring(dir->dir_name, dir->dir_nt_reserved, dirname, dirname + index);
+					}
+					
+					if (dirname_e != NULL)
+					{
+					    index -= (dirname_e - dirname -1);
+					    
+					    memcpy(&dirname[index+1], &dirname[0], (dirname_e - dirname -1));
+					    
+					    clsno_s = clsno_p;
+					    clsno_p = clsno_g;
+					}
+					else
+					{
+					    status = F_ERR_TOOLONGNAME;
+					}
+				    }
+				}
+				else
+				{
+				    status = F_ERR_NOTFOUND;
+				}
+			    }
+			}
+		    }
+		    while ((status == F_NO_ERROR) && (clsno_s != RFAT_CLSNO_NONE));
+		}
+	    }
+		
+	    if (status == F_NO_ERROR)
+	    {
+		if (index >= 2)
+		{
+		    dirname[index] = F_SEPARATORCHAR;
+		    
+		    memcpy(&dirname[0], &dirname[index], (length - index));
+		    
+		    dirname[length - index] = '\0';
+		}
+		else
+		{
+		    status = F_ERR_TOOLONGNAME;
+		}
+	    }
+	}
+
+	status = rfat_volume_unlock(volume, status);
+    }
+	
+    return status;
+}
+
+
+#if !defined(RFAT_CONFIG_ULTRA_LIGHT_BUILD)
+
+int f_rename(const char *filename, const char *newname)
+{
+    int status = F_NO_ERROR;
+    uint32_t blkno, clsno_d, clsno_o, index_o;
+#if (RFAT_CONFIG_VFAT_SUPPORTED == 1)
+    uint32_t clsno, index, entries_o, count;
+    uint8_t nt_reserved_o;
+#endif /* (RFAT_CONFIG_VFAT_SUPPORTED == 1) */
+    rfat_dir_t *dir;
+    rfat_cache_entry_t *entry;
+    rfat_volume_t *volume;
+
+    volume = RFAT_PATH_VOLUME(filename);
+
+    status = rfat_volume_lock(volume);
+    
+    if (status == F_NO_ERROR)
+    {
+	if (volume->flags & RFAT_VOLUME_FLAG_WRITE_PROTECTED)
+	{
+	    status = F_ERR_WRITEPROTECT;
+	}
+	else
+	{
+	    status = rfat_path_find_directory(volume, filename, &filename, &clsno_d);
+            
+	    if (status == F_NO_ERROR)
+	    {
+		status = rfat_path_convert_filename(volume, filename, NULL);
+	    
+		if (status == F_NO_ERROR)
+		{
+		    status = rfat_path_find_entry(volume, clsno_d, 0, 0, rfat_path_find_callback_name, NULL, &clsno_o, &index_o, &dir);
+
+		    if (status == F_NO_ERROR)
+		    {
+			if (dir != NULL)
+			{
+			    if (dir->dir_attr & RFAT_DIR_ATTR_READ_ONLY)
+			    {
+				status = F_ERR_ACCESSDENIED;
+			    }
+			    else
+			    {
+				if (rfat_file_enumerate(volume, NULL, clsno_o, index_o))
+				{
+				    status = F_ERR_LOCKED;
+				}
+				else
+				{
+#if (RFAT_CONFIG_VFAT_SUPPORTED == 1)
+				    memcpy(&volume->dir, dir, sizeof(rfat_dir_t));
+
+				    nt_reserved_o = dir->dir_nt_reserved;
+
+				    /* rfat_path_find_callback_name() fills in the proper volume->dir_entries on a match.
+				     */
+				    entries_o = volume->dir_entries;
+#endif /* (RFAT_CONFIG_VFAT_SUPPORTED == 1) */
+
+				    status = rfat_path_convert_filename(volume, newname, NULL);
+				
+				    if (status == F_NO_ERROR)
+				    {
+#if (RFAT_CONFIG_VFAT_SUPPORTED == 1)
+					if ((volume->dir.dir_name[0] == '\0') || (volume->dir.dir_nt_reserved & RFAT_DIR_TYPE_LOSSY))
+					{
+					    count = 1 + volume->dir_entries;
+					}
+					else
+					{
+					    count = 1;
+					}
+
+					status = rfat_path_find_entry(volume, clsno_d, 0, count, rfat_path_find_callback_name, NULL, &clsno, &index, &dir);
+#else /* (RFAT_CONFIG_VFAT_SUPPORTED == 1) */
+					status = rfat_path_find_entry(volume, clsno_d, 0, 0, rfat_path_find_callback_name, NULL, NULL, NULL, &dir);
+#endif /* (RFAT_CONFIG_VFAT_SUPPORTED == 1) */
+				    
+					if (status == F_NO_ERROR)
+					{
+					    if (dir != NULL)
+					    {
+						status = F_ERR_DUPLICATED;
+					    }
+					    else
+					    {
+#if (RFAT_CONFIG_VFAT_SUPPORTED == 1)
+						if ((entries_o != 0) || (count != 1))
+						{
+#if (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1)
+						    /* For TRANSACTION_SAFE, the RFAT_DIR_FLAG_DESTROY_ENTRY operation is recorded first, and
+						     * the rfat_path_create_entry() gets called to add the RFAT_DIR_FLAG_CREATE_ENTRY part.
+						     * If that fails somehow, then the pending operations are canceled.
+						     */
+						    volume->dir_flags |= RFAT_DIR_FLAG_DESTROY_ENTRY;
+						    volume->del_clsno = clsno_o;
+						    volume->del_index = index_o;
+#if (RFAT_CONFIG_VFAT_SUPPORTED == 1)
+						    volume->del_entries = entries_o;
+#endif /* (RFAT_CONFIG_VFAT_SUPPORTED == 1) */
+
+						    /* The call to rfat_path_create_entry() is special. The RFAT_CLUSTER_END_OF_CHAIN tells it
+						     * use the existing volume->dir as a template, and to overlay "attr" onto dir_nt_reserved.
+						     */
+						    status = rfat_path_create_entry(volume, clsno_d, clsno, index, NULL, nt_reserved_o, RFAT_CLSNO_END_OF_CHAIN, 0, 0);
+						
+						    if (status != F_NO_ERROR)
+						    {
+							volume->dir_flags &= ~(RFAT_DIR_FLAG_DESTROY_ENTRY | RFAT_DIR_FLAG_CREATE_ENTRY);
+						    }
+
+#else /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1) */
+						    status = rfat_volume_dirty(volume);
+
+						    if (status == F_NO_ERROR)
+						    {
+							/* The call to rfat_path_create_entry() is special. The RFAT_CLUSTER_END_OF_CHAIN tells it
+							 * use the existing volume->dir as a template, and to overlay "attr" onto dir_nt_reserved.
+							 */
+
+							status = rfat_path_create_entry(volume, clsno_d, clsno, index, NULL, nt_reserved_o, RFAT_CLSNO_END_OF_CHAIN, 0, 0);
+						    
+							if (status == F_NO_ERROR)
+							{
+#if (RFAT_CONFIG_VFAT_SUPPORTED == 1)
+							    status = rfat_path_destroy_entry(volume, clsno_o, index_o, entries_o, RFAT_CLSNO_NONE);
+#else /* (RFAT_CONFIG_VFAT_SUPPORTED == 1) */
+							    status = rfat_path_destroy_entry(volume, clsno_o, index_o, RFAT_CLUSTER_NONE);
+#endif /* (RFAT_CONFIG_VFAT_SUPPORTED == 1) */
+							}
+
+							status = rfat_volume_clean(volume, status);
+						    }
+#endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1) */
+						}
+						else
+#endif /* (RFAT_CONFIG_VFAT_SUPPORTED == 1) */
 						{
 						    /* Nothing special to do here for TRANSACTION_SAFE/VOLUME_DIRTY/FSINFO. The dir entry
 						     * update is atomic and not dependent upon the FAT.
 						     */
 
-						    if (clsno_o == RFAT_CLSNO_NONE)
-						    {
-							blkno = volume->root_blkno + RFAT_INDEX_TO_BLKCNT_ROOT(index_o);
-						    }
-						    else
-						    {
-							blkno = RFAT_CLSNO_TO_BLKNO(clsno_o) + RFAT_INDEX_TO_BLKCNT(index_o);
-						    }
-						
-						    status = rfat_dir_cache_read(volume, blkno, &entry);
-						
-						    if (status == F_NO_ERROR)
-						    {
-							dir = (rfat_dir_t*)((void*)(entry->data + RFAT_INDEX_TO_BLKOFS(index_o)));
-						    
-							memcpy(dir->dir_name, volume->dir.dir_name, 11);
-						    
-							dir->dir_nt_reserved = volume->dir.dir_nt_reserved;
-						    
-							status = rfat_dir_cache_write(volume);
-						    }
-						}
-					    }
-					}
-				    }
+						    if (clsno_o == RFAT_CLSNO_NONE)
+						    {
+							blkno = volume->root_blkno + RFAT_INDEX_TO_BLKCNT_ROOT(index_o);
+						    }
+						    else
+						    {
+							blkno = RFAT_CLSNO_TO_BLKNO(clsno_o) + RFAT_INDEX_TO_BLKCNT(index_o);
+						    }
+						
+						    status = rfat_dir_cache_read(volume, blkno, &entry);
+						
+						    if (status == F_NO_ERROR)
+						    {
+							dir = (rfat_dir_t*)((void*)(entry->data + RFAT_INDEX_TO_BLKOFS(index_o)));
+						    
+							memcpy(dir->dir_name, volume->dir.dir_name, 11);
+						    
+							dir->dir_nt_reserved = volume->dir.dir_nt_reserved;
+						    
+							status = rfat_dir_cache_write(volume);
+						    }
+						}
+					    }
+					}
+				    }
+				}
+			    }
+			}
+			else
+			{
+			    status = F_ERR_NOTFOUND;
+			}
+		    }
+		}
+	    }
+	}
+
+	status = rfat_volume_unlock(volume, status);
+    }
+
+    return status;
+}
+
+#endif /* !defined(RFAT_CONFIG_ULTRA_LIGHT_BUILD) */
+
+int f_delete(const char *filename)
+{
+    int status = F_NO_ERROR;
+    uint32_t clsno, index, first_clsno;
+    rfat_dir_t *dir;
+    rfat_volume_t *volume;
+
+    volume = RFAT_PATH_VOLUME(filename);
+
+    status = rfat_volume_lock(volume);
+    
+    if (status == F_NO_ERROR)
+    {
+	if (volume->flags & RFAT_VOLUME_FLAG_WRITE_PROTECTED)
+	{
+	    status = F_ERR_WRITEPROTECT;
+	}
+	else
+	{
+	    status = rfat_path_find_file(volume, filename, &clsno, &index, &dir);
+            
+	    if (status == F_NO_ERROR)
+	    {
+		if (dir->dir_attr & RFAT_DIR_ATTR_DIRECTORY)
+		{
+		    status = F_ERR_NOTFOUND;
+		}
+		else if (dir->dir_attr & RFAT_DIR_ATTR_READ_ONLY)
+		{
+		    status = F_ERR_ACCESSDENIED;
+		}
+		else
+		{
+		    if (rfat_file_enumerate(volume, NULL, clsno, index))
+		    {
+			status = F_ERR_LOCKED;
+		    }
+		    else
+		    {
+			if (volume->type == RFAT_VOLUME_TYPE_FAT32)
+			{
+			    first_clsno = ((uint32_t)RFAT_FTOHS(dir->dir_clsno_hi) << 16) | (uint32_t)RFAT_FTOHS(dir->dir_clsno_lo);
+			}
+			else
+			{ 
+			    first_clsno = (uint32_t)RFAT_FTOHS(dir->dir_clsno_lo);
+			}
+
+#if (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0)
+			status = rfat_volume_dirty(volume);
+		    
+			if (status == F_NO_ERROR)
+#endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0) */
+			{
+#if (RFAT_CONFIG_VFAT_SUPPORTED == 1)
+			    /* rfat_path_find_file() fills in the proper volume->dir_entries on a match.
+			     */
+			    status = rfat_path_destroy_entry(volume, clsno, index, volume->dir_entries, first_clsno);
+#else /* (RFAT_CONFIG_VFAT_SUPPORTED == 1) */
+			    status = rfat_path_destroy_entry(volume, clsno, index, first_clsno);
+#endif /* (RFAT_CONFIG_VFAT_SUPPORTED == 1) */
+
+#if (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0)
+			    status = rfat_volume_clean(volume, status);
+#endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0) */
+			}
+		    }
+		}
+	    }
+	}
+
+	status = rfat_volume_unlock(volume, status);
+    }
+
+    return status;
+}
+
+long f_filelength(const char *filename)
+{
+    int status = F_NO_ERROR;
+    uint32_t length;
+    rfat_dir_t *dir;
+    rfat_volume_t *volume;
+
+    length = 0;
+
+    volume = RFAT_PATH_VOLUME(filename);
+
+    status = rfat_volume_lock(volume);
+    
+    if (status == F_NO_ERROR)
+    {
+      status = rfat_path_find_file(volume, filename, NULL, NULL, &dir);
+            
+	if (status == F_NO_ERROR)
+	{
+	    length = dir->dir_file_size;
+	}
+
+	status = rfat_volume_unlock(volume, status);
+    }
+
+    return (long)length;
+}
+
+int f_findfirst(const char *filename, F_FIND *find)
+{
+    int status = F_NO_ERROR;
+    rfat_volume_t *volume;
+    volume = RFAT_PATH_VOLUME(filename);
+
+    status = rfat_volume_lock(volume);
+    
+    if (status == F_NO_ERROR)
+    {
+	find->find_index = 0;
+
+        status = rfat_path_find_directory(volume, filename, &filename, &find->find_clsno);
+            
+        if (status == F_NO_ERROR)
+        {
+#if (RFAT_CONFIG_VFAT_SUPPORTED == 0)
+
+	    /* For non-VFAT, build a MSDOS style template where '*' is expanded into
+	     * a sequence of '?'.
+	     */
+
+	    filename = rfat_name_cstring_to_pattern(filename, find->find_pattern);
+
+	    if (filename == NULL)
+	    {
+		status = F_ERR_INVALIDNAME;
+	    }
+
+#else /* (RFAT_CONFIG_VFAT_SUPPORTED == 0) */
+
+	    /* Copy the remaining filename into find_pattern, and do a WINNT compatible
+	     * pattern match based upon the incoming lfn_name, or the converted sfn_name.
+	     */
+
+	    char c, *pattern, *pattern_e;
+	    
+	    pattern = &find->find_pattern[0];
+	    pattern_e = &find->find_pattern[F_MAXPATH];
+	    
+	    do
+	    {
+		if (pattern == pattern_e)
+		{
+		    status = F_ERR_TOOLONGNAME;
+		}
+		else
+		{
+		    c = *filename++;
+		    
+		    *pattern++ = c;
+		}
+	    }
+	    while ((status == F_NO_ERROR) && (c != '\0'));
+#endif /* (RFAT_CONFIG_VFAT_SUPPORTED == 0) */
+
+	    if (status == F_NO_ERROR)
+	    {
+		status = rfat_path_find_next(volume, find);
+	    }
+	}
+
+	if (status != F_NO_ERROR)
+	{
+	    find->find_clsno = RFAT_CLSNO_END_OF_CHAIN;
+	}
+
+	status = rfat_volume_unlock(volume, status);
+    }
+
+    return status;
+}
+
+int f_findnext(F_FIND *find)
+{
+    int status = F_NO_ERROR;
+    rfat_volume_t *volume;
+
+    volume = RFAT_FIND_VOLUME(find);
+
+    status = rfat_volume_lock(volume);
+    
+    if (status == F_NO_ERROR)
+    {
+	if (find->find_clsno == RFAT_CLSNO_END_OF_CHAIN)
+	{
+	    status = F_ERR_NOTFOUND;
+	}
+	else
+	{
+	    status = rfat_path_find_next(volume, find);
+	}
+
+	status = rfat_volume_unlock(volume, status);
+    }
+
+    return status;
+}
+
+#if !defined(RFAT_CONFIG_ULTRA_LIGHT_BUILD)
+
+int f_settimedate(const char *filename, unsigned short ctime, unsigned short cdate)
+{
+    int status = F_NO_ERROR;
+    rfat_dir_t *dir;
+    rfat_volume_t *volume;
+
+    volume = RFAT_PATH_VOLUME(filename);
+
+    status = rfat_volume_lock(volume);
+    
+    if (status == F_NO_ERROR)
+    {
+	if (volume->flags & RFAT_VOLUME_FLAG_WRITE_PROTECTED)
+	{
+	    status = F_ERR_WRITEPROTECT;
+	}
+	else
+	{
+	    status = rfat_path_find_file(volume, filename, NULL, NULL, &dir);
+	
+	    if (status == F_NO_ERROR)
+	    {
+		/* Nothing special to do here for TRANSACTION_SAFE/VOLUME_DIRTY/FSINFO. The dir entry
+		 * update is atomic and not dependent upon the FAT.
+		 */
+		dir->dir_wrt_time = RFAT_HTOFS(ctime);
+		dir->dir_wrt_date = RFAT_HTOFS(cdate);
+	    
+		status = rfat_dir_cache_write(volume);
+	    }
+	}
+
+	status = rfat_volume_unlock(volume, status);
+    }
+
+    return status;
+}
+
+int f_gettimedate(const char *filename, unsigned short *p_ctime, unsigned short *p_cdate)
+{
+    int status = F_NO_ERROR;
+    rfat_dir_t *dir;
+    rfat_volume_t *volume;
+
+    volume = RFAT_PATH_VOLUME(filename);
+
+    status = rfat_volume_lock(volume);
+    
+    if (status == F_NO_ERROR)
+    {
+	status = rfat_path_find_file(volume, filename, NULL, NULL, &dir);
+	
+	if (status == F_NO_ERROR)
+	{
+	    *p_ctime = RFAT_FTOHS(dir->dir_wrt_time);
+	    *p_cdate = RFAT_FTOHS(dir->dir_wrt_date);
+	}
+
+	status = rfat_volume_unlock(volume, status);
+    }
+
+    return status;
+}
+
+int f_setattr(const char *filename, unsigned char attr)
+{
+    int status = F_NO_ERROR;
+    rfat_dir_t *dir;
+    rfat_volume_t *volume;
+
+    volume = RFAT_PATH_VOLUME(filename);
+
+    status = rfat_volume_lock(volume);
+    
+    if (status == F_NO_ERROR)
+    {
+	if (volume->flags & RFAT_VOLUME_FLAG_WRITE_PROTECTED)
+	{
+	    status = F_ERR_WRITEPROTECT;
+	}
+	else
+	{
+	    status = rfat_path_find_file(volume, filename, NULL, NULL, &dir);
+	
+	    if (status == F_NO_ERROR)
+	    {
+		/* Nothing special to do here for TRANSACTION_SAFE/VOLUME_DIRT/FSINFO. The dir entry
+		 * update is atomic and not dependent upon the FAT.
+		 */
+		dir->dir_attr = ((dir->dir_attr & ~(F_ATTR_ARC | F_ATTR_SYSTEM | F_ATTR_HIDDEN | F_ATTR_READONLY)) |
+				 (attr & (F_ATTR_ARC | F_ATTR_SYSTEM | F_ATTR_HIDDEN | F_ATTR_READONLY)));
+	    
+		status = rfat_dir_cache_write(volume);
+	    }
+	}
+
+	status = rfat_volume_unlock(volume, status);
+    }
+
+    return status;
+}
+
+int f_getattr(const char *filename, unsigned char *p_attr)
+{
+    int status = F_NO_ERROR;
+    rfat_dir_t *dir;
+    rfat_volume_t *volume;
+
+    volume = RFAT_PATH_VOLUME(filename);
+
+    status = rfat_volume_lock(volume);
+    
+    if (status == F_NO_ERROR)
+    {
+	status = rfat_path_find_file(volume, filename, NULL, NULL, &dir);
+	
+	if (status == F_NO_ERROR)
+	{
+	    *p_attr = dir->dir_attr;
+	}
+
+	status = rfat_volume_unlock(volume, status);
+    }
+
+    return status;
+}
+
+int f_stat(const char *filename, F_STAT *stat)
+{
+    int status = F_NO_ERROR;
+    rfat_dir_t *dir;
+    rfat_volume_t *volume;
+
+    volume = RFAT_PATH_VOLUME(filename);
+
+    status = rfat_volume_lock(volume);
+    
+    if (status == F_NO_ERROR)
+    {
+	/* All information is collected from a single lookup of the
+	 * dir entry, rather than having to call f_filelength(),
+	 * f_getattr() and f_gettimedate() separately.
+	 */
+	status = rfat_path_find_file(volume, filename, NULL, NULL, &dir);
+	
+	if (status == F_NO_ERROR)
+	{
+	    stat->filesize = RFAT_FTOHL(dir->dir_file_size);
+	    stat->attr = dir->dir_attr;
+	    stat->modifiedtime = RFAT_FTOHS(dir->dir_wrt_time);
+	    stat->modifieddate = RFAT_FTOHS(dir->dir_wrt_date);
+
+	    if (volume->type == RFAT_VOLUME_TYPE_FAT32)
+	    {
+		stat->createtime = RFAT_FTOHS(dir->dir_crt_time);
+		stat->createdate = RFAT_FTOHS(dir->dir_crt_date);
+		stat->lastaccessdate = RFAT_FTOHS(dir->dir_acc_date);
+		stat->cluster = ((uint32_t)RFAT_FTOHS(dir->dir_clsno_hi) << 16) | (uint32_t)RFAT_FTOHS(dir->dir_clsno_lo);
+	    }
+	    else
+	    {
+		/* FAT12/FAT16 record a composite create/modify time/date.
+		 */
+		stat->createtime = RFAT_FTOHS(dir->dir_wrt_time);
+		stat->createdate = RFAT_FTOHS(dir->dir_wrt_date);
+		stat->lastaccessdate = 0;
+		stat->cluster = (uint32_t)RFAT_FTOHS(dir->dir_clsno_lo);
+	    }
+	}
+
+	status = rfat_volume_unlock(volume, status);
+    }
+
+    return status;
+}
+
+#endif /* !defined(RFAT_CONFIG_ULTRA_LIGHT_BUILD) */
+
+F_FILE * f_open(const char *filename, const char *type)
+{
+    int status = F_NO_ERROR;
+    rfat_file_t *file = NULL;
+    uint32_t mode, size;
+    rfat_volume_t *volume;
+
+    status = rfat_file_mode(type, &mode, &size);
+
+    if (status == F_NO_ERROR)
+    {
+	volume = RFAT_PATH_VOLUME(filename);
+      
+        status = rfat_volume_lock(volume);
+    
+        if (status == F_NO_ERROR)
+        {
+	    status = rfat_file_open(volume, filename, mode, size, &file);
+
+	    status = rfat_volume_unlock(volume, status);
+        }
+    }
+
+    return (status == F_NO_ERROR) ? file : NULL;
+}
+
+F_FILE * f_open_find(F_FIND *find, const char *type)
+{
+    int status = F_NO_ERROR;
+    rfat_file_t *file = NULL;
+    uint32_t mode, size;
+    rfat_volume_t *volume;
+
+    status = rfat_file_mode(type, &mode, &size);
+
+    if (status == F_NO_ERROR)
+    {
+	volume = RFAT_FIND_VOLUME(find);
+      
+        status = rfat_volume_lock(volume);
+    
+        if (status == F_NO_ERROR)
+        {
+	    status = rfat_file_open_find(volume, find, mode, size, &file);
+
+	    status = rfat_volume_unlock(volume, status);
+        }
+    }
+
+    return (status == F_NO_ERROR) ? file : NULL;
+}
+
+int f_close(F_FILE *file)
+{
+    int status = F_NO_ERROR;
+    rfat_volume_t *volume;
+
+    if (!file || !file->mode)
+    {
+        status = F_ERR_NOTOPEN;
+    }
+    else
+    {
+	/* There is no check for "file->status" here, as this
+	 * is handled in rfat_file_close(), so that the meta
+	 * data gets updated, while the file data is treated
+	 * as optional.
+	 */
+
+	volume = RFAT_FILE_VOLUME(file);
+    
+        status = rfat_volume_lock(volume);
+    
+        if (status == F_NO_ERROR)
+        {
+	    if ((file->option & RFAT_FILE_OPTION_NONBLOCK) && (file->mode & RFAT_FILE_MODE_WRITE) && (file->status == F_NO_ERROR))
+	    {
+		status = rfat_file_sync_poll(volume, file);
+	    }
+
+	    /* The file is always closed, unless the SDCARD is still busy.
+	     */
+	    if (status != F_ERR_INPROGRESS)
+	    {
+		status = rfat_file_close(volume, file);
+	    }
+
+	    status = rfat_volume_unlock(volume, status);
+        }
+    }
+
+    return status;
+}
+
+int f_flush(F_FILE *file)
+{
+    int status = F_NO_ERROR;
+    rfat_volume_t *volume;
+
+    if (!file || !file->mode)
+    {
+	status = F_ERR_NOTOPEN;
+    }
+    else
+    {
+	status = file->status;
+	
+	if (status == F_NO_ERROR)
+	{
+	    if (file->mode & RFAT_FILE_MODE_WRITE)
+	    {
+		volume = RFAT_FILE_VOLUME(file);
+	    
+		status = rfat_volume_lock(volume);
+		
+		if (status == F_NO_ERROR)
+		{
+		    if (file->option & RFAT_FILE_OPTION_NONBLOCK)
+		    {
+			status = rfat_file_sync_poll(volume, file);
+		    }
+
+		    if (status == F_NO_ERROR)
+		    {
+			status = rfat_file_flush(volume, file, FALSE);
+		    }
+		    
+		    status = rfat_volume_unlock(volume, status);
+		}
+	    }
+	}
+    }
+
+    return status;
+}
+
+int f_datasync(F_FILE *file)
+{
+    int status = F_NO_ERROR;
+    rfat_volume_t *volume;
+
+    if (!file || !file->mode)
+    {
+	status = F_ERR_NOTOPEN;
+    }
+    else
+    {
+	status = file->status;
+	
+	if (status == F_NO_ERROR)
+	{
+	    if (file->mode & RFAT_FILE_MODE_WRITE)
+	    {
+		volume = RFAT_FILE_VOLUME(file);
+	    
+		status = rfat_volume_lock(volume);
+		
+		if (status == F_NO_ERROR)
+		{
+		    if (file->option & RFAT_FILE_OPTION_NONBLOCK)
+		    {
+			status = rfat_file_sync_poll(volume, file);
+		    }
+
+		    if (status == F_NO_ERROR)
+		    {
+			status = rfat_file_datasync(volume, file);
+		    }
+		    
+		    status = rfat_volume_unlock(volume, status);
+		}
+	    }
+	}
+    }
+
+    return status;
+}
+
+int f_setcommit(F_FILE *file, int policy, unsigned long interval)
+{
+    int status = F_NO_ERROR;
+#if (RFAT_CONFIG_COMMIT_POLICY_SUPPORTED == 1)
+    rfat_volume_t *volume;
+#endif /* (RFAT_CONFIG_COMMIT_POLICY_SUPPORTED == 1) */
+
+    if (!file || !file->mode)
+    {
+	status = F_ERR_NOTOPEN;
+    }
+    else
+    {
+	if (!(file->mode & RFAT_FILE_MODE_WRITE))
+	{
+	    status = F_ERR_ACCESSDENIED;
+	}
+	else
+	{
+#if (RFAT_CONFIG_COMMIT_POLICY_SUPPORTED == 1)
+	    if ((policy < F_COMMIT_NONE) || (policy > F_COMMIT_MILLISECONDS) ||
+#if !defined(RFAT_PORT_CORE_TIMEDATE)
+		(policy == F_COMMIT_SECONDS) ||
+#endif /* !RFAT_PORT_CORE_TIMEDATE */
+#if defined(RFAT_PORT_CORE_TIME_STAMP)
+		((policy == F_COMMIT_MILLISECONDS) && (interval > (0xffffffff / 1000))))
+#else /* RFAT_PORT_CORE_TIME_STAMP */
+		(policy == F_COMMIT_MILLISECONDS))
+#endif /* RFAT_PORT_CORE_TIME_STAMP */
+	    {
+		status = F_ERR_NOTUSEABLE;
+	    }
+	    else
+	    {
+		volume = RFAT_FILE_VOLUME(file);
+	    
+		status = rfat_volume_lock(volume);
+		
+		if (status == F_NO_ERROR)
+		{
+		    file->commit_policy = policy;
+		    file->commit_interval = (policy == F_COMMIT_MILLISECONDS) ? (interval * 1000) : interval;
+
+		    if (policy != F_COMMIT_NONE)
+		    {
+			file->commit_mark = rfat_file_commit_mark(volume, file);
+		    }
+
+		    status = rfat_volume_unlock(volume, status);
+		}
+	    }
+#else /* (RFAT_CONFIG_COMMIT_POLICY_SUPPORTED == 1) */
+	    if (policy != F_COMMIT_NONE)
+	    {
+		status = F_ERR_NOTUSEABLE;
+	    }
+#endif /* (RFAT_CONFIG_COMMIT_POLICY_SUPPORTED == 1) */
+	}
+    }
+
+    return status;
+}
+
+/* f_setvbuf() attaches a caller supplied stream buffer. f_putc()/f_getc() and
+ * f_read()/f_write() smaller than the buffer are then served without taking
+ * the volume lock, while the buffer is transferred with one rfat_file_write()
+ * or rfat_file_read() once it is full or empty.
+ */
+
+int f_setvbuf(F_FILE *file, void *buffer, long size)
+{
+    int status = F_NO_ERROR;
+#if (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1)
+    rfat_volume_t *volume;
+#endif /* (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1) */
+
+    if (!file || !file->mode)
+    {
+	status = F_ERR_NOTOPEN;
+    }
+    else
+    {
+#if (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1)
+	if ((buffer != NULL) && ((size < RFAT_BLK_SIZE) || (size & RFAT_BLK_MASK) || (file->flags & RFAT_FILE_FLAG_DIRECT) || (file->option & RFAT_FILE_OPTION_NONBLOCK)))
+	{
+	    status = F_ERR_NOTUSEABLE;
+	}
+	else
+	{
+	    volume = RFAT_FILE_VOLUME(file);
+	    
+	    status = rfat_volume_lock(volume);
+		
+	    if (status == F_NO_ERROR)
+	    {
+		if (file->stream_count | file->stream_index)
+		{
+		    status = rfat_file_stream_flush(volume, file);
+		}
+
+		if (status == F_NO_ERROR)
+		{
+		    file->stream_data = (uint8_t*)buffer;
+		    file->stream_size = (buffer != NULL) ? size : 0;
+		}
+
+		status = rfat_volume_unlock(volume, status);
+	    }
+	}
+#else /* (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1) */
+	if (buffer != NULL)
+	{
+	    status = F_ERR_NOTUSEABLE;
+	}
+#endif /* (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1) */
+    }
+
+    return status;
+}
+
+long f_write(const void *buffer, long size, long count, F_FILE *file)
+{
+    int status = F_NO_ERROR;
+    long result = 0;
+    uint32_t total;
+#if (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1)
+    uint32_t length;
+#endif /* (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1) */
+    rfat_volume_t *volume;
+
+    if (!file || !file->mode)
+    {
+        status = F_ERR_NOTOPEN;
+    }
+    else
+    {
+        if (!(file->mode & RFAT_FILE_MODE_WRITE))
+        {
+            status = F_ERR_ACCESSDENIED;
+        }
+        else
+        {
+	    status = file->status;
+	    
+	    if (status == F_NO_ERROR)
+	    {
+		if ((size > 0) && (count > 0))
+		{
+		    volume = RFAT_FILE_VOLUME(file);
+
+#if (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1)
+		    length = (unsigned long)count * (unsigned long)size;
+#endif /* (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1) */
+
+		    /* A misaligned direct transfer is rejected up front, without
+		     * taking the lock and without touching "file->status".
+		     */
+		    if (rfat_file_direct_check(file, (unsigned long)count * (unsigned long)size, TRUE) != F_NO_ERROR)
+		    {
+			status = F_ERR_NOTUSEABLE;
+		    }
+		    else
+#if (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1)
+		    if ((length < file->stream_size) && RFAT_FILE_STREAM_WRITABLE(file, length))
+		    {
+			memcpy(file->stream_data + file->stream_index, buffer, length);
+
+			file->stream_index += length;
+
+			result = count;
+		    }
+		    else
+#endif /* (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1) */
+		    {
+			status = rfat_volume_lock(volume);
+		    
+			if (status == F_NO_ERROR)
+			{
+#if (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1)
+			    if (length < file->stream_size)
+			    {
+				status = rfat_file_stream_write(volume, file, (const uint8_t*)buffer, length, &total);
+			    }
+			    else
+#endif /* (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1) */
+			    {
+				if (file->option & RFAT_FILE_OPTION_NONBLOCK)
+				{
+				    total = (unsigned long)count * (unsigned long)size;
+
+				    status = rfat_file_write_poll(volume, file, &total);
+
+				    if ((status == F_NO_ERROR) && (total != 0))
+				    {
+					status = rfat_file_write(volume, file, (const uint8_t*)buffer, total, &total);
+				    }
+				    else
+				    {
+					total = 0;
+				    }
+				}
+				else
+				{
+				    status = rfat_file_write(volume, file, (const uint8_t*)buffer, (unsigned long)count * (unsigned long)size, &total);
+				}
+			    }
+
+			    result = total / (unsigned long)size;
+			
+			    status = rfat_volume_unlock(volume, status);
+			}
+		    }
+                }
+            }
+        }
+    }
+
+    return result;
+}
+
+/* f_write_reserve() hands out a pointer into the cached block at the current file position,
+ * so that a record can be serialized in place. This mirrors the fast path of f_putc(), except
+ * that "file->blkno" has to be a valid block within the current cluster. If the block is not
+ * cached, it is pulled in via rfat_file_prepare(). If that is not possible, a staging buffer of
+ * RFAT_CONFIG_WRITE_RESERVE_SIZE bytes is handed out instead, which gets written by
+ * f_write_commit() via rfat_file_write().
+ *
+ * There must be no other call for the same volume between f_write_reserve() and f_write_commit().
+ */
+
+int f_write_reserve(F_FILE *file, long size, void **p_data)
+{
+    int status = F_NO_ERROR;
+    rfat_cache_entry_t *entry;
+#if (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1)
+    uint32_t total;
+#endif /* (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1) */
+    rfat_volume_t *volume;
+
+    if (!file || !file->mode)
+    {
+        status = F_ERR_NOTOPEN;
+    }
+    else
+    {
+        if (!(file->mode & RFAT_FILE_MODE_WRITE))
+        {
+            status = F_ERR_ACCESSDENIED;
+        }
+        else
+        {
+	    status = file->status;
+
+	    if (status == F_NO_ERROR)
+	    {
+#if (RFAT_CONFIG_DATA_CACHE_ENTRIES != 0)
+#if (RFAT_CONFIG_FILE_DATA_CACHE == 1)
+		entry = &file->data_cache;
+#else /* (RFAT_CONFIG_FILE_DATA_CACHE == 1) */
+		entry = &RFAT_FILE_VOLUME(file)->data_cache;
+#endif /* (RFAT_CONFIG_FILE_DATA_CACHE == 1) */
+#else /* (RFAT_CONFIG_DATA_CACHE_ENTRIES != 0) */
+		entry = &RFAT_FILE_VOLUME(file)->dir_cache;
+#endif /* (RFAT_CONFIG_DATA_CACHE_ENTRIES != 0) */
+
+		volume = RFAT_FILE_VOLUME(file);
+
+#if (RFAT_CONFIG_WRITE_RESERVE_SIZE != 0)
+		if (volume->reserve_file == file)
+		{
+		    volume->reserve_file = NULL;
+		}
+#endif /* (RFAT_CONFIG_WRITE_RESERVE_SIZE != 0) */
+
+		if ((size <= 0) || ((unsigned long)size > (RFAT_FILE_SIZE_MAX - file->position)))
+		{
+		    status = F_ERR_NOTUSEABLE;
+		}
+		else
+		{
+#if (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1)
+		    if (file->stream_data != NULL)
+		    {
+			/* With a stream buffer, the record is placed directly into it.
+			 */
+			if ((unsigned long)size > file->stream_size)
+			{
+			    status = F_ERR_NOMOREENTRY;
+			}
+			else
+			{
+			    if (!RFAT_FILE_STREAM_WRITABLE(file, (unsigned long)size))
+			    {
+				status = rfat_volume_lock(volume);
+
+				if (status == F_NO_ERROR)
+				{
+				    status = rfat_file_stream_write(volume, file, file->stream_data, 0, &total);
+
+				    status = rfat_volume_unlock(volume, status);
+				}
+
+				/* The end of a contiguous file, or RFAT_FILE_SIZE_MAX, is
+				 * left to f_write() to report as a short count.
+				 */
+				if ((status == F_NO_ERROR) && !RFAT_FILE_STREAM_WRITABLE(file, (unsigned long)size))
+				{
+				    status = F_ERR_NOMOREENTRY;
+				}
+			    }
+
+			    if (status == F_NO_ERROR)
+			    {
+				*p_data = (void*)(file->stream_data + file->stream_index);
+			    }
+			}
+		    }
+		    else
+#endif /* (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1) */
+		    if ((entry->blkno == file->blkno) && (file->blkno != file->blkno_e) && !(file->flags & RFAT_FILE_FLAG_DIRECT) &&
+			((file->mode & RFAT_FILE_MODE_APPEND) ? (file->position == file->length) : (file->position <= file->length)) &&
+			(((file->position & RFAT_BLK_MASK) + (unsigned long)size) <= RFAT_BLK_SIZE))
+		    {
+			*p_data = (void*)(entry->data + (file->position & RFAT_BLK_MASK));
+		    }
+		    else
+		    {
+			/* The block at the file position is not cached. Pull it into the
+			 * data cache, unless a new cluster would have to be allocated.
+			 */
+			status = F_ERR_NOMOREENTRY;
+
+			if (!(file->flags & RFAT_FILE_FLAG_DIRECT))
+			{
+			    status = rfat_volume_lock(volume);
+
+			    if (status == F_NO_ERROR)
+			    {
+				status = rfat_file_prepare(volume, file, (unsigned long)size, &entry);
+
+				if (status == F_NO_ERROR)
+				{
+				    *p_data = (void*)(entry->data + (file->position & RFAT_BLK_MASK));
+				}
+
+				status = rfat_volume_unlock(volume, status);
+			    }
+			}
+
+#if (RFAT_CONFIG_WRITE_RESERVE_SIZE != 0)
+			if ((status == F_ERR_NOMOREENTRY) && ((unsigned long)size <= RFAT_CONFIG_WRITE_RESERVE_SIZE))
+			{
+			    volume->reserve_file = file;
+
+			    *p_data = (void*)volume->reserve_data;
+
+			    status = F_NO_ERROR;
+			}
+#endif /* (RFAT_CONFIG_WRITE_RESERVE_SIZE != 0) */
+		    }
+		}
+	    }
+	}
+    }
+
+    return status;
+}
+
+long f_write_commit(F_FILE *file, long size)
+{
+    int status = F_NO_ERROR;
+    long result = 0;
+#if (RFAT_CONFIG_WRITE_RESERVE_SIZE != 0)
+    uint32_t total;
+#endif /* (RFAT_CONFIG_WRITE_RESERVE_SIZE != 0) */
+    rfat_cache_entry_t *entry;
+    rfat_volume_t *volume;
+
+    if (!file || !file->mode)
+    {
+        status = F_ERR_NOTOPEN;
+    }
+    else
+    {
+        if (!(file->mode & RFAT_FILE_MODE_WRITE))
+        {
+            status = F_ERR_ACCESSDENIED;
+        }
+        else
+        {
+	    status = file->status;
+
+	    if (status == F_NO_ERROR)
+	    {
+		volume = RFAT_FILE_VOLUME(file);
+
+#if (RFAT_CONFIG_DATA_CACHE_ENTRIES != 0)
+#if (RFAT_CONFIG_FILE_DATA_CACHE == 1)
+		entry = &file->data_cache;
+#else /* (RFAT_CONFIG_FILE_DATA_CACHE == 1) */
+		entry = &volume->data_cache;
+#endif /* (RFAT_CONFIG_FILE_DATA_CACHE == 1) */
+#else /* (RFAT_CONFIG_DATA_CACHE_ENTRIES != 0) */
+		entry = &volume->dir_cache;
+#endif /* (RFAT_CONFIG_DATA_CACHE_ENTRIES != 0) */
+
+#if (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1)
+		if (file->stream_data != NULL)
+		{
+		    if ((size > 0) && RFAT_FILE_STREAM_WRITABLE(file, (unsigned long)size))
+		    {
+			file->stream_index += size;
+
+			result = size;
+		    }
+		}
+		else
+#endif /* (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1) */
+#if (RFAT_CONFIG_WRITE_RESERVE_SIZE != 0)
+		if (volume->reserve_file == file)
+		{
+		    volume->reserve_file = NULL;
+
+		    if ((size > 0) && (size <= RFAT_CONFIG_WRITE_RESERVE_SIZE))
+		    {
+			status = rfat_volume_lock(volume);
+		    
+			if (status == F_NO_ERROR)
+			{
+			    status = rfat_file_write(volume, file, volume->reserve_data, size, &total);
+
+			    result = total;
+			
+			    status = rfat_volume_unlock(volume, status);
+			}
+		    }
+		}
+		else
+#endif /* (RFAT_CONFIG_WRITE_RESERVE_SIZE != 0) */
+		{
+		    if ((size > 0) &&
+			(entry->blkno == file->blkno) && (file->blkno != file->blkno_e) && !(file->flags & RFAT_FILE_FLAG_DIRECT) &&
+			((file->mode & RFAT_FILE_MODE_APPEND) ? (file->position == file->length) : (file->position <= file->length)) &&
+			(((file->position & RFAT_BLK_MASK) + (unsigned long)size) <= RFAT_BLK_SIZE))
+		    {
+			file->flags |= RFAT_FILE_FLAG_DATA_MODIFIED;
+
+			rfat_data_cache_modify(volume, file);
+                
+			file->position += size;
+                
+			if (!(file->position & RFAT_BLK_MASK))
+			{
+			    file->blkno++;
+			}
+                
+			if (file->position >= file->length)
+			{
+			    file->length = file->position;
+			}
+
+			result = size;
+
+			if (RFAT_FILE_SETTLE(file))
+			{
+			    status = rfat_volume_lock(volume);
+
+			    if (status == F_NO_ERROR)
+			    {
+				status = rfat_file_settle(volume, file);
+
+				if (file->status == F_NO_ERROR)
+				{
+				    file->status = status;
 				}
+
+				status = rfat_volume_unlock(volume, status);
 			    }
 			}
-			else
+		    }
+		}
+	    }
+	}
+    }
+
+    return result;
+}
+
+long f_read(void *buffer, long size, long count, F_FILE *file)
+{
+    int status = F_NO_ERROR;
+    long result = 0;
+    uint32_t total;
+#if (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1)
+    uint32_t length;
+#endif /* (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1) */
+    rfat_volume_t *volume;
+
+    if (!file || !file->mode)
+    {
+        status = F_ERR_NOTOPEN;
+    }
+    else
+    {
+        if (!(file->mode & RFAT_FILE_MODE_READ))
+        {
+            status = F_ERR_ACCESSDENIED;
+        }
+        else
+        {
+	    status = rfat_file_reattach(file);
+		
+	    if (status == F_NO_ERROR)
+	    {
+		if ((size > 0) && (count > 0))
+		{
+		    volume = RFAT_FILE_VOLUME(file);
+
+#if (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1)
+		    length = (unsigned long)count * (unsigned long)size;
+#endif /* (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1) */
+
+		    /* A misaligned direct transfer is rejected up front, without
+		     * taking the lock and without touching "file->status".
+		     */
+		    if (rfat_file_direct_check(file, (unsigned long)count * (unsigned long)size, FALSE) != F_NO_ERROR)
+		    {
+			status = F_ERR_NOTUSEABLE;
+		    }
+		    else
+#if (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1)
+		    if ((length < file->stream_size) && ((file->stream_index + length) <= file->stream_count))
+		    {
+			memcpy(buffer, file->stream_data + file->stream_index, length);
+
+			file->stream_index += length;
+
+			result = count;
+		    }
+		    else
+#endif /* (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1) */
+		    {
+			status = rfat_volume_lock(volume);
+		    
+			if (status == F_NO_ERROR)
 			{
-			    status = F_ERR_NOTFOUND;
+#if (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1)
+			    if (length < file->stream_size)
+			    {
+				status = rfat_file_stream_read(volume, file, (uint8_t*)buffer, length, &total);
+			    }
+			    else
+#endif /* (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1) */
+			    {
+				status = rfat_file_read(volume, file, (uint8_t*)buffer, (unsigned long)count * (unsigned long)size, &total);
+			    }
+
+			    result = total / (unsigned long)size;
+
+			    status = rfat_volume_unlock(volume, status);
 			}
 		    }
-		}
+                }
+            }
+        }
+    }
+
+    return result;
+}
+
+/* f_writev() and f_readv() walk the vector under one lock, so that a record
+ * consisting of multiple parts does not have to be gathered by the caller.
+ * Full blocks within a vector entry are transferred directly by rfat_file_write()
+ * and rfat_file_read(). A block written from several entries is gathered by
+ * rfat_file_writev() and then written like a full block. A block read into
+ * several entries is read once into the data cache and copied from there.
+ */
+
+long f_writev(F_FILE *file, const F_IOVEC *iov, int iovcnt)
+{
+    int status = F_NO_ERROR;
+    long result = 0;
+    uint32_t total;
+    int index;
+    rfat_volume_t *volume;
+
+    if (!file || !file->mode)
+    {
+        status = F_ERR_NOTOPEN;
+    }
+    else
+    {
+        if (!(file->mode & RFAT_FILE_MODE_WRITE))
+        {
+            status = F_ERR_ACCESSDENIED;
+        }
+        else
+        {
+	    status = file->status;
+	    
+	    if (status == F_NO_ERROR)
+	    {
+		if (iovcnt > 0)
+		{
+		    volume = RFAT_FILE_VOLUME(file);
+
+		    /* A misaligned direct transfer is rejected up front, without
+		     * taking the lock and without touching "file->status".
+		     */
+		    for (index = 0; index < iovcnt; index++)
+		    {
+			if ((iov[index].size > 0) && (rfat_file_direct_check(file, (unsigned long)iov[index].size, TRUE) != F_NO_ERROR))
+			{
+			    status = F_ERR_NOTUSEABLE;
+			}
+		    }
+
+		    if (status == F_NO_ERROR)
+		    {
+			status = rfat_volume_lock(volume);
+		    }
+		    
+		    if (status == F_NO_ERROR)
+		    {
+			status = rfat_file_writev(volume, file, iov, iovcnt, &total);
+
+			result = total;
+			
+			status = rfat_volume_unlock(volume, status);
+		    }
+                }
+            }
+        }
+    }
+
+    return result;
+}
+
+long f_readv(F_FILE *file, const F_IOVEC *iov, int iovcnt)
+{
+    int status = F_NO_ERROR;
+    long result = 0;
+    uint32_t total;
+    int index;
+    rfat_volume_t *volume;
+
+    if (!file || !file->mode)
+    {
+        status = F_ERR_NOTOPEN;
+    }
+    else
+    {
+        if (!(file->mode & RFAT_FILE_MODE_READ))
+        {
+            status = F_ERR_ACCESSDENIED;
+        }
+        else
+        {
+	    status = rfat_file_reattach(file);
+		
+	    if (status == F_NO_ERROR)
+	    {
+		if (iovcnt > 0)
+		{
+		    volume = RFAT_FILE_VOLUME(file);
+
+		    /* A misaligned direct transfer is rejected up front, without
+		     * taking the lock and without touching "file->status".
+		     */
+		    for (index = 0; index < iovcnt; index++)
+		    {
+			if ((iov[index].size > 0) && (rfat_file_direct_check(file, (unsigned long)iov[index].size, FALSE) != F_NO_ERROR))
+			{
+			    status = F_ERR_NOTUSEABLE;
+			}
+		    }
+
+		    if (status == F_NO_ERROR)
+		    {
+			status = rfat_volume_lock(volume);
+		    }
+		    
+		    if (status == F_NO_ERROR)
+		    {
+			for (index = 0; index < iovcnt; index++)
+			{
+			    if (iov[index].size > 0)
+			    {
+				status = rfat_file_read(volume, file, (uint8_t*)iov[index].buffer, (unsigned long)iov[index].size, &total);
+
+				result += total;
+
+				if ((status != F_NO_ERROR) || (total != (unsigned long)iov[index].size))
+				{
+				    break;
+				}
+			    }
+			}
+
+			status = rfat_volume_unlock(volume, status);
+		    }
+                }
+            }
+        }
+    }
+
+    return result;
+}
+
+/* F_QUEUE is a single producer/single consumer ring buffer. f_queue_put() does
+ * not take the volume lock and only copies into RAM, so that it can be called
+ * from an interrupt handler. The producer owns "head" and "overrun", the
+ * consumer f_queue_drain() owns "tail". RFAT_PORT_CORE_BARRIER() orders the
+ * data copy against the index update on either side.
+ */
+
+int f_queue_init(F_QUEUE *queue, F_FILE *file, void *data, unsigned long size)
+{
+    int status = F_NO_ERROR;
+
+    if (!file || !file->mode)
+    {
+        status = F_ERR_NOTOPEN;
+    }
+    else
+    {
+        if (!(file->mode & RFAT_FILE_MODE_WRITE))
+        {
+            status = F_ERR_ACCESSDENIED;
+        }
+        else
+        {
+	    if ((size < RFAT_BLK_SIZE) || (size & (size -1)))
+	    {
+		status = F_ERR_NOTUSEABLE;
+	    }
+	    else
+	    {
+		queue->file = file;
+		queue->data = (unsigned char*)data;
+		queue->size = size;
+		queue->head = 0;
+		queue->tail = 0;
+		queue->overrun = 0;
 	    }
 	}
-
-	status = rfat_volume_unlock(volume, status);
     }
 
     return status;
 }
 
-#endif /* !defined(RFAT_CONFIG_ULTRA_LIGHT_BUILD) */
-
-int f_delete(const char *filename)
+int f_queue_put(F_QUEUE *queue, const void *record, unsigned long size)
 {
     int status = F_NO_ERROR;
-    uint32_t clsno, index, first_clsno;
-    rfat_dir_t *dir;
-    rfat_volume_t *volume;
+    unsigned long head, tail, offset, count;
 
-    volume = RFAT_PATH_VOLUME(filename);
+    head = queue->head;
+    tail = queue->tail;
 
-    status = rfat_volume_lock(volume);
-    
-    if (status == F_NO_ERROR)
+    RFAT_PORT_CORE_BARRIER();
+
+    if (size > (queue->size - (head - tail)))
     {
-	if (volume->flags & RFAT_VOLUME_FLAG_WRITE_PROTECTED)
+	queue->overrun++;
+
+	status = F_ERR_NOMOREENTRY;
+    }
+    else
+    {
+	offset = head & (queue->size -1);
+	count = queue->size - offset;
+
+	if (count > size)
 	{
-	    status = F_ERR_WRITEPROTECT;
+	    count = size;
 	}
-	else
-	{
-	    status = rfat_path_find_file(volume, filename, &clsno, &index, &dir);
-            
-	    if (status == F_NO_ERROR)
-	    {
-		if (dir->dir_attr & RFAT_DIR_ATTR_DIRECTORY)
-		{
-		    status = F_ERR_NOTFOUND;
-		}
-		else if (dir->dir_attr & RFAT_DIR_ATTR_READ_ONLY)
-		{
-		    status = F_ERR_ACCESSDENIED;
-		}
-		else
-		{
-		    if (rfat_file_enumerate(volume, NULL, clsno, index))
-		    {
-			status = F_ERR_LOCKED;
-		    }
-		    else
-		    {
-			if (volume->type == RFAT_VOLUME_TYPE_FAT32)
-			{
-			    first_clsno = ((uint32_t)RFAT_FTOHS(dir->dir_clsno_hi) << 16) | (uint32_t)RFAT_FTOHS(dir->dir_clsno_lo);
-			}
-			else
-			{ 
-			    first_clsno = (uint32_t)RFAT_FTOHS(dir->dir_clsno_lo);
-			}
 
-#if (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0)
-			status = rfat_volume_dirty(volume);
-		    
-			if (status == F_NO_ERROR)
-#endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0) */
-			{
-#if (RFAT_CONFIG_VFAT_SUPPORTED == 1)
-			    /* rfat_path_find_file() fills in the proper volume->dir_entries on a match.
-			     */
-			    status = rfat_path_destroy_entry(volume, clsno, index, volume->dir_entries, first_clsno);
-#else /* (RFAT_CONFIG_VFAT_SUPPORTED == 1) */
-			    status = rfat_path_destroy_entry(volume, clsno, index, first_clsno);
-#endif /* (RFAT_CONFIG_VFAT_SUPPORTED == 1) */
+	memcpy(queue->data + offset, record, count);
 
-#if (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0)
-			    status = rfat_volume_clean(volume, status);
-#endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0) */
-			}
-		    }
-		}
-	    }
+	if (count != size)
+	{
+	    memcpy(queue->data, (const uint8_t*)record + count, (size - count));
 	}
 
-	status = rfat_volume_unlock(volume, status);
+	RFAT_PORT_CORE_BARRIER();
+
+	queue->head = head + size;
     }
 
     return status;
 }
 
-long f_filelength(const char *filename)
+/* f_queue_drain() writes out all queued data that ends up filling complete
+ * blocks in the file, so that rfat_file_write() can pass them straight to
+ * rfat_disk_write_sequential(). If "flush" is set, a trailing partial block
+ * is written as well. The number of bytes written is returned.
+ */
+long f_queue_drain(F_QUEUE *queue, int flush)
 {
     int status = F_NO_ERROR;
-    uint32_t length;
-    rfat_dir_t *dir;
+    long result = 0;
+    unsigned long head, tail, offset, count, size;
+    uint32_t total;
+    F_FILE *file;
     rfat_volume_t *volume;
 
-    length = 0;
-
-    volume = RFAT_PATH_VOLUME(filename);
+    file = queue->file;
 
-    status = rfat_volume_lock(volume);
-    
-    if (status == F_NO_ERROR)
+    if (!file || !file->mode)
     {
-      status = rfat_path_find_file(volume, filename, NULL, NULL, &dir);
-            
+        status = F_ERR_NOTOPEN;
+    }
+    else
+    {
+	status = file->status;
+	    
 	if (status == F_NO_ERROR)
 	{
-	    length = dir->dir_file_size;
-	}
+	    head = queue->head;
 
-	status = rfat_volume_unlock(volume, status);
+	    RFAT_PORT_CORE_BARRIER();
+
+	    tail = queue->tail;
+	    count = head - tail;
+
+	    if (!flush)
+	    {
+		size = (file->position + count) & RFAT_BLK_MASK;
+
+		count = (count > size) ? (count - size) : 0;
+	    }
+
+	    if (count != 0)
+	    {
+		volume = RFAT_FILE_VOLUME(file);
+		    
+		status = rfat_volume_lock(volume);
+		    
+		if (status == F_NO_ERROR)
+		{
+		    while ((status == F_NO_ERROR) && (count != 0))
+		    {
+			offset = tail & (queue->size -1);
+			size = queue->size - offset;
+
+			if (size > count)
+			{
+			    size = count;
+			}
+
+			status = rfat_file_write(volume, file, queue->data + offset, size, &total);
+
+			result += total;
+			tail += total;
+			count -= total;
+
+			if (total != size)
+			{
+			    break;
+			}
+		    }
+
+		    RFAT_PORT_CORE_BARRIER();
+
+		    queue->tail = tail;
+
+		    status = rfat_volume_unlock(volume, status);
+		}
+	    }
+	}
     }
 
-    return (long)length;
+    return result;
 }
 
-int f_findfirst(const char *filename, F_FIND *find)
+unsigned long f_queue_overrun(F_QUEUE *queue)
+{
+    return queue->overrun;
+}
+
+#if (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1)
+
+/* A F_RING is a fixed size log on top of a contiguous file. Once created
+ * neither the FAT nor the directory entry are modified anymore. The tail
+ * is recorded by f_ring_sync() in the header block, and recovered on
+ * f_ring_open() from the stamps of the data blocks written afterwards.
+ */
+
+int f_ring_open(F_RING *ring, const char *filename, unsigned long size)
 {
     int status = F_NO_ERROR;
+    rfat_file_t *file = NULL;
     rfat_volume_t *volume;
-    volume = RFAT_PATH_VOLUME(filename);
 
-    status = rfat_volume_lock(volume);
-    
-    if (status == F_NO_ERROR)
+    if ((size & RFAT_BLK_MASK) || (size < (2 * RFAT_BLK_SIZE)))
     {
-	find->find_index = 0;
-
-        status = rfat_path_find_directory(volume, filename, &filename, &find->find_clsno);
-            
+	status = F_ERR_NOTUSEABLE;
+    }
+    else
+    {
+	volume = RFAT_PATH_VOLUME(filename);
+      
+        status = rfat_volume_lock(volume);
+    
         if (status == F_NO_ERROR)
         {
-#if (RFAT_CONFIG_VFAT_SUPPORTED == 0)
+	    status = rfat_file_open(volume, filename, (RFAT_FILE_MODE_READ | RFAT_FILE_MODE_WRITE | RFAT_FILE_MODE_CREATE), size, &file);
 
-	    /* For non-VFAT, build a MSDOS style template where '*' is expanded into
-	     * a sequence of '?'.
-	     */
+	    if (status == F_NO_ERROR)
+	    {
+		ring->file = file;
+		ring->blkcnt = (size >> RFAT_BLK_SHIFT) -1;
+		ring->tail_blkno = 0;
+		ring->tail_offset = 0;
 
-	    filename = rfat_name_cstring_to_pattern(filename, find->find_pattern);
+		if (file->length == 0)
+		{
+		    /* A new file gets the header written, and is extended to
+		     * its full size with all data blocks being zeroed out.
+		     */
+		    status = rfat_ring_sync(volume, ring);
 
-	    if (filename == NULL)
-	    {
-		status = F_ERR_INVALIDNAME;
-	    }
+		    if (status == F_NO_ERROR)
+		    {
+			status = rfat_file_seek(volume, file, size);
 
-#else /* (RFAT_CONFIG_VFAT_SUPPORTED == 0) */
+			if (status == F_NO_ERROR)
+			{
+			    status = rfat_file_extend(volume, file, size);
 
-	    /* Copy the remaining filename into find_pattern, and do a WINNT compatible
-	     * pattern match based upon the incoming lfn_name, or the converted sfn_name.
-	     */
+			    if (status == F_NO_ERROR)
+			    {
+				status = rfat_file_flush(volume, file, FALSE);
+			    }
+			}
+		    }
+		}
+		else
+		{
+		    status = rfat_ring_recover(volume, ring);
+		}
 
-	    char c, *pattern, *pattern_e;
-	    
-	    pattern = &find->find_pattern[0];
-	    pattern_e = &find->find_pattern[F_MAXPATH];
-	    
-	    do
-	    {
-		if (pattern == pattern_e)
+		if (status == F_NO_ERROR)
 		{
-		    status = F_ERR_TOOLONGNAME;
+		    ring->head_blkno = 0;
+		    ring->head_offset = 0;
 		}
 		else
 		{
-		    c = *filename++;
-		    
-		    *pattern++ = c;
-		}
-	    }
-	    while ((status == F_NO_ERROR) && (c != '\0'));
-#endif /* (RFAT_CONFIG_VFAT_SUPPORTED == 0) */
+		    rfat_file_close(volume, file);
 
-	    if (status == F_NO_ERROR)
-	    {
-		status = rfat_path_find_next(volume, find);
+		    ring->file = NULL;
+		}
 	    }
-	}
 
-	if (status != F_NO_ERROR)
-	{
-	    find->find_clsno = RFAT_CLSNO_END_OF_CHAIN;
-	}
-
-	status = rfat_volume_unlock(volume, status);
+	    status = rfat_volume_unlock(volume, status);
+        }
     }
 
     return status;
 }
 
-int f_findnext(F_FIND *find)
+int f_ring_close(F_RING *ring)
 {
     int status = F_NO_ERROR;
+    rfat_file_t *file;
     rfat_volume_t *volume;
 
-    volume = RFAT_FIND_VOLUME(find);
+    file = ring->file;
 
-    status = rfat_volume_lock(volume);
-    
-    if (status == F_NO_ERROR)
+    if (!file || !file->mode)
     {
-	if (find->find_clsno == RFAT_CLSNO_END_OF_CHAIN)
-	{
-	    status = F_ERR_NOTFOUND;
-	}
-	else
-	{
-	    status = rfat_path_find_next(volume, find);
-	}
+        status = F_ERR_NOTOPEN;
+    }
+    else
+    {
+	volume = RFAT_FILE_VOLUME(file);
+    
+        status = rfat_volume_lock(volume);
+    
+        if (status == F_NO_ERROR)
+        {
+	    if (file->status == F_NO_ERROR)
+	    {
+		status = rfat_ring_sync(volume, ring);
+	    }
 
-	status = rfat_volume_unlock(volume, status);
+	    status = rfat_file_close(volume, file);
+
+	    ring->file = NULL;
+
+	    status = rfat_volume_unlock(volume, status);
+        }
     }
 
     return status;
 }
 
-#if !defined(RFAT_CONFIG_ULTRA_LIGHT_BUILD)
-
-int f_settimedate(const char *filename, unsigned short ctime, unsigned short cdate)
+int f_ring_sync(F_RING *ring)
 {
     int status = F_NO_ERROR;
-    rfat_dir_t *dir;
+    rfat_file_t *file;
     rfat_volume_t *volume;
 
-    volume = RFAT_PATH_VOLUME(filename);
+    file = ring->file;
 
-    status = rfat_volume_lock(volume);
-    
-    if (status == F_NO_ERROR)
+    if (!file || !file->mode)
     {
-	if (volume->flags & RFAT_VOLUME_FLAG_WRITE_PROTECTED)
-	{
-	    status = F_ERR_WRITEPROTECT;
-	}
-	else
-	{
-	    status = rfat_path_find_file(volume, filename, NULL, NULL, &dir);
+        status = F_ERR_NOTOPEN;
+    }
+    else
+    {
+	status = file->status;
 	
+	if (status == F_NO_ERROR)
+	{
+	    volume = RFAT_FILE_VOLUME(file);
+	    
+	    status = rfat_volume_lock(volume);
+		
 	    if (status == F_NO_ERROR)
 	    {
-		/* Nothing special to do here for TRANSACTION_SAFE/VOLUME_DIRTY/FSINFO. The dir entry
-		 * update is atomic and not dependent upon the FAT.
-		 */
-		dir->dir_wrt_time = RFAT_HTOFS(ctime);
-		dir->dir_wrt_date = RFAT_HTOFS(cdate);
-	    
-		status = rfat_dir_cache_write(volume);
+		status = rfat_ring_sync(volume, ring);
+		    
+		status = rfat_volume_unlock(volume, status);
 	    }
 	}
-
-	status = rfat_volume_unlock(volume, status);
     }
 
     return status;
 }
 
-int f_gettimedate(const char *filename, unsigned short *p_ctime, unsigned short *p_cdate)
+long f_ring_write(F_RING *ring, const void *buffer, long size)
 {
     int status = F_NO_ERROR;
-    rfat_dir_t *dir;
+    long result = 0;
+    uint32_t total;
+    rfat_file_t *file;
     rfat_volume_t *volume;
 
-    volume = RFAT_PATH_VOLUME(filename);
+    file = ring->file;
 
-    status = rfat_volume_lock(volume);
-    
-    if (status == F_NO_ERROR)
+    if (!file || !file->mode)
     {
-	status = rfat_path_find_file(volume, filename, NULL, NULL, &dir);
-	
+        status = F_ERR_NOTOPEN;
+    }
+    else
+    {
+	status = file->status;
+	    
 	if (status == F_NO_ERROR)
 	{
-	    *p_ctime = RFAT_FTOHS(dir->dir_wrt_time);
-	    *p_cdate = RFAT_FTOHS(dir->dir_wrt_date);
-	}
+	    if (size > 0)
+	    {
+		volume = RFAT_FILE_VOLUME(file);
+		    
+		status = rfat_volume_lock(volume);
+		    
+		if (status == F_NO_ERROR)
+		{
+		    status = rfat_ring_write(volume, ring, (const uint8_t*)buffer, size, &total);
 
-	status = rfat_volume_unlock(volume, status);
+		    result = total;
+			
+		    status = rfat_volume_unlock(volume, status);
+		}
+	    }
+	}
     }
 
-    return status;
+    return result;
 }
 
-int f_setattr(const char *filename, unsigned char attr)
+long f_ring_read(F_RING *ring, void *buffer, long size)
 {
     int status = F_NO_ERROR;
-    rfat_dir_t *dir;
+    long result = 0;
+    uint32_t total;
+    rfat_file_t *file;
     rfat_volume_t *volume;
 
-    volume = RFAT_PATH_VOLUME(filename);
+    file = ring->file;
 
-    status = rfat_volume_lock(volume);
-    
-    if (status == F_NO_ERROR)
+    if (!file || !file->mode)
     {
-	if (volume->flags & RFAT_VOLUME_FLAG_WRITE_PROTECTED)
-	{
-	    status = F_ERR_WRITEPROTECT;
-	}
-	else
+        status = F_ERR_NOTOPEN;
+    }
+    else
+    {
+	status = file->status;
+	    
+	if (status == F_NO_ERROR)
 	{
-	    status = rfat_path_find_file(volume, filename, NULL, NULL, &dir);
-	
-	    if (status == F_NO_ERROR)
+	    if (size > 0)
 	    {
-		/* Nothing special to do here for TRANSACTION_SAFE/VOLUME_DIRT/FSINFO. The dir entry
-		 * update is atomic and not dependent upon the FAT.
-		 */
-		dir->dir_attr = ((dir->dir_attr & ~(F_ATTR_ARC | F_ATTR_SYSTEM | F_ATTR_HIDDEN | F_ATTR_READONLY)) |
-				 (attr & (F_ATTR_ARC | F_ATTR_SYSTEM | F_ATTR_HIDDEN | F_ATTR_READONLY)));
-	    
-		status = rfat_dir_cache_write(volume);
+		volume = RFAT_FILE_VOLUME(file);
+		    
+		status = rfat_volume_lock(volume);
+		    
+		if (status == F_NO_ERROR)
+		{
+		    status = rfat_ring_read(volume, ring, (uint8_t*)buffer, size, &total);
+
+		    result = total;
+			
+		    status = rfat_volume_unlock(volume, status);
+		}
 	    }
 	}
-
-	status = rfat_volume_unlock(volume, status);
     }
 
-    return status;
+    return result;
 }
 
-int f_getattr(const char *filename, unsigned char *p_attr)
+int f_ring_rewind(F_RING *ring)
 {
     int status = F_NO_ERROR;
-    rfat_dir_t *dir;
-    rfat_volume_t *volume;
-
-    volume = RFAT_PATH_VOLUME(filename);
 
-    status = rfat_volume_lock(volume);
-    
-    if (status == F_NO_ERROR)
+    if (!ring->file || !ring->file->mode)
     {
-	status = rfat_path_find_file(volume, filename, NULL, NULL, &dir);
-	
-	if (status == F_NO_ERROR)
-	{
-	    *p_attr = dir->dir_attr;
-	}
-
-	status = rfat_volume_unlock(volume, status);
+        status = F_ERR_NOTOPEN;
+    }
+    else
+    {
+	ring->head_blkno = 0;
+	ring->head_offset = 0;
     }
 
     return status;
 }
 
-#endif /* !defined(RFAT_CONFIG_ULTRA_LIGHT_BUILD) */
+/* A F_POOL is a numbered sequence of contiguous files, out of which "count"
+ * files past the active one are kept preallocated by f_pool_fill() during idle
+ * time. f_pool_rotate() then only closes the active file and reopens the next
+ * preallocated one, which does not modify the FAT or create a directory entry.
+ */
 
-F_FILE * f_open(const char *filename, const char *type)
+int f_pool_open(F_POOL *pool, const char *pattern, unsigned long size, int count)
 {
     int status = F_NO_ERROR;
-    int c;
-    rfat_file_t *file = NULL;
-    uint32_t mode, size;
-    rfat_volume_t *volume;
+    unsigned int n, offset, digits;
+    uint32_t sequence;
+    char filename[F_MAXPOOLPATH];
+    F_FIND find;
 
-    mode = 0;
-    size = 0;
+    pool->file = NULL;
+    pool->size = size;
+    pool->count = count;
+    pool->sequence = 0;
+    pool->limit = 0;
 
-    while ((status == F_NO_ERROR) && (c = *type++))
+    offset = 0;
+    digits = 0;
+
+    for (n = 0; (n < (F_MAXPOOLPATH -1)) && (pattern[n] != '\0'); n++)
     {
-	if ((c == 'r') || (c == 'w') || (c == 'a'))
-	{
-	    if (!(mode & (RFAT_FILE_MODE_READ | RFAT_FILE_MODE_WRITE)))
-	    {
-		if (c == 'r')
-		{
-		    mode = RFAT_FILE_MODE_READ;
-		}
-		else if (c == 'w')
-		{
-		    mode = RFAT_FILE_MODE_WRITE | RFAT_FILE_MODE_CREATE | RFAT_FILE_MODE_TRUNCATE;
-		}
-		else
-		{
-		    mode = RFAT_FILE_MODE_WRITE | RFAT_FILE_MODE_CREATE | RFAT_FILE_MODE_APPEND;
-		}
-		
-		if (*type == '+')
-		{
-		    mode |= (RFAT_FILE_MODE_READ | RFAT_FILE_MODE_WRITE);
-		    type++;
-		}
-	    }
-	    else
-	    {
-		status = F_ERR_NOTUSEABLE;
-	    }
-	}
-	else if (c == 'c')
+	if ((pattern[n] == '/') || (pattern[n] == '\\'))
 	{
-	    mode |= RFAT_FILE_MODE_COMMIT;
+	    offset = n +1;
 	}
-	else if (c == 'S')
+
+	if (pattern[n] == '#')
 	{
-	    mode &= ~RFAT_FILE_MODE_RANDOM;
-	    mode |= RFAT_FILE_MODE_SEQUENTIAL;
+	    digits++;
+
+	    filename[n] = '?';
 	}
-	else if (c == 'R')
+	else
 	{
-	    mode &= ~RFAT_FILE_MODE_SEQUENTIAL;
-	    mode |= RFAT_FILE_MODE_RANDOM;
+	    filename[n] = pattern[n];
 	}
-#if (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1)
-	else if ((c == ',') && (*type != '\0'))
-	{
-	    /* ",<size>". Make sure that <size> does not overflow
-	     * RFAT_FILE_SIZE_MAX.
-	     */
-	    while ((status == F_NO_ERROR) && (*type != '\0'))
-	    {
-		c = *type++;
 
-		if ((c >= '0') && (c <= '9'))
-		{
-		    if (size >= (RFAT_FILE_SIZE_MAX / 10u))
-		    {
-			size = RFAT_FILE_SIZE_MAX;
-		    }
-		    else
-		    {
-			size = size * 10u;
+	pool->pattern[n] = pattern[n];
+    }
 
-			if (size >= (RFAT_FILE_SIZE_MAX - (c - '0')))
-			{
-			    size = RFAT_FILE_SIZE_MAX;
-			}
-			else
-			{
-			    size += (c - '0');
-			}
-		    }
-		}
-		else if ((c == 'K') && (*type == '\0'))
-		{
-		    if (size >= (RFAT_FILE_SIZE_MAX / 1024u))
-		    {
-			size = RFAT_FILE_SIZE_MAX;
-		    }
-		    else
-		    {
-			size = size * 1024u;
-		    }
-		}
-		else if ((c == 'M') && (*type == '\0'))
-		{
-		    if (size >= (RFAT_FILE_SIZE_MAX / 1048576u))
-		    {
-			size = RFAT_FILE_SIZE_MAX;
-		    }
-		    else
-		    {
-			size = size * 1048576u;
-		    }
-		}
-		else if ((c == 'G') && (*type == '\0'))
+    filename[n] = '\0';
+
+    pool->pattern[n] = '\0';
+
+    if ((size == 0) || (count < 0) || (digits == 0))
+    {
+	status = F_ERR_NOTUSEABLE;
+    }
+    else if (pattern[n] != '\0')
+    {
+	status = F_ERR_TOOLONGNAME;
+    }
+    else
+    {
+	/* Files past the last one with data are either preallocated or
+	 * got never written to. They are reused, and "pool->limit" is set
+	 * past the highest numbered of those.
+	 */
+
+	status = f_findfirst(filename, &find);
+
+	while (status == F_NO_ERROR)
+	{
+	    sequence = 0;
+
+	    for (n = offset; pool->pattern[n] != '\0'; n++)
+	    {
+		if (pool->pattern[n] == '#')
 		{
-		    if (size >= (RFAT_FILE_SIZE_MAX / 1073741824u))
+		    if ((find.filename[n - offset] >= '0') && (find.filename[n - offset] <= '9'))
 		    {
-			size = RFAT_FILE_SIZE_MAX;
+			sequence = sequence * 10 + (find.filename[n - offset] - '0');
 		    }
 		    else
 		    {
-			size = size * 1073741824u;
+			break;
 		    }
 		}
-		else
+	    }
+
+	    if (pool->pattern[n] == '\0')
+	    {
+		if (pool->limit <= sequence)
 		{
-		    status = F_ERR_NOTUSEABLE;
+		    pool->limit = sequence +1;
+		}
+
+		if ((find.filesize != 0) && (pool->sequence <= sequence))
+		{
+		    pool->sequence = sequence +1;
 		}
 	    }
+
+	    status = f_findnext(&find);
 	}
-#endif /* (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1) */
-	else
+
+	if (status == F_ERR_NOTFOUND)
 	{
-	    status = F_ERR_NOTUSEABLE;
+	    status = F_NO_ERROR;
 	}
     }
 
-    if ((status == F_NO_ERROR) && (mode & (RFAT_FILE_MODE_READ | RFAT_FILE_MODE_WRITE)))
-    {
-	volume = RFAT_PATH_VOLUME(filename);
-      
-        status = rfat_volume_lock(volume);
-    
-        if (status == F_NO_ERROR)
-        {
-	    status = rfat_file_open(volume, filename, mode, size, &file);
-
-	    status = rfat_volume_unlock(volume, status);
-        }
-    }
-    else
-    {
-        status = F_ERR_NOTUSEABLE;
-    }
-
-    return (status == F_NO_ERROR) ? file : NULL;
+    return status;
 }
 
-int f_close(F_FILE *file)
+int f_pool_close(F_POOL *pool)
 {
     int status = F_NO_ERROR;
+    rfat_file_t *file;
     rfat_volume_t *volume;
 
+    file = pool->file;
+
     if (!file || !file->mode)
     {
         status = F_ERR_NOTOPEN;
     }
     else
     {
-	/* There is no check for "file->status" here, as this
-	 * is handled in rfat_file_close(), so that the meta
-	 * data gets updated, while the file data is treated
-	 * as optional.
-	 */
-
 	volume = RFAT_FILE_VOLUME(file);
     
         status = rfat_volume_lock(volume);
@@ -10674,6 +15656,8 @@ int f_close(F_FILE *file)
         {
 	    status = rfat_file_close(volume, file);
 
+	    pool->file = NULL;
+
 	    status = rfat_volume_unlock(volume, status);
         }
     }
@@ -10681,33 +15665,41 @@ int f_close(F_FILE *file)
     return status;
 }
 
-int f_flush(F_FILE *file)
+int f_pool_fill(F_POOL *pool)
 {
     int status = F_NO_ERROR;
+    rfat_file_t *file;
     rfat_volume_t *volume;
+    char filename[F_MAXPOOLPATH];
 
-    if (!file || !file->mode)
-    {
-	status = F_ERR_NOTOPEN;
-    }
-    else
+    volume = RFAT_PATH_VOLUME(pool->pattern);
+
+    /* Each file is created under its own lock, so that a concurrent
+     * writer is not stalled for the whole pool.
+     */
+    while ((status == F_NO_ERROR) && (pool->limit < (pool->sequence + pool->count)))
     {
-	status = file->status;
-	
+	status = rfat_pool_name(pool, pool->limit, filename);
+
 	if (status == F_NO_ERROR)
 	{
-	    if (file->mode & RFAT_FILE_MODE_WRITE)
+	    status = rfat_volume_lock(volume);
+
+	    if (status == F_NO_ERROR)
 	    {
-		volume = RFAT_FILE_VOLUME(file);
-	    
-		status = rfat_volume_lock(volume);
-		
+		status = rfat_file_open(volume, filename, (RFAT_FILE_MODE_WRITE | RFAT_FILE_MODE_CREATE), pool->size, &file);
+
 		if (status == F_NO_ERROR)
 		{
-		    status = rfat_file_flush(volume, file, FALSE);
-		    
-		    status = rfat_volume_unlock(volume, status);
+		    status = rfat_file_close(volume, file);
+
+		    if (status == F_NO_ERROR)
+		    {
+			pool->limit++;
+		    }
 		}
+
+		status = rfat_volume_unlock(volume, status);
 	    }
 	}
     }
@@ -10715,96 +15707,60 @@ int f_flush(F_FILE *file)
     return status;
 }
 
-long f_write(const void *buffer, long size, long count, F_FILE *file)
+int f_pool_rotate(F_POOL *pool)
 {
     int status = F_NO_ERROR;
-    long result = 0;
-    uint32_t total;
+    rfat_file_t *file;
     rfat_volume_t *volume;
+    char filename[F_MAXPOOLPATH];
 
-    if (!file || !file->mode)
-    {
-        status = F_ERR_NOTOPEN;
-    }
-    else
+    status = rfat_pool_name(pool, pool->sequence, filename);
+
+    if (status == F_NO_ERROR)
     {
-        if (!(file->mode & RFAT_FILE_MODE_WRITE))
-        {
-            status = F_ERR_ACCESSDENIED;
-        }
-        else
-        {
-	    status = file->status;
-	    
-	    if (status == F_NO_ERROR)
-	    {
-		if ((size > 0) && (count > 0))
-		{
-		    volume = RFAT_FILE_VOLUME(file);
-		    
-		    status = rfat_volume_lock(volume);
-		    
-		    if (status == F_NO_ERROR)
-		    {
-			status = rfat_file_write(volume, file, (const uint8_t*)buffer, (unsigned long)count * (unsigned long)size, &total);
+	volume = RFAT_PATH_VOLUME(pool->pattern);
 
-			result = total / (unsigned long)size;
-			
-			status = rfat_volume_unlock(volume, status);
-		    }
-                }
-            }
-        }
-    }
+	status = rfat_volume_lock(volume);
 
-    return result;
-}
+	if (status == F_NO_ERROR)
+	{
+	    file = pool->file;
 
-long f_read(void *buffer, long size, long count, F_FILE *file)
-{
-    int status = F_NO_ERROR;
-    long result = 0;
-    uint32_t total;
-    rfat_volume_t *volume;
+	    if (file && file->mode)
+	    {
+		status = rfat_file_close(volume, file);
+	    }
+
+	    pool->file = NULL;
 
-    if (!file || !file->mode)
-    {
-        status = F_ERR_NOTOPEN;
-    }
-    else
-    {
-        if (!(file->mode & RFAT_FILE_MODE_READ))
-        {
-            status = F_ERR_ACCESSDENIED;
-        }
-        else
-        {
-	    status = file->status;
-		
 	    if (status == F_NO_ERROR)
 	    {
-		if ((size > 0) && (count > 0))
-		{
-		    volume = RFAT_FILE_VOLUME(file);
-		    
-		    status = rfat_volume_lock(volume);
-		    
-		    if (status == F_NO_ERROR)
-		    {
-			status = rfat_file_read(volume, file, (uint8_t*)buffer, (unsigned long)count * (unsigned long)size, &total);
+		/* A preallocated file only gets its cluster chain verified. If the
+		 * pool ran dry, the file is created and allocated here.
+		 */
+		status = rfat_file_open(volume, filename, (RFAT_FILE_MODE_WRITE | RFAT_FILE_MODE_CREATE | RFAT_FILE_MODE_APPEND), pool->size, &file);
 
-			result = total / (unsigned long)size;
+		if (status == F_NO_ERROR)
+		{
+		    pool->file = file;
+		    pool->sequence++;
 
-			status = rfat_volume_unlock(volume, status);
+		    if (pool->limit < pool->sequence)
+		    {
+			pool->limit = pool->sequence;
 		    }
-                }
-            }
-        }
+		}
+	    }
+
+	    status = rfat_volume_unlock(volume, status);
+	}
     }
 
-    return result;
+    return status;
 }
 
+#endif /* (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1) */
+
 int f_seek(F_FILE *file, long offset, int whence)
 {
     int status = F_NO_ERROR;
@@ -10824,27 +15780,27 @@ int f_seek(F_FILE *file, long offset, int whence)
 	    switch (whence) {
 	    case F_SEEK_CUR:
 		if ((offset >= 0)
-		    ? ((uint32_t)offset > (RFAT_FILE_SIZE_MAX - file->position))
-		    : ((uint32_t)(0 - offset) > file->position))
+		    ? ((uint32_t)offset > (RFAT_FILE_SIZE_MAX - RFAT_FILE_POSITION(file)))
+		    : ((uint32_t)(0 - offset) > RFAT_FILE_POSITION(file)))
 		{
 		    status = F_ERR_NOTUSEABLE;
 		}
 		else
 		{
-		    position = file->position + offset;
+		    position = RFAT_FILE_POSITION(file) + offset;
 		}
 		break;
 
 	    case F_SEEK_END:
 		if ((offset >= 0)
-		    ? ((uint32_t)offset > (RFAT_FILE_SIZE_MAX - file->length))
-		    : ((uint32_t)(0 - offset) > file->length))
+		    ? ((uint32_t)offset > (RFAT_FILE_SIZE_MAX - RFAT_FILE_LENGTH(file)))
+		    : ((uint32_t)(0 - offset) > RFAT_FILE_LENGTH(file)))
 		{
 		    status = F_ERR_NOTUSEABLE;
 		}
 		else
 		{
-		    position = file->length + offset;
+		    position = RFAT_FILE_LENGTH(file) + offset;
 		}
 		break;
 
@@ -10895,7 +15851,7 @@ long f_tell(F_FILE *file)
     else
     {
 	status = file->status;
-        position = file->position;
+        position = RFAT_FILE_POSITION(file);
     }
 
     return (status == F_NO_ERROR) ? (long)position : -1;
@@ -10903,7 +15859,7 @@ long f_tell(F_FILE *file)
 
 int f_eof(F_FILE *file)
 {
-    return (!file || !file->mode || (file->position >= file->length));
+    return (!file || !file->mode || (RFAT_FILE_POSITION(file) >= RFAT_FILE_LENGTH(file)));
 }
 
 int f_error(F_FILE *file)
@@ -10998,7 +15954,40 @@ int f_putc(int c, F_FILE *file)
 		entry = &volume->dir_cache;
 #endif /* (RFAT_CONFIG_FILE_DATA_CACHE) */
 
-		if ((entry->blkno == file->blkno) && ((file->mode & RFAT_FILE_MODE_APPEND) ? (file->position == file->length) : (file->position <= file->length)))
+#if (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1)
+		if (file->stream_data != NULL)
+		{
+		    data = c;
+
+		    if (RFAT_FILE_STREAM_WRITABLE(file, 1))
+		    {
+			file->stream_data[file->stream_index++] = data;
+
+			result = c;
+		    }
+		    else
+		    {
+			status = rfat_volume_lock(volume);
+                
+			if (status == F_NO_ERROR)
+			{
+			    status = rfat_file_stream_write(volume, file, &data, 1, &total);
+
+			    if (status == F_NO_ERROR)
+			    {
+				if (total == 1)
+				{
+				    result = c;
+				}
+			    }
+
+			    status = rfat_volume_unlock(volume, status);
+			}
+		    }
+		}
+		else
+#endif /* (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1) */
+		if ((entry->blkno == file->blkno) && !(file->flags & RFAT_FILE_FLAG_DIRECT) && !RFAT_FILE_SETTLE(file) && ((file->mode & RFAT_FILE_MODE_APPEND) ? (file->position == file->length) : (file->position <= file->length)))
 		{
 		    file->flags |= RFAT_FILE_FLAG_DATA_MODIFIED;
 
@@ -11069,7 +16058,7 @@ int f_getc(F_FILE *file)
         }
         else
         {
-	    status = file->status;
+	    status = rfat_file_reattach(file);
 
 	    if (status == F_NO_ERROR)
 	    {
@@ -11081,7 +16070,33 @@ int f_getc(F_FILE *file)
 		entry = &volume->dir_cache;
 #endif /* (RFAT_CONFIG_FILE_DATA_CACHE) */
 		    
-		if ((entry->blkno == file->blkno) && (file->position < file->length))
+#if (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1)
+		if (file->stream_data != NULL)
+		{
+		    if (file->stream_index < file->stream_count)
+		    {
+			result = file->stream_data[file->stream_index++];
+		    }
+		    else
+		    {
+			status = rfat_volume_lock(volume);
+			
+			if (status == F_NO_ERROR)
+			{
+			    status = rfat_file_stream_read(volume, file, &data, 1, &total);
+			    
+			    if (total == 1)
+			    {
+				result = data;
+			    }
+			    
+			    status = rfat_volume_unlock(volume, status);
+			}
+		    }
+		}
+		else
+#endif /* (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1) */
+		if ((entry->blkno == file->blkno) && !(file->flags & RFAT_FILE_FLAG_DIRECT) && (file->position < file->length))
 		{
 		    result = *(entry->data + (file->position & RFAT_BLK_MASK));
 			
@@ -11136,30 +16151,40 @@ int f_seteof(F_FILE *file)
         
 	    if (status == F_NO_ERROR)
 	    {
-		/* Allow always a truncation, to deal with the case where there
-		 * was a file->length but no cluster allocated.
-		 */
-		if ((file->position == 0) || (file->position < file->length))
+#if (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1)
+		if (file->stream_count | file->stream_index)
 		{
-		    status = rfat_file_shrink(volume, file);
+		    status = rfat_file_stream_flush(volume, file);
 		}
-		else
+#endif /* (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1) */
+
+		if (status == F_NO_ERROR)
 		{
-		    if ((file->first_clsno == RFAT_CLSNO_NONE) || (file->length < file->position))
+		    /* Allow always a truncation, to deal with the case where there
+		     * was a file->length but no cluster allocated.
+		     */
+		    if ((file->position == 0) || (file->position < file->length))
 		    {
-#if (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1)
-			if (file->flags & RFAT_FILE_FLAG_CONTIGUOUS)
+			status = rfat_file_shrink(volume, file);
+		    }
+		    else
+		    {
+			if ((file->first_clsno == RFAT_CLSNO_NONE) || (file->length < file->position))
 			{
-			    if (file->size < file->position)
+#if (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1)
+			    if (file->flags & RFAT_FILE_FLAG_CONTIGUOUS)
 			    {
-				status = F_ERR_EOF;
+				if (file->size < file->position)
+				{
+				    status = F_ERR_EOF;
+				}
 			    }
-			}
 
-			if (status == F_NO_ERROR)
+			    if (status == F_NO_ERROR)
 #endif /* (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1) */
-			{
-			    status = rfat_file_extend(volume, file, file->position);
+			    {
+				status = rfat_file_extend(volume, file, file->position);
+			    }
 			}
 		    }
 		}
@@ -11172,6 +16197,46 @@ int f_seteof(F_FILE *file)
     return status;
 }
 
+int f_fstat(F_FILE *file, F_STAT *stat)
+{
+    int status = F_NO_ERROR;
+    rfat_volume_t *volume;
+
+    if (!file || !file->mode)
+    {
+        status = F_ERR_NOTOPEN;
+    }
+    else
+    {
+	/* The information is taken from the open file, without accessing
+	 * the dir entry. Hence "filesize" includes data that has not been
+	 * flushed to the SDCARD yet.
+	 */
+	volume = RFAT_FILE_VOLUME(file);
+
+	stat->filesize = RFAT_FILE_LENGTH(file);
+	stat->attr = file->attr;
+	stat->modifiedtime = file->wrt_time;
+	stat->modifieddate = file->wrt_date;
+	stat->cluster = file->first_clsno;
+
+	if (volume->type == RFAT_VOLUME_TYPE_FAT32)
+	{
+	    stat->createtime = file->crt_time;
+	    stat->createdate = file->crt_date;
+	    stat->lastaccessdate = file->acc_date;
+	}
+	else
+	{
+	    stat->createtime = file->wrt_time;
+	    stat->createdate = file->wrt_date;
+	    stat->lastaccessdate = 0;
+	}
+    }
+
+    return status;
+}
+
 F_FILE * f_truncate(const char *filename, long length)
 {
     int status = F_NO_ERROR;
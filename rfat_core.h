@@ -39,6 +39,10 @@ typedef struct _rfat_file_t          rfat_file_t;
 typedef struct _rfat_cache_entry_t   rfat_cache_entry_t;
 typedef struct _rfat_cluster_entry_t rfat_cluster_entry_t;
 typedef struct _rfat_volume_t        rfat_volume_t;
+#if (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1)
+typedef struct _rfat_ring_header_t   rfat_ring_header_t;
+typedef struct _rfat_ring_stamp_t    rfat_ring_stamp_t;
+#endif /* (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1) */
 
 #if (RFAT_CONFIG_VFAT_SUPPORTED == 0)
 
@@ -160,7 +164,11 @@ union _rfat_boot_t {
     } bs;
 
     struct __attribute__((packed)) {
-        uint8_t             bs_reserved_1[446];
+        uint8_t             bs_reserved_1[428];
+        uint32_t            mbr_unit_sig;             /* 0x54494e55 ("UNIT") */
+        uint32_t            mbr_unit_size;            /* probed AU size in blocks */
+        uint32_t            mbr_page_size;            /* probed page size in blocks, 0 if unknown */
+        uint8_t             bs_reserved_2[6];
 	struct __attribute__((packed)) {
 	    uint8_t             mbr_boot_ind;
 	    uint8_t             mbr_start_chs[3];
@@ -264,14 +272,17 @@ union _rfat_boot_t {
         uint16_t            log_dir_index;
         uint32_t            log_dir_clsno;
         uint32_t            log_dot_clsno;
-        uint32_t            log_struct_sig;           /* 0x45563031 ("EV01") */
+        uint32_t            log_struct_sig;           /* 0x45563033 ("EV03") */
         uint32_t            log_del_clsno;
         uint16_t            log_del_index;
         uint8_t             log_del_entries;
         uint8_t             log_lfn_count;
         uint32_t            log_lfn_blkno;
         uint8_t             log_lfn_name[256];
-        uint8_t             bs_reserved_2[22];
+        uint32_t            log_group_clsno;
+        uint32_t            log_group_dir_clsno;
+        uint32_t            log_group_dir_index;
+        uint8_t             bs_reserved_2[10];
 	uint16_t            bs_trail_sig;            /* 0xaa55 */
     } bpblog;
 
@@ -288,6 +299,31 @@ struct _rfat_fsinfo_t {
     uint32_t                fsi_trail_sig;           /* 0xaa550000 */
 };
 
+#if (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1)
+
+/* A ring file consists of a header block, followed by "ring_blkcnt" data blocks.
+ * Each data block starts with a stamp, which holds the logical block number
+ * (+1) of the data, so that the tail can be recovered by scanning forward from
+ * the last recorded "ring_tail_blkno".
+ */
+
+struct _rfat_ring_header_t {
+    uint32_t                ring_lead_sig;           /* 0x474e4952 ("RING") */
+    uint32_t                ring_blkcnt;
+    uint32_t                ring_tail_blkno;
+    uint32_t                ring_tail_offset;
+};
+
+struct _rfat_ring_stamp_t {
+    uint32_t                stamp_blkno;             /* logical block number +1 */
+    uint32_t                stamp_count;             /* valid data bytes */
+};
+
+#define RFAT_RING_LEAD_SIG                  0x474e4952
+#define RFAT_RING_DATA_SIZE                 (RFAT_BLK_SIZE - sizeof(rfat_ring_stamp_t))
+
+#endif /* (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1) */
+
 struct _rfat_cache_entry_t {
     uint32_t                blkno;
     uint8_t                 *data;
@@ -302,6 +338,7 @@ struct _rfat_cache_entry_t {
 #define RFAT_MAP_FLAG_MAP_FSINFO            0x08
 
 #define RFAT_MAP_TABLE_ENTRIES              32
+#define RFAT_MAP_TABLE_EXTENTS              16             /* (offset, count) pairs in map_table[] */
 #define RFAT_MAP_TABLE_OVERFLOW             255
 
 #define RFAT_DIR_FLAG_SYNC_ENTRY            0x01
@@ -311,10 +348,21 @@ struct _rfat_cache_entry_t {
 #define RFAT_DIR_FLAG_CREATE_ENTRY          0x10
 
 #define RFAT_LOG_LEAD_SIG                   0x52444154     /* "RFAT" */
-#define RFAT_LOG_STRUCT_SIG                 0x45563031     /* "EV01" */
+#define RFAT_LOG_STRUCT_SIG                 0x45563033     /* "EV03" */
+
+#define RFAT_GROUP_INDEX_NONE               0xffffffff
 
 #endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1) */
 
+#if (RFAT_CONFIG_UNIT_PROBE_SUPPORTED == 1)
+
+#define RFAT_UNIT_SIG                       0x54494e55     /* "UNIT" */
+
+#define RFAT_UNIT_PROBE_PAGE_SIZE           64             /* largest page size probed, in blocks */
+#define RFAT_UNIT_PROBE_UNIT_SIZE           32768          /* largest AU size probed, in blocks */
+
+#endif /* (RFAT_CONFIG_UNIT_PROBE_SUPPORTED == 1) */
+
 #define RFAT_FILE_MODE_READ                 0x01
 #define RFAT_FILE_MODE_WRITE                0x02
 #define RFAT_FILE_MODE_APPEND               0x04
@@ -323,6 +371,8 @@ struct _rfat_cache_entry_t {
 #define RFAT_FILE_MODE_COMMIT               0x20
 #define RFAT_FILE_MODE_SEQUENTIAL           0x40
 #define RFAT_FILE_MODE_RANDOM               0x80
+#define RFAT_FILE_MODE_DIRECT               0x100  /* rfat_file_mode() only, kept as RFAT_FILE_FLAG_DIRECT */
+#define RFAT_FILE_MODE_NONBLOCK             0x200  /* rfat_file_mode() only, kept as RFAT_FILE_OPTION_NONBLOCK */
 
 #if (RFAT_CONFIG_FILE_DATA_CACHE == 1)
 #if (RFAT_CONFIG_DATA_CACHE_ENTRIES != 0)
@@ -331,16 +381,25 @@ struct _rfat_cache_entry_t {
 #endif /* (RFAT_CONFIG_FILE_DATA_CACHE == 1) */
 #define RFAT_FILE_FLAG_DATA_MODIFIED        0x02
 #define RFAT_FILE_FLAG_DIR_MODIFIED         0x04
+#define RFAT_FILE_FLAG_DIRECT               0x08   /* block aligned transfers only, bypassing the data cache */
+#define RFAT_FILE_FLAG_CHAIN_MODIFIED       0x10   /* cluster chain changed since last rfat_file_sync() */
+#if (RFAT_CONFIG_APPEND_RESERVE_CLUSTERS != 0)
+#define RFAT_FILE_FLAG_RESERVED             0x20   /* cluster chain may extend past file->length */
+#endif /* (RFAT_CONFIG_APPEND_RESERVE_CLUSTERS != 0) */
 #if (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1)
 #define RFAT_FILE_FLAG_CONTIGUOUS           0x40   /* contiguous cluster range to file->total_clscnt */
 #endif /* (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1) */
 #define RFAT_FILE_FLAG_END_OF_CHAIN         0x80   /* END_OF_CHAIN seen */
 
+#define RFAT_FILE_OPTION_NONBLOCK           0x01   /* f_write()/f_flush()/f_close() return instead of waiting for the SDCARD */
+
 struct _rfat_file_t {
     uint8_t                 mode;
     uint8_t                 flags;
     volatile uint8_t        status;
-    uint8_t                 reserved[3];    /* unused for now */
+    uint8_t                 attr;           /* dir_attr from dir entry */
+    uint8_t                 option;         /* RFAT_FILE_OPTION_* */
+    uint8_t                 reserved[1];    /* unused for now */
     uint16_t                dir_index;      /* index within directory where primary dir entry resides */
     uint32_t                dir_clsno;      /* clsno where primary dir entry resides */ 
     uint32_t                first_clsno;    /* dir_clsno_hi/dir_clsno_lo from dir entry */
@@ -349,10 +408,31 @@ struct _rfat_file_t {
     uint32_t                size;           /* size of reserved area */
 #endif /* (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1) */
     uint32_t                length;         /* dir_file_size from dir entry */
+    uint16_t                crt_time;       /* dir_crt_time from dir entry */
+    uint16_t                crt_date;       /* dir_crt_date from dir entry */
+    uint16_t                wrt_time;       /* dir_wrt_time from dir entry */
+    uint16_t                wrt_date;       /* dir_wrt_date from dir entry */
+    uint16_t                acc_date;       /* dir_acc_date from dir entry */
     uint32_t                position;
     uint32_t                clsno;
     uint32_t                blkno;
     uint32_t                blkno_e;        /* exclusive */
+#if (RFAT_CONFIG_SEQUENTIAL_SUPPORTED == 1) && (RFAT_CONFIG_MAX_FILES > 1)
+    uint32_t                base_clsno;     /* bottom clsno for free_clsno allocation unit (inclusive) */
+    uint32_t                limit_clsno;    /* top clsno for free_clsno allocation unit (exclusive) */
+    uint32_t                free_clsno;     /* first free clsno */
+#endif /* (RFAT_CONFIG_SEQUENTIAL_SUPPORTED == 1) && (RFAT_CONFIG_MAX_FILES > 1) */
+#if (RFAT_CONFIG_COMMIT_POLICY_SUPPORTED == 1)
+    uint8_t                 commit_policy;  /* F_COMMIT_* */
+    uint32_t                commit_interval; /* in units of "commit_mark" */
+    uint32_t                commit_mark;    /* bytes, clusters, seconds or microseconds at last rfat_file_flush() */
+#endif /* (RFAT_CONFIG_COMMIT_POLICY_SUPPORTED == 1) */
+#if (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1)
+    uint8_t                 *stream_data;   /* f_setvbuf() buffer */
+    uint32_t                stream_size;
+    uint32_t                stream_index;   /* next byte to be read, or number of bytes to be written */
+    uint32_t                stream_count;   /* bytes read into stream_data, 0 if writing */
+#endif /* (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1) */
 #if (RFAT_CONFIG_FILE_DATA_CACHE == 1)
 #if (RFAT_CONFIG_DATA_CACHE_ENTRIES != 0)
     rfat_cache_entry_t      data_cache;
@@ -385,6 +465,9 @@ struct _rfat_cluster_entry_t {
 #define RFAT_VOLUME_FLAG_FAT_1_CURRENT      0x0001
 #define RFAT_VOLUME_FLAG_FAT_0_DIRTY        0x0002
 #define RFAT_VOLUME_FLAG_FAT_1_DIRTY        0x0004
+#if (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1)
+#define RFAT_VOLUME_FLAG_FAT_1_FIRST        0x0800   /* fat_cache[1] got dirty before fat_cache[0] */
+#endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1) */
 #else /* (RFAT_CONFIG_FAT_CACHE_ENTRIES > 1) */
 #define RFAT_VOLUME_FLAG_FAT_DIRTY          0x0002
 #endif /* (RFAT_CONFIG_FAT_CACHE_ENTRIES > 1) */
@@ -398,6 +481,10 @@ struct _rfat_cluster_entry_t {
 #define RFAT_VOLUME_FLAG_MOUNTED_DIRTY      0x0080
 #endif /* (RFAT_CONFIG_VOLUME_DIRTY_SUPPORTED == 1) */
 #define RFAT_VOLUME_FLAG_WRITE_PROTECTED    0x0100
+#if (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1)
+#define RFAT_VOLUME_FLAG_TRANSACTION        0x0200   /* within f_begin()/f_commit() */
+#define RFAT_VOLUME_FLAG_TRANSACTION_LOGGED 0x0400   /* log on disk covers the map, without directory updates */
+#endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1) */
 
 struct _rfat_volume_t {
     uint8_t                 state;
@@ -425,6 +512,9 @@ struct _rfat_volume_t {
     rfat_cache_entry_t      dir_cache;
 #if (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1)
     rfat_cache_entry_t      map_cache;
+#if (RFAT_CONFIG_MAP_RESOLVE_ENTRIES != 1)
+    uint8_t                 *map_data;                    /* RFAT_CONFIG_MAP_RESOLVE_ENTRIES blocks for rfat_map_cache_copy() */
+#endif /* (RFAT_CONFIG_MAP_RESOLVE_ENTRIES != 1) */
 #endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1) */
 #if (RFAT_CONFIG_FAT_CACHE_ENTRIES != 0)
 #if (RFAT_CONFIG_FAT_CACHE_ENTRIES == 1)
@@ -442,6 +532,21 @@ struct _rfat_volume_t {
 #if (RFAT_CONFIG_CLUSTER_CACHE_ENTRIES != 0)
     rfat_cluster_entry_t    cluster_cache[RFAT_CONFIG_CLUSTER_CACHE_ENTRIES];
 #endif /* (RFAT_CONFIG_CLUSTER_CACHE_ENTRIES != 0) */
+#if (RFAT_CONFIG_DEFERRED_RELEASE_ENTRIES != 0)
+    uint32_t                release_count;                /* number of queued cluster chains */
+    uint32_t                release_table[RFAT_CONFIG_DEFERRED_RELEASE_ENTRIES]; /* head clsno of queued chains */
+#endif /* (RFAT_CONFIG_DEFERRED_RELEASE_ENTRIES != 0) */
+#if (RFAT_CONFIG_WRITE_BUDGET_SUPPORTED == 1) && (RFAT_CONFIG_2NDFAT_SUPPORTED == 1) && (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0)
+    uint32_t                mirror_blkno;                 /* FAT1 blocks not yet copied to FAT2 (inclusive) */
+    uint32_t                mirror_blkno_e;               /* exclusive */
+#endif /* (RFAT_CONFIG_WRITE_BUDGET_SUPPORTED == 1) && (RFAT_CONFIG_2NDFAT_SUPPORTED == 1) && (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0) */
+#if (RFAT_CONFIG_WRITE_RESERVE_SIZE != 0)
+    rfat_file_t             *reserve_file;                /* owner of reserve_data between f_write_reserve() and f_write_commit() */
+    uint8_t                 reserve_data[RFAT_CONFIG_WRITE_RESERVE_SIZE];
+#endif /* (RFAT_CONFIG_WRITE_RESERVE_SIZE != 0) */
+#if (RFAT_CONFIG_TRANSFER_UNLOCK_SUPPORTED == 1)
+    uint32_t                transfer_count;               /* multi block transfers running without the core lock */
+#endif /* (RFAT_CONFIG_TRANSFER_UNLOCK_SUPPORTED == 1) */
 
     /* WORK AREA BELOW */
 
@@ -451,13 +556,16 @@ struct _rfat_volume_t {
     uint32_t                start_clsno;              /* first valid cluster for sequential/contiguous allocation */
     uint32_t                end_clsno;                /* last valid cluster for sequential/contiguous allocation */
 #if (RFAT_CONFIG_SEQUENTIAL_SUPPORTED == 1)
-    uint32_t                base_clsno;               /* bottom clsno for  next_clsno allocation unit (inclusive) */
+    uint32_t                base_clsno;               /* bottom clsno for  next_clsno allocation unit (inclusive), AU cursor for RFAT_CONFIG_MAX_FILES > 1 */
     uint32_t                limit_clsno;              /* top clsno for  next_clsno allocation unit (exclusive) */
     uint32_t                free_clsno;               /* first free clsno */
 #endif /* (RFAT_CONFIG_SEQUENTIAL_SUPPORTED == 1) */
 #endif /* (RFAT_CONFIG_SEQUENTIAL_SUPPORTED == 1) || (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1) */
 
 #if (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1)
+    uint32_t                group_clsno;              /* head of the chain allocated for the group file, RFAT_CLSNO_END_OF_CHAIN while pending */
+    uint32_t                group_dir_clsno;          /* directory entry of the file allocating clusters within f_begin()/f_commit() */
+    uint32_t                group_dir_index;          /* RFAT_GROUP_INDEX_NONE if there is no such file */
     uint8_t                 bs_data[90];
     uint8_t                 map_flags;
     uint8_t                 map_entries;
@@ -472,7 +580,7 @@ struct _rfat_volume_t {
     uint16_t                dir_index;
     uint32_t                dir_clsno;
     uint32_t                dot_clsno;                /* reserved for f_move() */
-    uint32_t                log_struct_sig;           /* 0x45563031 ("EV01") */
+    uint32_t                log_struct_sig;           /* 0x45563033 ("EV03") */
     uint32_t                del_clsno;
     uint16_t                del_index;
     uint8_t                 del_entries;
@@ -541,6 +649,12 @@ struct _rfat_volume_t {
 	uint32_t                cluster_cache_miss;
     }                       statistics;
 #endif /* (RFAT_CONFIG_STATISTICS == 1) */
+
+#if (RFAT_CONFIG_LOCK_STATISTICS_ENTRIES != 0)
+    F_LOCKSTAT              *lock_entry;
+    uint32_t                lock_stamp;
+    F_LOCKSTAT              lock_statistics[RFAT_CONFIG_LOCK_STATISTICS_ENTRIES];
+#endif /* (RFAT_CONFIG_LOCK_STATISTICS_ENTRIES != 0) */
 };
 
 /* The conversion from a linear offset/size to a clscnt is somewhat tricky.
@@ -578,6 +692,75 @@ struct _rfat_volume_t {
 #define RFAT_FIND_VOLUME(_find)  (&rfat_volume)
 #define RFAT_FILE_VOLUME(_file)  (&rfat_volume)
 
+/* rfat_file_writev() gathers a block that is made up from several vector entries
+ * in the data cache entry. That is not possible if the data cache is the directory
+ * cache, or if another task could fill the data cache entry while the block is
+ * being transferred without the volume lock.
+ */
+
+#if (RFAT_CONFIG_DATA_CACHE_ENTRIES != 0) && ((RFAT_CONFIG_FILE_DATA_CACHE == 1) || (RFAT_CONFIG_TRANSFER_UNLOCK_SUPPORTED == 0))
+#define RFAT_FILE_GATHER_SUPPORTED 1
+#else
+#define RFAT_FILE_GATHER_SUPPORTED 0
+#endif
+
+/* Data written to a file with RFAT_FILE_MODE_COMMIT or a commit policy needs a
+ * rfat_file_settle() afterwards, also if it was written without rfat_file_write().
+ */
+
+#if (RFAT_CONFIG_COMMIT_POLICY_SUPPORTED == 1)
+#define RFAT_FILE_SETTLE(_file)  (((_file)->mode & RFAT_FILE_MODE_COMMIT) || ((_file)->commit_policy != F_COMMIT_NONE))
+#else /* (RFAT_CONFIG_COMMIT_POLICY_SUPPORTED == 1) */
+#define RFAT_FILE_SETTLE(_file)  ((_file)->mode & RFAT_FILE_MODE_COMMIT)
+#endif /* (RFAT_CONFIG_COMMIT_POLICY_SUPPORTED == 1) */
+
+/* With a stream buffer attached, "file->position" lags behind the pending write
+ * data, or is ahead of the unconsumed read data. RFAT_FILE_POSITION()/RFAT_FILE_LENGTH()
+ * return the values as seen by the caller.
+ */
+
+#if (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1)
+
+#define RFAT_FILE_POSITION(_file)                                       \
+    ((_file)->stream_count                                              \
+     ? ((_file)->position - ((_file)->stream_count - (_file)->stream_index)) \
+     : ((_file)->position + (_file)->stream_index))
+
+#define RFAT_FILE_LENGTH(_file)                                         \
+    (((_file)->length < RFAT_FILE_POSITION(_file)) ? RFAT_FILE_POSITION(_file) : (_file)->length)
+
+/* RFAT_FILE_STREAM_LIMIT() is the number of bytes rfat_file_write() would still accept
+ * behind the pending write data, i.e. up to the reserved size of a contiguous file, or
+ * up to RFAT_FILE_SIZE_MAX. Data beyond that must not be taken into the stream buffer.
+ */
+#if (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1)
+#define RFAT_FILE_STREAM_LIMIT(_file)                                   \
+    (((_file)->flags & RFAT_FILE_FLAG_CONTIGUOUS)                       \
+     ? (((_file)->size > ((_file)->position + (_file)->stream_index))   \
+	? ((_file)->size - ((_file)->position + (_file)->stream_index)) : 0) \
+     : (RFAT_FILE_SIZE_MAX - ((_file)->position + (_file)->stream_index)))
+#else /* (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1) */
+#define RFAT_FILE_STREAM_LIMIT(_file)                                   \
+    (RFAT_FILE_SIZE_MAX - ((_file)->position + (_file)->stream_index))
+#endif /* (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1) */
+
+/* Write data can be appended to the stream buffer without the volume lock, if there
+ * is no read data, there is space left, the file can grow by that much, and the data
+ * would not be moved by RFAT_FILE_MODE_APPEND.
+ */
+#define RFAT_FILE_STREAM_WRITABLE(_file, _count)                        \
+    (((_file)->stream_count == 0) &&                                    \
+     ((_file)->stream_size - (_file)->stream_index >= (_count)) &&      \
+     (RFAT_FILE_STREAM_LIMIT(_file) >= (_count)) &&                     \
+     (!((_file)->mode & RFAT_FILE_MODE_APPEND) || ((_file)->position == (_file)->length)))
+
+#else /* (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1) */
+
+#define RFAT_FILE_POSITION(_file)  ((_file)->position)
+#define RFAT_FILE_LENGTH(_file)    ((_file)->length)
+
+#endif /* (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1) */
+
 #if (RFAT_CONFIG_STATISTICS == 1)
 
 #define RFAT_VOLUME_STATISTICS_COUNT(_name)       { volume->statistics._name += 1; }
@@ -590,13 +773,54 @@ struct _rfat_volume_t {
 
 #endif /* (RFAT_CONFIG_STATISTICS == 1) */
 
+/* The lock statistics are broken down by the f_* function that locks the volume.
+ * RFAT_VOLUME_LOCK_TIME_STAMP() is supplied by rfat_core.c, as it depends upon
+ * rfat_port.h.
+ */
+
+#if (RFAT_CONFIG_LOCK_STATISTICS_ENTRIES != 0)
+
+#define rfat_volume_lock(_volume)          rfat_volume_lock_function((_volume), __func__)
+#define rfat_volume_lock_noinit(_volume)   rfat_volume_lock_noinit_function((_volume), __func__)
+#define rfat_volume_lock_nomount(_volume)  rfat_volume_lock_nomount_function((_volume), __func__)
+
+#define RFAT_VOLUME_LOCK_STATISTICS_ACQUIRE(_function, _stamp)          \
+    {                                                                   \
+	uint32_t _now = RFAT_VOLUME_LOCK_TIME_STAMP();                  \
+	volume->lock_entry = rfat_lock_statistics_acquire(volume->lock_statistics, (_function), (_now - (_stamp))); \
+	volume->lock_stamp = _now;                                      \
+    }
+
+#define RFAT_VOLUME_LOCK_STATISTICS_RELEASE()                           \
+    {                                                                   \
+	uint32_t _now = RFAT_VOLUME_LOCK_TIME_STAMP();                  \
+	rfat_lock_statistics_release(volume->lock_entry, (_now - volume->lock_stamp)); \
+	volume->lock_stamp = _now;                                      \
+    }
+
+#else /* (RFAT_CONFIG_LOCK_STATISTICS_ENTRIES != 0) */
+
+#define rfat_volume_lock(_volume)          rfat_volume_lock_function((_volume), NULL)
+#define rfat_volume_lock_noinit(_volume)   rfat_volume_lock_noinit_function((_volume), NULL)
+#define rfat_volume_lock_nomount(_volume)  rfat_volume_lock_nomount_function((_volume), NULL)
+
+#define RFAT_VOLUME_LOCK_STATISTICS_ACQUIRE(_function, _stamp) /**/
+#define RFAT_VOLUME_LOCK_STATISTICS_RELEASE()                  /**/
+
+#endif /* (RFAT_CONFIG_LOCK_STATISTICS_ENTRIES != 0) */
+
 static int rfat_volume_init(rfat_volume_t *volume);
 static int rfat_volume_mount(rfat_volume_t *volume);
+static int rfat_volume_remount(rfat_volume_t *volume);
 static int rfat_volume_unmount(rfat_volume_t *volume);
-static int rfat_volume_lock(rfat_volume_t *volume);
-static int rfat_volume_lock_noinit(rfat_volume_t *volume);
-static int rfat_volume_lock_nomount(rfat_volume_t *volume);
+static int rfat_volume_lock_function(rfat_volume_t *volume, const char *function);
+static int rfat_volume_lock_noinit_function(rfat_volume_t *volume, const char *function);
+static int rfat_volume_lock_nomount_function(rfat_volume_t *volume, const char *function);
 static int rfat_volume_unlock(rfat_volume_t *volume, int status);
+#if (RFAT_CONFIG_TRANSFER_UNLOCK_SUPPORTED == 1)
+static void rfat_volume_transfer_begin(rfat_volume_t *volume);
+static int rfat_volume_transfer_end(rfat_volume_t *volume, int status);
+#endif /* (RFAT_CONFIG_TRANSFER_UNLOCK_SUPPORTED == 1) */
 static int rfat_volume_read(rfat_volume_t *volume, uint32_t address, uint8_t *data);
 static int rfat_volume_write(rfat_volume_t *volume, uint32_t address, const uint8_t *data);
 static int rfat_volume_zero(rfat_volume_t *volume, uint32_t address, uint32_t length, volatile uint8_t *p_status);
@@ -607,10 +831,26 @@ static int rfat_volume_fsinfo(rfat_volume_t *volume, uint32_t free_clscnt, uint3
 static int rfat_volume_dirty(rfat_volume_t *volume);
 static int rfat_volume_clean(rfat_volume_t *volume, int status_o);
 #else /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0) */
+static int rfat_volume_log(rfat_volume_t *volume);
 static int rfat_volume_record(rfat_volume_t *volume);
+static int rfat_volume_reclaim(rfat_volume_t *volume);
 static int rfat_volume_commit(rfat_volume_t *volume);
+static int rfat_volume_settle(rfat_volume_t *volume);
+static void rfat_volume_claim(rfat_volume_t *volume, rfat_file_t *file, uint32_t clsno);
 #endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0) */
+#if (RFAT_CONFIG_DEFERRED_RELEASE_ENTRIES != 0)
+static int rfat_volume_release(rfat_volume_t *volume, uint32_t clscnt);
+#endif /* (RFAT_CONFIG_DEFERRED_RELEASE_ENTRIES != 0) */
+#if (RFAT_CONFIG_WRITE_BUDGET_SUPPORTED == 1)
+#if (RFAT_CONFIG_2NDFAT_SUPPORTED == 1) && (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0)
+static int rfat_volume_mirror(rfat_volume_t *volume, uint32_t blkcnt);
+#endif /* (RFAT_CONFIG_2NDFAT_SUPPORTED == 1) && (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0) */
+static int rfat_volume_idle(rfat_volume_t *volume);
+#endif /* (RFAT_CONFIG_WRITE_BUDGET_SUPPORTED == 1) */
 static int rfat_volume_format(rfat_volume_t *volume);
+#if (RFAT_CONFIG_UNIT_PROBE_SUPPORTED == 1)
+static int rfat_volume_probe(rfat_volume_t *volume, uint32_t blkcnt, uint32_t *p_unit_size, uint32_t *p_page_size);
+#endif /* (RFAT_CONFIG_UNIT_PROBE_SUPPORTED == 1) */
 static int rfat_volume_erase(rfat_volume_t *volume);
 
 static int rfat_dir_cache_write(rfat_volume_t *volume);
@@ -623,7 +863,9 @@ static int rfat_dir_cache_flush(rfat_volume_t *volume);
 static int rfat_map_cache_fill(rfat_volume_t *volume, uint32_t page);
 static int rfat_map_cache_write(rfat_volume_t *volume, uint32_t blkno, const uint8_t *data);
 static int rfat_map_cache_read(rfat_volume_t *volume, uint32_t blkno, uint8_t *data);
+static int rfat_map_cache_store(rfat_volume_t *volume);
 static int rfat_map_cache_flush(rfat_volume_t *volume);
+static int rfat_map_cache_copy(rfat_volume_t *volume, uint32_t blkno, uint32_t blkcnt);
 static int rfat_map_cache_resolve(rfat_volume_t *volume);
 #endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1) */
 
@@ -632,6 +874,10 @@ static int rfat_fat_cache_fill(rfat_volume_t *volume, uint32_t blkno, rfat_cache
 static int rfat_fat_cache_read(rfat_volume_t *volume, uint32_t blkno, rfat_cache_entry_t **p_entry);
 static void rfat_fat_cache_modify(rfat_volume_t *volume, rfat_cache_entry_t *entry);
 static int rfat_fat_cache_flush(rfat_volume_t *volume);
+#if (RFAT_CONFIG_2NDFAT_SUPPORTED == 1) && (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0)
+static int rfat_fat_cache_mirror(rfat_volume_t *volume, uint32_t blkno, const uint8_t *data);
+#endif /* (RFAT_CONFIG_2NDFAT_SUPPORTED == 1) && (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 0) */
+static int rfat_fat_cache_zero(rfat_volume_t *volume, uint32_t blkno, uint32_t blkcnt);
 
 static int rfat_data_cache_write(rfat_volume_t *volume, rfat_file_t *file);
 static int rfat_data_cache_fill(rfat_volume_t *volume, rfat_file_t *file, uint32_t blkno, int zero);
@@ -639,19 +885,36 @@ static int rfat_data_cache_read(rfat_volume_t *volume, rfat_file_t *file, uint32
 static int rfat_data_cache_zero(rfat_volume_t *volume, rfat_file_t *file, uint32_t blkno, rfat_cache_entry_t ** p_entry);
 static void rfat_data_cache_modify(rfat_volume_t *volume, rfat_file_t *file);
 static int rfat_data_cache_flush(rfat_volume_t *volume, rfat_file_t *file);
+static rfat_cache_entry_t *rfat_data_cache_entry(rfat_volume_t *volume, rfat_file_t *file, int *p_dirty);
+#if (RFAT_FILE_GATHER_SUPPORTED == 1)
+static int rfat_data_cache_bounce(rfat_volume_t *volume, rfat_file_t *file, rfat_cache_entry_t ** p_entry);
+#endif /* (RFAT_FILE_GATHER_SUPPORTED == 1) */
 
 static int rfat_cluster_read_uncached(rfat_volume_t *volume, uint32_t clsno, uint32_t *p_clsdata);
 static int rfat_cluster_read(rfat_volume_t *volume, uint32_t clsno, uint32_t *p_clsdata);
 static int rfat_cluster_write(rfat_volume_t *volume, uint32_t clsno, uint32_t clsdata, int allocate);
 static int rfat_cluster_chain_seek(rfat_volume_t *volume, uint32_t clsno, uint32_t clscnt, uint32_t *p_clsno);
+#if (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1)
+static int rfat_cluster_chain_append(rfat_volume_t *volume, uint32_t clsno, uint32_t clsno_n);
+#endif /* (RFAT_CONFIG_TRANSACTION_SAFE_SUPPORTED == 1) */
 static int rfat_cluster_chain_create(rfat_volume_t *volume, uint32_t clsno, uint32_t clscnt, uint32_t *p_clsno_a, uint32_t *p_clsno_l);
 #if (RFAT_CONFIG_SEQUENTIAL_SUPPORTED == 1)
-static int rfat_cluster_chain_create_sequential(rfat_volume_t *volume, uint32_t clsno, uint32_t clscnt, uint32_t *p_clsno_a, uint32_t *p_clsno_l);
+static int rfat_cluster_chain_window(rfat_volume_t *volume, rfat_file_t *file, uint32_t aucnt, uint32_t *p_clsno_b, uint32_t *p_clsno_t, uint32_t *p_clsno_n);
+#if (RFAT_CONFIG_MAX_FILES > 1)
+static int rfat_cluster_chain_seed(rfat_volume_t *volume, rfat_file_t *file, uint32_t clsno_b, uint32_t clsno_s, uint32_t *p_clsno_b, uint32_t *p_clsno_t, uint32_t *p_clsno_n);
+#endif /* (RFAT_CONFIG_MAX_FILES > 1) */
+static int rfat_cluster_chain_create_sequential(rfat_volume_t *volume, rfat_file_t *file, uint32_t clsno, uint32_t clscnt, uint32_t *p_clsno_a, uint32_t *p_clsno_l);
 #endif /* (RFAT_CONFIG_SEQUENTIAL_SUPPORTED == 1) */
 #if (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1)
 static int rfat_cluster_chain_create_contiguous(rfat_volume_t *volume, uint32_t clscnt, uint32_t *p_clsno_a);
 #endif /* (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1) */
+static int rfat_cluster_chain_free(rfat_volume_t *volume, uint32_t clsno, uint32_t clsdata, uint32_t *p_clscnt, uint32_t *p_clsno);
 static int rfat_cluster_chain_destroy(rfat_volume_t *volume, uint32_t clsno, uint32_t clsdata);
+static int rfat_cluster_chain_discard(rfat_volume_t *volume, uint32_t clsno, uint32_t clsdata);
+#if (RFAT_CONFIG_DEFERRED_RELEASE_ENTRIES != 0)
+static int rfat_cluster_chain_defer(rfat_volume_t *volume, uint32_t clsno, uint32_t clsdata);
+static int rfat_cluster_chain_release(rfat_volume_t *volume, uint32_t clscnt);
+#endif /* (RFAT_CONFIG_DEFERRED_RELEASE_ENTRIES != 0) */
 
 static unsigned int rfat_name_ascii_upcase(unsigned int cc);
 #if (RFAT_CONFIG_VFAT_SUPPORTED == 0)
@@ -691,15 +954,43 @@ static int rfat_path_destroy_entry(rfat_volume_t *volume, uint32_t clsno, uint32
 static rfat_file_t *rfat_file_enumerate(rfat_volume_t *volume, rfat_file_t *file, uint32_t clsno, uint32_t index);
 static int rfat_file_sync(rfat_volume_t *volume, rfat_file_t *file, int access, int modify, uint32_t first_clsno, uint32_t length);
 static int rfat_file_flush(rfat_volume_t *volume, rfat_file_t *file, int close);
+static int rfat_file_datasync(rfat_volume_t *volume, rfat_file_t *file);
+static int rfat_file_settle(rfat_volume_t *volume, rfat_file_t *file);
+#if (RFAT_CONFIG_COMMIT_POLICY_SUPPORTED == 1)
+static uint32_t rfat_file_commit_mark(rfat_volume_t *volume, rfat_file_t *file);
+static int rfat_file_commit(rfat_volume_t *volume, rfat_file_t *file);
+#endif /* (RFAT_CONFIG_COMMIT_POLICY_SUPPORTED == 1) */
+#if (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1)
+static int rfat_file_stream_flush(rfat_volume_t *volume, rfat_file_t *file);
+static int rfat_file_stream_read(rfat_volume_t *volume, rfat_file_t *file, uint8_t *data, uint32_t count, uint32_t *p_count);
+static int rfat_file_stream_write(rfat_volume_t *volume, rfat_file_t *file, const uint8_t *data, uint32_t count, uint32_t *p_count);
+#endif /* (RFAT_CONFIG_STREAM_BUFFER_SUPPORTED == 1) */
 static int rfat_file_seek(rfat_volume_t *volume, rfat_file_t *file, uint32_t position);
 static int rfat_file_shrink(rfat_volume_t *volume, rfat_file_t *file);
 static int rfat_file_extend(rfat_volume_t *volume, rfat_file_t *file, uint32_t length);
 #if (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1)
 static int rfat_file_reserve(rfat_volume_t *volume, rfat_file_t *file, uint32_t size);
 #endif /* (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1) */
+static rfat_file_t *rfat_file_allocate(rfat_volume_t *volume);
+static void rfat_file_attach(rfat_volume_t *volume, rfat_file_t *file, uint32_t clsno, uint32_t index, rfat_dir_t *dir);
+static int rfat_file_setup(rfat_volume_t *volume, rfat_file_t *file, uint32_t mode, uint32_t size);
+static int rfat_file_mode(const char *type, uint32_t *p_mode, uint32_t *p_size);
 static int rfat_file_open(rfat_volume_t *volume, const char *filename, uint32_t mode, uint32_t size, rfat_file_t **p_file);
+static int rfat_file_open_find(rfat_volume_t *volume, F_FIND *find, uint32_t mode, uint32_t size, rfat_file_t **p_file);
 static int rfat_file_close(rfat_volume_t *volume, rfat_file_t *file);
+static int rfat_file_direct_check(rfat_file_t *file, uint32_t count, int write);
 static int rfat_file_read(rfat_volume_t *volume, rfat_file_t *file, uint8_t *data, uint32_t count, uint32_t *p_count);
 static int rfat_file_write(rfat_volume_t *volume, rfat_file_t *file, const uint8_t *data, uint32_t count, uint32_t *p_count);
+static int rfat_file_write_poll(rfat_volume_t *volume, rfat_file_t *file, uint32_t *p_count);
+static int rfat_file_sync_poll(rfat_volume_t *volume, rfat_file_t *file);
+static int rfat_file_writev(rfat_volume_t *volume, rfat_file_t *file, const F_IOVEC *iov, int iovcnt, uint32_t *p_count);
+static int rfat_file_prepare(rfat_volume_t *volume, rfat_file_t *file, uint32_t count, rfat_cache_entry_t **p_entry);
+#if (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1)
+static int rfat_ring_sync(rfat_volume_t *volume, F_RING *ring);
+static int rfat_ring_recover(rfat_volume_t *volume, F_RING *ring);
+static int rfat_ring_write(rfat_volume_t *volume, F_RING *ring, const uint8_t *data, uint32_t count, uint32_t *p_count);
+static int rfat_ring_read(rfat_volume_t *volume, F_RING *ring, uint8_t *data, uint32_t count, uint32_t *p_count);
+static int rfat_pool_name(F_POOL *pool, uint32_t sequence, char *filename);
+#endif /* (RFAT_CONFIG_CONTIGUOUS_SUPPORTED == 1) */
 
 #endif /* _RFAT_CORE_H */
@@ -29,6 +29,14 @@
 #include "rfat_disk.h"
 #include "rfat_port.h"
 
+#if (RFAT_CONFIG_LOCK_STATISTICS_ENTRIES != 0)
+#if defined(RFAT_PORT_DISK_TIME_STAMP)
+#define RFAT_DISK_LOCK_TIME_STAMP()  RFAT_PORT_DISK_TIME_STAMP()
+#else /* RFAT_PORT_DISK_TIME_STAMP */
+#define RFAT_DISK_LOCK_TIME_STAMP()  0
+#endif /* RFAT_PORT_DISK_TIME_STAMP */
+#endif /* (RFAT_CONFIG_LOCK_STATISTICS_ENTRIES != 0) */
+
 static rfat_disk_t rfat_disk;
 
 #if (RFAT_CONFIG_DISK_SIMULATE == 0)
@@ -44,9 +52,19 @@ static int rfat_disk_send_command(rfat_disk_t *disk, uint8_t index, const uint32
 static int rfat_disk_send_data(rfat_disk_t *disk, uint8_t token, const uint8_t *data, uint32_t count, unsigned int *p_retries);
 static int rfat_disk_receive_data(rfat_disk_t *disk, uint8_t *data, uint32_t count, unsigned int *p_retries);
 static int rfat_disk_reset(rfat_disk_t *disk);
-static int rfat_disk_lock(rfat_disk_t *disk, int state, uint32_t address);
+static int rfat_disk_serial(rfat_disk_t *disk, uint32_t *p_serial);
+static int rfat_disk_write_finish(rfat_disk_t *disk);
+static int rfat_disk_lock_function(rfat_disk_t *disk, int state, uint32_t address, const char *function);
 static int rfat_disk_unlock(rfat_disk_t *disk, int status);
 
+/* The lock statistics are broken down by the rfat_disk_* function that locks the disk.
+ */
+#if (RFAT_CONFIG_LOCK_STATISTICS_ENTRIES != 0)
+#define rfat_disk_lock(_disk, _state, _address)  rfat_disk_lock_function((_disk), (_state), (_address), __func__)
+#else /* (RFAT_CONFIG_LOCK_STATISTICS_ENTRIES != 0) */
+#define rfat_disk_lock(_disk, _state, _address)  rfat_disk_lock_function((_disk), (_state), (_address), NULL)
+#endif /* (RFAT_CONFIG_LOCK_STATISTICS_ENTRIES != 0) */
+
 
 #define SD_CMD_GO_IDLE_STATE           (0)
 #define SD_CMD_SEND_OP_COND            (1)
@@ -230,6 +248,13 @@ static int rfat_disk_wait_ready(rfat_disk_t *disk)
     int status = F_NO_ERROR;
     unsigned int n;
     uint8_t response;
+#if (RFAT_CONFIG_STATISTICS == 1) && defined(RFAT_PORT_DISK_TIME_STAMP)
+    uint32_t stamp = RFAT_PORT_DISK_TIME_STAMP();
+#endif /* (RFAT_CONFIG_STATISTICS == 1) && RFAT_PORT_DISK_TIME_STAMP */
+#if (RFAT_CONFIG_LOCK_STATISTICS_ENTRIES != 0) && defined(RFAT_PORT_DISK_YIELD)
+    const char *lock_function;
+    uint32_t lock_stamp;
+#endif /* (RFAT_CONFIG_LOCK_STATISTICS_ENTRIES != 0) && RFAT_PORT_DISK_YIELD */
 
     /* While waiting for non busy (not 0x00) the host can
      * release the CS line to let somebody else access the
@@ -248,6 +273,8 @@ static int rfat_disk_wait_ready(rfat_disk_t *disk)
     {
         response = RFAT_PORT_DISK_SPI_RECEIVE();
 
+	RFAT_DISK_STATISTICS_COUNT(disk_spi_busy);
+
         if (response == SD_READY_TOKEN)
         {
             break;
@@ -261,6 +288,8 @@ static int rfat_disk_wait_ready(rfat_disk_t *disk)
 	do
 	{
 	    response = RFAT_PORT_DISK_SPI_RECEIVE();
+
+	    RFAT_DISK_STATISTICS_COUNT(disk_spi_busy);
 	
 	    if (response != SD_READY_TOKEN)
 	    {
@@ -272,14 +301,28 @@ static int rfat_disk_wait_ready(rfat_disk_t *disk)
 #if defined(RFAT_PORT_DISK_YIELD)
 		RFAT_PORT_DISK_SPI_DESELECT();
 
+		RFAT_DISK_STATISTICS_COUNT(disk_spi_deselect);
+
+#if (RFAT_CONFIG_LOCK_STATISTICS_ENTRIES != 0)
+		lock_function = disk->lock_entry->function;
+#endif /* (RFAT_CONFIG_LOCK_STATISTICS_ENTRIES != 0) */
+
+		RFAT_DISK_LOCK_STATISTICS_RELEASE();
+
 		RFAT_PORT_DISK_UNLOCK();
 
+#if (RFAT_CONFIG_LOCK_STATISTICS_ENTRIES != 0)
+		lock_stamp = RFAT_DISK_LOCK_TIME_STAMP();
+#endif /* (RFAT_CONFIG_LOCK_STATISTICS_ENTRIES != 0) */
+
 		RFAT_PORT_DISK_YIELD();
 
 		status = RFAT_PORT_DISK_LOCK();
 
 		if (status == F_NO_ERROR)
 		{
+		    RFAT_DISK_LOCK_STATISTICS_ACQUIRE(lock_function, lock_stamp);
+
 		    RFAT_PORT_DISK_SPI_SELECT();
 		}
 #endif /* RFAT_PORT_DISK_SPI_YIELD */
@@ -303,6 +346,8 @@ static int rfat_disk_wait_ready(rfat_disk_t *disk)
 	for (n = 0; n < 256; n++)
 	{
 	    response = RFAT_PORT_DISK_SPI_RECEIVE();
+
+	    RFAT_DISK_STATISTICS_COUNT(disk_spi_busy);
 	    
 	    if (response == SD_READY_TOKEN)
 	    {
@@ -319,6 +364,10 @@ static int rfat_disk_wait_ready(rfat_disk_t *disk)
 
 #endif /* RFAT_PORT_DISK_TIME_START */
 
+#if (RFAT_CONFIG_STATISTICS == 1) && defined(RFAT_PORT_DISK_TIME_STAMP)
+    RFAT_DISK_STATISTICS_COUNT_N(disk_busy_time, (uint32_t)(RFAT_PORT_DISK_TIME_STAMP() - stamp));
+#endif /* (RFAT_CONFIG_STATISTICS == 1) && RFAT_PORT_DISK_TIME_STAMP */
+
     disk->flags &= ~RFAT_DISK_FLAG_COMMAND_SUBSEQUENT;
 
     if (response != SD_READY_TOKEN)
@@ -374,6 +423,8 @@ static int rfat_disk_send_command(rfat_disk_t *disk, uint8_t index, const uint32
 	if (disk->flags & RFAT_DISK_FLAG_COMMAND_SUBSEQUENT)
 	{
 	    RFAT_PORT_DISK_SPI_RECEIVE();
+
+	    RFAT_DISK_STATISTICS_COUNT(disk_spi_command);
 	}
 
 	disk->flags |= RFAT_DISK_FLAG_COMMAND_SUBSEQUENT;
@@ -385,6 +436,8 @@ static int rfat_disk_send_command(rfat_disk_t *disk, uint8_t index, const uint32
 	RFAT_PORT_DISK_SPI_SEND(data[4]);
 	RFAT_PORT_DISK_SPI_SEND(crc7);
 
+	RFAT_DISK_STATISTICS_COUNT_N(disk_spi_command, 6);
+
 	/* NCR is 1..8 bytes, so simply always discard the first byte,
 	 * and then read up to 8 bytes or till a vaild response
 	 * was seen. N.b that STOP_TRANSMISSION specifies that
@@ -395,9 +448,13 @@ static int rfat_disk_send_command(rfat_disk_t *disk, uint8_t index, const uint32
 
 	RFAT_PORT_DISK_SPI_RECEIVE();
 
+	RFAT_DISK_STATISTICS_COUNT(disk_spi_response);
+
 	for (n = 0; n < 8; n++)
 	{
 	    response = RFAT_PORT_DISK_SPI_RECEIVE();
+
+	    RFAT_DISK_STATISTICS_COUNT(disk_spi_response);
         
 	    if (!(response & 0x80))
 	    {
@@ -467,6 +524,7 @@ static int rfat_disk_send_command(rfat_disk_t *disk, uint8_t index, const uint32
 
 		disk->flags &= ~RFAT_DISK_FLAG_COMMAND_SUBSEQUENT;
 
+		RFAT_DISK_STATISTICS_COUNT(disk_spi_deselect);
 		RFAT_DISK_STATISTICS_COUNT(disk_send_command_retry);
 		    
 		retries--;
@@ -489,6 +547,8 @@ static int rfat_disk_send_command(rfat_disk_t *disk, uint8_t index, const uint32
 		disk->response[n] = RFAT_PORT_DISK_SPI_RECEIVE();
 	    } 
 
+	    RFAT_DISK_STATISTICS_COUNT_N(disk_spi_response, count);
+
 	    if (response != 0x00)
 	    {
 		if (disk->state != RFAT_DISK_STATE_RESET)
@@ -517,13 +577,17 @@ static int rfat_disk_send_data(rfat_disk_t *disk, uint8_t token, const uint8_t *
     uint8_t response;
 #if !defined(RFAT_PORT_DISK_SPI_SEND_BLOCK)
     unsigned int n;
-    uint32_t crc16
+    uint32_t crc16;
 #endif /* !RFAT_PORT_DISK_SPI_SEND_BLOCK */
 
     RFAT_DISK_STATISTICS_COUNT(disk_send_data);
 
     RFAT_PORT_DISK_SPI_SEND(token);
 
+    RFAT_DISK_STATISTICS_COUNT(disk_spi_token);
+    RFAT_DISK_STATISTICS_COUNT_N(disk_spi_data, count);
+    RFAT_DISK_STATISTICS_COUNT_N(disk_spi_crc, 2);
+
 #if defined(RFAT_PORT_DISK_SPI_SEND_BLOCK)
 
     RFAT_PORT_DISK_SPI_SEND_BLOCK(data);
@@ -555,6 +619,8 @@ static int rfat_disk_send_data(rfat_disk_t *disk, uint8_t token, const uint8_t *
 
     response = RFAT_PORT_DISK_SPI_RECEIVE() & SD_DATA_RESPONSE_MASK;
 
+    RFAT_DISK_STATISTICS_COUNT(disk_spi_token);
+
     if (response == SD_DATA_RESPONSE_ACCEPTED)
     {
 	retries = 0;
@@ -578,6 +644,8 @@ static int rfat_disk_send_data(rfat_disk_t *disk, uint8_t token, const uint8_t *
 	RFAT_PORT_DISK_SPI_DESELECT();
 	
 	RFAT_PORT_DISK_SPI_SELECT();
+
+	RFAT_DISK_STATISTICS_COUNT(disk_spi_deselect);
 	
 	status = rfat_disk_wait_ready(disk);
 
@@ -711,6 +779,8 @@ static int rfat_disk_receive_data(rfat_disk_t *disk, uint8_t *data, uint32_t cou
         {
             break;
         }
+
+	RFAT_DISK_STATISTICS_COUNT(disk_spi_response);
     }
 
     if (token == SD_READY_TOKEN)
@@ -723,6 +793,8 @@ static int rfat_disk_receive_data(rfat_disk_t *disk, uint8_t *data, uint32_t cou
 	    
 	    if (token == SD_READY_TOKEN)
 	    {
+		RFAT_DISK_STATISTICS_COUNT(disk_spi_response);
+
 		if (RFAT_PORT_DISK_TIME_ELAPSED(100))
 		{
 		    break;
@@ -752,6 +824,8 @@ static int rfat_disk_receive_data(rfat_disk_t *disk, uint8_t *data, uint32_t cou
 	    {
 		break;
 	    }
+
+	    RFAT_DISK_STATISTICS_COUNT(disk_spi_response);
 	}
 
 	if (token == SD_READY_TOKEN)
@@ -763,6 +837,8 @@ static int rfat_disk_receive_data(rfat_disk_t *disk, uint8_t *data, uint32_t cou
 
 #endif /* RFAT_PORT_DISK_TIME_START */
 
+    RFAT_DISK_STATISTICS_COUNT(disk_spi_token);
+
     if (token != SD_START_READ_TOKEN)
     {
 	/* On an invalid token a toggle of the CS signal
@@ -774,6 +850,8 @@ static int rfat_disk_receive_data(rfat_disk_t *disk, uint8_t *data, uint32_t cou
 	RFAT_PORT_DISK_SPI_DESELECT();
 	
 	RFAT_PORT_DISK_SPI_SELECT();
+
+	RFAT_DISK_STATISTICS_COUNT(disk_spi_deselect);
 	
 	disk->flags &= ~RFAT_DISK_FLAG_COMMAND_SUBSEQUENT;
 	
@@ -822,6 +900,9 @@ static int rfat_disk_receive_data(rfat_disk_t *disk, uint8_t *data, uint32_t cou
     }
     else
     {
+	RFAT_DISK_STATISTICS_COUNT_N(disk_spi_data, count);
+	RFAT_DISK_STATISTICS_COUNT_N(disk_spi_crc, 2);
+
 #if (RFAT_CONFIG_DISK_CRC == 1)
 
 #if defined(RFAT_PORT_DISK_SPI_RECEIVE_BLOCK)
@@ -857,6 +938,8 @@ static int rfat_disk_receive_data(rfat_disk_t *disk, uint8_t *data, uint32_t cou
 
 	    RFAT_PORT_DISK_SPI_SELECT();
 
+	    RFAT_DISK_STATISTICS_COUNT(disk_spi_deselect);
+
 	    disk->flags &= ~RFAT_DISK_FLAG_COMMAND_SUBSEQUENT;
 	
 	    status = rfat_disk_send_command(disk, SD_CMD_STOP_TRANSMISSION, 0, 0);
@@ -980,6 +1063,8 @@ static int rfat_disk_reset(rfat_disk_t *disk)
 		RFAT_PORT_DISK_SPI_RECEIVE();
 	    }
 
+	    RFAT_DISK_STATISTICS_COUNT_N(disk_spi_busy, 1024);
+
 	    rfat_disk_send_command(disk, SD_CMD_GO_IDLE_STATE, 0, 0);
 	}
 
@@ -1082,6 +1167,8 @@ static int rfat_disk_reset(rfat_disk_t *disk)
 			    {
 				RFAT_PORT_DISK_SPI_RECEIVE();
 			    }
+
+			    RFAT_DISK_STATISTICS_COUNT_N(disk_spi_busy, (64 - 2 * 9));
 			    
 			    cycles += 512;
 			}
@@ -1171,7 +1258,6 @@ static int rfat_disk_reset(rfat_disk_t *disk)
 static int rfat_disk_write_stop(rfat_disk_t *disk)
 {
     int status = F_NO_ERROR;
-    uint8_t response;
 
     status = rfat_disk_wait_ready(disk);
     
@@ -1183,76 +1269,103 @@ static int rfat_disk_write_stop(rfat_disk_t *disk)
 	 */
 	
 	RFAT_PORT_DISK_SPI_SEND(SD_STOP_TRANSMISSION_TOKEN);
-	
-	status = rfat_disk_wait_ready(disk);
 
-	if (status == F_NO_ERROR)
-	{
-	    /* Here it's getting a tad interesting. The spec says that
-	     * an error that occured after the STOP_TRANSMISSION_TOKEN
-	     * occured will be forwarded to the next command. So here
-	     * one really has to send a CMD_SEND_STATUS to find out.
-	     *
-	     * But there is the chance that the STOP_TRANSMISSION_TOKEN
-	     * was lost. If so, the CMD_SEND_STATUS will transition to BUSY
-	     * state. When this is detected, one has to wait for READY and
-	     * then reissue CMD_SEND_STATUS.
-	     */
+	RFAT_DISK_STATISTICS_COUNT(disk_spi_token);
+
+	disk->state = RFAT_DISK_STATE_WRITE_STOP;
+
+	status = rfat_disk_write_finish(disk);
+    }
+    else
+    {
+	disk->p_status = NULL;
+    }
+
+    return status;
+}
+
+/*
+ * int rfat_disk_write_finish(rfat_disk_t *disk)
+ *
+ * Complete a RFAT_DISK_STATE_WRITE_STOP, i.e. wait for the card to finish
+ * programming after the "Stop Transfer Token" and collect the status.
+ */
+
+static int rfat_disk_write_finish(rfat_disk_t *disk)
+{
+    int status = F_NO_ERROR;
+    uint8_t response;
+
+    status = rfat_disk_wait_ready(disk);
+
+    if (status == F_NO_ERROR)
+    {
+	/* Here it's getting a tad interesting. The spec says that
+	 * an error that occured after the STOP_TRANSMISSION_TOKEN
+	 * occured will be forwarded to the next command. So here
+	 * one really has to send a CMD_SEND_STATUS to find out.
+	 *
+	 * But there is the chance that the STOP_TRANSMISSION_TOKEN
+	 * was lost. If so, the CMD_SEND_STATUS will transition to BUSY
+	 * state. When this is detected, one has to wait for READY and
+	 * then reissue CMD_SEND_STATUS.
+	 */
 	    
-	    status = rfat_disk_send_command(disk, SD_CMD_SEND_STATUS, 0, 1);
+	status = rfat_disk_send_command(disk, SD_CMD_SEND_STATUS, 0, 1);
 	    
-	    if (status == F_NO_ERROR)
-	    {
-		response = RFAT_PORT_DISK_SPI_RECEIVE();
+	if (status == F_NO_ERROR)
+	{
+	    response = RFAT_PORT_DISK_SPI_RECEIVE();
+
+	    RFAT_DISK_STATISTICS_COUNT(disk_spi_busy);
 		
-		disk->flags &= ~RFAT_DISK_FLAG_COMMAND_SUBSEQUENT;
+	    disk->flags &= ~RFAT_DISK_FLAG_COMMAND_SUBSEQUENT;
 		
-		if (response != SD_READY_TOKEN)
-		{
-		    status = rfat_disk_wait_ready(disk);
+	    if (response != SD_READY_TOKEN)
+	    {
+		status = rfat_disk_wait_ready(disk);
 		    
-		    if (status == F_NO_ERROR)
-		    {
-			status = rfat_disk_send_command(disk, SD_CMD_SEND_STATUS, 0, 1);
-		    }
+		if (status == F_NO_ERROR)
+		{
+		    status = rfat_disk_send_command(disk, SD_CMD_SEND_STATUS, 0, 1);
 		}
 	    }
+	}
 	    
-	    if (status == F_NO_ERROR)
-	    {
-		disk->state = RFAT_DISK_STATE_READY;
+	if (status == F_NO_ERROR)
+	{
+	    disk->state = RFAT_DISK_STATE_READY;
 
-		if (disk->response[1] != 0x00)
+	    if (disk->response[1] != 0x00)
+	    {
+		if (disk->response[1] & (SD_R2_CARD_IS_LOCKED | SD_R2_WP_ERASE_SKIP | SD_R2_CC_ERROR | SD_R2_ERASE_PARAM))
+		{
+		    status = F_ERR_ONDRIVE;
+		}
+		else
 		{
-		    if (disk->response[1] & (SD_R2_CARD_IS_LOCKED | SD_R2_WP_ERASE_SKIP | SD_R2_CC_ERROR | SD_R2_ERASE_PARAM))
+		    if (disk->response[1] & (SD_R2_EXECUTION_ERROR | SD_R2_OUT_OF_RANGE))
 		    {
 			status = F_ERR_ONDRIVE;
 		    }
+		    else if (disk->response[1] & SD_R2_WP_VIOLATION)
+		    {
+			status = F_ERR_WRITEPROTECT;
+		    }
 		    else
 		    {
-			if (disk->response[1] & (SD_R2_EXECUTION_ERROR | SD_R2_OUT_OF_RANGE))
-			{
-			    status = F_ERR_ONDRIVE;
-			}
-			else if (disk->response[1] & SD_R2_WP_VIOLATION)
-			{
-			    status = F_ERR_WRITEPROTECT;
-			}
-			else
-			{
-			    /* CARD_ECC_FAILED */
-			    status = F_ERR_INVALIDSECTOR;
-			}
+			/* CARD_ECC_FAILED */
+			status = F_ERR_INVALIDSECTOR;
+		    }
 			
-			if (disk->p_status != NULL)
+		    if (disk->p_status != NULL)
+		    {
+			if (*disk->p_status == F_NO_ERROR)
 			{
-			    if (*disk->p_status == F_NO_ERROR)
-			    {
-				*disk->p_status = status;
-			    }
-			    
-			    status = F_NO_ERROR;
+			    *disk->p_status = status;
 			}
+			    
+			status = F_NO_ERROR;
 		    }
 		}
 	    }
@@ -1265,15 +1378,18 @@ static int rfat_disk_write_stop(rfat_disk_t *disk)
 }
 
 /* 
- * int rfat_disk_lock(rfat_disk_t *disk, int state, uint32_t address)
+ * int rfat_disk_lock_function(rfat_disk_t *disk, int state, uint32_t address, const char *function)
  *
  * Lock the disk device, pull CS low, and process "state" (READY, READ, WRITE).
  * Unless there is an error, the disk will be in READY state, locked and selected.
  */
 
-static int rfat_disk_lock(rfat_disk_t *disk, int state, uint32_t address)
+static int rfat_disk_lock_function(rfat_disk_t *disk, int state, uint32_t address, const char *function)
 {
     int status = F_NO_ERROR;
+#if (RFAT_CONFIG_LOCK_STATISTICS_ENTRIES != 0)
+    uint32_t stamp = RFAT_DISK_LOCK_TIME_STAMP();
+#endif /* (RFAT_CONFIG_LOCK_STATISTICS_ENTRIES != 0) */
 
 #if defined(RFAT_PORT_DISK_LOCK)
     status = RFAT_PORT_DISK_LOCK();
@@ -1281,6 +1397,8 @@ static int rfat_disk_lock(rfat_disk_t *disk, int state, uint32_t address)
     if (status == F_NO_ERROR)
 #endif /* RFAT_PORT_DISK_LOCK */
     {
+	RFAT_DISK_LOCK_STATISTICS_ACQUIRE(function, stamp);
+
 	disk->flags &= ~RFAT_DISK_FLAG_COMMAND_SUBSEQUENT;
 	    
 	if (disk->state == RFAT_DISK_STATE_RESET)
@@ -1323,6 +1441,11 @@ static int rfat_disk_lock(rfat_disk_t *disk, int state, uint32_t address)
 		    {
 			status = rfat_disk_write_stop(disk);
 		    }
+
+		    if (disk->state == RFAT_DISK_STATE_WRITE_STOP)
+		    {
+			status = rfat_disk_write_finish(disk);
+		    }
 		}
 	    }
 	}
@@ -1341,14 +1464,31 @@ static int rfat_disk_unlock(rfat_disk_t *disk, int status)
     if (disk->state != RFAT_DISK_STATE_RESET)
     {
 	RFAT_PORT_DISK_SPI_DESELECT();
+
+	RFAT_DISK_STATISTICS_COUNT(disk_spi_deselect);
     }
     
     if (status == F_ERR_ONDRIVE)
     {
 	disk->state = RFAT_DISK_STATE_RESET;
 	disk->speed = RFAT_PORT_DISK_SPI_MODE(RFAT_DISK_MODE_NONE);
+
+	/* A transfer that failed because the SDCARD got pulled is reported as
+	 * such, so that the volume gets remounted once it is back.
+	 */
+	if (!RFAT_PORT_DISK_SPI_PRESENT())
+	{
+	    status = F_ERR_CARDREMOVED;
+	}
     }
 
+#if (RFAT_CONFIG_LOCK_STATISTICS_ENTRIES != 0)
+    if (status != F_ERR_BUSY)
+    {
+	RFAT_DISK_LOCK_STATISTICS_RELEASE();
+    }
+#endif /* (RFAT_CONFIG_LOCK_STATISTICS_ENTRIES != 0) */
+
 #if defined(RFAT_PORT_DISK_UNLOCK)
     if (status != F_ERR_BUSY)
     {
@@ -1409,6 +1549,46 @@ int rfat_disk_release(rfat_disk_t *disk)
     return status;
 }
 
+/*
+ * int rfat_disk_serial(rfat_disk_t *disk, uint32_t *p_serial)
+ *
+ * Read the product serial number (PSN) from the CID.
+ */
+
+static int rfat_disk_serial(rfat_disk_t *disk, uint32_t *p_serial)
+{
+    int status = F_NO_ERROR;
+    unsigned int retries;
+    uint8_t data[16];
+
+#if (RFAT_CONFIG_DISK_CRC == 1) && (RFAT_CONFIG_DISK_DATA_RETRIES != 0)
+    retries = RFAT_CONFIG_DISK_DATA_RETRIES +1;
+#else /* (RFAT_CONFIG_DISK_CRC == 1) && (RFAT_CONFIG_DISK_DATA_RETRIES != 0) */
+    retries = 0;
+#endif /* (RFAT_CONFIG_DISK_CRC == 1) && (RFAT_CONFIG_DISK_DATA_RETRIES != 0) */
+
+    do
+    {
+	status = rfat_disk_send_command(disk, SD_CMD_SEND_CID, 0, 0);
+
+	if (status == F_NO_ERROR)
+	{
+	    status = rfat_disk_receive_data(disk, data, 16, &retries);
+
+	    if ((status == F_NO_ERROR) && !retries)
+	    {
+		*p_serial = (((uint32_t)data[9]  << 24) |
+			     ((uint32_t)data[10] << 16) |
+			     ((uint32_t)data[11] <<  8) |
+			     ((uint32_t)data[12] <<  0));
+	    }
+	}
+    } 
+    while ((status == F_NO_ERROR) && retries);
+
+    return status;
+}
+
 int rfat_disk_info(rfat_disk_t *disk, bool *p_write_protected, uint32_t *p_block_count, uint32_t *p_au_size, uint32_t *p_serial)
 {
     int status = F_NO_ERROR;
@@ -1540,31 +1720,41 @@ int rfat_disk_info(rfat_disk_t *disk, bool *p_write_protected, uint32_t *p_block
 
 	if (status == F_NO_ERROR)
 	{
-#if (RFAT_CONFIG_DISK_CRC == 1) && (RFAT_CONFIG_DISK_DATA_RETRIES != 0)
-	    retries = RFAT_CONFIG_DISK_DATA_RETRIES +1;
-#else /* (RFAT_CONFIG_DISK_CRC == 1) && (RFAT_CONFIG_DISK_DATA_RETRIES != 0) */
-	    retries = 0;
-#endif /* (RFAT_CONFIG_DISK_CRC == 1) && (RFAT_CONFIG_DISK_DATA_RETRIES != 0) */
+	    status = rfat_disk_serial(disk, p_serial);
+	}
 
-	    do
-	    {
-		status = rfat_disk_send_command(disk, SD_CMD_SEND_CID, 0, 0);
+	status = rfat_disk_unlock(disk, status);
+    }
 
-		if (status == F_NO_ERROR)
-		{
-		    status = rfat_disk_receive_data(disk, data, 16, &retries);
+    return status;
+}
 
-		    if ((status == F_NO_ERROR) && !retries)
-		    {
-			*p_serial = (((uint32_t)data[9]  << 24) |
-				     ((uint32_t)data[10] << 16) |
-				     ((uint32_t)data[11] <<  8) |
-				     ((uint32_t)data[12] <<  0));
-		    }
-		}
-	    } 
-	    while ((status == F_NO_ERROR) && retries);
+/*
+ * int rfat_disk_identify(rfat_disk_t *disk, bool *p_write_protected, uint32_t *p_serial)
+ *
+ * The subset of rfat_disk_info() needed to tell whether a reinserted SDCARD
+ * is the one that was removed. Only the CID is read, CSD and SD_STATUS are
+ * skipped. Hence "*p_write_protected" reflects only the write protect switch.
+ */
+
+int rfat_disk_identify(rfat_disk_t *disk, bool *p_write_protected, uint32_t *p_serial)
+{
+    int status = F_NO_ERROR;
+
+    status = rfat_disk_lock(disk, RFAT_DISK_STATE_READY, 0);
+
+    if (status == F_NO_ERROR)
+    {
+	*p_write_protected = false;
+
+#if defined(RFAT_PORT_DISK_SPI_WRITE_PROTECTED)
+	if (RFAT_PORT_DISK_SPI_WRITE_PROTECTED())
+	{
+	    *p_write_protected = true;
 	}
+#endif /* RFAT_PORT_DISK_SPI_WRITE_PROTECTED */
+
+	status = rfat_disk_serial(disk, p_serial);
 
 	status = rfat_disk_unlock(disk, status);
     }
@@ -1693,6 +1883,8 @@ int rfat_disk_write(rfat_disk_t *disk, uint32_t address, const uint8_t *data)
 		 * the Start Block Token.
 		 */
 		RFAT_PORT_DISK_SPI_RECEIVE();
+
+		RFAT_DISK_STATISTICS_COUNT(disk_spi_command);
 		    
 		status = rfat_disk_send_data(disk, SD_START_WRITE_SINGLE_TOKEN, data, RFAT_BLK_SIZE, &retries);
 	    }
@@ -1768,6 +1960,8 @@ int rfat_disk_write_sequential(rfat_disk_t *disk, uint32_t address, uint32_t len
 			 * the Start Block Token.
 			 */
 			RFAT_PORT_DISK_SPI_RECEIVE();
+
+			RFAT_DISK_STATISTICS_COUNT(disk_spi_command);
 			
 			disk->state = RFAT_DISK_STATE_WRITE_SEQUENTIAL;
 			disk->address = 0;
@@ -1894,7 +2088,7 @@ int rfat_disk_sync(rfat_disk_t *disk, volatile uint8_t *p_status)
 {
     int status = F_NO_ERROR;
 
-    if ((disk->state == RFAT_DISK_STATE_WRITE_SEQUENTIAL) && ((p_status == NULL) || (p_status == disk->p_status)))
+    if (((disk->state == RFAT_DISK_STATE_WRITE_SEQUENTIAL) || (disk->state == RFAT_DISK_STATE_WRITE_STOP)) && ((p_status == NULL) || (p_status == disk->p_status)))
     {
 	status = rfat_disk_lock(disk, RFAT_DISK_STATE_READY, 0);
 
@@ -1907,6 +2101,95 @@ int rfat_disk_sync(rfat_disk_t *disk, volatile uint8_t *p_status)
     return status;
 }
 
+/*
+ * int rfat_disk_poll(rfat_disk_t *disk, uint32_t address, bool *p_busy)
+ *
+ * Advance an outstanding multi block write without waiting for the card.
+ * If the card is still busy programming, return with "*p_busy" set. Once
+ * it is ready, a RFAT_DISK_STATE_WRITE_SEQUENTIAL is ended by sending the
+ * "Stop Transfer Token" (RFAT_DISK_STATE_WRITE_STOP), and on a later call
+ * the status is collected, which moves the disk to RFAT_DISK_STATE_READY.
+ * If "address" is the next block of the multi block write, it is left open
+ * instead, so that the following rfat_disk_write_sequential() for "address"
+ * does not wait. RFAT_DISK_ADDRESS_NONE always ends the multi block write.
+ */
+
+int rfat_disk_poll(rfat_disk_t *disk, uint32_t address, bool *p_busy)
+{
+    int status = F_NO_ERROR;
+    uint8_t response;
+#if (RFAT_CONFIG_LOCK_STATISTICS_ENTRIES != 0)
+    uint32_t stamp = RFAT_DISK_LOCK_TIME_STAMP();
+#endif /* (RFAT_CONFIG_LOCK_STATISTICS_ENTRIES != 0) */
+
+    *p_busy = false;
+
+    if ((disk->state == RFAT_DISK_STATE_WRITE_SEQUENTIAL) || (disk->state == RFAT_DISK_STATE_WRITE_STOP))
+    {
+#if defined(RFAT_PORT_DISK_LOCK)
+	status = RFAT_PORT_DISK_LOCK();
+
+	if (status == F_NO_ERROR)
+#endif /* RFAT_PORT_DISK_LOCK */
+	{
+	    RFAT_DISK_LOCK_STATISTICS_ACQUIRE(__func__, stamp);
+
+	    RFAT_PORT_DISK_SPI_SELECT();
+
+	    /* There needs to be one clock cycle after driving CS to L,
+	     * before DO is valid again. Hence sample the second byte.
+	     */
+	    RFAT_PORT_DISK_SPI_RECEIVE();
+
+	    response = RFAT_PORT_DISK_SPI_RECEIVE();
+
+	    RFAT_DISK_STATISTICS_COUNT_N(disk_spi_busy, 2);
+
+	    disk->flags &= ~RFAT_DISK_FLAG_COMMAND_SUBSEQUENT;
+
+	    if (response != SD_READY_TOKEN)
+	    {
+		*p_busy = true;
+	    }
+	    else
+	    {
+		if (disk->state == RFAT_DISK_STATE_WRITE_SEQUENTIAL)
+		{
+		    if (disk->address == address)
+		    {
+			/* Continuation of the multi block write ... */
+		    }
+		    else
+		    {
+			/* The 8 clocks before the "Stop Transfer Token" are covered by
+			 * the sampling above, the 8 clocks after it are sent here.
+			 */
+			RFAT_PORT_DISK_SPI_SEND(SD_STOP_TRANSMISSION_TOKEN);
+
+			RFAT_DISK_STATISTICS_COUNT(disk_spi_token);
+
+			RFAT_PORT_DISK_SPI_RECEIVE();
+
+			RFAT_DISK_STATISTICS_COUNT(disk_spi_busy);
+
+			disk->state = RFAT_DISK_STATE_WRITE_STOP;
+
+			*p_busy = true;
+		    }
+		}
+		else
+		{
+		    status = rfat_disk_write_finish(disk);
+		}
+	    }
+
+	    status = rfat_disk_unlock(disk, status);
+	}
+    }
+
+    return status;
+}
+
 #else /* (RFAT_CONFIG_DISK_SIMULATE == 0) */
 
 /********************************************************************************************************************************************/
@@ -2053,6 +2336,23 @@ int rfat_disk_info(rfat_disk_t *disk, bool *p_write_protected, uint32_t *p_block
     return status;
 }
 
+int rfat_disk_identify(rfat_disk_t *disk, bool *p_write_protected, uint32_t *p_serial)
+{
+    int status = F_NO_ERROR;
+
+    status = rfat_disk_lock(disk, RFAT_DISK_STATE_READY, 0);
+
+    if (status == F_NO_ERROR)
+    {
+	*p_write_protected = false;
+	*p_serial = 0;
+
+	status = rfat_disk_unlock(disk, status);
+    }
+
+    return status;
+}
+
 int rfat_disk_read(rfat_disk_t *disk, uint32_t address, uint8_t *data)
 {
     int status = F_NO_ERROR;
@@ -2171,7 +2471,7 @@ int rfat_disk_sync(rfat_disk_t *disk, volatile uint8_t *p_status)
 {
     int status = F_NO_ERROR;
 
-    if ((disk->state == RFAT_DISK_STATE_WRITE_SEQUENTIAL) && ((p_status == NULL) || (p_status == disk->p_status)))
+    if (((disk->state == RFAT_DISK_STATE_WRITE_SEQUENTIAL) || (disk->state == RFAT_DISK_STATE_WRITE_STOP)) && ((p_status == NULL) || (p_status == disk->p_status)))
     {
 	status = rfat_disk_lock(disk, RFAT_DISK_STATE_READY, 0);
 
@@ -2184,4 +2484,224 @@ int rfat_disk_sync(rfat_disk_t *disk, volatile uint8_t *p_status)
     return status;
 }
 
+int rfat_disk_poll(rfat_disk_t *disk, uint32_t address, bool *p_busy)
+{
+    int status = F_NO_ERROR;
+
+    *p_busy = false;
+
+    /* Walk through the same states as the real driver, with the card
+     * being ready on each call.
+     */
+
+    if ((disk->state == RFAT_DISK_STATE_WRITE_SEQUENTIAL) && (disk->address != address))
+    {
+#if (RFAT_CONFIG_DISK_SIMULATE_TRACE == 1)
+	printf("DISK_WRITE_STOP\n");
+#endif /* (RFAT_CONFIG_DISK_SIMULATE_TRACE == 1) */
+
+	disk->state = RFAT_DISK_STATE_WRITE_STOP;
+
+	*p_busy = true;
+    }
+    else if (disk->state == RFAT_DISK_STATE_WRITE_STOP)
+    {
+	disk->state = RFAT_DISK_STATE_READY;
+    }
+
+    return status;
+}
+
 #endif /* (RFAT_CONFIG_DISK_SIMULATE == 0) */
+
+#if (RFAT_CONFIG_STATISTICS == 1)
+
+/*
+ * void rfat_disk_bus_statistics(rfat_disk_t *disk, F_BUSSTAT *pstat, bool reset)
+ *
+ * Report the number of bytes clocked over the SPI bus, broken down by
+ * what they were used for. Bytes clocked by RFAT_PORT_DISK_SPI_MODE()
+ * are not accounted for.
+ */
+
+void rfat_disk_bus_statistics(rfat_disk_t *disk, F_BUSSTAT *pstat, bool reset)
+{
+    pstat->command   = disk->statistics.disk_spi_command;
+    pstat->response  = disk->statistics.disk_spi_response;
+    pstat->data      = disk->statistics.disk_spi_data;
+    pstat->crc       = disk->statistics.disk_spi_crc;
+    pstat->token     = disk->statistics.disk_spi_token;
+    pstat->busy      = disk->statistics.disk_spi_busy;
+    pstat->deselect  = disk->statistics.disk_spi_deselect;
+    pstat->busy_time = disk->statistics.disk_busy_time;
+
+    if (reset)
+    {
+	disk->statistics.disk_spi_command  = 0;
+	disk->statistics.disk_spi_response = 0;
+	disk->statistics.disk_spi_data     = 0;
+	disk->statistics.disk_spi_crc      = 0;
+	disk->statistics.disk_spi_token    = 0;
+	disk->statistics.disk_spi_busy     = 0;
+	disk->statistics.disk_spi_deselect = 0;
+	disk->statistics.disk_busy_time    = 0;
+    }
+}
+
+#endif /* (RFAT_CONFIG_STATISTICS == 1) */
+
+#if (RFAT_CONFIG_LOCK_STATISTICS_ENTRIES != 0)
+
+/*
+ * F_LOCKSTAT * rfat_lock_statistics_acquire(F_LOCKSTAT *table, const char *function, uint32_t wait)
+ *
+ * Find the entry for "function" in a table of RFAT_CONFIG_LOCK_STATISTICS_ENTRIES
+ * entries, and account for one acquisition after waiting "wait" microseconds.
+ * "function" is a __func__, so a pointer compare is sufficient. If the table
+ * is full, the last entry collects the remaining functions as "*".
+ *
+ * This is shared between rfat_core.c and rfat_disk.c, and has to be called with
+ * the corresponding lock held.
+ */
+
+F_LOCKSTAT * rfat_lock_statistics_acquire(F_LOCKSTAT *table, const char *function, uint32_t wait)
+{
+    F_LOCKSTAT *entry, *entry_e;
+
+    entry = &table[0];
+    entry_e = &table[RFAT_CONFIG_LOCK_STATISTICS_ENTRIES -1];
+
+    while ((entry != entry_e) && (entry->function != NULL) && (entry->function != function))
+    {
+	entry++;
+    }
+
+    if (entry->function == NULL)
+    {
+	entry->function = function;
+    }
+    else if (entry->function != function)
+    {
+	entry->function = "*";
+    }
+
+    entry->count++;
+    entry->wait_time += wait;
+
+    if (entry->wait_max < wait)
+    {
+	entry->wait_max = wait;
+    }
+
+    return entry;
+}
+
+/*
+ * void rfat_lock_statistics_release(F_LOCKSTAT *entry, uint32_t hold)
+ *
+ * Account for the lock having been held "hold" microseconds.
+ */
+
+void rfat_lock_statistics_release(F_LOCKSTAT *entry, uint32_t hold)
+{
+    unsigned int index;
+    uint32_t limit;
+
+    entry->hold_time += hold;
+
+    if (entry->hold_max < hold)
+    {
+	entry->hold_max = hold;
+    }
+
+    for (index = 0, limit = 10; (index < (F_LOCKSTAT_BUCKETS -1)) && (hold >= limit); index++, limit *= 10)
+    {
+	continue;
+    }
+
+    entry->hold_histogram[index]++;
+}
+
+/*
+ * int rfat_disk_lock_statistics(rfat_disk_t *disk, F_LOCKSTAT *plockstat, bool reset)
+ */
+
+int rfat_disk_lock_statistics(rfat_disk_t *disk, F_LOCKSTAT *plockstat, bool reset)
+{
+    int status = F_NO_ERROR;
+
+#if (RFAT_CONFIG_DISK_SIMULATE == 0) && defined(RFAT_PORT_DISK_LOCK)
+    status = RFAT_PORT_DISK_LOCK();
+
+    if (status == F_NO_ERROR)
+#endif /* (RFAT_CONFIG_DISK_SIMULATE == 0) && RFAT_PORT_DISK_LOCK */
+    {
+	memcpy(plockstat, &disk->lock_statistics[0], sizeof(disk->lock_statistics));
+
+	if (reset)
+	{
+	    memset(&disk->lock_statistics[0], 0, sizeof(disk->lock_statistics));
+	}
+
+#if (RFAT_CONFIG_DISK_SIMULATE == 0) && defined(RFAT_PORT_DISK_UNLOCK)
+	RFAT_PORT_DISK_UNLOCK();
+#endif /* (RFAT_CONFIG_DISK_SIMULATE == 0) && RFAT_PORT_DISK_UNLOCK */
+    }
+
+    return status;
+}
+
+#endif /* (RFAT_CONFIG_LOCK_STATISTICS_ENTRIES != 0) */
+
+#if (RFAT_CONFIG_UNIT_PROBE_SUPPORTED == 1)
+
+/*
+ * int rfat_disk_write_timed(rfat_disk_t *disk, uint32_t address, uint32_t length, const uint8_t *data, uint32_t *p_time)
+ *
+ * Write "length" copies of the block "data" starting at "address" as one
+ * multi block write, and wait till the card has finished programming.
+ * "*p_time" is the time this took in microseconds, or 0 if there is no
+ * RFAT_PORT_DISK_TIME_STAMP() to measure it.
+ */
+
+int rfat_disk_write_timed(rfat_disk_t *disk, uint32_t address, uint32_t length, const uint8_t *data, uint32_t *p_time)
+{
+    int status = F_NO_ERROR;
+#if (RFAT_CONFIG_DISK_SIMULATE == 0) && defined(RFAT_PORT_DISK_TIME_STAMP)
+    uint32_t stamp;
+#endif /* (RFAT_CONFIG_DISK_SIMULATE == 0) && RFAT_PORT_DISK_TIME_STAMP */
+
+    *p_time = 0;
+
+    /* Outstanding writes must not be accounted to this one.
+     */
+    status = rfat_disk_sync(disk, NULL);
+
+    if (status == F_NO_ERROR)
+    {
+#if (RFAT_CONFIG_DISK_SIMULATE == 0) && defined(RFAT_PORT_DISK_TIME_STAMP)
+	stamp = RFAT_PORT_DISK_TIME_STAMP();
+#endif /* (RFAT_CONFIG_DISK_SIMULATE == 0) && RFAT_PORT_DISK_TIME_STAMP */
+
+	while ((status == F_NO_ERROR) && length)
+	{
+	    status = rfat_disk_write_sequential(disk, address, 1, data, NULL);
+
+	    address++;
+	    length--;
+	}
+
+	if (status == F_NO_ERROR)
+	{
+	    status = rfat_disk_sync(disk, NULL);
+
+#if (RFAT_CONFIG_DISK_SIMULATE == 0) && defined(RFAT_PORT_DISK_TIME_STAMP)
+	    *p_time = (uint32_t)(RFAT_PORT_DISK_TIME_STAMP() - stamp);
+#endif /* (RFAT_CONFIG_DISK_SIMULATE == 0) && RFAT_PORT_DISK_TIME_STAMP */
+	}
+    }
+
+    return status;
+}
+
+#endif /* (RFAT_CONFIG_UNIT_PROBE_SUPPORTED == 1) */
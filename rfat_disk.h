@@ -30,6 +30,7 @@
 #define _RFAT_DISK_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <string.h>
 
@@ -47,6 +48,7 @@ typedef struct _rfat_disk_t rfat_disk_t;
 #define RFAT_DISK_STATE_READY             3
 #define RFAT_DISK_STATE_READ_SEQUENTIAL   4
 #define RFAT_DISK_STATE_WRITE_SEQUENTIAL  5
+#define RFAT_DISK_STATE_WRITE_STOP        6
 
 #define RFAT_DISK_TYPE_NONE               0
 #define RFAT_DISK_TYPE_SDSC               1
@@ -54,6 +56,8 @@ typedef struct _rfat_disk_t rfat_disk_t;
 
 #define RFAT_DISK_FLAG_COMMAND_SUBSEQUENT 0x01
 
+#define RFAT_DISK_ADDRESS_NONE            0xffffffff
+
 #define RFAT_DISK_MODE_NONE               0
 #define RFAT_DISK_MODE_IDENTIFY           1
 #define RFAT_DISK_MODE_DATA_TRANSFER      2
@@ -91,8 +95,22 @@ struct _rfat_disk_t {
 	uint32_t                disk_write_single;
 	uint32_t                disk_write_sequential;
 	uint32_t                disk_write_coalesce;
+	uint32_t                disk_spi_command;
+	uint32_t                disk_spi_response;
+	uint32_t                disk_spi_data;
+	uint32_t                disk_spi_crc;
+	uint32_t                disk_spi_token;
+	uint32_t                disk_spi_busy;
+	uint32_t                disk_spi_deselect;
+	uint32_t                disk_busy_time;
     }                       statistics;
 #endif /* (RFAT_CONFIG_STATISTICS == 1) */
+
+#if (RFAT_CONFIG_LOCK_STATISTICS_ENTRIES != 0)
+    F_LOCKSTAT              *lock_entry;
+    uint32_t                lock_stamp;
+    F_LOCKSTAT              lock_statistics[RFAT_CONFIG_LOCK_STATISTICS_ENTRIES];
+#endif /* (RFAT_CONFIG_LOCK_STATISTICS_ENTRIES != 0) */
 };
 
 #if (RFAT_CONFIG_DISK_CRC == 1)
@@ -120,13 +138,54 @@ extern uint16_t rfat_compute_crc16(const uint8_t *data, uint32_t count);
 
 #endif /* (RFAT_CONFIG_STATISTICS == 1) */
 
+#if (RFAT_CONFIG_LOCK_STATISTICS_ENTRIES != 0)
+
+/* RFAT_DISK_LOCK_TIME_STAMP() is supplied by rfat_disk.c, as it depends upon rfat_port.h.
+ */
+#define RFAT_DISK_LOCK_STATISTICS_ACQUIRE(_function, _stamp)            \
+    {                                                                   \
+	uint32_t _now = RFAT_DISK_LOCK_TIME_STAMP();                    \
+	disk->lock_entry = rfat_lock_statistics_acquire(disk->lock_statistics, (_function), (_now - (_stamp))); \
+	disk->lock_stamp = _now;                                        \
+    }
+
+#define RFAT_DISK_LOCK_STATISTICS_RELEASE()                             \
+    {                                                                   \
+	uint32_t _now = RFAT_DISK_LOCK_TIME_STAMP();                    \
+	rfat_lock_statistics_release(disk->lock_entry, (_now - disk->lock_stamp)); \
+	disk->lock_stamp = _now;                                        \
+    }
+
+#else /* (RFAT_CONFIG_LOCK_STATISTICS_ENTRIES != 0) */
+
+#define RFAT_DISK_LOCK_STATISTICS_ACQUIRE(_function, _stamp) /**/
+#define RFAT_DISK_LOCK_STATISTICS_RELEASE()                  /**/
+
+#endif /* (RFAT_CONFIG_LOCK_STATISTICS_ENTRIES != 0) */
+
 extern rfat_disk_t * rfat_disk_acquire(void);
 extern int rfat_disk_release(rfat_disk_t *disk);
 extern int rfat_disk_info(rfat_disk_t *disk, bool *p_write_protected, uint32_t *p_block_count, uint32_t *p_au_size, uint32_t *p_serial);
+extern int rfat_disk_identify(rfat_disk_t *disk, bool *p_write_protected, uint32_t *p_serial);
 extern int rfat_disk_read(rfat_disk_t *disk, uint32_t address, uint8_t *data);
 extern int rfat_disk_read_sequential(rfat_disk_t *disk, uint32_t address, uint32_t length, uint8_t *data);
 extern int rfat_disk_write(rfat_disk_t *disk, uint32_t address, const uint8_t *data);
 extern int rfat_disk_write_sequential(rfat_disk_t *disk, uint32_t address, uint32_t length, const uint8_t *data, volatile uint8_t *p_status);
 extern int rfat_disk_sync(rfat_disk_t *disk, volatile uint8_t *p_status);
+extern int rfat_disk_poll(rfat_disk_t *disk, uint32_t address, bool *p_busy);
+
+#if (RFAT_CONFIG_UNIT_PROBE_SUPPORTED == 1)
+extern int rfat_disk_write_timed(rfat_disk_t *disk, uint32_t address, uint32_t length, const uint8_t *data, uint32_t *p_time);
+#endif /* (RFAT_CONFIG_UNIT_PROBE_SUPPORTED == 1) */
+
+#if (RFAT_CONFIG_STATISTICS == 1)
+extern void rfat_disk_bus_statistics(rfat_disk_t *disk, F_BUSSTAT *pstat, bool reset);
+#endif /* (RFAT_CONFIG_STATISTICS == 1) */
+
+#if (RFAT_CONFIG_LOCK_STATISTICS_ENTRIES != 0)
+extern F_LOCKSTAT *rfat_lock_statistics_acquire(F_LOCKSTAT *table, const char *function, uint32_t wait);
+extern void rfat_lock_statistics_release(F_LOCKSTAT *entry, uint32_t hold);
+extern int rfat_disk_lock_statistics(rfat_disk_t *disk, F_LOCKSTAT *plockstat, bool reset);
+#endif /* (RFAT_CONFIG_LOCK_STATISTICS_ENTRIES != 0) */
 
 #endif /*_RFAT_DISK_H */
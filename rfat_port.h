@@ -29,6 +29,14 @@
 #if !defined(_RFAT_PORT_h)
 #define _RFAT_PORT_h
 
+#if defined(RFAT_PORT_HOST)
+#include "host_disk.h"
+#else /* RFAT_PORT_HOST */
 #include "tm4c123_disk.h"
+#endif /* RFAT_PORT_HOST */
+
+#if !defined(RFAT_PORT_CORE_BARRIER)
+#define RFAT_PORT_CORE_BARRIER()                 __asm__ volatile ("" : : : "memory")
+#endif /* RFAT_PORT_CORE_BARRIER */
 
 #endif /* _RFAT_PORT_h */
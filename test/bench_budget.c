@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2014 Thomas Roell.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal with the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimers.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimers in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of Thomas Roell, nor the names of its contributors
+ *     may be used to endorse or promote products derived from this Software
+ *     without specific prior written permission.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * WITH THE SOFTWARE.
+ */
+
+/* Latency distribution of f_write() for a log that grows by 1024 byte records,
+ * in emulated bus time. Built as bench_budget with RFAT_CONFIG_WRITE_BUDGET_SUPPORTED,
+ * where f_idle() is called after each record, and as bench_budget_none without.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rfat_disk.h"
+#include "host_disk.h"
+
+#define BENCH_BUDGET_RECORD      1024
+#define BENCH_BUDGET_LENGTH      (8 * 1024 * 1024)
+#define BENCH_BUDGET_BUCKETS     8
+
+#if (RFAT_CONFIG_WRITE_BUDGET_SUPPORTED == 1)
+#define BENCH_BUDGET_NAME        "bench_budget"
+#else /* (RFAT_CONFIG_WRITE_BUDGET_SUPPORTED == 1) */
+#define BENCH_BUDGET_NAME        "bench_budget_none"
+#endif /* (RFAT_CONFIG_WRITE_BUDGET_SUPPORTED == 1) */
+
+/* Upper bounds of the histogram buckets in microseconds. */
+static const uint32_t bench_budget_limit[BENCH_BUDGET_BUCKETS] = {
+    250, 500, 1000, 2000, 5000, 10000, 20000, 0xffffffff
+};
+
+int main(void)
+{
+    F_FILE *file;
+    uint8_t record[BENCH_BUDGET_RECORD];
+    unsigned long index, count[BENCH_BUDGET_BUCKETS];
+    uint32_t time, time_max, idle_max, total;
+#if (RFAT_CONFIG_WRITE_BUDGET_SUPPORTED == 1)
+    uint32_t idle;
+#endif /* (RFAT_CONFIG_WRITE_BUDGET_SUPPORTED == 1) */
+    unsigned int bucket;
+
+    if ((f_initvolume() != F_NO_ERROR) || (f_hardformat(F_FAT16_MEDIA) != F_NO_ERROR))
+    {
+	printf(BENCH_BUDGET_NAME ": cannot format\n");
+	return 1;
+    }
+
+    file = f_open("LOG.BIN", "w");
+
+    if (file == NULL)
+    {
+	printf(BENCH_BUDGET_NAME ": cannot open LOG.BIN\n");
+	return 1;
+    }
+
+    memset(record, 0x5a, BENCH_BUDGET_RECORD);
+    memset(count, 0, sizeof(count));
+
+    time_max = 0;
+    idle_max = 0;
+    total = host_disk_time_current();
+
+    for (index = 0; index < (BENCH_BUDGET_LENGTH / BENCH_BUDGET_RECORD); index++)
+    {
+	time = host_disk_time_current();
+
+	if (f_write(record, 1, BENCH_BUDGET_RECORD, file) != BENCH_BUDGET_RECORD)
+	{
+	    printf(BENCH_BUDGET_NAME ": write failed\n");
+	    return 1;
+	}
+
+	time = host_disk_time_current() - time;
+
+	if (time_max < time)
+	{
+	    time_max = time;
+	}
+
+	for (bucket = 0; time > bench_budget_limit[bucket]; bucket++)
+	{
+	}
+
+	count[bucket]++;
+
+#if (RFAT_CONFIG_WRITE_BUDGET_SUPPORTED == 1)
+	idle = host_disk_time_current();
+
+	if (f_idle() != F_NO_ERROR)
+	{
+	    printf(BENCH_BUDGET_NAME ": idle failed\n");
+	    return 1;
+	}
+
+	idle = host_disk_time_current() - idle;
+
+	if (idle_max < idle)
+	{
+	    idle_max = idle;
+	}
+#endif /* (RFAT_CONFIG_WRITE_BUDGET_SUPPORTED == 1) */
+    }
+
+    if (f_close(file) != F_NO_ERROR)
+    {
+	printf(BENCH_BUDGET_NAME ": close failed\n");
+	return 1;
+    }
+
+    total = host_disk_time_current() - total;
+
+    f_delvolume();
+
+    printf(BENCH_BUDGET_NAME ": f_write() max %lu us, f_idle() max %lu us, %.1f kB/s\n",
+	   (unsigned long)time_max, (unsigned long)idle_max,
+	   ((double)BENCH_BUDGET_LENGTH * 1000000.0) / ((double)total * 1024.0));
+
+    for (bucket = 0; bucket < BENCH_BUDGET_BUCKETS; bucket++)
+    {
+	if (bench_budget_limit[bucket] != 0xffffffff)
+	{
+	    printf(BENCH_BUDGET_NAME ":     <= %5lu us: %6lu\n", (unsigned long)bench_budget_limit[bucket], count[bucket]);
+	}
+	else
+	{
+	    printf(BENCH_BUDGET_NAME ":      > %5lu us: %6lu\n", (unsigned long)bench_budget_limit[bucket -1], count[bucket]);
+	}
+    }
+
+    return 0;
+}
@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2014 Thomas Roell.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal with the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimers.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimers in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of Thomas Roell, nor the names of its contributors
+ *     may be used to endorse or promote products derived from this Software
+ *     without specific prior written permission.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * WITH THE SOFTWARE.
+ */
+
+
+/* Cost curve of the commit policy (f_setcommit()). A log of 128 byte records
+ * is written with f_write() for each policy, and the time the emulated SPI bus
+ * was busy and the number of blocks written are reported against the amount of
+ * data that is at risk on a power failure. F_COMMIT_SECONDS/F_COMMIT_MILLISECONDS
+ * are left out, as the host clock has nothing to do with the emulated bus time.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rfat_disk.h"
+#include "host_disk.h"
+
+#define BENCH_COMMIT_RECORD      128
+#define BENCH_COMMIT_LENGTH      (1024 * 1024)
+
+typedef struct _bench_commit_t {
+    int                     policy;
+    unsigned long           interval;
+    const char              *label;
+} bench_commit_t;
+
+static const bench_commit_t bench_commit_table[] = {
+    { F_COMMIT_NONE,     0,       "none"            },
+    { F_COMMIT_CLUSTERS, 16,      "16 clusters"     },
+    { F_COMMIT_CLUSTERS, 4,       "4 clusters"      },
+    { F_COMMIT_CLUSTERS, 1,       "1 cluster"       },
+    { F_COMMIT_BYTES,    16384,   "16384 bytes"     },
+    { F_COMMIT_BYTES,    4096,    "4096 bytes"      },
+    { F_COMMIT_BYTES,    1024,    "1024 bytes"      },
+    { F_COMMIT_BYTES,    512,     "512 bytes"       },
+    { F_COMMIT_BYTES,    128,     "128 bytes"       },
+};
+
+int main(void)
+{
+    F_FILE *file;
+    uint8_t record[BENCH_COMMIT_RECORD];
+    unsigned int index, offset;
+    uint32_t time, blocks, cls_size;
+    F_SPACE space;
+
+    if ((f_initvolume() != F_NO_ERROR) || (f_hardformat(F_FAT16_MEDIA) != F_NO_ERROR) || (f_getfreespace(&space) != F_NO_ERROR))
+    {
+	printf("bench_commit: cannot format\n");
+	return 1;
+    }
+
+    /* A file of 1 byte takes up one cluster.
+     */
+    cls_size = (uint32_t)space.free;
+
+    file = f_open("SIZE.BIN", "w");
+    f_write(record, 1, 1, file);
+    f_close(file);
+    f_getfreespace(&space);
+    f_delete("SIZE.BIN");
+
+    cls_size -= (uint32_t)space.free;
+
+    printf("%-16s %12s %10s %10s\n", "policy", "at risk", "KB/s", "blocks");
+
+    for (index = 0; index < (sizeof(bench_commit_table) / sizeof(bench_commit_table[0])); index++)
+    {
+	file = f_open("LOG.BIN", "w");
+
+	if ((file == NULL) || (f_setcommit(file, bench_commit_table[index].policy, bench_commit_table[index].interval) != F_NO_ERROR))
+	{
+	    printf("bench_commit: policy not supported\n");
+	    return 1;
+	}
+
+	time = host_disk_time_current();
+	blocks = host_disk_statistics.blocks_written;
+
+	for (offset = 0; offset < BENCH_COMMIT_LENGTH; offset += BENCH_COMMIT_RECORD)
+	{
+	    memset(record, offset / BENCH_COMMIT_RECORD, BENCH_COMMIT_RECORD);
+
+	    if (f_write(record, 1, BENCH_COMMIT_RECORD, file) != BENCH_COMMIT_RECORD)
+	    {
+		printf("bench_commit: write failed\n");
+		return 1;
+	    }
+	}
+
+	f_close(file);
+
+	time = host_disk_time_current() - time;
+	blocks = host_disk_statistics.blocks_written - blocks;
+
+	if (bench_commit_table[index].policy == F_COMMIT_NONE)
+	{
+	    printf("%-16s %12s", bench_commit_table[index].label, "all");
+	}
+	else
+	{
+	    printf("%-16s %12lu", bench_commit_table[index].label,
+		   (bench_commit_table[index].policy == F_COMMIT_CLUSTERS) ? (bench_commit_table[index].interval * cls_size) : bench_commit_table[index].interval);
+	}
+
+	printf(" %10.1f %10u\n", ((double)BENCH_COMMIT_LENGTH / 1024.0) / ((double)time / 1000000.0), blocks);
+
+	f_delete("LOG.BIN");
+    }
+
+    f_delvolume();
+
+    return 0;
+}
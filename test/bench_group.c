@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2014 Thomas Roell.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal with the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimers.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimers in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of Thomas Roell, nor the names of its contributors
+ *     may be used to endorse or promote products derived from this Software
+ *     without specific prior written permission.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * WITH THE SOFTWARE.
+ */
+/* Cost of f_begin()/f_commit() groups (TRANSACTION_SAFE). 100 small files are
+ * created and written, and every 4th one gets deleted again, with a group
+ * spanning the given number of files. The time the emulated SPI bus was busy
+ * and the number of blocks written are reported for each group size, with a
+ * group size of 1 meaning no f_begin()/f_commit() at all.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rfat_disk.h"
+#include "host_disk.h"
+
+#define BENCH_GROUP_FILES        100
+#define BENCH_GROUP_LENGTH       300
+
+static const unsigned int bench_group_table[] = {
+    1, 5, 25, 100,
+};
+
+static uint8_t bench_group_data[BENCH_GROUP_LENGTH];
+
+static int bench_group_file(unsigned int index)
+{
+    F_FILE *file;
+    char name[16];
+
+    sprintf(name, "F%03u.TXT", index);
+
+    memset(bench_group_data, 'a' + (index % 26), BENCH_GROUP_LENGTH);
+
+    file = f_open(name, "w");
+
+    if (file == NULL)
+    {
+	return 0;
+    }
+
+    if (f_write(bench_group_data, 1, BENCH_GROUP_LENGTH, file) != BENCH_GROUP_LENGTH)
+    {
+	f_close(file);
+	return 0;
+    }
+
+    if (f_close(file) != F_NO_ERROR)
+    {
+	return 0;
+    }
+
+    if ((index % 4) == 3)
+    {
+	return (f_delete(name) == F_NO_ERROR);
+    }
+
+    return 1;
+}
+
+int main(void)
+{
+    unsigned int index, count, size;
+    uint32_t time, blocks;
+    char name[16];
+
+    if ((f_initvolume() != F_NO_ERROR) || (f_hardformat(F_FAT16_MEDIA) != F_NO_ERROR))
+    {
+	printf("bench_group: cannot format\n");
+	return 1;
+    }
+
+    printf("%-16s %10s %10s\n", "files per group", "ms", "blocks");
+
+    for (index = 0; index < (sizeof(bench_group_table) / sizeof(bench_group_table[0])); index++)
+    {
+	size = bench_group_table[index];
+
+	time = host_disk_time_current();
+	blocks = host_disk_statistics.blocks_written;
+
+	for (count = 0; count < BENCH_GROUP_FILES; count++)
+	{
+	    if ((size != 1) && ((count % size) == 0) && (f_begin() != F_NO_ERROR))
+	    {
+		printf("bench_group: f_begin() failed\n");
+		return 1;
+	    }
+
+	    if (!bench_group_file(count))
+	    {
+		printf("bench_group: file failed\n");
+		return 1;
+	    }
+
+	    if ((size != 1) && (((count % size) == (size -1)) || (count == (BENCH_GROUP_FILES -1))) && (f_commit() != F_NO_ERROR))
+	    {
+		printf("bench_group: f_commit() failed\n");
+		return 1;
+	    }
+	}
+
+	time = host_disk_time_current() - time;
+	blocks = host_disk_statistics.blocks_written - blocks;
+
+	printf("%-16u %10.1f %10u\n", size, ((double)time / 1000.0), blocks);
+
+	for (count = 0; count < BENCH_GROUP_FILES; count++)
+	{
+	    if ((count % 4) != 3)
+	    {
+		sprintf(name, "F%03u.TXT", count);
+
+		f_delete(name);
+	    }
+	}
+    }
+
+    f_delvolume();
+
+    return 0;
+}
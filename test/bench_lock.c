@@ -0,0 +1,200 @@
+/*
+ * Copyright (c) 2014 Thomas Roell.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal with the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimers.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimers in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of Thomas Roell, nor the names of its contributors
+ *     may be used to endorse or promote products derived from this Software
+ *     without specific prior written permission.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * WITH THE SOFTWARE.
+ */
+
+/* Contention between a thread writing BIG.BIN in cluster sized f_write() calls
+ * and the main thread opening, reading and stat'ing SMALL.TXT, with the host port
+ * mutexes (HOST_DISK_MUTEX). Reports the latency distribution of the small
+ * operations in wall clock time, and how long the core lock was held and waited
+ * for. Built as bench_lock with RFAT_CONFIG_TRANSFER_UNLOCK_SUPPORTED, and as
+ * bench_lock_none without.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "rfat_disk.h"
+#include "host_disk.h"
+
+#define BENCH_LOCK_CHUNK         32768
+#define BENCH_LOCK_LENGTH        (8 * 1024 * 1024)
+#define BENCH_LOCK_SMALL         1500
+#define BENCH_LOCK_SAMPLES       65536
+
+#if (RFAT_CONFIG_TRANSFER_UNLOCK_SUPPORTED == 1)
+#define BENCH_LOCK_NAME          "bench_lock"
+#else /* (RFAT_CONFIG_TRANSFER_UNLOCK_SUPPORTED == 1) */
+#define BENCH_LOCK_NAME          "bench_lock_none"
+#endif /* (RFAT_CONFIG_TRANSFER_UNLOCK_SUPPORTED == 1) */
+
+static volatile int bench_lock_done;
+static volatile int bench_lock_failed;
+
+static uint32_t bench_lock_sample[BENCH_LOCK_SAMPLES];
+
+static void *bench_lock_big(void *arg)
+{
+    F_FILE *file;
+    static uint8_t chunk[BENCH_LOCK_CHUNK];
+    uint32_t offset;
+
+    memset(chunk, 0x5a, BENCH_LOCK_CHUNK);
+
+    file = f_open("BIG.BIN", "w");
+
+    for (offset = 0; file && !bench_lock_failed && (offset < BENCH_LOCK_LENGTH); offset += BENCH_LOCK_CHUNK)
+    {
+	if (f_write(chunk, 1, BENCH_LOCK_CHUNK, file) != BENCH_LOCK_CHUNK)
+	{
+	    bench_lock_failed = 1;
+	}
+    }
+
+    if (!file || (f_close(file) != F_NO_ERROR))
+    {
+	bench_lock_failed = 1;
+    }
+
+    bench_lock_done = 1;
+
+    return NULL;
+}
+
+static int bench_lock_compare(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+
+    return (x < y) ? -1 : ((x > y) ? 1 : 0);
+}
+
+int main(void)
+{
+    F_FILE *file;
+    F_STAT stat;
+    F_LOCKSTAT lockstat[RFAT_CONFIG_LOCK_STATISTICS_ENTRIES];
+    pthread_t big;
+    uint8_t small[BENCH_LOCK_SMALL];
+    uint32_t time, total, count, index;
+    unsigned long hold_max, wait_max, wait_time;
+
+    if ((f_initvolume() != F_NO_ERROR) || (f_hardformat(F_FAT16_MEDIA) != F_NO_ERROR))
+    {
+	printf(BENCH_LOCK_NAME ": cannot format\n");
+	return 1;
+    }
+
+    memset(small, 0xa5, BENCH_LOCK_SMALL);
+
+    file = f_open("SMALL.TXT", "w");
+
+    if ((file == NULL) || (f_write(small, 1, BENCH_LOCK_SMALL, file) != BENCH_LOCK_SMALL) || (f_close(file) != F_NO_ERROR))
+    {
+	printf(BENCH_LOCK_NAME ": cannot create SMALL.TXT\n");
+	return 1;
+    }
+
+    f_getlockstat(F_LOCKSTAT_CORE, lockstat, 1);
+
+    total = host_core_time_current();
+
+    if (pthread_create(&big, NULL, bench_lock_big, NULL))
+    {
+	printf(BENCH_LOCK_NAME ": cannot create thread\n");
+	return 1;
+    }
+
+    count = 0;
+
+    while (!bench_lock_done && !bench_lock_failed && (count < BENCH_LOCK_SAMPLES))
+    {
+	time = host_core_time_current();
+
+	file = f_open("SMALL.TXT", "r");
+
+	if ((file == NULL) || (f_read(small, 1, BENCH_LOCK_SMALL, file) != BENCH_LOCK_SMALL) || (f_close(file) != F_NO_ERROR) ||
+	    (f_stat("SMALL.TXT", &stat) != F_NO_ERROR))
+	{
+	    bench_lock_failed = 1;
+	}
+
+	bench_lock_sample[count++] = host_core_time_current() - time;
+
+	sched_yield();
+    }
+
+    pthread_join(big, NULL);
+
+    total = host_core_time_current() - total;
+
+    if (bench_lock_failed || (count == 0))
+    {
+	printf(BENCH_LOCK_NAME ": failed\n");
+	return 1;
+    }
+
+    /* The core lock statistics are taken before f_delvolume() adds its own entry.
+     */
+    f_getlockstat(F_LOCKSTAT_CORE, lockstat, 0);
+
+    hold_max = 0;
+    wait_max = 0;
+    wait_time = 0;
+
+    for (index = 0; (index < RFAT_CONFIG_LOCK_STATISTICS_ENTRIES) && lockstat[index].function; index++)
+    {
+	if (hold_max < lockstat[index].hold_max)
+	{
+	    hold_max = lockstat[index].hold_max;
+	}
+
+	if (wait_max < lockstat[index].wait_max)
+	{
+	    wait_max = lockstat[index].wait_max;
+	}
+
+	wait_time += lockstat[index].wait_time;
+    }
+
+    f_delvolume();
+
+    qsort(bench_lock_sample, count, sizeof(uint32_t), bench_lock_compare);
+
+    printf(BENCH_LOCK_NAME ": %lu small operations, p50 %lu us, p99 %lu us, max %lu us\n",
+	   (unsigned long)count,
+	   (unsigned long)bench_lock_sample[count / 2],
+	   (unsigned long)bench_lock_sample[(count * 99) / 100],
+	   (unsigned long)bench_lock_sample[count -1]);
+
+    printf(BENCH_LOCK_NAME ": core lock held max %lu us, waited max %lu us, %lu us total, BIG.BIN %.1f kB/s\n",
+	   hold_max, wait_max, wait_time,
+	   ((double)BENCH_LOCK_LENGTH / 1024.0) / ((double)total / 1000000.0));
+
+    return 0;
+}
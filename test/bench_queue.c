@@ -0,0 +1,200 @@
+/*
+ * Copyright (c) 2014 Thomas Roell.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal with the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimers.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimers in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of Thomas Roell, nor the names of its contributors
+ *     may be used to endorse or promote products derived from this Software
+ *     without specific prior written permission.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * WITH THE SOFTWARE.
+ */
+
+/* Throughput and overrun of F_QUEUE with the producer on its own host thread.
+ * First the producer retries a full queue, which yields the rate at which
+ * f_queue_drain() empties the queue. Then the producer is paced at fractions
+ * of that rate, and drops records on a full queue, for several queue sizes.
+ * In the first run the retried puts show up as overrun.
+ * Rates are host wall clock, as the producer runs concurrently to the
+ * emulated SPI bus; "bus kB/s" is the rate the emulated card sustained.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "rfat_disk.h"
+#include "host_disk.h"
+
+#define BENCH_QUEUE_RECORD       32
+#define BENCH_QUEUE_RECORDS      32768
+#define BENCH_QUEUE_SIZE_MAX     65536
+
+static F_QUEUE bench_queue;
+static uint32_t bench_queue_data[BENCH_QUEUE_SIZE_MAX / sizeof(uint32_t)];
+static volatile int bench_queue_done;
+static unsigned long bench_queue_rate;
+static unsigned long bench_queue_fill;
+
+static void *bench_queue_producer(void *arg)
+{
+    uint8_t record[BENCH_QUEUE_RECORD];
+    uint32_t sequence, start;
+    uint64_t due;
+    unsigned long fill;
+
+    memset(record, 0xa5, BENCH_QUEUE_RECORD);
+
+    start = host_core_time_current();
+
+    for (sequence = 0; sequence < BENCH_QUEUE_RECORDS; sequence++)
+    {
+	memcpy(record, &sequence, sizeof(sequence));
+
+	if (bench_queue_rate)
+	{
+	    due = ((uint64_t)(uint32_t)(host_core_time_current() - start) * bench_queue_rate) / 1000000;
+
+	    while (due < sequence)
+	    {
+		sched_yield();
+
+		due = ((uint64_t)(uint32_t)(host_core_time_current() - start) * bench_queue_rate) / 1000000;
+	    }
+
+	    f_queue_put(&bench_queue, record, BENCH_QUEUE_RECORD);
+	}
+	else
+	{
+	    while (f_queue_put(&bench_queue, record, BENCH_QUEUE_RECORD) != F_NO_ERROR)
+	    {
+		sched_yield();
+	    }
+	}
+
+	fill = bench_queue.head - bench_queue.tail;
+
+	if (bench_queue_fill < fill)
+	{
+	    bench_queue_fill = fill;
+	}
+    }
+
+    bench_queue_done = 1;
+
+    return NULL;
+}
+
+/* Returns the records per second drained, or 0 on failure.
+ */
+static unsigned long bench_queue_run(unsigned long size, unsigned long rate)
+{
+    F_FILE *file;
+    pthread_t producer;
+    uint32_t time, nanos;
+    unsigned long records;
+
+    file = f_open("LOG.BIN", "w");
+
+    if ((file == NULL) || (f_queue_init(&bench_queue, file, bench_queue_data, size) != F_NO_ERROR))
+    {
+	return 0;
+    }
+
+    bench_queue_done = 0;
+    bench_queue_rate = rate;
+    bench_queue_fill = 0;
+
+    nanos = host_disk_time_current();
+    time = host_core_time_current();
+
+    if (pthread_create(&producer, NULL, bench_queue_producer, NULL))
+    {
+	return 0;
+    }
+
+    while (!bench_queue_done)
+    {
+	if (f_queue_drain(&bench_queue, 0) == 0)
+	{
+	    sched_yield();
+	}
+    }
+
+    pthread_join(producer, NULL);
+
+    f_queue_drain(&bench_queue, 1);
+
+    time = host_core_time_current() - time;
+    nanos = host_disk_time_current() - nanos;
+
+    if ((f_error(file) != F_NO_ERROR) || (f_close(file) != F_NO_ERROR) || (f_delete("LOG.BIN") != F_NO_ERROR) || !time || !nanos)
+    {
+	return 0;
+    }
+
+    records = BENCH_QUEUE_RECORDS - f_queue_overrun(&bench_queue);
+
+    printf("bench_queue: %6lu bytes, %7lu rec/s: %8.1f kB/s, bus %7.1f kB/s, %5lu overrun, max fill %5lu\n",
+	   size, rate,
+	   ((double)records * BENCH_QUEUE_RECORD * 1000000.0) / ((double)time * 1024.0),
+	   ((double)records * BENCH_QUEUE_RECORD * 1000000.0) / ((double)nanos * 1024.0),
+	   f_queue_overrun(&bench_queue), bench_queue_fill);
+
+    return (unsigned long)(((uint64_t)records * 1000000) / time);
+}
+
+int main(void)
+{
+    unsigned long rate, size;
+    unsigned int index;
+    static const unsigned int percent[] = { 50, 90, 120 };
+
+    if ((f_initvolume() != F_NO_ERROR) || (f_hardformat(F_FAT16_MEDIA) != F_NO_ERROR))
+    {
+	printf("bench_queue: cannot format\n");
+	return 1;
+    }
+
+    rate = bench_queue_run(BENCH_QUEUE_SIZE_MAX, 0);
+
+    if (rate == 0)
+    {
+	printf("bench_queue: failed\n");
+	return 1;
+    }
+
+    for (size = 4096; size <= BENCH_QUEUE_SIZE_MAX; size <<= 2)
+    {
+	for (index = 0; index < (sizeof(percent) / sizeof(percent[0])); index++)
+	{
+	    if (bench_queue_run(size, (rate * percent[index]) / 100) == 0)
+	    {
+		printf("bench_queue: failed\n");
+		return 1;
+	    }
+	}
+    }
+
+    f_delvolume();
+
+    return 0;
+}
@@ -0,0 +1,193 @@
+/*
+ * Copyright (c) 2014 Thomas Roell.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal with the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimers.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimers in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of Thomas Roell, nor the names of its contributors
+ *     may be used to endorse or promote products derived from this Software
+ *     without specific prior written permission.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * WITH THE SOFTWARE.
+ */
+
+
+/* Cluster allocation with more than one open file:
+ *
+ * - Files written one after the other are packed into the same allocation
+ *   units (AU), rather than one AU per file.
+ * - A contiguous preallocation ("w,<size>") does not overlap with the
+ *   clusters of already existing files after a remount.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rfat_disk.h"
+#include "host_disk.h"
+#include "test_fsck.h"
+
+#define TEST_ALLOC_FILES         40
+#define TEST_ALLOC_LENGTH        100000
+#define TEST_ALLOC_RESERVE       400000000
+
+static uint8_t test_alloc_data[TEST_ALLOC_LENGTH];
+
+static void test_alloc_pattern(unsigned int index)
+{
+    unsigned int offset;
+
+    for (offset = 0; offset < TEST_ALLOC_LENGTH; offset++)
+    {
+	test_alloc_data[offset] = (uint8_t)(index * 7 + offset);
+    }
+}
+
+static int test_alloc_check(const char *label, uint32_t allocated)
+{
+    test_fsck_t fsck;
+
+    if (!test_fsck(&fsck, 1))
+    {
+	printf("%s: no file system\n", label);
+	return 0;
+    }
+
+    if (fsck.crosslinked || fsck.broken || fsck.lost || (fsck.allocated != allocated))
+    {
+	printf("%s: %u allocated, expected %u\n", label, fsck.allocated, allocated);
+	return 0;
+    }
+
+    return 1;
+}
+
+int main(void)
+{
+    test_fsck_t fsck;
+    F_FILE *file;
+    char name[16];
+    unsigned int index, offset;
+    uint32_t clscnt, unit;
+    int failed = 0;
+
+    if ((f_initvolume() != F_NO_ERROR) || (f_hardformat(F_FAT32_MEDIA) != F_NO_ERROR))
+    {
+	printf("test_alloc: cannot format\n");
+	return 1;
+    }
+
+    for (index = 0; index < TEST_ALLOC_FILES; index++)
+    {
+	sprintf(name, "F%02u.BIN", index);
+
+	test_alloc_pattern(index);
+
+	file = f_open(name, "w");
+
+	if ((file == NULL) || (f_write(test_alloc_data, 1, TEST_ALLOC_LENGTH, file) != TEST_ALLOC_LENGTH) || (f_close(file) != F_NO_ERROR))
+	{
+	    printf("test_alloc: cannot write %s\n", name);
+	    return 1;
+	}
+    }
+
+    test_fsck(&fsck, 0);
+
+    clscnt = (TEST_ALLOC_LENGTH + fsck.cls_size -1) / fsck.cls_size;
+    unit = (HOST_DISK_UNIT_SIZE * RFAT_BLK_SIZE) / fsck.cls_size;
+
+    /* The root directory takes one cluster, all files should fit into the
+     * AUs they need plus one partially used at each end.
+     */
+    if (!test_alloc_check("write", TEST_ALLOC_FILES * clscnt +1))
+    {
+	failed = 1;
+    }
+
+    if ((fsck.clsno_last - fsck.clsno_first +1) > (((TEST_ALLOC_FILES * clscnt + unit -1) / unit) +2) * unit)
+    {
+	printf("test_alloc: %u files spread over clusters %u to %u\n", TEST_ALLOC_FILES, fsck.clsno_first, fsck.clsno_last);
+	failed = 1;
+    }
+
+    f_delvolume();
+    f_initvolume();
+
+    file = f_open("BIG.BIN", "w,400000000");
+
+    if ((file == NULL) || (f_close(file) != F_NO_ERROR))
+    {
+	printf("test_alloc: cannot reserve BIG.BIN\n");
+	return 1;
+    }
+
+    if (!test_alloc_check("reserve", TEST_ALLOC_FILES * clscnt +1 + (TEST_ALLOC_RESERVE + fsck.cls_size -1) / fsck.cls_size))
+    {
+	failed = 1;
+    }
+
+    for (index = 0; index < TEST_ALLOC_FILES; index++)
+    {
+	sprintf(name, "F%02u.BIN", index);
+
+	file = f_open(name, "r");
+
+	memset(test_alloc_data, 0, TEST_ALLOC_LENGTH);
+
+	if ((file == NULL) || (f_read(test_alloc_data, 1, TEST_ALLOC_LENGTH, file) != TEST_ALLOC_LENGTH) || (f_close(file) != F_NO_ERROR))
+	{
+	    printf("test_alloc: cannot read %s\n", name);
+	    failed = 1;
+	    continue;
+	}
+
+	for (offset = 0; offset < TEST_ALLOC_LENGTH; offset++)
+	{
+	    if (test_alloc_data[offset] != (uint8_t)(index * 7 + offset))
+	    {
+		printf("test_alloc: %s differs at %u\n", name, offset);
+		failed = 1;
+		break;
+	    }
+	}
+    }
+
+    for (index = 0; index < TEST_ALLOC_FILES; index++)
+    {
+	sprintf(name, "F%02u.BIN", index);
+
+	if (f_delete(name) != F_NO_ERROR)
+	{
+	    printf("test_alloc: cannot delete %s\n", name);
+	    failed = 1;
+	}
+    }
+
+    if ((f_delete("BIG.BIN") != F_NO_ERROR) || !test_alloc_check("delete", 1))
+    {
+	failed = 1;
+    }
+
+    f_delvolume();
+
+    printf("test_alloc: %s\n", (failed ? "FAILED" : "passed"));
+
+    return failed;
+}
@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2014 Thomas Roell.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal with the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimers.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimers in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of Thomas Roell, nor the names of its contributors
+ *     may be used to endorse or promote products derived from this Software
+ *     without specific prior written permission.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * WITH THE SOFTWARE.
+ */
+
+
+/* Commit policy for all the ways data can be written:
+ *
+ * - f_write(), f_putc() and f_write_reserve()/f_write_commit() keep the
+ *   directory entry on the card within one interval of F_COMMIT_BYTES.
+ * - F_COMMIT_MILLISECONDS with an interval of 0 updates it on every write.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rfat_disk.h"
+#include "host_disk.h"
+#include "test_fsck.h"
+
+#define TEST_COMMIT_RECORD       32
+#define TEST_COMMIT_RECORDS      2000
+#define TEST_COMMIT_INTERVAL     1024
+
+static int test_commit_lag(const char *label, long position, long lag)
+{
+    long length;
+
+    length = test_fsck_length("REC.BIN");
+
+    if ((length < 0) || ((position - length) > lag))
+    {
+	printf("test_commit: %s: %ld bytes written, %ld on the card\n", label, position, length);
+	return 0;
+    }
+
+    return 1;
+}
+
+int main(void)
+{
+    F_FILE *file;
+    uint8_t record[TEST_COMMIT_RECORD];
+    void *data;
+    long position;
+    unsigned int index, offset;
+    int status, method, failed = 0;
+    static const char * const label[4] = { "f_write", "f_putc", "f_write_commit", "F_COMMIT_MILLISECONDS" };
+
+    if ((f_initvolume() != F_NO_ERROR) || (f_hardformat(F_FAT16_MEDIA) != F_NO_ERROR))
+    {
+	printf("test_commit: cannot format\n");
+	return 1;
+    }
+
+    for (method = 0; method < 4; method++)
+    {
+	file = f_open("REC.BIN", "w");
+
+	if ((file == NULL) ||
+	    ((method != 3) && (f_setcommit(file, F_COMMIT_BYTES, TEST_COMMIT_INTERVAL) != F_NO_ERROR)) ||
+	    ((method == 3) && (f_setcommit(file, F_COMMIT_MILLISECONDS, 0) != F_NO_ERROR)))
+	{
+	    printf("test_commit: cannot open REC.BIN\n");
+	    return 1;
+	}
+
+	for (index = 0, position = 0; (index < TEST_COMMIT_RECORDS) && !failed; index++)
+	{
+	    memset(record, index, TEST_COMMIT_RECORD);
+
+	    if ((method == 0) || (method == 3))
+	    {
+		if (f_write(record, 1, TEST_COMMIT_RECORD, file) != TEST_COMMIT_RECORD)
+		{
+		    failed = 1;
+		}
+	    }
+	    else if (method == 1)
+	    {
+		for (offset = 0; offset < TEST_COMMIT_RECORD; offset++)
+		{
+		    if (f_putc(record[offset], file) != record[offset])
+		    {
+			failed = 1;
+		    }
+		}
+	    }
+	    else
+	    {
+		status = f_write_reserve(file, TEST_COMMIT_RECORD, &data);
+
+		if (status == F_NO_ERROR)
+		{
+		    memcpy(data, record, TEST_COMMIT_RECORD);
+
+		    if (f_write_commit(file, TEST_COMMIT_RECORD) != TEST_COMMIT_RECORD)
+		    {
+			failed = 1;
+		    }
+		}
+		else if (status == F_ERR_NOMOREENTRY)
+		{
+		    if (f_write(record, 1, TEST_COMMIT_RECORD, file) != TEST_COMMIT_RECORD)
+		    {
+			failed = 1;
+		    }
+		}
+		else
+		{
+		    failed = 1;
+		}
+	    }
+
+	    if (failed)
+	    {
+		printf("test_commit: %s: write failed at %u\n", label[method], index);
+	    }
+	    else
+	    {
+		position += TEST_COMMIT_RECORD;
+
+		if (!test_commit_lag(label[method], position, ((method == 3) ? 0 : (TEST_COMMIT_INTERVAL -1))))
+		{
+		    failed = 1;
+		}
+	    }
+	}
+
+	if (f_close(file) != F_NO_ERROR)
+	{
+	    failed = 1;
+	}
+    }
+
+    f_delvolume();
+
+    printf("test_commit: %s\n", (failed ? "FAILED" : "passed"));
+
+    return failed;
+}
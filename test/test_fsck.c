@@ -0,0 +1,504 @@
+/*
+ * Copyright (c) 2014 Thomas Roell.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal with the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimers.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimers in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of Thomas Roell, nor the names of its contributors
+ *     may be used to endorse or promote products derived from this Software
+ *     without specific prior written permission.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * WITH THE SOFTWARE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rfat_disk.h"
+#include "host_disk.h"
+#include "test_fsck.h"
+
+typedef struct _test_fsck_volume_t {
+    test_fsck_t             *fsck;
+    int                     verbose;
+    const uint8_t           *fat;
+    uint32_t                fat_size;       /* in bytes */
+    uint32_t                cls_blk_shift;
+    uint32_t                cls_first;      /* first data block */
+    uint32_t                cls_last;       /* last valid cluster number */
+    uint32_t                root_blkno;
+    uint32_t                root_blkcnt;
+    uint32_t                root_clsno;
+    uint8_t                 *map;
+} test_fsck_volume_t;
+
+static uint16_t test_fsck_load_16(const uint8_t *data)
+{
+    return ((uint16_t)data[0] | ((uint16_t)data[1] << 8));
+}
+
+static uint32_t test_fsck_load_32(const uint8_t *data)
+{
+    return ((uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24));
+}
+
+static const uint8_t *test_fsck_block(uint32_t blkno)
+{
+    return &host_disk_image[(size_t)blkno * RFAT_BLK_SIZE];
+}
+
+static uint32_t test_fsck_fat_read(test_fsck_volume_t *volume, uint32_t clsno)
+{
+    uint32_t clsdata;
+
+    if (volume->fsck->type == 12)
+    {
+	clsdata = test_fsck_load_16(&volume->fat[clsno + (clsno >> 1)]);
+
+	clsdata = (clsno & 1) ? (clsdata >> 4) : (clsdata & 0x0fff);
+
+	if (clsdata >= 0x0ff8)
+	{
+	    clsdata = 0x0fffffff;
+	}
+	else if (clsdata == 0x0ff7)
+	{
+	    clsdata = 0x0ffffff7;
+	}
+    }
+    else if (volume->fsck->type == 16)
+    {
+	clsdata = test_fsck_load_16(&volume->fat[clsno * 2]);
+
+	if (clsdata >= 0xfff8)
+	{
+	    clsdata = 0x0fffffff;
+	}
+	else if (clsdata == 0xfff7)
+	{
+	    clsdata = 0x0ffffff7;
+	}
+    }
+    else
+    {
+	clsdata = test_fsck_load_32(&volume->fat[clsno * 4]) & 0x0fffffff;
+
+	if (clsdata >= 0x0ffffff8)
+	{
+	    clsdata = 0x0fffffff;
+	}
+    }
+
+    return clsdata;
+}
+
+/* Walks the chain starting at "clsno", marking each cluster in the map.
+ * Returns the number of clusters walked. A file size of ~0 means no size
+ * check (directories).
+ */
+static uint32_t test_fsck_chain(test_fsck_volume_t *volume, const char *name, uint32_t clsno, uint32_t length)
+{
+    uint32_t clscnt, clsdata;
+
+    clscnt = 0;
+
+    while (1)
+    {
+	if ((clsno < 2) || (clsno > volume->cls_last))
+	{
+	    if (volume->verbose)
+	    {
+		printf("fsck: %s: invalid cluster %u after %u clusters\n", name, clsno, clscnt);
+	    }
+
+	    volume->fsck->broken++;
+	    break;
+	}
+
+	if (volume->map[clsno])
+	{
+	    if (volume->verbose)
+	    {
+		printf("fsck: %s: cluster %u cross-linked\n", name, clsno);
+	    }
+
+	    volume->fsck->crosslinked++;
+	    break;
+	}
+
+	volume->map[clsno] = 1;
+	volume->fsck->used++;
+	clscnt++;
+
+	if (length != 0xffffffff)
+	{
+	    if ((volume->fsck->clsno_first == 0) || (volume->fsck->clsno_first > clsno))
+	    {
+		volume->fsck->clsno_first = clsno;
+	    }
+
+	    if (volume->fsck->clsno_last < clsno)
+	    {
+		volume->fsck->clsno_last = clsno;
+	    }
+	}
+
+	clsdata = test_fsck_fat_read(volume, clsno);
+
+	if (clsdata == 0x0fffffff)
+	{
+	    break;
+	}
+
+	if ((clsdata == 0) || (clsdata == 0x0ffffff7))
+	{
+	    if (volume->verbose)
+	    {
+		printf("fsck: %s: cluster %u links to %s\n", name, clsno, (clsdata ? "bad cluster" : "free cluster"));
+	    }
+
+	    volume->fsck->broken++;
+	    break;
+	}
+
+	clsno = clsdata;
+    }
+
+    if ((length != 0xffffffff) && (((uint64_t)clscnt * volume->fsck->cls_size) < length))
+    {
+	if (volume->verbose)
+	{
+	    printf("fsck: %s: %u clusters for %u bytes\n", name, clscnt, length);
+	}
+
+	volume->fsck->broken++;
+    }
+
+    return clscnt;
+}
+
+static void test_fsck_directory(test_fsck_volume_t *volume, const char *path, uint32_t clsno, unsigned int level);
+
+static int test_fsck_entries(test_fsck_volume_t *volume, const char *path, const uint8_t *data, uint32_t count, unsigned int level)
+{
+    const uint8_t *dir;
+    uint32_t index, clsno, length;
+    char name[256];
+    unsigned int i, n;
+
+    for (index = 0; index < count; index++)
+    {
+	dir = &data[index * 32];
+
+	if (dir[0] == 0x00)
+	{
+	    return 0;
+	}
+
+	if ((dir[0] == 0xe5) || ((dir[11] & 0x3f) == 0x0f) || (dir[11] & 0x08))
+	{
+	    continue;
+	}
+
+	if ((dir[0] == '.') && ((dir[1] == ' ') || (dir[1] == '.')))
+	{
+	    continue;
+	}
+
+	n = (unsigned int)snprintf(name, sizeof(name) -13, "%s/", path);
+
+	if (n > (sizeof(name) -14))
+	{
+	    n = sizeof(name) -14;
+	}
+
+	for (i = 0; (i < 8) && (dir[i] != ' '); i++)
+	{
+	    name[n++] = dir[i];
+	}
+
+	if (dir[8] != ' ')
+	{
+	    name[n++] = '.';
+
+	    for (i = 8; (i < 11) && (dir[i] != ' '); i++)
+	    {
+		name[n++] = dir[i];
+	    }
+	}
+
+	name[n] = '\0';
+
+	clsno = test_fsck_load_16(&dir[26]);
+
+	if (volume->fsck->type == 32)
+	{
+	    clsno |= ((uint32_t)test_fsck_load_16(&dir[20]) << 16);
+	}
+
+	length = test_fsck_load_32(&dir[28]);
+
+	if (dir[11] & 0x10)
+	{
+	    volume->fsck->directories++;
+
+	    if (level < 16)
+	    {
+		test_fsck_directory(volume, name, clsno, level +1);
+	    }
+	}
+	else
+	{
+	    volume->fsck->files++;
+
+	    if (clsno != 0)
+	    {
+		test_fsck_chain(volume, name, clsno, length);
+	    }
+	    else if (length != 0)
+	    {
+		if (volume->verbose)
+		{
+		    printf("fsck: %s: %u bytes without clusters\n", name, length);
+		}
+
+		volume->fsck->broken++;
+	    }
+	}
+    }
+
+    return 1;
+}
+
+static void test_fsck_directory(test_fsck_volume_t *volume, const char *path, uint32_t clsno, unsigned int level)
+{
+    uint32_t clscnt, clsdata, blkno;
+    uint32_t count = (RFAT_BLK_SIZE / 32) << volume->cls_blk_shift;
+
+    if (clsno == 0)
+    {
+	test_fsck_entries(volume, path, test_fsck_block(volume->root_blkno), (volume->root_blkcnt * RFAT_BLK_SIZE) / 32, level);
+	return;
+    }
+
+    clscnt = test_fsck_chain(volume, path, clsno, 0xffffffff);
+
+    while (clscnt--)
+    {
+	blkno = volume->cls_first + ((clsno - 2) << volume->cls_blk_shift);
+
+	if (!test_fsck_entries(volume, path, test_fsck_block(blkno), count, level))
+	{
+	    break;
+	}
+
+	clsdata = test_fsck_fat_read(volume, clsno);
+
+	if ((clsdata < 2) || (clsdata > volume->cls_last))
+	{
+	    break;
+	}
+
+	clsno = clsdata;
+    }
+}
+
+static int test_fsck_volume(test_fsck_volume_t *volume, test_fsck_t *fsck)
+{
+    const uint8_t *boot;
+    uint32_t blkno, fat_blkcnt, fat_count, tot_blkcnt, rsv_blkcnt, cls_blk_size, clscnt;
+
+    memset(fsck, 0, sizeof(test_fsck_t));
+    memset(volume, 0, sizeof(test_fsck_volume_t));
+
+    volume->fsck = fsck;
+
+    boot = test_fsck_block(0);
+    blkno = 0;
+
+    if ((boot[0] != 0xeb) && (boot[0] != 0xe9))
+    {
+	blkno = test_fsck_load_32(&boot[0x1c6]);
+	boot = test_fsck_block(blkno);
+    }
+
+    if ((boot[510] != 0x55) || (boot[511] != 0xaa) || (test_fsck_load_16(&boot[11]) != RFAT_BLK_SIZE))
+    {
+	return 0;
+    }
+
+    cls_blk_size = boot[13];
+    rsv_blkcnt = test_fsck_load_16(&boot[14]);
+    fat_count = boot[16];
+    volume->root_blkcnt = (test_fsck_load_16(&boot[17]) * 32 + (RFAT_BLK_SIZE -1)) / RFAT_BLK_SIZE;
+    tot_blkcnt = test_fsck_load_16(&boot[19]);
+    fat_blkcnt = test_fsck_load_16(&boot[22]);
+
+    if (tot_blkcnt == 0)
+    {
+	tot_blkcnt = test_fsck_load_32(&boot[32]);
+    }
+
+    if (fat_blkcnt == 0)
+    {
+	fat_blkcnt = test_fsck_load_32(&boot[36]);
+	volume->root_clsno = test_fsck_load_32(&boot[44]);
+    }
+
+    for (volume->cls_blk_shift = 0; (1u << volume->cls_blk_shift) < cls_blk_size; volume->cls_blk_shift++)
+    {
+    }
+
+    volume->root_blkno = blkno + rsv_blkcnt + fat_count * fat_blkcnt;
+    volume->cls_first = volume->root_blkno + volume->root_blkcnt;
+
+    clscnt = (tot_blkcnt - (volume->cls_first - blkno)) >> volume->cls_blk_shift;
+    volume->cls_last = clscnt +1;
+
+    fsck->type = (clscnt < 4085) ? 12 : ((clscnt < 65525) ? 16 : 32);
+    fsck->cls_size = cls_blk_size * RFAT_BLK_SIZE;
+
+    volume->fat = test_fsck_block(blkno + rsv_blkcnt);
+    volume->fat_size = fat_blkcnt * RFAT_BLK_SIZE;
+
+    if (fat_count == 2)
+    {
+	for (blkno = 0; blkno < fat_blkcnt; blkno++)
+	{
+	    if (memcmp(&volume->fat[blkno * RFAT_BLK_SIZE], &volume->fat[(fat_blkcnt + blkno) * RFAT_BLK_SIZE], RFAT_BLK_SIZE))
+	    {
+		fsck->mismatch++;
+	    }
+	}
+    }
+
+    return 1;
+}
+
+int test_fsck(test_fsck_t *fsck, int verbose)
+{
+    test_fsck_volume_t volume;
+    uint32_t clsno, clsdata;
+
+    if (!test_fsck_volume(&volume, fsck))
+    {
+	return 0;
+    }
+
+    volume.verbose = verbose;
+    volume.map = (uint8_t*)calloc(volume.cls_last +1, 1);
+
+    if (volume.map == NULL)
+    {
+	return 0;
+    }
+
+    test_fsck_directory(&volume, "", volume.root_clsno, 0);
+
+    for (clsno = 2; clsno <= volume.cls_last; clsno++)
+    {
+	clsdata = test_fsck_fat_read(&volume, clsno);
+
+	if ((clsdata != 0) && (clsdata != 0x0ffffff7))
+	{
+	    fsck->allocated++;
+
+	    if (!volume.map[clsno])
+	    {
+		fsck->lost++;
+	    }
+	}
+    }
+
+    free(volume.map);
+
+    if (verbose)
+    {
+	printf("fsck: FAT%u, %u files, %u directories, %u/%u clusters, %u cross-linked, %u broken, %u lost, %u FAT mismatch\n",
+	       fsck->type, fsck->files, fsck->directories, fsck->used, fsck->allocated,
+	       fsck->crosslinked, fsck->broken, fsck->lost, fsck->mismatch);
+    }
+
+    return 1;
+}
+
+long test_fsck_length(const char *name)
+{
+    test_fsck_t fsck;
+    test_fsck_volume_t volume;
+    const uint8_t *data;
+    uint32_t clsno, count, index;
+    char entry[11];
+    unsigned int i, n;
+
+    if (!test_fsck_volume(&volume, &fsck))
+    {
+	return -1;
+    }
+
+    memset(entry, ' ', sizeof(entry));
+
+    for (i = 0, n = 0; (name[i] != '\0') && (name[i] != '.') && (n < 8); i++)
+    {
+	entry[n++] = name[i];
+    }
+
+    if (name[i] == '.')
+    {
+	for (i++, n = 8; (name[i] != '\0') && (n < 11); i++)
+	{
+	    entry[n++] = name[i];
+	}
+    }
+
+    clsno = volume.root_clsno;
+
+    do
+    {
+	if (clsno == 0)
+	{
+	    data = test_fsck_block(volume.root_blkno);
+	    count = (volume.root_blkcnt * RFAT_BLK_SIZE) / 32;
+	}
+	else
+	{
+	    data = test_fsck_block(volume.cls_first + ((clsno - 2) << volume.cls_blk_shift));
+	    count = (RFAT_BLK_SIZE / 32) << volume.cls_blk_shift;
+	}
+
+	for (index = 0; index < count; index++, data += 32)
+	{
+	    if (data[0] == 0x00)
+	    {
+		return -1;
+	    }
+
+	    if ((data[0] != 0xe5) && ((data[11] & 0x3f) != 0x0f) && !memcmp(data, entry, 11))
+	    {
+		return (long)test_fsck_load_32(&data[28]);
+	    }
+	}
+
+	clsno = (clsno == 0) ? 0x0fffffff : test_fsck_fat_read(&volume, clsno);
+    }
+    while ((clsno >= 2) && (clsno <= volume.cls_last));
+
+    return -1;
+}
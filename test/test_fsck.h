@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2014 Thomas Roell.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal with the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimers.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimers in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of Thomas Roell, nor the names of its contributors
+ *     may be used to endorse or promote products derived from this Software
+ *     without specific prior written permission.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * WITH THE SOFTWARE.
+ */
+
+#if !defined(_TEST_FSCK_h)
+#define _TEST_FSCK_h
+
+#include <stdint.h>
+
+/* test_fsck() checks the file system in "host_disk_image" independent of
+ * the RFAT code. Every cluster chain reachable from the root directory is
+ * walked. A cluster reached twice is counted as cross-linked, a chain that
+ * ends early, runs into a free or invalid cluster, or is shorter than the
+ * file size as broken. Allocated clusters not reached at all are lost.
+ */
+
+typedef struct _test_fsck_t {
+    uint32_t                type;           /* 12, 16 or 32 */
+    uint32_t                cls_size;
+    uint32_t                files;
+    uint32_t                directories;
+    uint32_t                used;           /* clusters reached */
+    uint32_t                allocated;      /* clusters not free in FAT1 */
+    uint32_t                clsno_first;    /* lowest/highest cluster used by a file */
+    uint32_t                clsno_last;
+    uint32_t                crosslinked;
+    uint32_t                broken;
+    uint32_t                lost;
+    uint32_t                mismatch;       /* FAT blocks differing between FAT1 and FAT2 */
+} test_fsck_t;
+
+extern int test_fsck(test_fsck_t *fsck, int verbose);
+
+/* test_fsck_length() returns the file size the directory entry of "name" (8.3,
+ * upper case, in the root directory) holds on the card, or -1 if there is none.
+ */
+extern long test_fsck_length(const char *name);
+
+#endif /* _TEST_FSCK_h */
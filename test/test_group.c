@@ -0,0 +1,223 @@
+/*
+ * Copyright (c) 2014 Thomas Roell.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal with the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimers.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimers in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of Thomas Roell, nor the names of its contributors
+ *     may be used to endorse or promote products derived from this Software
+ *     without specific prior written permission.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * WITH THE SOFTWARE.
+ */
+
+/* Power cuts within a f_begin()/f_commit() group (TRANSACTION_SAFE, FAT16):
+ *
+ * - The card image is cut after every single block write of a group that
+ *   creates, appends to, overwrites, truncates and deletes files, and
+ *   creates a directory. After the remount replayed the log, no cluster
+ *   is cross-linked, broken or lost.
+ * - Once f_commit() has returned, all files of the group are on the card
+ *   with their final size.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rfat_disk.h"
+#include "host_disk.h"
+#include "test_fsck.h"
+
+#define TEST_GROUP_FILES         16
+
+static const long test_group_length[TEST_GROUP_FILES] = {
+    100, 400, -1, 2200, 1300, -1, 1900, 50, 2500, 2800, 700, -1, 700, 700, 700, 10,
+};
+
+static uint8_t test_group_data[8192];
+
+static int test_group_file(unsigned int index, unsigned int length, const char *mode)
+{
+    F_FILE *file;
+    char name[16];
+
+    sprintf(name, "F%02u.TXT", index);
+
+    memset(test_group_data, 'a' + index, length);
+
+    file = f_open(name, mode);
+
+    if (file == NULL)
+    {
+	return 0;
+    }
+
+    if (f_write(test_group_data, 1, length, file) != length)
+    {
+	f_close(file);
+	return 0;
+    }
+
+    return (f_close(file) == F_NO_ERROR);
+}
+
+/* The group returns the number of blocks written up to the point where f_commit()
+ * returned, or 0 if any of the calls failed.
+ */
+static uint32_t test_group_run(void)
+{
+    uint32_t committed = 0;
+    unsigned int index;
+    int success;
+
+    success = (f_begin() == F_NO_ERROR);
+
+    for (index = 0; success && (index < 10); index++)
+    {
+	success = test_group_file(index, 100 + index * 300, "w");
+    }
+
+    success = (success &&
+	       (f_delete("F02.TXT") == F_NO_ERROR) &&
+	       (f_delete("F05.TXT") == F_NO_ERROR) &&
+	       test_group_file(7, 50, "w") &&
+	       test_group_file(3, 1200, "a") &&
+	       test_group_file(4, 1300, "r+"));
+
+    for (index = 10; success && (index < 15); index++)
+    {
+	success = test_group_file(index, 700, "w");
+    }
+
+    success = (success &&
+	       (f_mkdir("SUB") == F_NO_ERROR) &&
+	       (f_delete("F11.TXT") == F_NO_ERROR) &&
+	       (f_commit() == F_NO_ERROR));
+
+    if (success)
+    {
+	committed = host_disk_statistics.blocks_written;
+
+	success = test_group_file(15, 10, "w");
+    }
+
+    return (success ? committed : 0);
+}
+
+int main(void)
+{
+    test_fsck_t fsck;
+    F_SPACE space;
+    uint8_t *image;
+    uint32_t total, committed, limit;
+    unsigned int index, cuts;
+    long length;
+    int failed = 0;
+
+    if ((f_initvolume() != F_NO_ERROR) || (f_hardformat(F_FAT16_MEDIA) != F_NO_ERROR) || (f_delvolume() != F_NO_ERROR))
+    {
+	printf("test_group: cannot format\n");
+	return 1;
+    }
+
+    image = (uint8_t*)malloc((size_t)HOST_DISK_BLKCNT * RFAT_BLK_SIZE);
+
+    if (image == NULL)
+    {
+	printf("test_group: no memory\n");
+	return 1;
+    }
+
+    memcpy(image, host_disk_image, (size_t)HOST_DISK_BLKCNT * RFAT_BLK_SIZE);
+
+    host_disk_statistics.blocks_written = 0;
+
+    committed = ((f_initvolume() == F_NO_ERROR) ? test_group_run() : 0);
+
+    total = host_disk_statistics.blocks_written;
+
+    if ((committed == 0) || (f_delvolume() != F_NO_ERROR))
+    {
+	printf("test_group: group failed\n");
+	return 1;
+    }
+
+    cuts = 0;
+
+    for (limit = 1; (limit < total) && !failed; limit++)
+    {
+	memcpy(host_disk_image, image, (size_t)HOST_DISK_BLKCNT * RFAT_BLK_SIZE);
+
+	host_disk_statistics.blocks_written = 0;
+	host_disk_write_limit = limit;
+
+	if (f_initvolume() == F_NO_ERROR)
+	{
+	    test_group_run();
+
+	    f_delvolume();
+	}
+
+	host_disk_write_limit = 0xffffffff;
+
+	/* The remount replays the log, and the unmount leaves a consistent FAT1.
+	 */
+	if ((f_initvolume() != F_NO_ERROR) || (f_getfreespace(&space) != F_NO_ERROR) || (f_delvolume() != F_NO_ERROR))
+	{
+	    printf("test_group: cut after %lu blocks: cannot remount\n", (unsigned long)limit);
+	    failed = 1;
+	}
+	else
+	{
+	    if (!test_fsck(&fsck, 0) || fsck.crosslinked || fsck.broken || fsck.lost)
+	    {
+		printf("test_group: cut after %lu blocks: %lu crosslinked, %lu broken, %lu lost\n",
+		       (unsigned long)limit, (unsigned long)fsck.crosslinked, (unsigned long)fsck.broken, (unsigned long)fsck.lost);
+		failed = 1;
+	    }
+
+	    if (limit >= committed)
+	    {
+		for (index = 0; index < TEST_GROUP_FILES -1; index++)
+		{
+		    char name[16];
+
+		    sprintf(name, "F%02u.TXT", index);
+
+		    length = test_fsck_length(name);
+
+		    if (length != test_group_length[index])
+		    {
+			printf("test_group: cut after %lu blocks: %s holds %ld bytes, not %ld\n",
+			       (unsigned long)limit, name, length, test_group_length[index]);
+			failed = 1;
+		    }
+		}
+	    }
+	}
+
+	cuts++;
+    }
+
+    printf("test_group: %s (%u cuts, %lu blocks committed)\n", (failed ? "FAILED" : "passed"), cuts, (unsigned long)committed);
+
+    free(image);
+
+    return failed;
+}
@@ -0,0 +1,300 @@
+/*
+ * Copyright (c) 2014 Thomas Roell.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal with the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimers.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimers in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of Thomas Roell, nor the names of its contributors
+ *     may be used to endorse or promote products derived from this Software
+ *     without specific prior written permission.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * WITH THE SOFTWARE.
+ */
+
+/* Several pthreads share the volume through the host port mutexes
+ * (HOST_DISK_MUTEX), with RFAT_CONFIG_TRANSFER_UNLOCK_SUPPORTED:
+ *
+ * - one thread writes and reads back BIG.BIN in cluster sized transfers,
+ *   which run without the core lock.
+ * - one thread appends small records to LOG.BIN and flushes it, so that
+ *   both allocate clusters at the same time.
+ * - the main thread opens, reads and stats SMALL.TXT meanwhile.
+ * - all files end up with the right contents, and the volume checks clean.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "rfat_disk.h"
+#include "host_disk.h"
+#include "test_fsck.h"
+
+#define TEST_LOCK_CHUNK          32768
+#define TEST_LOCK_BIG            (1024 * 1024)
+#define TEST_LOCK_ROUNDS         4
+#define TEST_LOCK_RECORD         100
+#define TEST_LOCK_RECORDS        4000
+#define TEST_LOCK_SMALL          1500
+
+static volatile int test_lock_done;
+static volatile int test_lock_failed;
+
+static uint8_t test_lock_data(uint32_t round, uint32_t offset)
+{
+    return (uint8_t)((offset * 13) ^ (offset >> 11) ^ round);
+}
+
+static void *test_lock_big(void *arg)
+{
+    F_FILE *file;
+    static uint8_t chunk[TEST_LOCK_CHUNK];
+    uint32_t round, offset, index;
+
+    for (round = 0; (round < TEST_LOCK_ROUNDS) && !test_lock_failed; round++)
+    {
+	file = f_open("BIG.BIN", "w");
+
+	if (file == NULL)
+	{
+	    printf("test_lock: cannot open BIG.BIN\n");
+	    test_lock_failed = 1;
+	}
+
+	for (offset = 0; !test_lock_failed && (offset < TEST_LOCK_BIG); offset += TEST_LOCK_CHUNK)
+	{
+	    for (index = 0; index < TEST_LOCK_CHUNK; index++)
+	    {
+		chunk[index] = test_lock_data(round, offset + index);
+	    }
+
+	    if (f_write(chunk, 1, TEST_LOCK_CHUNK, file) != TEST_LOCK_CHUNK)
+	    {
+		printf("test_lock: BIG.BIN write failed with %d\n", f_error(file));
+		test_lock_failed = 1;
+	    }
+	}
+
+	if (file && (f_close(file) != F_NO_ERROR))
+	{
+	    test_lock_failed = 1;
+	}
+
+	file = test_lock_failed ? NULL : f_open("BIG.BIN", "r");
+
+	for (offset = 0; file && !test_lock_failed && (offset < TEST_LOCK_BIG); offset += TEST_LOCK_CHUNK)
+	{
+	    if (f_read(chunk, 1, TEST_LOCK_CHUNK, file) != TEST_LOCK_CHUNK)
+	    {
+		printf("test_lock: BIG.BIN read failed with %d\n", f_error(file));
+		test_lock_failed = 1;
+	    }
+
+	    for (index = 0; !test_lock_failed && (index < TEST_LOCK_CHUNK); index++)
+	    {
+		if (chunk[index] != test_lock_data(round, offset + index))
+		{
+		    printf("test_lock: BIG.BIN differs at %u in round %u\n", (unsigned int)(offset + index), (unsigned int)round);
+		    test_lock_failed = 1;
+		}
+	    }
+	}
+
+	if (file)
+	{
+	    f_close(file);
+	}
+    }
+
+    __sync_fetch_and_add(&test_lock_done, 1);
+
+    return NULL;
+}
+
+static void *test_lock_log(void *arg)
+{
+    F_FILE *file;
+    uint8_t record[TEST_LOCK_RECORD];
+    uint32_t sequence;
+
+    file = f_open("LOG.BIN", "a");
+
+    if (file == NULL)
+    {
+	printf("test_lock: cannot open LOG.BIN\n");
+	test_lock_failed = 1;
+    }
+
+    for (sequence = 0; file && !test_lock_failed && (sequence < TEST_LOCK_RECORDS); sequence++)
+    {
+	memset(record, (int)(sequence & 0xff), TEST_LOCK_RECORD);
+
+	if (f_write(record, 1, TEST_LOCK_RECORD, file) != TEST_LOCK_RECORD)
+	{
+	    printf("test_lock: LOG.BIN write failed with %d\n", f_error(file));
+	    test_lock_failed = 1;
+	}
+
+	if (!test_lock_failed && ((sequence % 10) == 9) && (f_flush(file) != F_NO_ERROR))
+	{
+	    test_lock_failed = 1;
+	}
+    }
+
+    if (file && (f_close(file) != F_NO_ERROR))
+    {
+	test_lock_failed = 1;
+    }
+
+    __sync_fetch_and_add(&test_lock_done, 1);
+
+    return NULL;
+}
+
+int main(void)
+{
+    F_FILE *file;
+    F_STAT stat;
+    pthread_t big, log;
+    uint8_t small[TEST_LOCK_SMALL], record[TEST_LOCK_RECORD];
+    uint32_t index, sequence, time, time_max;
+    unsigned long calls;
+    test_fsck_t fsck;
+
+    if ((f_initvolume() != F_NO_ERROR) || (f_hardformat(F_FAT16_MEDIA) != F_NO_ERROR))
+    {
+	printf("test_lock: cannot format\n");
+	return 1;
+    }
+
+    for (index = 0; index < TEST_LOCK_SMALL; index++)
+    {
+	small[index] = (uint8_t)index;
+    }
+
+    file = f_open("SMALL.TXT", "w");
+
+    if ((file == NULL) || (f_write(small, 1, TEST_LOCK_SMALL, file) != TEST_LOCK_SMALL) || (f_close(file) != F_NO_ERROR))
+    {
+	printf("test_lock: cannot create SMALL.TXT\n");
+	return 1;
+    }
+
+    if (pthread_create(&big, NULL, test_lock_big, NULL) || pthread_create(&log, NULL, test_lock_log, NULL))
+    {
+	printf("test_lock: cannot create threads\n");
+	return 1;
+    }
+
+    calls = 0;
+    time_max = 0;
+
+    while ((test_lock_done != 2) && !test_lock_failed)
+    {
+	time = host_core_time_current();
+
+	file = f_open("SMALL.TXT", "r");
+
+	if ((file == NULL) || (f_read(small, 1, TEST_LOCK_SMALL, file) != TEST_LOCK_SMALL) || (f_close(file) != F_NO_ERROR))
+	{
+	    printf("test_lock: cannot read SMALL.TXT\n");
+	    test_lock_failed = 1;
+	}
+
+	if (!test_lock_failed && ((f_stat("SMALL.TXT", &stat) != F_NO_ERROR) || (stat.filesize != TEST_LOCK_SMALL)))
+	{
+	    printf("test_lock: cannot stat SMALL.TXT\n");
+	    test_lock_failed = 1;
+	}
+
+	time = host_core_time_current() - time;
+
+	if (time_max < time)
+	{
+	    time_max = time;
+	}
+
+	calls++;
+
+	for (index = 0; !test_lock_failed && (index < TEST_LOCK_SMALL); index++)
+	{
+	    if (small[index] != (uint8_t)index)
+	    {
+		printf("test_lock: SMALL.TXT differs at %u\n", (unsigned int)index);
+		test_lock_failed = 1;
+	    }
+	}
+
+	sched_yield();
+    }
+
+    pthread_join(big, NULL);
+    pthread_join(log, NULL);
+
+    if (!test_lock_failed)
+    {
+	file = f_open("LOG.BIN", "r");
+
+	if (file == NULL)
+	{
+	    printf("test_lock: cannot reopen LOG.BIN\n");
+	    test_lock_failed = 1;
+	}
+
+	for (sequence = 0; file && !test_lock_failed && (sequence < TEST_LOCK_RECORDS); sequence++)
+	{
+	    if (f_read(record, 1, TEST_LOCK_RECORD, file) != TEST_LOCK_RECORD)
+	    {
+		printf("test_lock: LOG.BIN is short\n");
+		test_lock_failed = 1;
+	    }
+
+	    for (index = 0; !test_lock_failed && (index < TEST_LOCK_RECORD); index++)
+	    {
+		if (record[index] != (uint8_t)(sequence & 0xff))
+		{
+		    printf("test_lock: LOG.BIN record %u corrupted\n", (unsigned int)sequence);
+		    test_lock_failed = 1;
+		}
+	    }
+	}
+
+	if (file)
+	{
+	    f_close(file);
+	}
+    }
+
+    f_delvolume();
+
+    if (!test_fsck(&fsck, 1) || fsck.crosslinked || fsck.broken || fsck.lost || (fsck.files != 3))
+    {
+	test_lock_failed = 1;
+    }
+
+    if (!test_lock_failed && (test_fsck_length("BIG.BIN") != TEST_LOCK_BIG))
+    {
+	printf("test_lock: BIG.BIN has %ld bytes\n", test_fsck_length("BIG.BIN"));
+	test_lock_failed = 1;
+    }
+
+    printf("test_lock: %s (%lu small opens, max %u us)\n", (test_lock_failed ? "FAILED" : "passed"), calls, (unsigned int)time_max);
+
+    return test_lock_failed;
+}
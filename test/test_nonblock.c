@@ -0,0 +1,231 @@
+/*
+ * Copyright (c) 2014 Thomas Roell.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal with the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimers.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimers in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of Thomas Roell, nor the names of its contributors
+ *     may be used to endorse or promote products derived from this Software
+ *     without specific prior written permission.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * WITH THE SOFTWARE.
+ */
+
+/* Appends to a file opened with "N" (non-blocking):
+ *
+ * - f_write() returns a short count instead of waiting for the SDCARD, and
+ *   past the first cluster allocation no single call spends a write busy
+ *   period on the bus.
+ * - f_flush() and f_close() return F_ERR_INPROGRESS until the SDCARD is done.
+ * - the file ends up with all the data, and the volume checks clean.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rfat_disk.h"
+#include "host_disk.h"
+#include "test_fsck.h"
+
+#define TEST_NONBLOCK_RECORD     100
+#define TEST_NONBLOCK_LENGTH     (2 * 1024 * 1024)
+
+static uint8_t test_nonblock_data(uint32_t offset)
+{
+    return (uint8_t)((offset * 7) ^ (offset >> 9));
+}
+
+int main(void)
+{
+    F_FILE *file;
+    uint8_t record[TEST_NONBLOCK_RECORD];
+    uint32_t offset, index, size, time, time_max;
+    unsigned long calls, retries, pending;
+    long count;
+    int status, c, failed = 0;
+    test_fsck_t fsck;
+
+    if ((f_initvolume() != F_NO_ERROR) || (f_hardformat(F_FAT16_MEDIA) != F_NO_ERROR))
+    {
+	printf("test_nonblock: cannot format\n");
+	return 1;
+    }
+
+    file = f_open("LOG.BIN", "aN");
+
+    if (file == NULL)
+    {
+	printf("test_nonblock: cannot open LOG.BIN\n");
+	return 1;
+    }
+
+    calls = 0;
+    retries = 0;
+    pending = 0;
+    time_max = 0;
+
+    for (offset = 0; !failed && (offset < TEST_NONBLOCK_LENGTH); offset += size)
+    {
+	size = TEST_NONBLOCK_RECORD;
+
+	if (size > (TEST_NONBLOCK_LENGTH - offset))
+	{
+	    size = TEST_NONBLOCK_LENGTH - offset;
+	}
+
+	for (index = 0; index < size; index++)
+	{
+	    record[index] = test_nonblock_data(offset + index);
+	}
+
+	for (index = 0; !failed && (index < size); index += count)
+	{
+	    time = host_disk_time_current();
+
+	    count = f_write(record + index, 1, size - index, file);
+
+	    time = host_disk_time_current() - time;
+
+	    /* The first call allocates the first cluster, which waits for
+	     * the FAT and directory updates.
+	     */
+	    if ((offset != 0) && (time_max < time))
+	    {
+		time_max = time;
+	    }
+
+	    calls++;
+
+	    if (count == 0)
+	    {
+		retries++;
+
+		if (f_error(file) != F_NO_ERROR)
+		{
+		    printf("test_nonblock: f_write() failed with %d\n", f_error(file));
+		    failed = 1;
+		}
+	    }
+	}
+
+	/* Flush once in the middle, so that the metadata is updated while
+	 * appending continues afterwards.
+	 */
+	if (!failed && (offset == (TEST_NONBLOCK_LENGTH / 2)))
+	{
+	    while ((status = f_flush(file)) == F_ERR_INPROGRESS)
+	    {
+		pending++;
+	    }
+
+	    if (status != F_NO_ERROR)
+	    {
+		printf("test_nonblock: f_flush() failed with %d\n", status);
+		failed = 1;
+	    }
+	}
+    }
+
+    if (!failed)
+    {
+	while ((status = f_close(file)) == F_ERR_INPROGRESS)
+	{
+	    pending++;
+	}
+
+	if (status != F_NO_ERROR)
+	{
+	    printf("test_nonblock: f_close() failed with %d\n", status);
+	    failed = 1;
+	}
+    }
+
+    if (!failed && (retries == 0))
+    {
+	printf("test_nonblock: f_write() never reported a busy SDCARD\n");
+	failed = 1;
+    }
+
+    if (!failed && (pending == 0))
+    {
+	printf("test_nonblock: f_flush()/f_close() never reported F_ERR_INPROGRESS\n");
+	failed = 1;
+    }
+
+    /* A block takes HOST_DISK_WRITE_BUSY to program, which must not be
+     * spent within a single call.
+     */
+    if (!failed && (time_max >= HOST_DISK_WRITE_BUSY))
+    {
+	printf("test_nonblock: f_write() took %u us\n", (unsigned int)time_max);
+	failed = 1;
+    }
+
+    if (!failed && (test_fsck_length("LOG.BIN") != TEST_NONBLOCK_LENGTH))
+    {
+	printf("test_nonblock: LOG.BIN has %ld bytes\n", test_fsck_length("LOG.BIN"));
+	failed = 1;
+    }
+
+    if (!failed)
+    {
+	file = f_open("LOG.BIN", "r");
+
+	if (file == NULL)
+	{
+	    printf("test_nonblock: cannot reopen LOG.BIN\n");
+	    failed = 1;
+	}
+	else
+	{
+	    for (offset = 0; !failed && (offset < TEST_NONBLOCK_LENGTH); offset++)
+	    {
+		c = f_getc(file);
+
+		if (c != test_nonblock_data(offset))
+		{
+		    printf("test_nonblock: LOG.BIN differs at %u\n", (unsigned int)offset);
+		    failed = 1;
+		}
+	    }
+
+	    f_close(file);
+	}
+    }
+
+    if (!failed)
+    {
+	if (!test_fsck(&fsck, 1) || fsck.crosslinked || fsck.broken || fsck.lost || fsck.mismatch)
+	{
+	    printf("test_nonblock: volume check failed\n");
+	    failed = 1;
+	}
+    }
+
+    if (!failed)
+    {
+	printf("test_nonblock: passed (%lu calls, %lu busy, %lu in progress, max %u us)\n", calls, retries, pending, (unsigned int)time_max);
+    }
+    else
+    {
+	printf("test_nonblock: FAILED\n");
+    }
+
+    return failed;
+}
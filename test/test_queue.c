@@ -0,0 +1,198 @@
+/*
+ * Copyright (c) 2014 Thomas Roell.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal with the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimers.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimers in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of Thomas Roell, nor the names of its contributors
+ *     may be used to endorse or promote products derived from this Software
+ *     without specific prior written permission.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * WITH THE SOFTWARE.
+ */
+
+/* F_QUEUE with the producer and the consumer on separate host threads:
+ *
+ * - every record put by the producer thread ends up in the file, in order,
+ *   with records wrapping around the end of the ring buffer.
+ * - a full queue drops the record and counts it in f_queue_overrun().
+ * - the file system is consistent afterwards.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "rfat_disk.h"
+#include "host_disk.h"
+#include "test_fsck.h"
+
+#define TEST_QUEUE_SIZE          4096
+#define TEST_QUEUE_RECORD        20
+#define TEST_QUEUE_RECORDS       100000
+
+static F_QUEUE test_queue;
+static uint32_t test_queue_data[TEST_QUEUE_SIZE / sizeof(uint32_t)];
+static volatile int test_queue_done;
+static unsigned long test_queue_dropped;
+
+static void test_queue_record(uint8_t *record, uint32_t sequence)
+{
+    unsigned int offset;
+
+    memcpy(record, &sequence, sizeof(sequence));
+
+    for (offset = sizeof(sequence); offset < TEST_QUEUE_RECORD; offset++)
+    {
+	record[offset] = (uint8_t)(sequence * 7 + offset);
+    }
+}
+
+static void *test_queue_producer(void *arg)
+{
+    uint8_t record[TEST_QUEUE_RECORD];
+    uint32_t sequence;
+
+    for (sequence = 0; sequence < TEST_QUEUE_RECORDS; sequence++)
+    {
+	test_queue_record(record, sequence);
+
+	while (f_queue_put(&test_queue, record, TEST_QUEUE_RECORD) != F_NO_ERROR)
+	{
+	    test_queue_dropped++;
+
+	    sched_yield();
+	}
+    }
+
+    test_queue_done = 1;
+
+    return NULL;
+}
+
+int main(void)
+{
+    F_FILE *file;
+    pthread_t producer;
+    uint8_t record[TEST_QUEUE_RECORD], expected[TEST_QUEUE_RECORD];
+    uint32_t sequence;
+    long count, total = 0;
+    int failed = 0;
+    test_fsck_t fsck;
+
+    if ((f_initvolume() != F_NO_ERROR) || (f_hardformat(F_FAT16_MEDIA) != F_NO_ERROR))
+    {
+	printf("test_queue: cannot format\n");
+	return 1;
+    }
+
+    file = f_open("LOG.BIN", "w");
+
+    if ((file == NULL) || (f_queue_init(&test_queue, file, test_queue_data, TEST_QUEUE_SIZE) != F_NO_ERROR))
+    {
+	printf("test_queue: cannot open LOG.BIN\n");
+	return 1;
+    }
+
+    if (pthread_create(&producer, NULL, test_queue_producer, NULL))
+    {
+	printf("test_queue: cannot create producer\n");
+	return 1;
+    }
+
+    while (!test_queue_done)
+    {
+	count = f_queue_drain(&test_queue, 0);
+
+	if (f_error(file) != F_NO_ERROR)
+	{
+	    failed = 1;
+	    break;
+	}
+
+	total += count;
+
+	if (count == 0)
+	{
+	    sched_yield();
+	}
+    }
+
+    pthread_join(producer, NULL);
+
+    total += f_queue_drain(&test_queue, 1);
+
+    if ((f_error(file) != F_NO_ERROR) || (f_close(file) != F_NO_ERROR))
+    {
+	failed = 1;
+    }
+
+    if (total != ((long)TEST_QUEUE_RECORDS * TEST_QUEUE_RECORD))
+    {
+	printf("test_queue: %ld bytes drained\n", total);
+	failed = 1;
+    }
+
+    if (f_queue_overrun(&test_queue) != test_queue_dropped)
+    {
+	printf("test_queue: overrun %lu, %lu records dropped\n", f_queue_overrun(&test_queue), test_queue_dropped);
+	failed = 1;
+    }
+
+    file = f_open("LOG.BIN", "r");
+
+    if (file == NULL)
+    {
+	printf("test_queue: cannot reopen LOG.BIN\n");
+	failed = 1;
+    }
+    else
+    {
+	for (sequence = 0; (sequence < TEST_QUEUE_RECORDS) && !failed; sequence++)
+	{
+	    test_queue_record(expected, sequence);
+
+	    if ((f_read(record, 1, TEST_QUEUE_RECORD, file) != TEST_QUEUE_RECORD) || memcmp(record, expected, TEST_QUEUE_RECORD))
+	    {
+		printf("test_queue: record %u corrupted\n", (unsigned int)sequence);
+		failed = 1;
+	    }
+	}
+
+	if (!failed && (f_read(record, 1, 1, file) != 0))
+	{
+	    printf("test_queue: trailing data\n");
+	    failed = 1;
+	}
+
+	f_close(file);
+    }
+
+    f_delvolume();
+
+    if (!test_fsck(&fsck, 1) || fsck.crosslinked || fsck.broken || fsck.lost)
+    {
+	failed = 1;
+    }
+
+    printf("test_queue: %s (%lu puts retried)\n", (failed ? "FAILED" : "passed"), test_queue_dropped);
+
+    return failed;
+}
@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2014 Thomas Roell.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal with the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimers.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimers in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of Thomas Roell, nor the names of its contributors
+ *     may be used to endorse or promote products derived from this Software
+ *     without specific prior written permission.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * WITH THE SOFTWARE.
+ */
+
+/* Writes through a stream buffer (f_setvbuf()) into a contiguous file:
+ *
+ * - f_write(), f_putc() and f_write_reserve()/f_write_commit() accept data
+ *   only up to the reserved size, and report a short count past it.
+ * - the file ends up with exactly the data that was accepted.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rfat_disk.h"
+#include "host_disk.h"
+#include "test_fsck.h"
+
+#define TEST_STREAM_RECORD       100
+#define TEST_STREAM_BUFFER       1024
+#define TEST_STREAM_SIZE         10050
+
+static uint8_t test_stream_buffer[TEST_STREAM_BUFFER];
+
+int main(void)
+{
+    F_FILE *file;
+    uint8_t record[TEST_STREAM_RECORD];
+    void *data;
+    long size, total, count;
+    int status, method, failed = 0;
+    static const char * const label[3] = { "f_write", "f_putc", "f_write_commit" };
+
+    if ((f_initvolume() != F_NO_ERROR) || (f_hardformat(F_FAT16_MEDIA) != F_NO_ERROR))
+    {
+	printf("test_stream: cannot format\n");
+	return 1;
+    }
+
+    memset(record, 0x5a, TEST_STREAM_RECORD);
+
+    for (method = 0; method < 3; method++)
+    {
+	file = f_open("RES.BIN", "w,10050");
+
+	if ((file == NULL) || (f_setvbuf(file, test_stream_buffer, TEST_STREAM_BUFFER) != F_NO_ERROR))
+	{
+	    printf("test_stream: cannot open RES.BIN\n");
+	    return 1;
+	}
+
+	size = TEST_STREAM_SIZE;
+	total = 0;
+
+	do
+	{
+	    if (method == 0)
+	    {
+		count = f_write(record, 1, TEST_STREAM_RECORD, file);
+	    }
+	    else if (method == 1)
+	    {
+		count = (f_putc(record[0], file) == record[0]) ? 1 : 0;
+	    }
+	    else
+	    {
+		status = f_write_reserve(file, TEST_STREAM_RECORD, &data);
+
+		if (status == F_NO_ERROR)
+		{
+		    memcpy(data, record, TEST_STREAM_RECORD);
+
+		    count = f_write_commit(file, TEST_STREAM_RECORD);
+		}
+		else if (status == F_ERR_NOMOREENTRY)
+		{
+		    count = f_write(record, 1, TEST_STREAM_RECORD, file);
+		}
+		else
+		{
+		    count = 0;
+		}
+	    }
+
+	    total += count;
+	}
+	while ((count != 0) && (total <= size));
+
+	if (total != size)
+	{
+	    printf("test_stream: %s: %ld bytes accepted, %ld reserved\n", label[method], total, size);
+	    failed = 1;
+	}
+
+	if ((f_close(file) != F_NO_ERROR) || (test_fsck_length("RES.BIN") != size))
+	{
+	    printf("test_stream: %s: %ld bytes on the card\n", label[method], test_fsck_length("RES.BIN"));
+	    failed = 1;
+	}
+
+	f_delete("RES.BIN");
+    }
+
+    f_delvolume();
+
+    printf("test_stream: %s\n", (failed ? "FAILED" : "passed"));
+
+    return failed;
+}
@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2014 Thomas Roell.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal with the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimers.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimers in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. Neither the name of Thomas Roell, nor the names of its contributors
+ *     may be used to endorse or promote products derived from this Software
+ *     without specific prior written permission.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * WITH THE SOFTWARE.
+ */
+
+
+/* f_writev()/f_readv():
+ *
+ * - Records of several small parts are written and read back in order, for
+ *   appending as well as for overwriting an existing file.
+ * - A block made up from several parts is written as a whole, hence
+ *   overwriting does not read any block that ends up fully overwritten.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rfat_disk.h"
+#include "host_disk.h"
+#include "test_fsck.h"
+
+#define TEST_VECTOR_RECORDS      600
+#define TEST_VECTOR_LENGTH       (TEST_VECTOR_RECORDS * (12 + 100 + 4))
+
+static uint8_t test_vector_data[TEST_VECTOR_LENGTH];
+static uint8_t test_vector_read[TEST_VECTOR_LENGTH];
+
+/* Split "length" bytes at "data" into a header, payload and CRC per record.
+ */
+static int test_vector_setup(F_IOVEC *iov, uint8_t *data, unsigned int records)
+{
+    unsigned int index;
+
+    for (index = 0; index < records; index++)
+    {
+	iov[3 * index + 0].buffer = data;
+	iov[3 * index + 0].size = 12;
+	iov[3 * index + 1].buffer = data + 12;
+	iov[3 * index + 1].size = 100;
+	iov[3 * index + 2].buffer = data + 112;
+	iov[3 * index + 2].size = 4;
+
+	data += 116;
+    }
+
+    return 3 * records;
+}
+
+static int test_vector_compare(const char *label, const char *name, uint8_t seed)
+{
+    F_FILE *file;
+    F_IOVEC iov[3 * TEST_VECTOR_RECORDS];
+    unsigned int offset;
+    int iovcnt;
+
+    for (offset = 0; offset < TEST_VECTOR_LENGTH; offset++)
+    {
+	test_vector_data[offset] = (uint8_t)(offset * 13 + seed);
+    }
+
+    memset(test_vector_read, 0, TEST_VECTOR_LENGTH);
+
+    iovcnt = test_vector_setup(iov, test_vector_read, TEST_VECTOR_RECORDS);
+
+    file = f_open(name, "r");
+
+    if ((file == NULL) || (f_readv(file, iov, iovcnt) != TEST_VECTOR_LENGTH) || (f_close(file) != F_NO_ERROR))
+    {
+	printf("test_vector: %s: cannot read %s\n", label, name);
+	return 0;
+    }
+
+    if (memcmp(test_vector_data, test_vector_read, TEST_VECTOR_LENGTH))
+    {
+	printf("test_vector: %s: %s differs\n", label, name);
+	return 0;
+    }
+
+    return 1;
+}
+
+int main(void)
+{
+    F_FILE *file;
+    F_IOVEC iov[3 * TEST_VECTOR_RECORDS];
+    unsigned int offset;
+    uint32_t blocks_read;
+    int iovcnt, failed = 0;
+
+    if ((f_initvolume() != F_NO_ERROR) || (f_hardformat(F_FAT16_MEDIA) != F_NO_ERROR))
+    {
+	printf("test_vector: cannot format\n");
+	return 1;
+    }
+
+    /* Append.
+     */
+    for (offset = 0; offset < TEST_VECTOR_LENGTH; offset++)
+    {
+	test_vector_data[offset] = (uint8_t)(offset * 13 + 1);
+    }
+
+    iovcnt = test_vector_setup(iov, test_vector_data, TEST_VECTOR_RECORDS);
+
+    file = f_open("REC.BIN", "a");
+
+    if ((file == NULL) ||
+	(f_writev(file, iov, iovcnt / 2) != (TEST_VECTOR_LENGTH / 2)) ||
+	(f_writev(file, iov + iovcnt / 2, iovcnt / 2) != (TEST_VECTOR_LENGTH / 2)) ||
+	(f_close(file) != F_NO_ERROR))
+    {
+	printf("test_vector: cannot append to REC.BIN\n");
+	return 1;
+    }
+
+    if (!test_vector_compare("append", "REC.BIN", 1))
+    {
+	failed = 1;
+    }
+
+    /* Overwrite in place. Only the block holding the end of the records
+     * and the FAT block for the cluster chain may need to be read.
+     */
+    for (offset = 0; offset < TEST_VECTOR_LENGTH; offset++)
+    {
+	test_vector_data[offset] = (uint8_t)(offset * 13 + 2);
+    }
+
+    file = f_open("REC.BIN", "r+");
+
+    blocks_read = host_disk_statistics.blocks_read;
+
+    if ((file == NULL) || (f_writev(file, iov, iovcnt) != TEST_VECTOR_LENGTH))
+    {
+	printf("test_vector: cannot overwrite REC.BIN\n");
+	return 1;
+    }
+
+    blocks_read = host_disk_statistics.blocks_read - blocks_read;
+
+    if ((f_close(file) != F_NO_ERROR) || !test_vector_compare("overwrite", "REC.BIN", 2))
+    {
+	failed = 1;
+    }
+
+    if (blocks_read > 2)
+    {
+	printf("test_vector: %u blocks read while overwriting %u blocks\n", blocks_read, (TEST_VECTOR_LENGTH + RFAT_BLK_SIZE -1) / RFAT_BLK_SIZE);
+	failed = 1;
+    }
+
+    f_delvolume();
+
+    printf("test_vector: %s\n", (failed ? "FAILED" : "passed"));
+
+    return failed;
+}
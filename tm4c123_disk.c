@@ -70,6 +70,9 @@ static uint32_t tm4c123_disk_ssi_cpsr;
 
 static uint32_t tm4c123_disk_time_stamp;
 static uint32_t tm4c123_disk_time_scale;
+static uint32_t tm4c123_disk_time_cycles;
+static uint32_t tm4c123_disk_time_fraction;
+static uint32_t tm4c123_disk_time_micros;
 
 void tm4c123_spi_initialize(void)
 {
@@ -175,6 +178,30 @@ bool tm4c123_disk_time_elapsed(uint32_t time)
     return (((uint32_t)(DWT->CYCCNT - tm4c123_disk_time_stamp)) > (time * tm4c123_disk_time_scale));
 }
 
+/*
+ * tm4c123_disk_time_current(void)
+ *
+ * Returns a free running time stamp in microseconds. The CYCCNT deltas are
+ * accumulated, so that the return value wraps at 2^32 microseconds, and
+ * not when CYCCNT wraps.
+ */
+
+uint32_t tm4c123_disk_time_current(void)
+{
+    uint32_t cycles, scale;
+
+    cycles = DWT->CYCCNT;
+    scale = tm4c123_disk_time_scale / 1000;
+
+    tm4c123_disk_time_fraction += (cycles - tm4c123_disk_time_cycles);
+    tm4c123_disk_time_cycles = cycles;
+
+    tm4c123_disk_time_micros += (tm4c123_disk_time_fraction / scale);
+    tm4c123_disk_time_fraction = (tm4c123_disk_time_fraction % scale);
+
+    return tm4c123_disk_time_micros;
+}
+
 #endif /* RFAT_PORT_DISK_TIME_START */
 
 
@@ -104,9 +104,11 @@ extern void tm4c123_spi_initialize(void);
 
 extern void tm4c123_disk_time_start(void);
 extern bool tm4c123_disk_time_elapsed(uint32_t time);
+extern uint32_t tm4c123_disk_time_current(void);
 
 #define RFAT_PORT_DISK_TIME_START()              tm4c123_disk_time_start()
 #define RFAT_PORT_DISK_TIME_ELAPSED(_time)       tm4c123_disk_time_elapsed((_time))
+#define RFAT_PORT_DISK_TIME_STAMP()              tm4c123_disk_time_current()
 
 #if defined(TM4C123_DISK_LED_GPIO_PERIPH)
 